@@ -0,0 +1,110 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2017 Chris Gregory czipperz@gmail.com
+ */
+
+/*! \file atomic.h
+ *
+ * \brief Portable atomic operations and a spin lock.
+ *
+ * The operations are sequentially consistent.  They are macros so
+ * they compile down to single instructions on the hot paths that use
+ * them.
+ */
+
+#ifndef CUTIL_ATOMIC_H
+#define CUTIL_ATOMIC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define ATOMIC_LOAD_PTR(ptr)                                         \
+    _InterlockedCompareExchangePointer((void* volatile*)(ptr), 0, 0)
+#define ATOMIC_STORE_PTR(ptr, value)                                 \
+    ((void)_InterlockedExchangePointer((void* volatile*)(ptr), (value)))
+/* Evaluates to the value of \c *ptr before the operation. */
+#define ATOMIC_CAS_PTR(ptr, expected, desired)                       \
+    _InterlockedCompareExchangePointer((void* volatile*)(ptr),       \
+                                       (desired), (expected))
+#define ATOMIC_FETCH_ADD_I64(ptr, value)                             \
+    _InterlockedExchangeAdd64((volatile long long*)(ptr), (value))
+#define ATOMIC_LOAD_I64(ptr) ATOMIC_FETCH_ADD_I64(ptr, 0)
+#ifdef _WIN64
+#define ATOMIC_FETCH_ADD_SIZE(ptr, value)                            \
+    ((size_t)_InterlockedExchangeAdd64((volatile long long*)(ptr),   \
+                                       (long long)(value)))
+#define ATOMIC_STORE_SIZE(ptr, value)                                \
+    ((void)_InterlockedExchange64((volatile long long*)(ptr),        \
+                                  (long long)(value)))
+#define ATOMIC_CAS_SIZE(ptr, expected, desired)                      \
+    ((size_t)_InterlockedCompareExchange64((volatile long long*)(ptr), \
+                                           (long long)(desired),     \
+                                           (long long)(expected)))
+#else
+#define ATOMIC_FETCH_ADD_SIZE(ptr, value)                            \
+    ((size_t)_InterlockedExchangeAdd((volatile long*)(ptr),          \
+                                     (long)(value)))
+#define ATOMIC_STORE_SIZE(ptr, value)                                \
+    ((void)_InterlockedExchange((volatile long*)(ptr), (long)(value)))
+#define ATOMIC_CAS_SIZE(ptr, expected, desired)                      \
+    ((size_t)_InterlockedCompareExchange((volatile long*)(ptr),      \
+                                         (long)(desired),            \
+                                         (long)(expected)))
+#endif
+#define ATOMIC_LOAD_SIZE(ptr) ATOMIC_FETCH_ADD_SIZE(ptr, 0)
+#else
+#define ATOMIC_LOAD_PTR(ptr) __atomic_load_n((ptr), __ATOMIC_SEQ_CST)
+#define ATOMIC_STORE_PTR(ptr, value)                                 \
+    __atomic_store_n((ptr), (value), __ATOMIC_SEQ_CST)
+/* Evaluates to the value of \c *ptr before the operation. */
+#define ATOMIC_CAS_PTR(ptr, expected, desired)                       \
+    __sync_val_compare_and_swap((ptr), (expected), (desired))
+#define ATOMIC_FETCH_ADD_I64(ptr, value)                             \
+    __atomic_fetch_add((ptr), (value), __ATOMIC_SEQ_CST)
+#define ATOMIC_LOAD_I64(ptr) __atomic_load_n((ptr), __ATOMIC_SEQ_CST)
+#define ATOMIC_FETCH_ADD_SIZE(ptr, value)                            \
+    __atomic_fetch_add((ptr), (value), __ATOMIC_SEQ_CST)
+#define ATOMIC_LOAD_SIZE(ptr) __atomic_load_n((ptr), __ATOMIC_SEQ_CST)
+#define ATOMIC_STORE_SIZE(ptr, value)                                \
+    __atomic_store_n((ptr), (value), __ATOMIC_SEQ_CST)
+#define ATOMIC_CAS_SIZE(ptr, expected, desired)                      \
+    __sync_val_compare_and_swap((ptr), (expected), (desired))
+#endif
+
+/*! \brief A lock that busy waits.
+ *
+ * Only use this to protect very short critical sections. */
+typedef struct spinlock spinlock;
+struct spinlock {
+    volatile size_t _locked;
+};
+
+#define SPINLOCK_INIT {0}
+
+/*! \brief Wait until the lock is available and then take it. */
+void spinlock_lock(spinlock* self);
+
+/*! \brief Take the lock if it is available.
+ *
+ * \return 1 if the lock was taken, 0 otherwise. */
+int spinlock_try_lock(spinlock* self);
+
+/*! \brief Release the lock. */
+void spinlock_unlock(spinlock* self);
+
+/*! \brief Tell the processor we are busy waiting. */
+void spin_pause(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,90 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2017 Chris Gregory czipperz@gmail.com
+ */
+
+/*! \file counter_map.h
+ *
+ * \brief A concurrent map from byte strings to 64 bit counters.
+ *
+ * Any number of threads may call \c counter_map_add and \c
+ * counter_map_get at the same time.  Incrementing an existing key is
+ * a single atomic add on the count stored with it.  Inserting a new
+ * key is a compare and swap into an empty slot, so no thread ever
+ * waits on another to count.  Each operation also registers with a
+ * reader count, but these are striped over cache lines by thread so
+ * they aren't shared.
+ *
+ * Growing the table copies the keys into a bigger table, swaps it in
+ * and then waits for the threads still using the old one to finish
+ * their current operation.  Counts stay with their keys, so they are
+ * never missing from either table.  Threads inserting new keys wait
+ * for the copy to finish.  \c counter_map_drain swaps in an empty
+ * table in the same way.  Only these take a lock.
+ *
+ * Keys are allocated with rpmalloc, so every thread using the map
+ * must have called \c rpmalloc_thread_initialize.
+ */
+
+#ifndef CUTIL_COUNTER_MAP_H
+#define CUTIL_COUNTER_MAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct counter_map counter_map;
+/*! \brief Create an empty counter map.
+ *
+ * Returns null on error (in malloc).
+ */
+counter_map* counter_map_new(void);
+/*! \brief Destroy the counter map.  It is illegal to be used past
+ *  this point.
+ *
+ * This must not be called concurrently with any other function. */
+void counter_map_destroy(counter_map*);
+/*! \brief Add \c delta to the counter of \c key, inserting it with
+ *  a count of \c delta if it isn't present.
+ *
+ * If an error occured, return -1 (the count is not changed).
+ * Otherwise returns 0.
+ */
+int counter_map_add(counter_map*, const char* key, size_t key_len,
+                    int64_t delta);
+/*! \brief Get the current count of \c key.
+ *
+ * Returns 0 if \c key isn't present.
+ */
+int64_t counter_map_get(counter_map*, const char* key, size_t key_len);
+/*! \brief Get the number of keys in the map.
+ *
+ * While other threads are adding keys, this is only an estimate. */
+size_t counter_map_size(counter_map*);
+/*! \brief Swap in an empty table, then call \c fun on every key and
+ *  count of the old one.
+ *
+ * Every addition happens either before the swap, and is passed to \c
+ * fun, or after it, and is kept for the next drain.  Thus repeatedly
+ * draining never loses or double counts an addition.
+ *
+ * Additions on other threads continue while \c fun runs.
+ *
+ * If an error occured, return -1 (nothing is drained).
+ * Otherwise returns 0.
+ */
+int counter_map_drain(counter_map*,
+                      void (*fun)(const char* key, size_t key_len,
+                                  int64_t count, void* userdata),
+                      void* userdata);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
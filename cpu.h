@@ -0,0 +1,43 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2017 Chris Gregory czipperz@gmail.com
+ */
+
+/*! \file cpu.h
+ *
+ * \brief Runtime detection of instruction set extensions.
+ *
+ * Vectorized code is compiled with per function target attributes
+ * and only called if the running processor supports it.
+ */
+
+#ifndef CUTIL_CPU_H
+#define CUTIL_CPU_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+/*! \brief Defined if x86 intrinsics and target attributes can be
+ *  used. */
+#define CPU_X86 1
+#endif
+
+#define CPU_SSE2 (1 << 0)
+#define CPU_SSSE3 (1 << 1)
+#define CPU_AVX2 (1 << 2)
+
+/*! \brief Get the \c CPU_* flags supported by this processor.
+ *
+ * This is always 0 if \c CPU_X86 isn't defined.  The answer is
+ * cached after the first call. */
+unsigned cpu_features(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
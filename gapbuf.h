@@ -0,0 +1,137 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2017 Chris Gregory czipperz@gmail.com
+ */
+
+/*! \file gapbuf.h
+ *
+ * \brief A utf8 string with a gap at the most recent edit.
+ *
+ * The unused capacity is kept where the last insertion or erasure
+ * happened instead of at the end.  Edits next to the gap only touch
+ * the gap, so typing at a cursor is amortized O(1).  Editing
+ * somewhere else first moves the gap there, costing the distance
+ * moved.
+ *
+ * Positions are byte offsets and must be on character boundaries.
+ *
+ * Like \c str, functions return -1 on allocation failure and leave
+ * the buffer unchanged.
+ */
+
+#ifndef CUTIL_GAPBUF_H
+#define CUTIL_GAPBUF_H
+
+#include "str.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct gapbuf gapbuf;
+struct gapbuf {
+    char* _buffer;
+    size_t _cap;
+    /*! \brief The gap is the bytes in [\c _gap_begin, \c _gap_end). */
+    size_t _gap_begin;
+    size_t _gap_end;
+};
+
+#define GAPBUF_INIT {0, 0, 0, 0}
+
+/*! \brief Initialize the gap buffer. */
+void gapbuf_init(gapbuf* self);
+
+/*! \brief Free memory used by \c self.
+ *
+ * It is SAFE to call this multiple times. */
+void gapbuf_destroy(gapbuf* self);
+
+/*! \brief Get the number of bytes used by the gap buffer.
+ *
+ * Complexity: O(1) */
+size_t gapbuf_len_bytes(const gapbuf* self);
+
+/*! \brief Calculate the number of characters in the gap buffer.
+ *
+ * Complexity: O(n) where n = gapbuf_len_bytes(self) */
+size_t gapbuf_len_characters(const gapbuf* self);
+
+/*! \brief Increase the capacity to be at least \c new_cap bytes.
+ *
+ * \return -1 on reallocation failure. */
+int gapbuf_reserve(gapbuf* self, size_t new_cap);
+
+/*! \brief Insert \c character at \c pos.
+ *
+ * This verifies that \c character is a valid utf32 character.
+ *
+ * \return -1 on reallocation failure. */
+int gapbuf_insert(gapbuf* self, size_t pos, uint32_t character);
+
+/*! \brief Insert \c string at \c pos.
+ *
+ * This verifies that \c string is a valid utf8 string.
+ *
+ * \return -1 on reallocation failure. */
+int gapbuf_insert_s(gapbuf* self, size_t pos, const char* string);
+
+/*! \brief Insert \c len_bytes bytes of \c string at \c pos.
+ *
+ * This verifies that \c len_bytes bytes of \c string are a valid utf8
+ * string.
+ *
+ * \return -1 on reallocation failure. */
+int gapbuf_insert_sn(gapbuf* self, size_t pos, const char* string,
+                     size_t len_bytes);
+
+/*! \brief Insert \c character at the end. */
+int gapbuf_push(gapbuf* self, uint32_t character);
+
+/*! \brief Insert \c string at the end. */
+int gapbuf_push_s(gapbuf* self, const char* string);
+
+/*! \brief Insert \c len_bytes bytes of \c string at the end. */
+int gapbuf_push_sn(gapbuf* self, const char* string, size_t len_bytes);
+
+/*! \brief Erase elements between \c begin and \c end, excluding \c end. */
+void gapbuf_erase(gapbuf* self, size_t begin, size_t end);
+
+/*! \brief Erase \c num bytes starting at \c begin. */
+void gapbuf_erase_n_bytes(gapbuf* self, size_t begin, size_t num);
+
+/*! \brief The contents of a gap buffer, in two pieces.
+ *
+ * The contents are \c first followed by \c second.  Either may be
+ * empty. */
+typedef struct gapbuf_view gapbuf_view;
+struct gapbuf_view {
+    const char* first;
+    size_t first_len;
+    const char* second;
+    size_t second_len;
+};
+
+/*! \brief View the contents without copying them.
+ *
+ * Any edit invalidates the view. */
+gapbuf_view gapbuf_get_view(const gapbuf* self);
+
+/*! \brief Move the gap to the end so the contents are contiguous.
+ *
+ * \return A pointer to the \c gapbuf_len_bytes(self) bytes of
+ * contents.  It is not null terminated. */
+const char* gapbuf_make_contiguous(gapbuf* self);
+
+/*! \brief Copy the contents into \c out.
+ *
+ * \return -1 on allocation failure. */
+int gapbuf_to_str(const gapbuf* self, str* out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
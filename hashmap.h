@@ -57,11 +57,38 @@ int hashmap_reserve(hashmap*, size_t capacity, size_t key_size, size_t value_siz
 int hashmap_insert(hashmap*, const hashmap_key* key, size_t key_size,
                    const hashmap_value* value, size_t value_size);
 /*! \brief Erase an elememnt from this hash map.
+ *
+ * If the hash map becomes very sparse (fewer elements than an eighth
+ * of its buckets) it is rehashed into a smaller table.  Since the map
+ * only grows once there are twice as many elements as buckets, a map
+ * hovering around one size will not repeatedly shrink and grow.
+ *
+ * Because of this, erasing invalidates every pointer into the hash
+ * map, such as those from \c hashmap_lookup and iterators, not just
+ * those to the erased element.
  *
  * If the element didn't exist in the hash map, returns 1.
  * Otherwise returns 0.
  */
 int hashmap_erase(hashmap*, const hashmap_key* key, size_t key_size, size_t value_size);
+/*! \brief Erase every element from this hash map.
+ *
+ * The capacity of the hash map is kept, so refilling it to its
+ * previous size will not allocate.
+ */
+void hashmap_clear(hashmap*);
+/*! \brief Shrink the hash map's memory usage to fit its elements.
+ *
+ * This rehashes into the smallest table that holds the current
+ * elements and then shrinks every bucket's capacity to its length.
+ * This invalidates every pointer into the hash map.
+ *
+ * Error handling for this function can be ignored: it is only an
+ * optimization.
+ *
+ * \return Returns -1 on memory allocation error, 0 on success.
+ */
+int hashmap_shrink_to_fit(hashmap*, size_t key_size, size_t value_size);
 /*! \brief Lookup a key, retrieving the associated value. */
 void* hashmap_lookup(hashmap*, const hashmap_key* key, size_t key_size, size_t value_size);
 
@@ -137,6 +164,15 @@ hashmap_pair hashmap_iterator_peek(const hashmap_iterator*, size_t key_size, siz
 
 size_t str_hash(const void*);
 size_t size_t_hash(const void*);
+/*! \brief The initial value and multiplier of \c mem_hash.  Each
+ *  byte \c b updates the hash \c h to <tt>h * MEM_HASH_MUL +
+ *  (char)b</tt>, so other hashes can match it. */
+#define MEM_HASH_SEED ((size_t)1212382)
+#define MEM_HASH_MUL ((size_t)31)
+/*! \brief Hash \c len bytes starting at \c data.
+ *
+ * A \c str hashes to the same value as its bytes do. */
+size_t mem_hash(const void* data, size_t len);
 
 #ifdef __cplusplus
 }
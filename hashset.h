@@ -59,6 +59,20 @@ int hashset_insert(hashset*, const void* value, size_t size);
  * Otherwise returns 0.
  */
 int hashset_erase(hashset*, const void* value, size_t size);
+/*! \brief Erase every element from this hash map.
+ *
+ * The capacity of the hash map is kept, so refilling it to its
+ * previous size will not allocate.
+ */
+void hashset_clear(hashset*);
+/*! \brief Shrink the hash map's memory usage to fit its elements.
+ *
+ * Error handling for this function can be ignored: it is only an
+ * optimization.
+ *
+ * \return Returns -1 on memory allocation error, 0 on success.
+ */
+int hashset_shrink_to_fit(hashset*, size_t size);
 
 /*! \brief Iterate through the hash map.
  *
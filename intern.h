@@ -0,0 +1,88 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2017 Chris Gregory czipperz@gmail.com
+ */
+
+/*! \file intern.h
+ *
+ * \brief A string interning table.
+ *
+ * Each distinct byte string is stored exactly once and given a 32
+ * bit ID.  IDs are handed out consecutively starting at 0 and are
+ * stable for the lifetime of the interner, so equal strings can be
+ * compared by comparing their IDs.
+ *
+ * The strings are packed into large arena chunks that never move.
+ * Thus the pointer returned by \c interner_lookup is valid until the
+ * interner is destroyed.
+ */
+
+#ifndef CUTIL_INTERN_H
+#define CUTIL_INTERN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "str.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct interner interner;
+/*! \brief Create an empty interner.
+ *
+ * It must only be used by one thread at a time.
+ *
+ * Returns null on error (in malloc).
+ */
+interner* interner_new(void);
+/*! \brief Create an empty interner that any number of threads may
+ *  use at the same time.
+ *
+ * \c interner_lookup and \c interner_size never take a lock.
+ * Interning a string that is already present only takes a shared
+ * lock, so those proceed in parallel too.  Adding a new string takes
+ * the lock exclusively.
+ *
+ * Returns null on error (in malloc).
+ */
+interner* interner_new_concurrent(void);
+/*! \brief Destroy the interner.  It is illegal to be used past this
+ *  point, as are all strings retrieved from it. */
+void interner_destroy(interner*);
+/*! \brief Get the number of distinct strings interned. */
+size_t interner_size(interner*);
+/*! \brief Get the ID of \c string, storing it if it hasn't been seen
+ *  before.
+ *
+ * If an error occured, return -1 (this does not corrupt the
+ * interner).  Otherwise returns 0.
+ */
+int interner_intern(interner*, const char* string, size_t len, uint32_t* id);
+/*! \brief Get the ID of \c string, storing it if it hasn't been seen
+ *  before.
+ *
+ * If an error occured, return -1 (this does not corrupt the
+ * interner).  Otherwise returns 0.
+ */
+int interner_intern_str(interner*, const str* string, uint32_t* id);
+/*! \brief Get the ID of \c string without storing it.
+ *
+ * If \c string hasn't been interned, returns 1.
+ * Otherwise returns 0.
+ */
+int interner_find(interner*, const char* string, size_t len, uint32_t* id);
+/*! \brief Retrieve the string with the ID \c id.
+ *
+ * The string is null terminated.  If \c len is not null, the length
+ * of the string is stored in it.
+ */
+const char* interner_lookup(interner*, uint32_t id, size_t* len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,121 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2017 Chris Gregory czipperz@gmail.com
+ */
+
+/*! \file multimap.h
+ *
+ * \brief An implementation of a hash map that maps each key to many
+ * values.
+ *
+ * Like \c hashmap it uses an array of arrays approach.  Each bucket
+ * stores one run per key: the key followed by all of its values, one
+ * after another.  Thus reading every value of a key is a single
+ * sequential scan and adding a key does not allocate separately from
+ * its bucket.
+ *
+ * As with \c hashmap, two keys are considered equal if they hash to
+ * the same value.
+ */
+
+#ifndef CUTIL_MULTIMAP_H
+#define CUTIL_MULTIMAP_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void multimap_key;
+typedef void multimap_value;
+typedef struct multimap multimap;
+/*! \brief Create a multimap that will map elements to hashes based on this hashing function.
+ *
+ * Returns null on error (in malloc).
+ */
+multimap* multimap_new(size_t (*hash)(const multimap_key*));
+/*! \brief Destroy the multimap.  It is illegal to be used past this point. */
+void multimap_destroy(multimap*);
+/*! \brief Get the number of values in this multimap.
+ *
+ * This has O(1) performance.
+ */
+size_t multimap_size(const multimap*);
+/*! \brief Get the number of distinct keys in this multimap.
+ *
+ * This has O(1) performance.
+ */
+size_t multimap_keys(const multimap*);
+/*! \brief Count the number of values associated with \c key.
+ *
+ * This has amortized O(1) performance (assuming the hash algorithm is semi random).
+ */
+size_t multimap_count(const multimap*, const multimap_key* key,
+                      size_t key_size, size_t value_size);
+/*! \brief Insert \c value at the end of the values associated with \c key.
+ *
+ * If an error occured, return -1 (this does not corrupt the multimap).
+ * Otherwise returns 0.
+ */
+int multimap_insert(multimap*, const multimap_key* key, size_t key_size,
+                    const multimap_value* value, size_t value_size);
+/*! \brief Insert the \c count values in \c values at the end of the
+ *  values associated with \c key.
+ *
+ * This only makes space once, so it is much faster than calling
+ * \c multimap_insert \c count times.
+ *
+ * If an error occured, return -1 (this does not corrupt the multimap).
+ * Otherwise returns 0.
+ */
+int multimap_insert_n(multimap*, const multimap_key* key, size_t key_size,
+                      const multimap_value* values, size_t count,
+                      size_t value_size);
+/*! \brief Erase \c key and every value associated with it.
+ *
+ * \return The number of values erased.
+ */
+size_t multimap_erase(multimap*, const multimap_key* key,
+                      size_t key_size, size_t value_size);
+/*! \brief Erase every key and value from this multimap.
+ *
+ * The capacity of the multimap is kept.
+ */
+void multimap_clear(multimap*);
+
+typedef struct multimap_range multimap_range;
+/*! \brief The values associated with a key.
+ *
+ * The values are stored contiguously: the \c i th value is at
+ * <tt>(char*)values + i * value_size</tt>.  Keys and values are
+ * aligned for any type whose size is the \c key_size or \c
+ * value_size used, so \c values may be cast to a pointer to the value
+ * type.
+ *
+ * Any changes to the multimap invalidates it.
+ */
+struct multimap_range {
+    multimap_value* values;
+    size_t len;
+};
+/*! \brief Lookup a key, retrieving all its associated values.
+ *
+ * If the key isn't present, the range is empty and \c values is null.
+ */
+multimap_range multimap_equal_range(multimap*, const multimap_key* key,
+                                    size_t key_size, size_t value_size);
+
+/*! \brief Iterate through the multimap, once per key. */
+void multimap_iterate(multimap*, size_t key_size, size_t value_size,
+                      void (*fun)(void* key, void* values, size_t len,
+                                  void* userdata),
+                      void* userdata);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
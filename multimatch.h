@@ -0,0 +1,130 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2017 Chris Gregory czipperz@gmail.com
+ */
+
+/*! \file multimatch.h
+ *
+ * \brief Search for many patterns at once.
+ *
+ * The patterns are compiled into an Aho-Corasick automaton that
+ * finds every occurrence of every pattern, overlaps included, in a
+ * single pass over the text.  The automaton is a full DFA, so each
+ * byte costs one table lookup no matter how many patterns there are.
+ * Bytes are mapped to equivalence classes first, so the table only
+ * has a column for each distinct byte used by the patterns.
+ *
+ * For small pattern sets, a vector prefilter in the style of Teddy
+ * skips over text where no pattern can start, testing the first two
+ * bytes of each position against nibble masks.
+ *
+ * A built \c multimatch is never modified while searching, so it can
+ * be shared between threads.  Each search has its own iterator.
+ */
+
+#ifndef CUTIL_MULTIMATCH_H
+#define CUTIL_MULTIMATCH_H
+
+#include "str.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct multimatch multimatch;
+struct multimatch {
+    /*! \brief Row offsets of the next state, by state and class.  The
+     *  top bit is set if the next state has matches. */
+    uint32_t* _transitions;
+    /*! \brief The first pattern ending at each state. */
+    uint32_t* _state_patterns;
+    /*! \brief The next state down the failure chain that has
+     *  patterns ending at it. */
+    uint32_t* _output_links;
+    /*! \brief The next pattern ending at the same state. */
+    uint32_t* _pattern_next;
+    size_t* _pattern_lens;
+    size_t _num_patterns;
+    size_t _num_states;
+    size_t _num_classes;
+    unsigned char _classes[256];
+    /*! \brief The number of bytes tested by the prefilter, 0 if it is
+     *  disabled. */
+    int _prefilter;
+    /*! \brief Bucket masks by low and high nibble of the first and
+     *  second bytes. */
+    unsigned char _teddy[4][16];
+    /*! \brief A bitset of the first bytes of the patterns. */
+    unsigned char _first_bytes[32];
+};
+
+#define MULTIMATCH_INIT {0, 0, 0, 0, 0, 0, 0, 0, {0}, 0, {{0}}, {0}}
+
+/*! \brief Compile an automaton from \c num_patterns patterns.
+ *
+ * Pattern \c i is \c lens[i] bytes at \c patterns[i] and must not be
+ * empty.  Matches are reported by index into \c patterns.  \c self
+ * must be initialized, and a previous automaton is destroyed.
+ *
+ * Complexity: O(m * c) where m is the total length of the patterns
+ * and c is the number of distinct bytes in them.
+ *
+ * \return -1 on allocation failure, leaving \c self unchanged. */
+int multimatch_build(multimatch* self, const char* const* patterns,
+                     const size_t* lens, size_t num_patterns);
+
+/*! \brief Free memory used by \c self.
+ *
+ * It is SAFE to call this multiple times. */
+void multimatch_destroy(multimatch* self);
+
+typedef struct multimatch_match multimatch_match;
+struct multimatch_match {
+    /*! \brief The index of the pattern. */
+    size_t pattern;
+    /*! \brief The byte offset of the start of the match. */
+    size_t begin;
+    /*! \brief The byte offset after the end of the match. */
+    size_t end;
+};
+
+/*! \brief Walks the matches in a text.
+ *
+ * Matches are produced by increasing \c end.  Matches ending at the
+ * same offset are produced longest first. */
+typedef struct multimatch_iterator multimatch_iterator;
+struct multimatch_iterator {
+    const multimatch* _automaton;
+    const unsigned char* _text;
+    size_t _len;
+    size_t _pos;
+    uint32_t _state;
+    /*! \brief The next pattern to report at \c _pos, if any. */
+    uint32_t _pattern;
+    uint32_t _output_state;
+};
+
+/*! \brief Start searching the \c len bytes at \c text. */
+multimatch_iterator multimatch_iterator_new(const multimatch* self,
+                                            const char* text, size_t len);
+/*! \brief Start searching the contents of \c string.
+ *
+ * Modifying \c string invalidates the iterator. */
+multimatch_iterator multimatch_iterator_from_str(const multimatch* self,
+                                                 const str* string);
+/*! \brief Store the next match in \c match.
+ *
+ * \return 1 if there was another match, 0 once exhausted. */
+int multimatch_iterator_next(multimatch_iterator* iterator,
+                             multimatch_match* match);
+
+/*! \brief Count every match in the \c len bytes at \c text. */
+size_t multimatch_count(const multimatch* self, const char* text, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
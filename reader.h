@@ -0,0 +1,81 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2017 Chris Gregory czipperz@gmail.com
+ */
+
+/*! \file reader.h
+ *
+ * \brief Buffered line reading from file descriptors, and loading
+ * whole files into a \c str.
+ *
+ * A \c reader reads in large chunks and hands out lines as views into
+ * its buffer, so a line is only copied when it crosses the end of the
+ * buffer and has to be moved to the front.  Lines longer than the
+ * buffer grow it.
+ */
+
+#ifndef CUTIL_READER_H
+#define CUTIL_READER_H
+
+#include "str.h"
+#include "strview.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! \brief The initial buffer size and the most read at once. */
+#define READER_CHUNK ((size_t)64 * 1024)
+
+typedef struct reader reader;
+struct reader {
+    int _fd;
+    char* _buffer;
+    size_t _cap;
+    /*! \brief The start of the data not yet returned. */
+    size_t _begin;
+    /*! \brief The end of the data read. */
+    size_t _end;
+    int _eof;
+};
+
+/*! \brief Start reading from \c fd.
+ *
+ * The reader doesn't own \c fd and doesn't close it.
+ *
+ * \return -1 on allocation failure. */
+int reader_init(reader* self, int fd);
+
+/*! \brief Free memory used by \c self.
+ *
+ * It is SAFE to call this multiple times. */
+void reader_destroy(reader* self);
+
+/*! \brief Get the next line, without its '\\n'.
+ *
+ * The last line doesn't need a '\\n'.  A "\\r\\n" line ending leaves
+ * the '\\r' in the line.  \c line points into the reader's buffer
+ * and is valid until the next call.  Lines aren't checked for utf8
+ * validity.
+ *
+ * \return 1 if there was a line, 0 at the end of the input, or -1 on
+ * a read or allocation error. */
+int reader_next_line(reader* self, strview* line);
+
+/*! \brief Replace the contents of \c self with the file at \c path.
+ *
+ * The str is sized once from the file size and filled by reading
+ * straight into it.
+ *
+ * \return 0 on success, -1 if the file can't be read or on
+ * allocation failure, or 1 if it isn't valid utf8.  On failure \c
+ * self is unchanged. */
+int str_from_file(str* self, const char* path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,145 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2017 Chris Gregory czipperz@gmail.com
+ */
+
+/*! \file rope.h
+ *
+ * \brief A utf8 string for large texts that are edited in the middle.
+ *
+ * The text is split into \c str chunks of at most a kilobyte, which
+ * are the leaves of an AVL tree.  Each node knows how many bytes and
+ * characters are below it, so inserting, erasing, splitting and
+ * concatenating are all O(log n) instead of moving the whole tail.
+ * Chunks are only ever split on character boundaries.
+ *
+ * Positions are byte offsets and must be on character boundaries.
+ *
+ * Functions return -1 on allocation failure.  Like \c str, the rope
+ * is unchanged if allocation fails.
+ */
+
+#ifndef CUTIL_ROPE_H
+#define CUTIL_ROPE_H
+
+#include "str.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct rope_node rope_node;
+
+typedef struct rope rope;
+struct rope {
+    rope_node* _root;
+    /*! \brief Nodes allocated in advance so that rebalancing can't
+     *  fail halfway through. */
+    rope_node* _spare;
+    size_t _spare_len;
+};
+
+#define ROPE_INIT {0, 0, 0}
+
+/*! \brief Initialize the rope. */
+void rope_init(rope* self);
+
+/*! \brief Free memory used by \c self.
+ *
+ * It is SAFE to call this multiple times. */
+void rope_destroy(rope* self);
+
+/*! \brief Get the number of bytes in the rope.
+ *
+ * Complexity: O(1) */
+size_t rope_len_bytes(const rope* self);
+
+/*! \brief Get the number of characters in the rope.
+ *
+ * Complexity: O(1) */
+size_t rope_len_characters(const rope* self);
+
+/*! \brief Insert \c len_bytes bytes of \c string at \c pos.
+ *
+ * This verifies that \c string is a valid utf8 string.
+ *
+ * \return -1 on allocation failure. */
+int rope_insert(rope* self, size_t pos, const char* string, size_t len_bytes);
+
+/*! \brief Insert \c len_bytes bytes of \c string at the end. */
+int rope_push_sn(rope* self, const char* string, size_t len_bytes);
+
+/*! \brief Erase \c num bytes starting at \c pos.
+ *
+ * \return -1 on allocation failure, as a chunk may need to be split. */
+int rope_erase(rope* self, size_t pos, size_t num);
+
+/*! \brief Move everything from \c pos onwards into \c tail.
+ *
+ * \c tail must be empty.
+ *
+ * \return -1 on allocation failure. */
+int rope_split(rope* self, size_t pos, rope* tail);
+
+/*! \brief Move all of \c other onto the end of \c self.
+ *
+ * \c other is left empty.
+ *
+ * \return -1 on allocation failure. */
+int rope_concat(rope* self, rope* other);
+
+/*! \brief Get the byte offset of the character at \c char_index.
+ *
+ * Returns \c rope_len_bytes(self) if there are no more than \c
+ * char_index characters.
+ *
+ * Complexity: O(log n) */
+size_t rope_char_to_byte(const rope* self, size_t char_index);
+
+/*! \brief Get the index of the character starting at \c byte_index.
+ *
+ * Complexity: O(log n) */
+size_t rope_byte_to_char(const rope* self, size_t byte_index);
+
+/*! \brief Copy the contents of the rope into \c out.
+ *
+ * \return -1 on allocation failure. */
+int rope_flatten(const rope* self, str* out);
+
+/*! \brief The maximum height of the tree.  An AVL tree this tall has
+ *  more nodes than fit in memory. */
+#define ROPE_MAX_HEIGHT 96
+
+/*! \brief A contiguous piece of the rope. */
+typedef struct rope_chunk rope_chunk;
+struct rope_chunk {
+    /*! \brief Null once the iterator is exhausted. */
+    const char* str;
+    size_t len;
+};
+
+/*! \brief Visits the chunks of a rope in order.
+ *
+ * Any change to the rope invalidates it. */
+typedef struct rope_iterator rope_iterator;
+struct rope_iterator {
+    const rope_node* _stack[ROPE_MAX_HEIGHT];
+    size_t _depth;
+};
+
+/*! \brief Create an iterator at the first chunk of \c self. */
+rope_iterator rope_iterator_new(const rope* self);
+
+/*! \brief Retrieve the next chunk and increment the iterator.
+ *
+ * Chunks are never empty.  Once every chunk has been visited this
+ * returns a chunk whose \c str is null. */
+rope_chunk rope_iterator_next(rope_iterator* iterator);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,71 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2017 Chris Gregory czipperz@gmail.com
+ */
+
+/*! \file search.h
+ *
+ * \brief Substring search over byte ranges of known length.
+ *
+ * For short needles, candidates are found by comparing the first and
+ * last bytes of the needle against a whole vector of haystack
+ * positions at a time, and only those are verified with \c memcmp.
+ * If verification starts to cost more than scanning, as with
+ * periodic inputs like "aaa...ab", the search switches to the
+ * Two-Way algorithm for the rest of the haystack.  Long needles use
+ * Two-Way from the start, since its shifts skip most of the
+ * haystack.  Every search is therefore O(n + m).
+ *
+ * Nothing here allocates.
+ */
+
+#ifndef CUTIL_SEARCH_H
+#define CUTIL_SEARCH_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! \brief Returned by searches that find nothing. */
+#define MEM_NPOS ((size_t)-1)
+
+/*! \brief Find the first occurrence of \c needle in \c haystack.
+ *
+ * \return The byte offset of the match or \c MEM_NPOS.  An empty
+ * needle matches at 0. */
+size_t mem_find(const char* haystack, size_t haystack_len,
+                const char* needle, size_t needle_len);
+
+/*! \brief Find the last occurrence of \c needle in \c haystack.
+ *
+ * \return The byte offset of the match or \c MEM_NPOS.  An empty
+ * needle matches at \c haystack_len. */
+size_t mem_rfind(const char* haystack, size_t haystack_len,
+                 const char* needle, size_t needle_len);
+
+/*! \brief Find the last occurrence of \c byte in \c haystack. */
+size_t mem_rfind_byte(const char* haystack, size_t haystack_len, char byte);
+
+/*! \brief Find the first byte of \c haystack that is in \c set.
+ *
+ * \return The byte offset or \c MEM_NPOS. */
+size_t mem_find_any(const char* haystack, size_t haystack_len,
+                    const char* set, size_t set_len);
+
+/*! \brief Count the non overlapping occurrences of \c needle.
+ *
+ * Matches are counted left to right, so "aaaa" contains "aa" twice.
+ * An empty needle matches at every offset, \c haystack_len + 1
+ * times. */
+size_t mem_count(const char* haystack, size_t haystack_len,
+                 const char* needle, size_t needle_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
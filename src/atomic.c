@@ -0,0 +1,40 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2017 Chris Gregory czipperz@gmail.com
+ */
+
+#include "../atomic.h"
+
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+void
+spin_pause(void) {
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+    _mm_pause();
+#endif
+}
+
+int
+spinlock_try_lock(spinlock* self) {
+    /* Check first so waiting doesn't bounce the cache line around. */
+    if (ATOMIC_LOAD_SIZE(&self->_locked)) {
+        return 0;
+    }
+    return ATOMIC_CAS_SIZE(&self->_locked, 0, 1) == 0;
+}
+
+void
+spinlock_lock(spinlock* self) {
+    while (!spinlock_try_lock(self)) {
+        spin_pause();
+    }
+}
+
+void
+spinlock_unlock(spinlock* self) {
+    ATOMIC_STORE_SIZE(&self->_locked, 0);
+}
@@ -0,0 +1,533 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2017 Chris Gregory czipperz@gmail.com
+ */
+
+#include "../counter_map.h"
+#include "../atomic.h"
+#include "../hashmap.h"
+#include "../rpmalloc.h"
+#include <assert.h>
+#include <string.h>
+
+/*! \brief A key is allocated once and its bytes are never modified,
+ *  so it can be published to other threads by a single pointer swap.
+ *
+ *  The count lives with the key rather than in a slot, so growing
+ *  moves only the pointer and every table holding the key sees the
+ *  same count. */
+typedef struct counter_key counter_key;
+struct counter_key {
+    volatile int64_t count;
+    size_t hash;
+    size_t len;
+    char data[];
+};
+
+typedef struct counter_slot counter_slot;
+struct counter_slot {
+    counter_key* volatile key;
+};
+
+/*! \brief An open addressing table.  Slots are only ever filled,
+ *  never emptied, so a key found in a slot stays there.
+ *
+ *  Before a table is replaced by a bigger one, its empty slots are
+ *  filled with \c COUNTER_FROZEN so no new keys can be added to it
+ *  while its keys are being copied. */
+typedef struct counter_table counter_table;
+struct counter_table {
+    /*! \brief The number of slots.  Always a power of two. */
+    size_t cap;
+    /*! \brief The number of filled slots. */
+    volatile size_t used;
+    counter_slot slots[];
+};
+
+static counter_key counter_frozen;
+#define COUNTER_FROZEN (&counter_frozen)
+
+/*! \brief The size of a cache line.  Reader counts and the shared
+ *  fields are padded to it so threads don't write to each other's
+ *  lines. */
+#define COUNTER_MAP_CACHE_LINE 64
+/*! \brief The number of reader count stripes.  Threads are spread
+ *  over them round robin, so with up to this many threads none share
+ *  a stripe. */
+#define COUNTER_MAP_STRIPES 32
+
+#if defined(_MSC_VER)
+#define COUNTER_MAP_THREAD_LOCAL __declspec(thread)
+#else
+#define COUNTER_MAP_THREAD_LOCAL __thread
+#endif
+
+/*! \brief The number of threads using the table in each epoch, for
+ *  the threads assigned to this stripe. */
+typedef struct counter_stripe counter_stripe;
+struct counter_stripe {
+    volatile size_t active[2];
+    char _pad[COUNTER_MAP_CACHE_LINE - 2 * sizeof(size_t)];
+};
+
+/*! \brief Threads using the table register themselves in \c
+ *  active[epoch % 2] of their stripe.  To retire a table, we swap in
+ *  its replacement, increment \c epoch, and then wait for the old
+ *  epoch's count to reach zero in every stripe.  Threads registering
+ *  after the increment are guaranteed to see the replacement.
+ *
+ *  \c table and \c epoch are read by every operation but only
+ *  written by swaps, so they get a cache line to themselves. */
+struct counter_map {
+    counter_table* volatile table;
+    volatile size_t epoch;
+    char _pad[COUNTER_MAP_CACHE_LINE - sizeof(void*) - sizeof(size_t)];
+    counter_stripe stripes[COUNTER_MAP_STRIPES];
+    /*! \brief Serializes growing and draining. */
+    spinlock lock;
+};
+
+/*! \brief The stripe of this thread plus one, or 0 if unassigned. */
+static COUNTER_MAP_THREAD_LOCAL size_t counter_map_thread_stripe;
+static volatile size_t counter_map_next_stripe;
+
+#define COUNTER_MAP_MIN_CAP 64
+/*! \brief Returned by \c counter_table_add when the table is too full. */
+#define COUNTER_FULL 1
+
+static counter_table* counter_table_new(size_t cap) {
+    counter_table* table =
+        rpcalloc(1, sizeof(counter_table) + cap * sizeof(counter_slot));
+    if (table) {
+        table->cap = cap;
+    }
+    return table;
+}
+
+/*! \brief Destroy \c table and every key in it. */
+static void counter_table_destroy(counter_table* table) {
+    size_t i;
+    for (i = 0; i != table->cap; ++i) {
+        rpfree(table->slots[i].key);
+    }
+    rpfree(table);
+}
+
+static counter_key* counter_key_new(size_t hash, const char* key, size_t len,
+                                    int64_t count) {
+    counter_key* k = rpmalloc(sizeof(counter_key) + len);
+    if (k) {
+        k->count = count;
+        k->hash = hash;
+        k->len = len;
+        memcpy(k->data, key, len);
+    }
+    return k;
+}
+
+/*! \brief Add \c delta to \c key in \c table.
+ *
+ * This refuses to insert new keys once three quarters of the table is
+ * used, or once the table is frozen, and returns \c COUNTER_FULL.
+ * Returns -1 on allocation failure. */
+static int counter_table_add(counter_table* table, size_t hash,
+                             const char* key, size_t len, int64_t delta) {
+    size_t mask = table->cap - 1;
+    size_t i = hash & mask;
+    size_t probes;
+    counter_key* owned = 0;
+    for (probes = 0; probes != table->cap; ++probes, i = (i + 1) & mask) {
+        counter_slot* slot = &table->slots[i];
+        counter_key* k = ATOMIC_LOAD_PTR(&slot->key);
+        if (!k) {
+            if (ATOMIC_LOAD_SIZE(&table->used) * 4 >= table->cap * 3) {
+                break;
+            }
+            if (!owned && !(owned = counter_key_new(hash, key, len, delta))) {
+                return -1;
+            }
+            k = ATOMIC_CAS_PTR(&slot->key, (counter_key*)0, owned);
+            if (!k) {
+                ATOMIC_FETCH_ADD_SIZE(&table->used, 1);
+                return 0;
+            }
+            /* Another thread filled the slot first.  It may have
+             * been with our key, so check it like normal. */
+        }
+        if (k == COUNTER_FROZEN) {
+            break;
+        }
+        if (k->hash == hash && k->len == len && memcmp(k->data, key, len) == 0) {
+            rpfree(owned);
+            ATOMIC_FETCH_ADD_I64(&k->count, delta);
+            return 0;
+        }
+    }
+    rpfree(owned);
+    return COUNTER_FULL;
+}
+
+/*! \brief Put \c k in \c table, which no other thread can see yet. */
+static void counter_table_place(counter_table* table, counter_key* k) {
+    size_t mask = table->cap - 1;
+    size_t i = k->hash & mask;
+    while (table->slots[i].key) {
+        i = (i + 1) & mask;
+    }
+    table->slots[i].key = k;
+    ++table->used;
+}
+
+static size_t counter_map_stripe(void) {
+    if (!counter_map_thread_stripe) {
+        counter_map_thread_stripe =
+            ATOMIC_FETCH_ADD_SIZE(&counter_map_next_stripe, 1) %
+                COUNTER_MAP_STRIPES + 1;
+    }
+    return counter_map_thread_stripe - 1;
+}
+
+/*! \brief Enter the current epoch and return the table to use.
+ *
+ * \c *active is set to the count to pass to \c counter_map_exit. */
+static counter_table* counter_map_enter(counter_map* map,
+                                        volatile size_t** active) {
+    counter_stripe* stripe = &map->stripes[counter_map_stripe()];
+    for (;;) {
+        size_t epoch = ATOMIC_LOAD_SIZE(&map->epoch);
+        *active = &stripe->active[epoch & 1];
+        ATOMIC_FETCH_ADD_SIZE(*active, 1);
+        if (ATOMIC_LOAD_SIZE(&map->epoch) == epoch) {
+            return ATOMIC_LOAD_PTR(&map->table);
+        }
+        /* We raced with a swap and may be blocking it. */
+        ATOMIC_FETCH_ADD_SIZE(*active, (size_t)-1);
+    }
+}
+
+static void counter_map_exit(volatile size_t* active) {
+    ATOMIC_FETCH_ADD_SIZE(active, (size_t)-1);
+}
+
+/*! \brief Replace the current table with \c table and wait until no
+ *  thread is using the old one.  The lock must be held. */
+static counter_table* counter_map_swap(counter_map* map, counter_table* table) {
+    counter_table* old = ATOMIC_LOAD_PTR(&map->table);
+    size_t epoch = ATOMIC_LOAD_SIZE(&map->epoch);
+    size_t i;
+    ATOMIC_STORE_PTR(&map->table, table);
+    ATOMIC_STORE_SIZE(&map->epoch, epoch + 1);
+    for (i = 0; i != COUNTER_MAP_STRIPES; ++i) {
+        while (ATOMIC_LOAD_SIZE(&map->stripes[i].active[epoch & 1]) != 0) {
+            spin_pause();
+        }
+    }
+    return old;
+}
+
+/*! \brief Replace \c full with a bigger table, unless someone else
+ *  already has.
+ *
+ *  The new table is filled before it is swapped in, so \c
+ *  counter_map_get always finds every key.  Increments to existing
+ *  keys carry on during the copy since both tables share the keys. */
+static int counter_map_grow(counter_map* map, counter_table* full) {
+    counter_table* table;
+    size_t i;
+    spinlock_lock(&map->lock);
+    if (ATOMIC_LOAD_PTR(&map->table) != full) {
+        spinlock_unlock(&map->lock);
+        return 0;
+    }
+    table = counter_table_new(full->cap * 2);
+    if (!table) {
+        spinlock_unlock(&map->lock);
+        return -1;
+    }
+    for (i = 0; i != full->cap; ++i) {
+        /* Freeze empty slots so a key can't be added behind us.
+         * Threads adding new keys then wait for us in this function
+         * and retry in the new table. */
+        counter_key* k = ATOMIC_CAS_PTR(&full->slots[i].key, (counter_key*)0,
+                                        COUNTER_FROZEN);
+        if (k) {
+            counter_table_place(table, k);
+        }
+    }
+    counter_map_swap(map, table);
+    /* The keys now belong to the new table. */
+    rpfree(full);
+    spinlock_unlock(&map->lock);
+    return 0;
+}
+
+counter_map*
+counter_map_new(void) {
+    counter_map* map =
+        rpaligned_alloc(COUNTER_MAP_CACHE_LINE, sizeof(struct counter_map));
+    if (map) {
+        memset(map, 0, sizeof(struct counter_map));
+        map->table = counter_table_new(COUNTER_MAP_MIN_CAP);
+        if (!map->table) {
+            rpfree(map);
+            return 0;
+        }
+    }
+    return map;
+}
+
+void
+counter_map_destroy(counter_map* map) {
+    counter_table_destroy(map->table);
+    rpfree(map);
+}
+
+int
+counter_map_add(counter_map* map, const char* key, size_t key_len,
+                int64_t delta) {
+    size_t hash = mem_hash(key, key_len);
+    for (;;) {
+        volatile size_t* active;
+        counter_table* table = counter_map_enter(map, &active);
+        int err = counter_table_add(table, hash, key, key_len, delta);
+        counter_map_exit(active);
+        if (err != COUNTER_FULL) {
+            return err;
+        }
+        if (counter_map_grow(map, table)) {
+            return -1;
+        }
+    }
+}
+
+int64_t
+counter_map_get(counter_map* map, const char* key, size_t key_len) {
+    size_t hash = mem_hash(key, key_len);
+    volatile size_t* active;
+    counter_table* table = counter_map_enter(map, &active);
+    size_t mask = table->cap - 1;
+    size_t i = hash & mask;
+    size_t probes;
+    int64_t count = 0;
+    for (probes = 0; probes != table->cap; ++probes, i = (i + 1) & mask) {
+        counter_key* k = ATOMIC_LOAD_PTR(&table->slots[i].key);
+        if (!k || k == COUNTER_FROZEN) {
+            break;
+        }
+        if (k->hash == hash && k->len == key_len &&
+            memcmp(k->data, key, key_len) == 0) {
+            count = ATOMIC_LOAD_I64(&k->count);
+            break;
+        }
+    }
+    counter_map_exit(active);
+    return count;
+}
+
+size_t
+counter_map_size(counter_map* map) {
+    volatile size_t* active;
+    counter_table* table = counter_map_enter(map, &active);
+    size_t used = ATOMIC_LOAD_SIZE(&table->used);
+    counter_map_exit(active);
+    return used;
+}
+
+int
+counter_map_drain(counter_map* map,
+                  void (*fun)(const char*, size_t, int64_t, void*),
+                  void* userdata) {
+    counter_table* table;
+    size_t i;
+    spinlock_lock(&map->lock);
+    /* Keep the same size so a steady workload doesn't regrow the
+     * table every period. */
+    table = counter_table_new(ATOMIC_LOAD_PTR(&map->table)->cap);
+    if (!table) {
+        spinlock_unlock(&map->lock);
+        return -1;
+    }
+    table = counter_map_swap(map, table);
+    spinlock_unlock(&map->lock);
+
+    for (i = 0; i != table->cap; ++i) {
+        counter_key* k = table->slots[i].key;
+        if (k) {
+            fun(k->data, k->len, k->count, userdata);
+        }
+    }
+    counter_table_destroy(table);
+    return 0;
+}
+
+#ifdef TEST_MODE
+#include "test.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+TEST(test_counter_map_add) {
+    counter_map* map = counter_map_new();
+    ASSERT(map, cleanup);
+    ASSERT(!counter_map_add(map, "/index", 6, 1), cleanup);
+    ASSERT(!counter_map_add(map, "/index", 6, 2), cleanup);
+    ASSERT(!counter_map_add(map, "/login", 6, 5), cleanup);
+    ASSERT(counter_map_get(map, "/index", 6) == 3, cleanup);
+    ASSERT(counter_map_get(map, "/login", 6) == 5, cleanup);
+    ASSERT(counter_map_get(map, "/logout", 7) == 0, cleanup);
+    ASSERT(counter_map_size(map) == 2, cleanup);
+cleanup:
+    counter_map_destroy(map);
+}
+END_TEST
+
+static void test_counter_map_sum(const char* key, size_t len,
+                                 int64_t count, void* userdata) {
+    int64_t* sums = userdata;
+    sums[0] += 1;
+    sums[1] += count;
+    (void)key;
+    (void)len;
+}
+
+TEST(test_counter_map_grow_and_drain) {
+    counter_map* map = counter_map_new();
+    char key[32];
+    int64_t sums[2] = {0, 0};
+    int i;
+    ASSERT(map, cleanup);
+    for (i = 0; i != 2000; ++i) {
+        int len = sprintf(key, "/endpoint/%d", i % 1000);
+        ASSERT(!counter_map_add(map, key, len, i), cleanup);
+    }
+    ASSERT(counter_map_size(map) == 1000, cleanup);
+    ASSERT(counter_map_get(map, "/endpoint/7", 11) == 7 + 1007, cleanup);
+
+    ASSERT(!counter_map_drain(map, test_counter_map_sum, sums), cleanup);
+    ASSERT(sums[0] == 1000, cleanup);
+    ASSERT(sums[1] == 1999 * 2000 / 2, cleanup);
+    ASSERT(counter_map_size(map) == 0, cleanup);
+    ASSERT(counter_map_get(map, "/endpoint/7", 11) == 0, cleanup);
+
+    ASSERT(!counter_map_add(map, "/endpoint/7", 11, 1), cleanup);
+    ASSERT(counter_map_get(map, "/endpoint/7", 11) == 1, cleanup);
+cleanup:
+    counter_map_destroy(map);
+}
+END_TEST
+
+#ifndef _WIN32
+#include <pthread.h>
+
+#define COUNTER_MAP_THREADS 4
+#define COUNTER_MAP_ITERATIONS 20000
+
+static void* test_counter_map_worker(void* map) {
+    char key[32];
+    int i;
+    rpmalloc_thread_initialize();
+    for (i = 0; i != COUNTER_MAP_ITERATIONS; ++i) {
+        int len = sprintf(key, "%d", i % 500);
+        if (counter_map_add(map, key, len, 1)) {
+            abort();
+        }
+    }
+    rpmalloc_thread_finalize();
+    return 0;
+}
+
+TEST(test_counter_map_concurrent) {
+    counter_map* map = counter_map_new();
+    pthread_t threads[COUNTER_MAP_THREADS];
+    int64_t sums[2] = {0, 0};
+    int started = 0;
+    int i;
+    ASSERT(map, cleanup);
+    for (; started != COUNTER_MAP_THREADS; ++started) {
+        ASSERT(!pthread_create(&threads[started], 0, test_counter_map_worker, map), cleanup);
+    }
+    /* Drain while the workers are adding. */
+    while (sums[1] < (int64_t)COUNTER_MAP_THREADS * COUNTER_MAP_ITERATIONS / 2) {
+        ASSERT(!counter_map_drain(map, test_counter_map_sum, sums), cleanup);
+    }
+    for (i = 0; i != started; ++i) {
+        pthread_join(threads[i], 0);
+    }
+    started = 0;
+    ASSERT(!counter_map_drain(map, test_counter_map_sum, sums), cleanup);
+    ASSERT(sums[1] == (int64_t)COUNTER_MAP_THREADS * COUNTER_MAP_ITERATIONS, cleanup);
+cleanup:
+    /* The workers use the map, so they must finish before it is
+     * destroyed. */
+    for (i = 0; i != started; ++i) {
+        pthread_join(threads[i], 0);
+    }
+    counter_map_destroy(map);
+}
+END_TEST
+struct test_counter_map_reader {
+    counter_map* map;
+    volatile size_t done;
+    int failed;
+};
+
+static void* test_counter_map_monotonic(void* data) {
+    struct test_counter_map_reader* reader = data;
+    int64_t last = 0;
+    rpmalloc_thread_initialize();
+    while (!ATOMIC_LOAD_SIZE(&reader->done)) {
+        int64_t count = counter_map_get(reader->map, "hot", 3);
+        if (count < last) {
+            reader->failed = 1;
+        }
+        last = count;
+    }
+    rpmalloc_thread_finalize();
+    return 0;
+}
+
+TEST(test_counter_map_get_during_grow) {
+    struct test_counter_map_reader reader;
+    pthread_t thread;
+    char key[32];
+    int started = 0;
+    int i;
+    reader.map = counter_map_new();
+    reader.done = 0;
+    reader.failed = 0;
+    ASSERT(reader.map, cleanup);
+    ASSERT(!counter_map_add(reader.map, "hot", 3, 1), cleanup);
+    ASSERT(!pthread_create(&thread, 0, test_counter_map_monotonic, &reader), cleanup);
+    started = 1;
+    /* Each new key may grow the table under the reader. */
+    for (i = 0; i != 20000; ++i) {
+        int len = sprintf(key, "cold %d", i);
+        ASSERT(!counter_map_add(reader.map, key, len, 1), cleanup);
+        ASSERT(!counter_map_add(reader.map, "hot", 3, 1), cleanup);
+    }
+    ATOMIC_STORE_SIZE(&reader.done, 1);
+    pthread_join(thread, 0);
+    started = 0;
+    ASSERT(!reader.failed, cleanup);
+    ASSERT(counter_map_get(reader.map, "hot", 3) == 20001, cleanup);
+    ASSERT(counter_map_size(reader.map) == 20001, cleanup);
+cleanup:
+    if (started) {
+        ATOMIC_STORE_SIZE(&reader.done, 1);
+        pthread_join(thread, 0);
+    }
+    counter_map_destroy(reader.map);
+}
+END_TEST
+#endif
+
+void test_counter_map(void) {
+    RUN(test_counter_map_add);
+    RUN(test_counter_map_grow_and_drain);
+#ifndef _WIN32
+    RUN(test_counter_map_concurrent);
+    RUN(test_counter_map_get_during_grow);
+#endif
+}
+#endif
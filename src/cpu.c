@@ -0,0 +1,34 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2017 Chris Gregory czipperz@gmail.com
+ */
+
+#include "../cpu.h"
+#include "../atomic.h"
+
+/*! \brief The features plus one, so 0 means not yet detected. */
+static volatile size_t cpu_cached;
+
+unsigned
+cpu_features(void) {
+    size_t features = ATOMIC_LOAD_SIZE(&cpu_cached);
+    if (!features) {
+        features = 1;
+#ifdef CPU_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("sse2")) {
+            features += CPU_SSE2;
+        }
+        if (__builtin_cpu_supports("ssse3")) {
+            features += CPU_SSSE3;
+        }
+        if (__builtin_cpu_supports("avx2")) {
+            features += CPU_AVX2;
+        }
+#endif
+        ATOMIC_STORE_SIZE(&cpu_cached, features);
+    }
+    return (unsigned)(features - 1);
+}
@@ -0,0 +1,323 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2017 Chris Gregory czipperz@gmail.com
+ */
+
+#include "../gapbuf.h"
+#include "../rpmalloc.h"
+#include "../utf8.h"
+#include "internal.h"
+#include <assert.h>
+#include <string.h>
+
+#define GAPBUF_MIN_CAP 64
+
+/*! \brief Check \c pos is at a character boundary. */
+static int
+gapbuf_is_boundary(const gapbuf* self, size_t pos) {
+    size_t index = pos < self->_gap_begin
+                       ? pos
+                       : pos + (self->_gap_end - self->_gap_begin);
+    return index == self->_cap ||
+           (self->_buffer[index] & 0xC0) != 0x80;
+}
+
+/*! \brief Move the gap so it starts at \c pos. */
+static void
+gapbuf_move_gap(gapbuf* self, size_t pos) {
+    if (pos < self->_gap_begin) {
+        size_t num = self->_gap_begin - pos;
+        memmove(self->_buffer + self->_gap_end - num, self->_buffer + pos, num);
+        self->_gap_begin -= num;
+        self->_gap_end -= num;
+    } else if (pos > self->_gap_begin) {
+        size_t num = pos - self->_gap_begin;
+        memmove(self->_buffer + self->_gap_begin, self->_buffer + self->_gap_end,
+                num);
+        self->_gap_begin += num;
+        self->_gap_end += num;
+    }
+}
+
+void
+gapbuf_init(gapbuf* self) {
+    self->_buffer = 0;
+    self->_cap = 0;
+    self->_gap_begin = 0;
+    self->_gap_end = 0;
+}
+
+void
+gapbuf_destroy(gapbuf* self) {
+    rpfree(self->_buffer);
+    gapbuf_init(self);
+}
+
+size_t
+gapbuf_len_bytes(const gapbuf* self) {
+    return self->_cap - (self->_gap_end - self->_gap_begin);
+}
+
+size_t
+gapbuf_len_characters(const gapbuf* self) {
+    gapbuf_view view = gapbuf_get_view(self);
+    return utf8_count_chars(view.first, view.first_len) +
+           utf8_count_chars(view.second, view.second_len);
+}
+
+int
+gapbuf_reserve(gapbuf* self, size_t new_cap) {
+    char* buffer;
+    size_t back;
+    if (new_cap <= self->_cap) {
+        return 0;
+    }
+    buffer = rprealloc(self->_buffer, new_cap);
+    if (!buffer) {
+        return -1;
+    }
+    /* Slide the text after the gap to the new end. */
+    back = self->_cap - self->_gap_end;
+    memmove(buffer + new_cap - back, buffer + self->_gap_end, back);
+    self->_buffer = buffer;
+    self->_gap_end = new_cap - back;
+    self->_cap = new_cap;
+    return 0;
+}
+
+int
+gapbuf_insert_sn(gapbuf* self, size_t pos, const char* string,
+                 size_t len_bytes) {
+    assert(pos <= gapbuf_len_bytes(self));
+    assert(gapbuf_is_boundary(self, pos));
+    cutil_assert(utf8_validate(string, len_bytes) == len_bytes);
+
+    if (len_bytes == 0) {
+        return 0;
+    }
+    if (self->_gap_end - self->_gap_begin < len_bytes) {
+        size_t len = gapbuf_len_bytes(self);
+        size_t new_cap = self->_cap * 2;
+        if (new_cap < len + len_bytes) {
+            new_cap = len + len_bytes;
+        }
+        if (new_cap < GAPBUF_MIN_CAP) {
+            new_cap = GAPBUF_MIN_CAP;
+        }
+        /* Moving the gap first would move the tail twice. */
+        if (gapbuf_reserve(self, new_cap)) {
+            return -1;
+        }
+    }
+    gapbuf_move_gap(self, pos);
+    memcpy(self->_buffer + self->_gap_begin, string, len_bytes);
+    self->_gap_begin += len_bytes;
+    return 0;
+}
+
+int
+gapbuf_insert_s(gapbuf* self, size_t pos, const char* string) {
+    assert(string);
+    return gapbuf_insert_sn(self, pos, string, strlen(string));
+}
+
+int
+gapbuf_insert(gapbuf* self, size_t pos, uint32_t character) {
+    char outbuf[4];
+    size_t size = utf8_encode(character, outbuf);
+    cutil_assert(size != 0);
+    return gapbuf_insert_sn(self, pos, outbuf, size);
+}
+
+int
+gapbuf_push(gapbuf* self, uint32_t character) {
+    return gapbuf_insert(self, gapbuf_len_bytes(self), character);
+}
+
+int
+gapbuf_push_s(gapbuf* self, const char* string) {
+    return gapbuf_insert_s(self, gapbuf_len_bytes(self), string);
+}
+
+int
+gapbuf_push_sn(gapbuf* self, const char* string, size_t len_bytes) {
+    return gapbuf_insert_sn(self, gapbuf_len_bytes(self), string, len_bytes);
+}
+
+void
+gapbuf_erase(gapbuf* self, size_t begin, size_t end) {
+    gapbuf_erase_n_bytes(self, begin, end - begin);
+}
+
+void
+gapbuf_erase_n_bytes(gapbuf* self, size_t begin, size_t num) {
+    assert(begin + num <= gapbuf_len_bytes(self));
+    assert(gapbuf_is_boundary(self, begin));
+    assert(gapbuf_is_boundary(self, begin + num));
+    if (begin + num <= self->_gap_begin) {
+        /* Before the gap: only move what is kept. */
+        gapbuf_move_gap(self, begin + num);
+        self->_gap_begin -= num;
+    } else if (begin >= self->_gap_begin) {
+        gapbuf_move_gap(self, begin);
+        self->_gap_end += num;
+    } else {
+        /* The range straddles the gap, so just widen it. */
+        self->_gap_end += begin + num - self->_gap_begin;
+        self->_gap_begin = begin;
+    }
+}
+
+gapbuf_view
+gapbuf_get_view(const gapbuf* self) {
+    gapbuf_view view;
+    view.first = self->_buffer;
+    view.first_len = self->_gap_begin;
+    view.second = self->_buffer + self->_gap_end;
+    view.second_len = self->_cap - self->_gap_end;
+    return view;
+}
+
+const char*
+gapbuf_make_contiguous(gapbuf* self) {
+    gapbuf_move_gap(self, gapbuf_len_bytes(self));
+    return self->_buffer;
+}
+
+int
+gapbuf_to_str(const gapbuf* self, str* out) {
+    gapbuf_view view = gapbuf_get_view(self);
+    char* dest;
+    if (str_reserve(out, view.first_len + view.second_len)) {
+        return -1;
+    }
+    dest = str_begin(out);
+    memcpy(dest, view.first, view.first_len);
+    memcpy(dest + view.first_len, view.second, view.second_len);
+    str_set_len_bytes(out, view.first_len + view.second_len);
+    return 0;
+}
+
+#ifdef TEST_MODE
+#include "test.h"
+
+static int
+gapbuf_equals(const gapbuf* self, const char* string) {
+    str flat = STR_INIT;
+    int equal = !gapbuf_to_str(self, &flat) &&
+                strcmp(str_cbegin(&flat), string) == 0;
+    str_destroy(&flat);
+    return equal;
+}
+
+TEST(test_gapbuf_cursor_typing) {
+    gapbuf buf = GAPBUF_INIT;
+    gapbuf_view view;
+    size_t cap;
+    size_t i;
+    ASSERT(gapbuf_len_bytes(&buf) == 0, cleanup);
+    ASSERT(!gapbuf_push_s(&buf, "hello world"), cleanup);
+    cap = buf._cap;
+    /* Type at a cursor in the middle. */
+    for (i = 0; i != 5; ++i) {
+        ASSERT(!gapbuf_insert(&buf, 5 + i, 'a' + i), cleanup);
+    }
+    ASSERT(gapbuf_equals(&buf, "helloabcde world"), cleanup);
+    gapbuf_erase_n_bytes(&buf, 5, 5);
+    ASSERT(gapbuf_equals(&buf, "hello world"), cleanup);
+    ASSERT(!gapbuf_insert(&buf, 5, 0xE9), cleanup);
+    ASSERT(!gapbuf_insert(&buf, 7, 0x20AC), cleanup);
+    ASSERT(gapbuf_equals(&buf, "hello\xC3\xA9\xE2\x82\xAC world"), cleanup);
+    ASSERT(gapbuf_len_bytes(&buf) == 16, cleanup);
+    ASSERT(gapbuf_len_characters(&buf) == 13, cleanup);
+    ASSERT(buf._cap == cap, cleanup);
+
+    view = gapbuf_get_view(&buf);
+    ASSERT(view.first_len == 10, cleanup);
+    ASSERT(memcmp(view.first, "hello\xC3\xA9\xE2\x82\xAC", 10) == 0, cleanup);
+    ASSERT(view.second_len == 6, cleanup);
+    ASSERT(memcmp(view.second, " world", 6) == 0, cleanup);
+
+    /* Backspace. */
+    gapbuf_erase(&buf, 7, 10);
+    gapbuf_erase(&buf, 5, 7);
+    ASSERT(gapbuf_equals(&buf, "hello world"), cleanup);
+    ASSERT(memcmp(gapbuf_make_contiguous(&buf), "hello world", 11) == 0, cleanup);
+    ASSERT(gapbuf_get_view(&buf).second_len == 0, cleanup);
+cleanup:
+    gapbuf_destroy(&buf);
+    gapbuf_destroy(&buf);
+}
+END_TEST
+
+TEST(test_gapbuf_erase_around_gap) {
+    gapbuf buf = GAPBUF_INIT;
+    ASSERT(!gapbuf_push_s(&buf, "0123456789"), cleanup);
+    ASSERT(!gapbuf_insert_s(&buf, 5, "abc"), cleanup);
+    ASSERT(gapbuf_equals(&buf, "01234abc56789"), cleanup);
+    /* The gap is after "abc". */
+    gapbuf_erase_n_bytes(&buf, 6, 3);
+    ASSERT(gapbuf_equals(&buf, "01234a6789"), cleanup);
+    gapbuf_erase_n_bytes(&buf, 0, 2);
+    ASSERT(gapbuf_equals(&buf, "234a6789"), cleanup);
+    gapbuf_erase_n_bytes(&buf, 6, 2);
+    ASSERT(gapbuf_equals(&buf, "234a67"), cleanup);
+    gapbuf_erase_n_bytes(&buf, 0, 6);
+    ASSERT(gapbuf_equals(&buf, ""), cleanup);
+    ASSERT(!gapbuf_push_s(&buf, "again"), cleanup);
+    ASSERT(gapbuf_equals(&buf, "again"), cleanup);
+cleanup:
+    gapbuf_destroy(&buf);
+}
+END_TEST
+
+TEST(test_gapbuf_random_edits) {
+    static const char* const pieces[] = {"a", "bc", "\xC3\xA9", "\xE2\x82\xAC",
+                                         "0123456789012345678901234567890123456789"};
+    gapbuf buf = GAPBUF_INIT;
+    str expected = STR_INIT;
+    unsigned long seed = 7;
+    size_t i;
+    for (i = 0; i != 2000; ++i) {
+        size_t len = str_len_bytes(&expected);
+        size_t pos;
+        seed = seed * 1103515245 + 12345;
+        pos = ((seed >> 16) & 0x7FFF) % (len + 1);
+        while (pos != len && (str_cbegin(&expected)[pos] & 0xC0) == 0x80) {
+            ++pos;
+        }
+        if (seed & 0x80000000UL || len == pos) {
+            const char* piece = pieces[(seed >> 8) % 5];
+            ASSERT(!gapbuf_insert_s(&buf, pos, piece), cleanup);
+            ASSERT(!str_insert_s(&expected, str_cbegin(&expected) + pos, piece),
+                   cleanup);
+        } else {
+            size_t num = (seed >> 4) % 8 + 1;
+            if (num > len - pos) {
+                num = len - pos;
+            }
+            while (pos + num != len &&
+                   (str_cbegin(&expected)[pos + num] & 0xC0) == 0x80) {
+                ++num;
+            }
+            gapbuf_erase_n_bytes(&buf, pos, num);
+            str_erase_n_bytes(&expected, pos, num);
+        }
+        ASSERT(gapbuf_len_bytes(&buf) == str_len_bytes(&expected), cleanup);
+    }
+    ASSERT(gapbuf_equals(&buf, str_cbegin(&expected)), cleanup);
+    ASSERT(gapbuf_len_characters(&buf) == str_len_characters(&expected), cleanup);
+cleanup:
+    gapbuf_destroy(&buf);
+    str_destroy(&expected);
+}
+END_TEST
+
+void test_gapbuf(void) {
+    RUN(test_gapbuf_cursor_typing);
+    RUN(test_gapbuf_erase_around_gap);
+    RUN(test_gapbuf_random_edits);
+}
+#endif
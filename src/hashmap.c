@@ -9,6 +9,7 @@
 #include "../rpmalloc.h"
 #include "../vec.h"
 #include "../str.h"
+#include "internal.h"
 #include <assert.h>
 #include <string.h>
 
@@ -30,7 +31,7 @@ hashmap*
 hashmap_new(size_t (*hash)(const void*)) {
     hashmap* hashmap = rpmalloc(sizeof(struct hashmap));
     if (hashmap) {
-        hashmap->len = 8;
+        hashmap->len = CUTIL_MIN_BUCKETS;
         hashmap->mods = rpcalloc(hashmap->len, sizeof(elemvec));
         if (!hashmap->mods) {
             rpfree(hashmap);
@@ -189,10 +190,46 @@ hashmap_erase(hashmap* hashmap, const void* key, size_t key_size, size_t value_s
     if (contains) {
         vec_remove(&hashmap->mods[mod], key_size + value_size, index);
         --hashmap->elems;
+        /* A failed shrink leaves the hashmap as is, which is fine. */
+        if (cutil_should_shrink(hashmap->len, hashmap->elems)) {
+            hashmap_resize(hashmap, key_size + value_size,
+                           cutil_fit_buckets(hashmap->elems));
+        }
     }
     return !contains;
 }
 
+void
+hashmap_clear(hashmap* hashmap) {
+    size_t i;
+    for (i = 0; i != hashmap->len; ++i) {
+        hashmap->mods[i].len = 0;
+    }
+    hashmap->elems = 0;
+}
+
+int
+hashmap_shrink_to_fit(hashmap* hashmap, size_t key_size, size_t value_size) {
+    size_t new_len = cutil_fit_buckets(hashmap->elems);
+    size_t i;
+    int ret = 0;
+    if (new_len < hashmap->len &&
+        hashmap_resize(hashmap, key_size + value_size, new_len)) {
+        ret = -1;
+    }
+    for (i = 0; i != hashmap->len; ++i) {
+        elemvec* vec = &hashmap->mods[i];
+        if (vec->len == 0) {
+            rpfree(vec->elems);
+            vec->elems = 0;
+            vec->cap = 0;
+        } else if (vec_shrink_to_size(vec, key_size + value_size)) {
+            ret = -1;
+        }
+    }
+    return ret;
+}
+
 void
 hashmap_iterate(hashmap* hashmap, size_t key_size, size_t value_size,
                 void (*fun)(void*, void*, void*), void* userdata) {
@@ -279,18 +316,23 @@ size_t_hash(const void* v) {
 }
 
 size_t
-str_hash(const void* v) {
-    const str* s = v;
-    size_t total = 1212382;
-    const char* i = str_cbegin(s);
-    const char* e = str_cend(s);
+mem_hash(const void* data, size_t len) {
+    size_t total = MEM_HASH_SEED;
+    const char* i = data;
+    const char* e = i + len;
     for (; i != e; ++i) {
-        total *= 31;
+        total *= MEM_HASH_MUL;
         total += *i;
     }
     return total;
 }
 
+size_t
+str_hash(const void* v) {
+    const str* s = v;
+    return mem_hash(str_cbegin(s), str_len_bytes(s));
+}
+
 #ifdef TEST_MODE
 #include "test.h"
 
@@ -347,9 +389,109 @@ cleanup:
 }
 END_TEST
 
+TEST(test_hashmap_erase_shrinks) {
+    hashmap* hashmap = hashmap_new(size_t_hash);
+    size_t num;
+    size_t peak;
+    ASSERT(hashmap, cleanup);
+    for (num = 0; num != 1000; ++num) {
+        ASSERT(!hashmap_insert(hashmap, &num, sizeof(size_t), &num, sizeof(size_t)), cleanup);
+    }
+    peak = hashmap->len;
+    ASSERT(peak >= 500, cleanup);
+    for (num = 0; num != 990; ++num) {
+        ASSERT(!hashmap_erase(hashmap, &num, sizeof(size_t), sizeof(size_t)), cleanup);
+    }
+    ASSERT(hashmap_size(hashmap) == 10, cleanup);
+    ASSERT(hashmap->len < peak, cleanup);
+    for (num = 990; num != 1000; ++num) {
+        ASSERT(num == *(size_t*)hashmap_lookup(hashmap, &num, sizeof(size_t), sizeof(size_t)), cleanup);
+    }
+    num = 5;
+    ASSERT(!hashmap_contains(hashmap, &num, sizeof(size_t), sizeof(size_t)), cleanup);
+cleanup:
+    hashmap_destroy(hashmap);
+}
+END_TEST
+
+TEST(test_hashmap_no_thrash) {
+    hashmap* hashmap = hashmap_new(size_t_hash);
+    size_t num;
+    size_t len;
+    ASSERT(hashmap, cleanup);
+    for (num = 0; num != 40; ++num) {
+        ASSERT(!hashmap_insert(hashmap, &num, sizeof(size_t), &num, sizeof(size_t)), cleanup);
+    }
+    len = hashmap->len;
+    for (num = 0; num != 100; ++num) {
+        size_t key = 1000;
+        ASSERT(!hashmap_insert(hashmap, &key, sizeof(size_t), &key, sizeof(size_t)), cleanup);
+        ASSERT(!hashmap_erase(hashmap, &key, sizeof(size_t), sizeof(size_t)), cleanup);
+        ASSERT(hashmap->len == len, cleanup);
+    }
+cleanup:
+    hashmap_destroy(hashmap);
+}
+END_TEST
+
+TEST(test_hashmap_clear) {
+    hashmap* hashmap = hashmap_new(size_t_hash);
+    hashmap_iterator iterator;
+    size_t num;
+    size_t len;
+    ASSERT(hashmap, cleanup);
+    for (num = 0; num != 100; ++num) {
+        ASSERT(!hashmap_insert(hashmap, &num, sizeof(size_t), &num, sizeof(size_t)), cleanup);
+    }
+    len = hashmap->len;
+    hashmap_clear(hashmap);
+    ASSERT(hashmap_size(hashmap) == 0, cleanup);
+    ASSERT(hashmap->len == len, cleanup);
+    num = 3;
+    ASSERT(!hashmap_contains(hashmap, &num, sizeof(size_t), sizeof(size_t)), cleanup);
+    iterator = hashmap_iterator_new(hashmap);
+    ASSERT(!hashmap_iterator_peek(&iterator, sizeof(size_t), sizeof(size_t)).key, cleanup);
+    ASSERT(!hashmap_insert(hashmap, &num, sizeof(size_t), &num, sizeof(size_t)), cleanup);
+    ASSERT(hashmap_contains(hashmap, &num, sizeof(size_t), sizeof(size_t)), cleanup);
+cleanup:
+    hashmap_destroy(hashmap);
+}
+END_TEST
+
+TEST(test_hashmap_shrink_to_fit) {
+    hashmap* hashmap = hashmap_new(size_t_hash);
+    size_t num;
+    size_t i;
+    ASSERT(hashmap, cleanup);
+    for (num = 0; num != 100; ++num) {
+        ASSERT(!hashmap_insert(hashmap, &num, sizeof(size_t), &num, sizeof(size_t)), cleanup);
+    }
+    for (num = 0; num != 80; ++num) {
+        ASSERT(!hashmap_erase(hashmap, &num, sizeof(size_t), sizeof(size_t)), cleanup);
+    }
+    if (hashmap_shrink_to_fit(hashmap, sizeof(size_t), sizeof(size_t))) {
+        goto cleanup;
+    }
+    LAZY_ASSERT(hashmap->len == 32);
+    for (i = 0; i != hashmap->len; ++i) {
+        LAZY_ASSERT(hashmap->mods[i].len == hashmap->mods[i].cap);
+    }
+    LAZY_CONCLUDE(cleanup);
+    for (num = 80; num != 100; ++num) {
+        ASSERT(num == *(size_t*)hashmap_lookup(hashmap, &num, sizeof(size_t), sizeof(size_t)), cleanup);
+    }
+cleanup:
+    hashmap_destroy(hashmap);
+}
+END_TEST
+
 void test_hashmap(void) {
     RUN(test_hashmap_contains);
     RUN(test_hashmap_erase);
     RUN(test_hashmap_mass_addition);
+    RUN(test_hashmap_erase_shrinks);
+    RUN(test_hashmap_no_thrash);
+    RUN(test_hashmap_clear);
+    RUN(test_hashmap_shrink_to_fit);
 }
 #endif
@@ -29,6 +29,14 @@ int hashset_erase(hashset* hashset, const void* value, size_t size) {
     return hashmap_erase((void*)hashset, value, size, 0);
 }
 
+void hashset_clear(hashset* hashset) {
+    hashmap_clear((void*)hashset);
+}
+
+int hashset_shrink_to_fit(hashset* hashset, size_t size) {
+    return hashmap_shrink_to_fit((void*)hashset, size, 0);
+}
+
 typedef struct pair pair;
 struct pair {
     void (*fun)(void* elem, void* userdata);
@@ -0,0 +1,432 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2017 Chris Gregory czipperz@gmail.com
+ */
+
+#include "../intern.h"
+#include "../atomic.h"
+#include "../hashmap.h"
+#include "../multimap.h"
+#include "../rpmalloc.h"
+#include "../vec.h"
+#include <assert.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+typedef SRWLOCK interner_rwlock;
+#else
+#include <pthread.h>
+typedef pthread_rwlock_t interner_rwlock;
+#endif
+
+typedef struct intern_entry intern_entry;
+struct intern_entry {
+    const char* string;
+    size_t len;
+};
+
+/*! \brief The number of entries in the first segment. */
+#define INTERN_SEGMENT_MIN 16
+/*! \brief Enough segments to hold every 32 bit ID. */
+#define INTERN_SEGMENTS 29
+
+struct interner {
+    /*! \brief Maps the hash of each string to the IDs of the strings
+     *  with that hash. */
+    multimap* index;
+    /*! \brief Entries indexed by ID.  Segment \c k holds \c
+     *  INTERN_SEGMENT_MIN << k entries.  Segments are never moved or
+     *  freed, so an entry can be read without a lock once \c len
+     *  covers it. */
+    intern_entry* volatile segments[INTERN_SEGMENTS];
+    volatile size_t len;
+    /*! \brief Every chunk of the arena, so they can be freed. */
+    struct {
+        char** ptr;
+        size_t len;
+        size_t cap;
+    } chunks;
+    /*! \brief The unused end of the current chunk. */
+    char* free;
+    size_t free_len;
+    int concurrent;
+    /*! \brief Taken for reading to search the index and for writing
+     *  to add a string. */
+    interner_rwlock lock;
+};
+
+#define INTERN_CHUNK_SIZE (64 * 1024)
+
+static interner* interner_new_(int concurrent) {
+    interner* self = rpmalloc(sizeof(interner));
+    if (self) {
+        memset(self, 0, sizeof(interner));
+        self->index = multimap_new(size_t_hash);
+        if (!self->index) {
+            rpfree(self);
+            return 0;
+        }
+        self->concurrent = concurrent;
+        if (concurrent) {
+#ifdef _WIN32
+            InitializeSRWLock(&self->lock);
+#else
+            if (pthread_rwlock_init(&self->lock, 0)) {
+                multimap_destroy(self->index);
+                rpfree(self);
+                return 0;
+            }
+#endif
+        }
+    }
+    return self;
+}
+
+interner*
+interner_new(void) {
+    return interner_new_(0);
+}
+
+interner*
+interner_new_concurrent(void) {
+    return interner_new_(1);
+}
+
+void
+interner_destroy(interner* self) {
+    size_t i;
+    for (i = 0; i != self->chunks.len; ++i) {
+        rpfree(self->chunks.ptr[i]);
+    }
+    rpfree(self->chunks.ptr);
+    for (i = 0; i != INTERN_SEGMENTS; ++i) {
+        rpfree(self->segments[i]);
+    }
+    multimap_destroy(self->index);
+#ifndef _WIN32
+    if (self->concurrent) {
+        pthread_rwlock_destroy(&self->lock);
+    }
+#endif
+    rpfree(self);
+}
+
+static void interner_read_lock(interner* self) {
+    if (self->concurrent) {
+#ifdef _WIN32
+        AcquireSRWLockShared(&self->lock);
+#else
+        pthread_rwlock_rdlock(&self->lock);
+#endif
+    }
+}
+
+static void interner_read_unlock(interner* self) {
+    if (self->concurrent) {
+#ifdef _WIN32
+        ReleaseSRWLockShared(&self->lock);
+#else
+        pthread_rwlock_unlock(&self->lock);
+#endif
+    }
+}
+
+static void interner_write_lock(interner* self) {
+    if (self->concurrent) {
+#ifdef _WIN32
+        AcquireSRWLockExclusive(&self->lock);
+#else
+        pthread_rwlock_wrlock(&self->lock);
+#endif
+    }
+}
+
+static void interner_write_unlock(interner* self) {
+    if (self->concurrent) {
+#ifdef _WIN32
+        ReleaseSRWLockExclusive(&self->lock);
+#else
+        pthread_rwlock_unlock(&self->lock);
+#endif
+    }
+}
+
+size_t
+interner_size(interner* self) {
+    return ATOMIC_LOAD_SIZE(&self->len);
+}
+
+/*! \brief Find the segment holding \c id and its index in it. */
+static size_t interner_segment(size_t id, size_t* index) {
+    size_t n = id / INTERN_SEGMENT_MIN + 1;
+    size_t segment;
+#if defined(__GNUC__)
+    segment = sizeof(unsigned long long) * 8 - 1 - __builtin_clzll(n);
+#else
+    for (segment = 0; n >>= 1; ++segment) {
+    }
+#endif
+    *index = id - INTERN_SEGMENT_MIN * (((size_t)1 << segment) - 1);
+    return segment;
+}
+
+static intern_entry* interner_entry(interner* self, size_t id) {
+    size_t index;
+    size_t segment = interner_segment(id, &index);
+    intern_entry* entries = ATOMIC_LOAD_PTR(&self->segments[segment]);
+    return &entries[index];
+}
+
+/*! \brief Allocate \c size bytes in the arena. */
+static char* interner_alloc(interner* self, size_t size) {
+    char* chunk;
+    if (size <= self->free_len) {
+        chunk = self->free;
+        self->free += size;
+        self->free_len -= size;
+        return chunk;
+    }
+
+    if (vec_reserve(&self->chunks, sizeof(char*), self->chunks.len + 1) ||
+        !(chunk = rpmalloc(size > INTERN_CHUNK_SIZE / 4 ? size : INTERN_CHUNK_SIZE))) {
+        return 0;
+    }
+    self->chunks.ptr[self->chunks.len++] = chunk;
+    if (size > INTERN_CHUNK_SIZE / 4) {
+        /* Give big strings their own chunk so we don't waste the
+         * rest of the current one. */
+        return chunk;
+    }
+    self->free = chunk + size;
+    self->free_len = INTERN_CHUNK_SIZE - size;
+    return chunk;
+}
+
+/*! \brief Find the ID of \c string.  Returns 1 if it isn't present. */
+static int interner_find_(interner* self, const char* string, size_t len,
+                          size_t hash, uint32_t* id) {
+    multimap_range range = multimap_equal_range(self->index, &hash,
+                                                sizeof(size_t),
+                                                sizeof(uint32_t));
+    size_t i;
+    for (i = 0; i != range.len; ++i) {
+        uint32_t candidate = ((uint32_t*)range.values)[i];
+        const intern_entry* entry = interner_entry(self, candidate);
+        if (entry->len == len && memcmp(entry->string, string, len) == 0) {
+            *id = candidate;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*! \brief Add \c string, which must not be present, and store its ID
+ *  in \c id.  The write lock must be held. */
+static int interner_add(interner* self, const char* string, size_t len,
+                        size_t hash, uint32_t* id) {
+    size_t new_id = self->len;
+    size_t index;
+    size_t segment;
+    intern_entry* entry;
+    char* copy;
+
+    if (new_id == UINT32_MAX) {
+        return -1;
+    }
+    segment = interner_segment(new_id, &index);
+    if (!self->segments[segment]) {
+        intern_entry* entries =
+            rpmalloc((INTERN_SEGMENT_MIN << segment) * sizeof(intern_entry));
+        if (!entries) {
+            return -1;
+        }
+        ATOMIC_STORE_PTR(&self->segments[segment], entries);
+    }
+    /* If this fails the bytes in the arena are wasted but everything
+     * is still consistent. */
+    *id = (uint32_t)new_id;
+    if (!(copy = interner_alloc(self, len + 1)) ||
+        multimap_insert(self->index, &hash, sizeof(size_t),
+                        id, sizeof(uint32_t))) {
+        return -1;
+    }
+    memcpy(copy, string, len);
+    copy[len] = '\0';
+    entry = &self->segments[segment][index];
+    entry->string = copy;
+    entry->len = len;
+    /* Publish the entry to interner_lookup(). */
+    ATOMIC_STORE_SIZE(&self->len, new_id + 1);
+    return 0;
+}
+
+int
+interner_intern(interner* self, const char* string, size_t len, uint32_t* id) {
+    size_t hash = mem_hash(string, len);
+    int ret;
+    /* Most strings have been seen before, so look for them while
+     * letting other threads do the same. */
+    interner_read_lock(self);
+    ret = interner_find_(self, string, len, hash, id);
+    interner_read_unlock(self);
+    if (!ret) {
+        return 0;
+    }
+
+    interner_write_lock(self);
+    /* Another thread may have added it since we looked. */
+    ret = interner_find_(self, string, len, hash, id);
+    if (ret) {
+        ret = interner_add(self, string, len, hash, id);
+    }
+    interner_write_unlock(self);
+    return ret;
+}
+
+int
+interner_intern_str(interner* self, const str* string, uint32_t* id) {
+    return interner_intern(self, str_cbegin(string), str_len_bytes(string), id);
+}
+
+int
+interner_find(interner* self, const char* string, size_t len, uint32_t* id) {
+    int ret;
+    interner_read_lock(self);
+    ret = interner_find_(self, string, len, mem_hash(string, len), id);
+    interner_read_unlock(self);
+    return ret;
+}
+
+const char*
+interner_lookup(interner* self, uint32_t id, size_t* len) {
+    const intern_entry* entry;
+    assert(id < ATOMIC_LOAD_SIZE(&self->len));
+    entry = interner_entry(self, id);
+    if (len) {
+        *len = entry->len;
+    }
+    return entry->string;
+}
+
+#ifdef TEST_MODE
+#include "test.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+TEST(test_interner_intern) {
+    interner* interner = interner_new();
+    str s = STR_INIT;
+    uint32_t a, b, c, d;
+    size_t len;
+    ASSERT(interner, cleanup);
+    ASSERT(!interner_intern(interner, "GET", 3, &a), cleanup);
+    ASSERT(!interner_intern(interner, "POST", 4, &b), cleanup);
+    ASSERT(!interner_intern(interner, "GET", 3, &c), cleanup);
+    ASSERT(a == 0, cleanup);
+    ASSERT(b == 1, cleanup);
+    ASSERT(a == c, cleanup);
+    ASSERT(interner_size(interner) == 2, cleanup);
+
+    ASSERT(!str_copy(&s, "POST"), cleanup);
+    ASSERT(!interner_intern_str(interner, &s, &d), cleanup);
+    ASSERT(b == d, cleanup);
+
+    ASSERT(strcmp(interner_lookup(interner, a, &len), "GET") == 0, cleanup);
+    ASSERT(len == 3, cleanup);
+    ASSERT(strcmp(interner_lookup(interner, b, 0), "POST") == 0, cleanup);
+
+    ASSERT(!interner_find(interner, "GET", 3, &d), cleanup);
+    ASSERT(d == a, cleanup);
+    ASSERT(interner_find(interner, "PUT", 3, &d) == 1, cleanup);
+    ASSERT(interner_size(interner) == 2, cleanup);
+cleanup:
+    str_destroy(&s);
+    interner_destroy(interner);
+}
+END_TEST
+
+TEST(test_interner_many) {
+    interner* interner = interner_new();
+    const char* first;
+    char buffer[32];
+    static char big[INTERN_CHUNK_SIZE];
+    uint32_t id;
+    uint32_t big_id;
+    size_t i;
+    ASSERT(interner, cleanup);
+    ASSERT(!interner_intern(interner, "string 0", 8, &id), cleanup);
+    first = interner_lookup(interner, id, 0);
+    memset(big, 'x', sizeof(big));
+    ASSERT(!interner_intern(interner, big, sizeof(big), &big_id), cleanup);
+    for (i = 0; i != 20000; ++i) {
+        int len = sprintf(buffer, "string %lu", (unsigned long)i);
+        ASSERT(!interner_intern(interner, buffer, len, &id), cleanup);
+        ASSERT(id == (i == 0 ? 0 : i + 1), cleanup);
+    }
+    ASSERT(interner_size(interner) == 20001, cleanup);
+    /* The arena never moves strings. */
+    ASSERT(interner_lookup(interner, 0, 0) == first, cleanup);
+    for (i = 0; i != 20000; ++i) {
+        int len = sprintf(buffer, "string %lu", (unsigned long)i);
+        ASSERT(!interner_find(interner, buffer, len, &id), cleanup);
+        ASSERT(strcmp(interner_lookup(interner, id, 0), buffer) == 0, cleanup);
+    }
+    ASSERT(memcmp(interner_lookup(interner, big_id, 0), big, sizeof(big)) == 0, cleanup);
+cleanup:
+    interner_destroy(interner);
+}
+END_TEST
+
+#ifndef _WIN32
+#include <pthread.h>
+
+static void* test_interner_worker(void* interner) {
+    char buffer[32];
+    int i;
+    rpmalloc_thread_initialize();
+    for (i = 0; i != 2000; ++i) {
+        uint32_t id;
+        int len = sprintf(buffer, "%d", i);
+        if (interner_intern(interner, buffer, len, &id) ||
+            strcmp(interner_lookup(interner, id, 0), buffer) != 0) {
+            abort();
+        }
+    }
+    rpmalloc_thread_finalize();
+    return 0;
+}
+
+TEST(test_interner_concurrent) {
+    interner* interner = interner_new_concurrent();
+    pthread_t threads[4];
+    int started = 0;
+    int i;
+    ASSERT(interner, cleanup);
+    for (; started != 4; ++started) {
+        ASSERT(!pthread_create(&threads[started], 0, test_interner_worker, interner), cleanup);
+    }
+    for (i = 0; i != started; ++i) {
+        pthread_join(threads[i], 0);
+    }
+    started = 0;
+    ASSERT(interner_size(interner) == 2000, cleanup);
+cleanup:
+    for (i = 0; i != started; ++i) {
+        pthread_join(threads[i], 0);
+    }
+    interner_destroy(interner);
+}
+END_TEST
+#endif
+
+void test_intern(void) {
+    RUN(test_interner_intern);
+    RUN(test_interner_many);
+#ifndef _WIN32
+    RUN(test_interner_concurrent);
+#endif
+}
+#endif
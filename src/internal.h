@@ -0,0 +1,64 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2017 Chris Gregory czipperz@gmail.com
+ */
+
+/* Helpers shared between the source files.  This header is not
+ * installed. */
+
+#ifndef CUTIL_INTERNAL_H
+#define CUTIL_INTERNAL_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*! \brief Abort if \c cond is false.  Unlike \c assert, this is
+ *  checked in Release builds too. */
+static void
+cutil_assert_(int cond, const char* condstr,
+              const char* file, int line) {
+    if (!cond) {
+        fprintf(stderr, "%s:%d: Assertion failed: %s\n", file, line, condstr);
+        abort();
+    }
+}
+#define cutil_assert(cond) (cutil_assert_(cond, #cond, __FILE__, __LINE__))
+
+/*! \brief A vec of bytes, for use with the functions in vec.h. */
+typedef struct bytevec bytevec;
+struct bytevec {
+    char* bytes;
+    size_t len;
+    size_t cap;
+};
+
+/*! \brief The number of buckets in a new or fully shrunk hash table. */
+#define CUTIL_MIN_BUCKETS 8
+
+/*! \brief The smallest number of buckets adequate for \c elems
+ *  elements: a power of two with at most one element per bucket. */
+static size_t
+cutil_fit_buckets(size_t elems) {
+    size_t len = CUTIL_MIN_BUCKETS;
+    while (len < elems) {
+        len *= 2;
+    }
+    return len;
+}
+
+/*! \brief Test if a table of \c len buckets should shrink after an
+ *  erase leaves \c elems elements.
+ *
+ * Growth happens at two elements per bucket and leaves one per
+ * bucket.  Shrinking at an eighth of an element per bucket back to
+ * one per bucket keeps the two far enough apart that we don't
+ * thrash. */
+static int
+cutil_should_shrink(size_t len, size_t elems) {
+    return len > CUTIL_MIN_BUCKETS && elems * 8 <= len;
+}
+
+#endif
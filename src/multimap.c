@@ -0,0 +1,499 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2017 Chris Gregory czipperz@gmail.com
+ */
+
+#include "../multimap.h"
+#include "../rpmalloc.h"
+#include "../vec.h"
+#include "internal.h"
+#include <assert.h>
+#include <string.h>
+
+/*! \brief Each bucket is a \c bytevec holding runs back to back.
+ *
+ * Each run is laid out as a \c run_header, then the key, then \c
+ * count values.  The key, the values and the run as a whole are
+ * padded to \c multimap_align() so that callers may read keys and
+ * values through pointers of their own types. */
+typedef struct run_header run_header;
+struct run_header {
+    size_t hash;
+    size_t count;
+};
+
+struct multimap {
+    size_t (*hash)(const void*);
+    size_t keys;
+    size_t values;
+    bytevec* mods;
+    size_t len;
+};
+
+/*! \brief The alignment rpmalloc guarantees for every block. */
+#define MULTIMAP_MAX_ALIGN 16
+
+#define MULTIMAP_ALIGN_UP(n, align) (((n) + (align) - 1) & ~((align) - 1))
+
+/*! \brief The alignment of runs for these key and value sizes.
+ *
+ * The alignment of a type divides its size, so the lowest set bit of
+ * each size is enough for both the key and value types. */
+static size_t multimap_align(size_t key_size, size_t value_size) {
+    size_t key_align = key_size & -key_size;
+    size_t value_align = value_size & -value_size;
+    size_t align = key_align > value_align ? key_align : value_align;
+    if (align == 0 || align > MULTIMAP_MAX_ALIGN) {
+        align = MULTIMAP_MAX_ALIGN;
+    }
+    return align;
+}
+
+#define KEY_OFFSET(key_size, value_size)                             \
+    MULTIMAP_ALIGN_UP(sizeof(run_header), multimap_align(key_size, value_size))
+
+#define VALUES_OFFSET(key_size, value_size)                          \
+    MULTIMAP_ALIGN_UP(KEY_OFFSET(key_size, value_size) + (key_size), \
+                      multimap_align(key_size, value_size))
+
+#define RUN_SIZE(count, key_size, value_size)                        \
+    (VALUES_OFFSET(key_size, value_size) +                           \
+     MULTIMAP_ALIGN_UP((count) * (value_size),                       \
+                       multimap_align(key_size, value_size)))
+
+/*! \brief Read the header of the run at \c run.  Runs are only
+ *  aligned for the key and value so we have to go through memcpy. */
+static run_header multimap_header(const char* run) {
+    run_header header;
+    memcpy(&header, run, sizeof(run_header));
+    return header;
+}
+
+multimap*
+multimap_new(size_t (*hash)(const void*)) {
+    multimap* multimap = rpmalloc(sizeof(struct multimap));
+    if (multimap) {
+        multimap->len = CUTIL_MIN_BUCKETS;
+        multimap->mods = rpcalloc(multimap->len, sizeof(bytevec));
+        if (!multimap->mods) {
+            rpfree(multimap);
+            return 0;
+        }
+        multimap->keys = 0;
+        multimap->values = 0;
+        multimap->hash = hash;
+    }
+    return multimap;
+}
+
+static void multimap_destroy_mods(bytevec* mods, size_t len) {
+    size_t i;
+    for (i = 0; i != len; ++i) {
+        rpfree(mods[i].bytes);
+    }
+    rpfree(mods);
+}
+
+void
+multimap_destroy(multimap* multimap) {
+    multimap_destroy_mods(multimap->mods, multimap->len);
+    rpfree(multimap);
+}
+
+size_t
+multimap_size(const multimap* multimap) {
+    return multimap->values;
+}
+
+size_t
+multimap_keys(const multimap* multimap) {
+    return multimap->keys;
+}
+
+/*! \brief Find the offset of the run for \c hash in bucket \c mod.
+ *
+ * Returns the length of the bucket if there is no such run. */
+static size_t multimap_find(const multimap* multimap, size_t hash,
+                            size_t mod, size_t key_size,
+                            size_t value_size) {
+    const bytevec* vec = &multimap->mods[mod];
+    size_t offset = 0;
+    while (offset != vec->len) {
+        run_header header = multimap_header(&vec->bytes[offset]);
+        if (header.hash == hash) {
+            break;
+        }
+        offset += RUN_SIZE(header.count, key_size, value_size);
+    }
+    return offset;
+}
+
+/*! \brief Make room for \c extra more bytes in \c vec.
+ *
+ * Like \c vec_push this doubles the capacity to keep appending
+ * amortized O(1). */
+static int multimap_reserve_bytes(bytevec* vec, size_t extra) {
+    size_t new_cap = vec->len + extra;
+    if (new_cap <= vec->cap) {
+        return 0;
+    }
+    if (new_cap < 64) {
+        new_cap = 64;
+    }
+    if (new_cap < vec->cap * 2) {
+        new_cap = vec->cap * 2;
+    }
+    return vec_reserve(vec, 1, new_cap);
+}
+
+static int multimap_resize(multimap* multimap, size_t key_size,
+                           size_t value_size, size_t new_len) {
+    bytevec* mods = rpcalloc(new_len, sizeof(bytevec));
+    size_t i;
+    if (!mods) {
+        return -1;
+    }
+
+    for (i = 0; i != multimap->len; ++i) {
+        const bytevec* old = &multimap->mods[i];
+        size_t offset = 0;
+        while (offset != old->len) {
+            run_header header = multimap_header(&old->bytes[offset]);
+            size_t size = RUN_SIZE(header.count, key_size, value_size);
+            bytevec* vec = &mods[header.hash % new_len];
+            if (multimap_reserve_bytes(vec, size)) {
+                multimap_destroy_mods(mods, new_len);
+                return -1;
+            }
+            memcpy(&vec->bytes[vec->len], &old->bytes[offset], size);
+            vec->len += size;
+            offset += size;
+        }
+    }
+
+    multimap_destroy_mods(multimap->mods, multimap->len);
+    multimap->mods = mods;
+    multimap->len = new_len;
+    return 0;
+}
+
+size_t
+multimap_count(const multimap* multimap, const void* key,
+               size_t key_size, size_t value_size) {
+    size_t hash = multimap->hash(key);
+    size_t mod = hash % multimap->len;
+    size_t offset = multimap_find(multimap, hash, mod, key_size, value_size);
+    if (offset == multimap->mods[mod].len) {
+        return 0;
+    }
+    return multimap_header(&multimap->mods[mod].bytes[offset]).count;
+}
+
+int
+multimap_insert(multimap* multimap, const void* key, size_t key_size,
+                const void* value, size_t value_size) {
+    return multimap_insert_n(multimap, key, key_size, value, 1, value_size);
+}
+
+int
+multimap_insert_n(multimap* multimap, const void* key, size_t key_size,
+                  const void* values, size_t count, size_t value_size) {
+    size_t hash = multimap->hash(key);
+    size_t mod = hash % multimap->len;
+    size_t offset = multimap_find(multimap, hash, mod, key_size, value_size);
+    bytevec* vec = &multimap->mods[mod];
+    run_header header;
+
+    if (offset == vec->len) {
+        /* New key: append a new run to the end of the bucket. */
+        if (multimap->keys >= multimap->len * 2) {
+            if (multimap_resize(multimap, key_size, value_size,
+                                multimap->len * 2)) {
+                return -1;
+            }
+            mod = hash % multimap->len;
+            vec = &multimap->mods[mod];
+        }
+        if (multimap_reserve_bytes(vec, RUN_SIZE(count, key_size, value_size))) {
+            return -1;
+        }
+        header.hash = hash;
+        header.count = count;
+        offset = vec->len;
+        memcpy(&vec->bytes[offset], &header, sizeof(run_header));
+        memcpy(&vec->bytes[offset + KEY_OFFSET(key_size, value_size)], key,
+               key_size);
+        memcpy(&vec->bytes[offset + VALUES_OFFSET(key_size, value_size)],
+               values, count * value_size);
+        vec->len += RUN_SIZE(count, key_size, value_size);
+        ++multimap->keys;
+    } else {
+        /* Existing key: make space at the end of its run. */
+        size_t end, grow;
+        header = multimap_header(&vec->bytes[offset]);
+        end = offset + RUN_SIZE(header.count, key_size, value_size);
+        grow = RUN_SIZE(header.count + count, key_size, value_size) -
+               RUN_SIZE(header.count, key_size, value_size);
+        if (multimap_reserve_bytes(vec, grow)) {
+            return -1;
+        }
+        memmove(&vec->bytes[end + grow], &vec->bytes[end], vec->len - end);
+        memcpy(&vec->bytes[offset + VALUES_OFFSET(key_size, value_size) +
+                           header.count * value_size],
+               values, count * value_size);
+        vec->len += grow;
+        header.count += count;
+        memcpy(&vec->bytes[offset], &header, sizeof(run_header));
+    }
+    multimap->values += count;
+    return 0;
+}
+
+size_t
+multimap_erase(multimap* multimap, const void* key,
+               size_t key_size, size_t value_size) {
+    size_t hash = multimap->hash(key);
+    size_t mod = hash % multimap->len;
+    size_t offset = multimap_find(multimap, hash, mod, key_size, value_size);
+    bytevec* vec = &multimap->mods[mod];
+    run_header header;
+    size_t size;
+    if (offset == vec->len) {
+        return 0;
+    }
+    header = multimap_header(&vec->bytes[offset]);
+    size = RUN_SIZE(header.count, key_size, value_size);
+    memmove(&vec->bytes[offset], &vec->bytes[offset + size],
+            vec->len - offset - size);
+    vec->len -= size;
+    --multimap->keys;
+    multimap->values -= header.count;
+    /* A failed shrink leaves the multimap as is, which is fine. */
+    if (cutil_should_shrink(multimap->len, multimap->keys)) {
+        multimap_resize(multimap, key_size, value_size,
+                        cutil_fit_buckets(multimap->keys));
+    }
+    return header.count;
+}
+
+void
+multimap_clear(multimap* multimap) {
+    size_t i;
+    for (i = 0; i != multimap->len; ++i) {
+        multimap->mods[i].len = 0;
+    }
+    multimap->keys = 0;
+    multimap->values = 0;
+}
+
+multimap_range
+multimap_equal_range(multimap* multimap, const void* key,
+                     size_t key_size, size_t value_size) {
+    size_t hash = multimap->hash(key);
+    size_t mod = hash % multimap->len;
+    size_t offset = multimap_find(multimap, hash, mod, key_size, value_size);
+    bytevec* vec = &multimap->mods[mod];
+    multimap_range range;
+    if (offset == vec->len) {
+        range.values = 0;
+        range.len = 0;
+    } else {
+        range.values = &vec->bytes[offset + VALUES_OFFSET(key_size, value_size)];
+        range.len = multimap_header(&vec->bytes[offset]).count;
+    }
+    return range;
+}
+
+void
+multimap_iterate(multimap* multimap, size_t key_size, size_t value_size,
+                 void (*fun)(void*, void*, size_t, void*), void* userdata) {
+    size_t mod;
+    for (mod = 0; mod != multimap->len; ++mod) {
+        bytevec* vec = &multimap->mods[mod];
+        size_t offset = 0;
+        while (offset != vec->len) {
+            char* run = &vec->bytes[offset];
+            run_header header = multimap_header(run);
+            fun(run + KEY_OFFSET(key_size, value_size),
+                run + VALUES_OFFSET(key_size, value_size),
+                header.count, userdata);
+            offset += RUN_SIZE(header.count, key_size, value_size);
+        }
+    }
+}
+
+#ifdef TEST_MODE
+#include "test.h"
+#include "../hashmap.h"
+
+static size_t multimap_value_at(multimap_range range, size_t i) {
+    size_t value;
+    memcpy(&value, (char*)range.values + i * sizeof(size_t), sizeof(size_t));
+    return value;
+}
+
+TEST(test_multimap_insert) {
+    multimap* multimap = multimap_new(size_t_hash);
+    multimap_range range;
+    size_t key;
+    size_t value;
+    ASSERT(multimap, cleanup);
+    key = 3;
+    value = 10;
+    ASSERT(!multimap_insert(multimap, &key, sizeof(size_t), &value, sizeof(size_t)), cleanup);
+    key = 4;
+    value = 40;
+    ASSERT(!multimap_insert(multimap, &key, sizeof(size_t), &value, sizeof(size_t)), cleanup);
+    key = 3;
+    value = 11;
+    ASSERT(!multimap_insert(multimap, &key, sizeof(size_t), &value, sizeof(size_t)), cleanup);
+    ASSERT(multimap_size(multimap) == 3, cleanup);
+    ASSERT(multimap_keys(multimap) == 2, cleanup);
+    ASSERT(multimap_count(multimap, &key, sizeof(size_t), sizeof(size_t)) == 2, cleanup);
+
+    range = multimap_equal_range(multimap, &key, sizeof(size_t), sizeof(size_t));
+    ASSERT(range.len == 2, cleanup);
+    ASSERT(multimap_value_at(range, 0) == 10, cleanup);
+    ASSERT(multimap_value_at(range, 1) == 11, cleanup);
+
+    key = 4;
+    range = multimap_equal_range(multimap, &key, sizeof(size_t), sizeof(size_t));
+    ASSERT(range.len == 1, cleanup);
+    ASSERT(multimap_value_at(range, 0) == 40, cleanup);
+
+    key = 5;
+    range = multimap_equal_range(multimap, &key, sizeof(size_t), sizeof(size_t));
+    ASSERT(range.len == 0, cleanup);
+    ASSERT(!range.values, cleanup);
+    ASSERT(multimap_count(multimap, &key, sizeof(size_t), sizeof(size_t)) == 0, cleanup);
+cleanup:
+    multimap_destroy(multimap);
+}
+END_TEST
+
+TEST(test_multimap_insert_n) {
+    multimap* multimap = multimap_new(size_t_hash);
+    multimap_range range;
+    size_t key = 7;
+    size_t values[4] = {1, 2, 3, 4};
+    ASSERT(multimap, cleanup);
+    ASSERT(!multimap_insert_n(multimap, &key, sizeof(size_t), values, 2, sizeof(size_t)), cleanup);
+    ASSERT(!multimap_insert_n(multimap, &key, sizeof(size_t), values + 2, 2, sizeof(size_t)), cleanup);
+    range = multimap_equal_range(multimap, &key, sizeof(size_t), sizeof(size_t));
+    ASSERT(range.len == 4, cleanup);
+    ASSERT(memcmp(range.values, values, sizeof(values)) == 0, cleanup);
+cleanup:
+    multimap_destroy(multimap);
+}
+END_TEST
+
+TEST(test_multimap_mass_addition) {
+    multimap* multimap = multimap_new(size_t_hash);
+    size_t key;
+    ASSERT(multimap, cleanup);
+    for (key = 0; key != 300; ++key) {
+        size_t value = key * 2;
+        ASSERT(!multimap_insert(multimap, &key, sizeof(size_t), &value, sizeof(size_t)), cleanup);
+    }
+    for (key = 0; key != 300; ++key) {
+        size_t value = key * 2 + 1;
+        ASSERT(!multimap_insert(multimap, &key, sizeof(size_t), &value, sizeof(size_t)), cleanup);
+    }
+    ASSERT(multimap_size(multimap) == 600, cleanup);
+    ASSERT(multimap_keys(multimap) == 300, cleanup);
+    for (key = 0; key != 300; ++key) {
+        multimap_range range = multimap_equal_range(multimap, &key, sizeof(size_t), sizeof(size_t));
+        ASSERT(range.len == 2, cleanup);
+        ASSERT(multimap_value_at(range, 0) == key * 2, cleanup);
+        ASSERT(multimap_value_at(range, 1) == key * 2 + 1, cleanup);
+    }
+    for (key = 0; key != 290; ++key) {
+        ASSERT(multimap_erase(multimap, &key, sizeof(size_t), sizeof(size_t)) == 2, cleanup);
+    }
+    ASSERT(multimap_erase(multimap, &key, sizeof(size_t), sizeof(size_t)) == 2, cleanup);
+    ASSERT(multimap_erase(multimap, &key, sizeof(size_t), sizeof(size_t)) == 0, cleanup);
+    ASSERT(multimap_size(multimap) == 18, cleanup);
+    ASSERT(multimap->len < 128, cleanup);
+    for (++key; key != 300; ++key) {
+        multimap_range range = multimap_equal_range(multimap, &key, sizeof(size_t), sizeof(size_t));
+        ASSERT(range.len == 2, cleanup);
+        ASSERT(multimap_value_at(range, 1) == key * 2 + 1, cleanup);
+    }
+cleanup:
+    multimap_destroy(multimap);
+}
+END_TEST
+
+static void test_multimap_sum(void* key, void* values, size_t len, void* userdata) {
+    size_t i;
+    for (i = 0; i != len; ++i) {
+        size_t value;
+        memcpy(&value, (char*)values + i * sizeof(size_t), sizeof(size_t));
+        *(size_t*)userdata += value;
+    }
+    (void)key;
+}
+
+TEST(test_multimap_iterate) {
+    multimap* multimap = multimap_new(size_t_hash);
+    size_t values[3] = {1, 2, 3};
+    size_t key;
+    size_t sum = 0;
+    ASSERT(multimap, cleanup);
+    for (key = 0; key != 20; ++key) {
+        ASSERT(!multimap_insert_n(multimap, &key, sizeof(size_t), values, 3, sizeof(size_t)), cleanup);
+    }
+    multimap_iterate(multimap, sizeof(size_t), sizeof(size_t), test_multimap_sum, &sum);
+    ASSERT(sum == 20 * 6, cleanup);
+    multimap_clear(multimap);
+    ASSERT(multimap_size(multimap) == 0, cleanup);
+    sum = 0;
+    multimap_iterate(multimap, sizeof(size_t), sizeof(size_t), test_multimap_sum, &sum);
+    ASSERT(sum == 0, cleanup);
+cleanup:
+    multimap_destroy(multimap);
+}
+END_TEST
+
+static size_t test_multimap_hash_3(const void* key) {
+    return mem_hash(key, 3);
+}
+
+TEST(test_multimap_alignment) {
+    multimap* multimap = multimap_new(test_multimap_hash_3);
+    multimap_range range;
+    double values[5] = {0.5, 1.5, 2.5, 3.5, 4.5};
+    char key[3] = {'a', 'b', 'c'};
+    size_t i;
+    ASSERT(multimap, cleanup);
+    for (i = 0; i != 10; ++i) {
+        key[0] = (char)('a' + i);
+        ASSERT(!multimap_insert_n(multimap, key, 3, values, 3, sizeof(double)), cleanup);
+    }
+    for (i = 0; i != 10; ++i) {
+        key[0] = (char)('a' + i);
+        ASSERT(!multimap_insert_n(multimap, key, 3, values + 3, 2, sizeof(double)), cleanup);
+    }
+    for (i = 0; i != 10; ++i) {
+        key[0] = (char)('a' + i);
+        range = multimap_equal_range(multimap, key, 3, sizeof(double));
+        ASSERT(range.len == 5, cleanup);
+        ASSERT((size_t)range.values % sizeof(double) == 0, cleanup);
+        ASSERT(((double*)range.values)[0] == 0.5, cleanup);
+        ASSERT(((double*)range.values)[4] == 4.5, cleanup);
+    }
+cleanup:
+    multimap_destroy(multimap);
+}
+END_TEST
+
+void test_multimap(void) {
+    RUN(test_multimap_insert);
+    RUN(test_multimap_insert_n);
+    RUN(test_multimap_mass_addition);
+    RUN(test_multimap_iterate);
+    RUN(test_multimap_alignment);
+}
+#endif
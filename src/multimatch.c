@@ -0,0 +1,550 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2017 Chris Gregory czipperz@gmail.com
+ */
+
+#include "../multimatch.h"
+#include "../cpu.h"
+#include "../rpmalloc.h"
+#include <assert.h>
+#include <string.h>
+
+#ifdef CPU_X86
+#include <immintrin.h>
+#endif
+
+#define MULTIMATCH_NONE ((uint32_t)-1)
+#define MULTIMATCH_FLAG ((uint32_t)1 << 31)
+
+/*! \brief The most patterns the prefilter is used for.
+ *
+ * With more, the eight buckets fill up and nearly every position is
+ * a candidate, so the prefilter only adds overhead. */
+#define MULTIMATCH_TEDDY_MAX 64
+
+static void
+multimatch_free(multimatch* self) {
+    rpfree(self->_transitions);
+    rpfree(self->_state_patterns);
+    rpfree(self->_output_links);
+    rpfree(self->_pattern_next);
+    rpfree(self->_pattern_lens);
+}
+
+void
+multimatch_destroy(multimatch* self) {
+    multimatch_free(self);
+    memset(self, 0, sizeof(*self));
+}
+
+int
+multimatch_build(multimatch* self, const char* const* patterns,
+                 const size_t* lens, size_t num_patterns) {
+    multimatch built;
+    uint32_t* fail = 0;
+    uint32_t* queue = 0;
+    uint32_t* transitions;
+    unsigned char used[256];
+    size_t total = 1;
+    size_t nc;
+    size_t head, tail, i, j, c;
+    uint32_t* resized;
+
+    memset(&built, 0, sizeof(built));
+    memset(used, 0, sizeof(used));
+
+    for (i = 0; i != num_patterns; ++i) {
+        assert(lens[i] != 0);
+        total += lens[i];
+        for (j = 0; j != lens[i]; ++j) {
+            used[(unsigned char)patterns[i][j]] = 1;
+        }
+    }
+    /* Each byte in a pattern gets its own class, and every other byte
+     * shares the last class. */
+    nc = 0;
+    for (c = 0; c != 256; ++c) {
+        if (used[c]) {
+            built._classes[c] = (unsigned char)nc++;
+        }
+    }
+    if (nc != 256) {
+        for (c = 0; c != 256; ++c) {
+            if (!used[c]) {
+                built._classes[c] = (unsigned char)nc;
+            }
+        }
+        ++nc;
+    }
+    if (num_patterns >= MULTIMATCH_NONE ||
+        total > (MULTIMATCH_FLAG - 1) / nc) {
+        return -1;
+    }
+    built._num_patterns = num_patterns;
+    built._num_classes = nc;
+
+    built._transitions = rpmalloc(total * nc * sizeof(uint32_t));
+    built._state_patterns = rpmalloc(total * sizeof(uint32_t));
+    built._output_links = rpmalloc(total * sizeof(uint32_t));
+    built._pattern_next = rpmalloc((num_patterns + 1) * sizeof(uint32_t));
+    built._pattern_lens = rpmalloc((num_patterns + 1) * sizeof(size_t));
+    fail = rpmalloc(total * sizeof(uint32_t));
+    queue = rpmalloc(total * sizeof(uint32_t));
+    if (!built._transitions || !built._state_patterns ||
+        !built._output_links || !built._pattern_next ||
+        !built._pattern_lens || !fail || !queue) {
+        goto error;
+    }
+    transitions = built._transitions;
+    memset(transitions, 0, total * nc * sizeof(uint32_t));
+    for (i = 0; i != total; ++i) {
+        built._state_patterns[i] = MULTIMATCH_NONE;
+    }
+
+    /* Build the trie.  State 0 is the root and can't be a child, so
+     * 0 means no child until the failure transitions are filled in.
+     * Patterns are inserted last first so the patterns ending at each
+     * state are listed by increasing index. */
+    built._num_states = 1;
+    for (i = num_patterns; i--;) {
+        uint32_t state = 0;
+        for (j = 0; j != lens[i]; ++j) {
+            uint32_t* next = &transitions[state * nc +
+                                          built._classes[(unsigned char)
+                                                             patterns[i][j]]];
+            if (!*next) {
+                *next = (uint32_t)built._num_states++;
+            }
+            state = *next;
+        }
+        built._pattern_next[i] = built._state_patterns[state];
+        built._state_patterns[state] = (uint32_t)i;
+        built._pattern_lens[i] = lens[i];
+    }
+
+    /* Breadth first, so the failure state of every state is complete
+     * before the state itself.  Missing transitions are copied from
+     * the failure state, turning the trie into a DFA. */
+    head = tail = 0;
+    built._output_links[0] = MULTIMATCH_NONE;
+    for (c = 0; c != nc; ++c) {
+        if (transitions[c]) {
+            fail[transitions[c]] = 0;
+            queue[tail++] = transitions[c];
+        }
+    }
+    while (head != tail) {
+        uint32_t u = queue[head++];
+        uint32_t f = fail[u];
+        built._output_links[u] = built._state_patterns[f] != MULTIMATCH_NONE
+                                     ? f
+                                     : built._output_links[f];
+        for (c = 0; c != nc; ++c) {
+            uint32_t v = transitions[u * nc + c];
+            if (v) {
+                fail[v] = transitions[f * nc + c];
+                queue[tail++] = v;
+            } else {
+                transitions[u * nc + c] = transitions[f * nc + c];
+            }
+        }
+    }
+
+    for (i = 0; i != num_patterns; ++i) {
+        unsigned char b = (unsigned char)patterns[i][0];
+        built._first_bytes[b >> 3] |= 1 << (b & 7);
+    }
+    if (num_patterns && num_patterns <= MULTIMATCH_TEDDY_MAX) {
+        built._prefilter = 2;
+        for (i = 0; i != num_patterns; ++i) {
+            unsigned char b = (unsigned char)patterns[i][0];
+            /* Patterns sharing a first byte share a bucket. */
+            unsigned char bucket = (unsigned char)(1 << (b & 7));
+            built._teddy[0][b & 15] |= bucket;
+            built._teddy[1][b >> 4] |= bucket;
+            if (lens[i] == 1) {
+                built._prefilter = 1;
+            } else {
+                b = (unsigned char)patterns[i][1];
+                built._teddy[2][b & 15] |= bucket;
+                built._teddy[3][b >> 4] |= bucket;
+            }
+        }
+    }
+
+    /* Store row offsets so the search loop doesn't multiply, and
+     * flag states with matches so it only tests one bit.  With a
+     * prefilter, returning to the root is flagged too, since that is
+     * when text can be skipped. */
+    for (i = 0; i != built._num_states * nc; ++i) {
+        uint32_t state = transitions[i];
+        uint32_t entry = (uint32_t)(state * nc);
+        if (built._state_patterns[state] != MULTIMATCH_NONE ||
+            built._output_links[state] != MULTIMATCH_NONE ||
+            (state == 0 && built._prefilter)) {
+            entry |= MULTIMATCH_FLAG;
+        }
+        transitions[i] = entry;
+    }
+    resized = rprealloc(transitions, built._num_states * nc * sizeof(uint32_t));
+    if (resized) {
+        built._transitions = resized;
+    }
+
+    rpfree(fail);
+    rpfree(queue);
+    multimatch_free(self);
+    *self = built;
+    return 0;
+
+error:
+    multimatch_free(&built);
+    rpfree(fail);
+    rpfree(queue);
+    return -1;
+}
+
+#ifdef CPU_X86
+/*! \brief Find the first position at or after \c pos where a pattern
+ *  could start.
+ *
+ * Each byte is looked up by nibble in the bucket masks and a
+ * position is a candidate if some bucket has its first byte, and
+ * second byte when \c _prefilter is 2. */
+__attribute__((target("ssse3"))) static size_t
+multimatch_teddy_ssse3(const multimatch* self, const unsigned char* text,
+                       size_t pos, size_t len) {
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i low0 = _mm_loadu_si128((const __m128i*)self->_teddy[0]);
+    const __m128i high0 = _mm_loadu_si128((const __m128i*)self->_teddy[1]);
+    const __m128i low1 = _mm_loadu_si128((const __m128i*)self->_teddy[2]);
+    const __m128i high1 = _mm_loadu_si128((const __m128i*)self->_teddy[3]);
+    const size_t reach = self->_prefilter == 2 ? 17 : 16;
+    while (len - pos >= reach) {
+        __m128i block = _mm_loadu_si128((const __m128i*)(text + pos));
+        __m128i buckets = _mm_and_si128(
+            _mm_shuffle_epi8(low0, _mm_and_si128(block, nibble)),
+            _mm_shuffle_epi8(high0,
+                             _mm_and_si128(_mm_srli_epi16(block, 4), nibble)));
+        unsigned mask;
+        if (reach == 17) {
+            block = _mm_loadu_si128((const __m128i*)(text + pos + 1));
+            buckets = _mm_and_si128(
+                buckets,
+                _mm_and_si128(
+                    _mm_shuffle_epi8(low1, _mm_and_si128(block, nibble)),
+                    _mm_shuffle_epi8(
+                        high1, _mm_and_si128(_mm_srli_epi16(block, 4), nibble))));
+        }
+        mask = ~(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(buckets, zero)) &
+               0xFFFF;
+        if (mask) {
+            return pos + __builtin_ctz(mask);
+        }
+        pos += 16;
+    }
+    return pos;
+}
+#endif
+
+static size_t
+multimatch_prefilter(const multimatch* self, const unsigned char* text,
+                     size_t pos, size_t len) {
+    if (!self->_prefilter) {
+        return pos;
+    }
+#ifdef CPU_X86
+    if (cpu_features() & CPU_SSSE3) {
+        size_t found = multimatch_teddy_ssse3(self, text, pos, len);
+        if (len - found >= 16) {
+            return found;
+        }
+        pos = found;
+    }
+#endif
+    for (; pos != len; ++pos) {
+        if (self->_first_bytes[text[pos] >> 3] & (1 << (text[pos] & 7))) {
+            break;
+        }
+    }
+    return pos;
+}
+
+multimatch_iterator
+multimatch_iterator_new(const multimatch* self, const char* text, size_t len) {
+    multimatch_iterator iterator;
+    iterator._automaton = self;
+    iterator._text = (const unsigned char*)text;
+    iterator._len = len;
+    iterator._pos = 0;
+    iterator._state = 0;
+    iterator._pattern = MULTIMATCH_NONE;
+    iterator._output_state = 0;
+    return iterator;
+}
+
+multimatch_iterator
+multimatch_iterator_from_str(const multimatch* self, const str* string) {
+    return multimatch_iterator_new(self, str_cbegin(string),
+                                   str_len_bytes(string));
+}
+
+int
+multimatch_iterator_next(multimatch_iterator* iterator,
+                         multimatch_match* match) {
+    const multimatch* self = iterator->_automaton;
+    size_t pos = iterator->_pos;
+    uint32_t pattern = iterator->_pattern;
+    uint32_t output = iterator->_output_state;
+
+    if (pattern == MULTIMATCH_NONE) {
+        const uint32_t* transitions = self->_transitions;
+        const unsigned char* classes = self->_classes;
+        const unsigned char* text = iterator->_text;
+        const size_t len = iterator->_len;
+        uint32_t state = iterator->_state;
+        for (;;) {
+            if (pos == len) {
+                iterator->_pos = pos;
+                iterator->_state = state;
+                return 0;
+            }
+            state = transitions[state + classes[text[pos++]]];
+            if (state & MULTIMATCH_FLAG) {
+                state &= ~MULTIMATCH_FLAG;
+                if (state) {
+                    break;
+                }
+                /* Back at the root no match is in progress, so bytes
+                 * that can't start a pattern would just loop back to
+                 * it. */
+                pos = multimatch_prefilter(self, text, pos, len);
+            }
+        }
+        iterator->_state = state;
+        output = (uint32_t)(state / self->_num_classes);
+        pattern = self->_state_patterns[output];
+        if (pattern == MULTIMATCH_NONE) {
+            output = self->_output_links[output];
+            pattern = self->_state_patterns[output];
+        }
+    }
+
+    match->pattern = pattern;
+    match->end = pos;
+    match->begin = pos - self->_pattern_lens[pattern];
+
+    /* Queue the next pattern ending here: first the others ending at
+     * the same state, then down the failure chain. */
+    pattern = self->_pattern_next[pattern];
+    if (pattern == MULTIMATCH_NONE) {
+        output = self->_output_links[output];
+        if (output != MULTIMATCH_NONE) {
+            pattern = self->_state_patterns[output];
+        }
+    }
+    iterator->_pos = pos;
+    iterator->_pattern = pattern;
+    iterator->_output_state = output;
+    return 1;
+}
+
+size_t
+multimatch_count(const multimatch* self, const char* text, size_t len) {
+    multimatch_iterator iterator = multimatch_iterator_new(self, text, len);
+    multimatch_match match;
+    size_t count = 0;
+    while (multimatch_iterator_next(&iterator, &match)) {
+        ++count;
+    }
+    return count;
+}
+
+#ifdef TEST_MODE
+#include "test.h"
+#include <stdlib.h>
+
+static unsigned long multimatch_test_seed = 1;
+
+static unsigned
+multimatch_test_rand(void) {
+    multimatch_test_seed = multimatch_test_seed * 1103515245 + 12345;
+    return (unsigned)(multimatch_test_seed / 65536) % 32768;
+}
+
+static int
+multimatch_test_compare(const void* a, const void* b) {
+    const multimatch_match* x = a;
+    const multimatch_match* y = b;
+    if (x->end != y->end) {
+        return x->end < y->end ? -1 : 1;
+    }
+    return (x->pattern > y->pattern) - (x->pattern < y->pattern);
+}
+
+/*! \brief Compare every match against a brute force search. */
+static int
+multimatch_test_check(const multimatch* self, const char* const* patterns,
+                      const size_t* lens, size_t num_patterns,
+                      const char* text, size_t len) {
+    /* Callers keep num_patterns * len below this. */
+    static multimatch_match expected[200000];
+    static multimatch_match actual[200000];
+    size_t num_expected = 0;
+    size_t num_actual = 0;
+    size_t end, i;
+    multimatch_iterator iterator = multimatch_iterator_new(self, text, len);
+    multimatch_match match;
+    for (end = 1; end <= len; ++end) {
+        for (i = 0; i != num_patterns; ++i) {
+            if (lens[i] <= end &&
+                memcmp(text + end - lens[i], patterns[i], lens[i]) == 0) {
+                if (num_expected == 200000) {
+                    return 0;
+                }
+                expected[num_expected].pattern = i;
+                expected[num_expected].begin = end - lens[i];
+                expected[num_expected].end = end;
+                ++num_expected;
+            }
+        }
+    }
+    while (multimatch_iterator_next(&iterator, &match)) {
+        if (num_actual == 200000 || match.end - match.begin != lens[match.pattern]) {
+            return 0;
+        }
+        /* By end, then longest first. */
+        if (num_actual && (match.end < actual[num_actual - 1].end ||
+                           (match.end == actual[num_actual - 1].end &&
+                            lens[match.pattern] >
+                                lens[actual[num_actual - 1].pattern]))) {
+            return 0;
+        }
+        actual[num_actual++] = match;
+    }
+    if (num_actual != num_expected) {
+        return 0;
+    }
+    qsort(actual, num_actual, sizeof(*actual), multimatch_test_compare);
+    for (i = 0; i != num_actual; ++i) {
+        if (actual[i].pattern != expected[i].pattern ||
+            actual[i].begin != expected[i].begin ||
+            actual[i].end != expected[i].end) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+TEST(test_multimatch_basic) {
+    static const char* const patterns[] = {"he", "she", "his", "hers", "she"};
+    static const size_t lens[] = {2, 3, 3, 4, 3};
+    multimatch automaton = MULTIMATCH_INIT;
+    multimatch_iterator iterator;
+    multimatch_match match;
+    str s = STR_INIT;
+    ASSERT(!multimatch_build(&automaton, patterns, lens, 5), cleanup);
+    ASSERT(!str_copy(&s, "ushers"), cleanup);
+    iterator = multimatch_iterator_from_str(&automaton, &s);
+    ASSERT(multimatch_iterator_next(&iterator, &match), cleanup);
+    ASSERT(match.pattern == 1 && match.begin == 1 && match.end == 4, cleanup);
+    ASSERT(multimatch_iterator_next(&iterator, &match), cleanup);
+    ASSERT(match.pattern == 4 && match.begin == 1 && match.end == 4, cleanup);
+    ASSERT(multimatch_iterator_next(&iterator, &match), cleanup);
+    ASSERT(match.pattern == 0 && match.begin == 2 && match.end == 4, cleanup);
+    ASSERT(multimatch_iterator_next(&iterator, &match), cleanup);
+    ASSERT(match.pattern == 3 && match.begin == 2 && match.end == 6, cleanup);
+    ASSERT(!multimatch_iterator_next(&iterator, &match), cleanup);
+    ASSERT(!multimatch_iterator_next(&iterator, &match), cleanup);
+    ASSERT(multimatch_count(&automaton, "", 0) == 0, cleanup);
+    ASSERT(multimatch_count(&automaton, "xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxhis", 35) == 1,
+           cleanup);
+    ASSERT(multimatch_test_check(&automaton, patterns, lens, 5, "ushers", 6),
+           cleanup);
+cleanup:
+    multimatch_destroy(&automaton);
+    multimatch_destroy(&automaton);
+    str_destroy(&s);
+}
+END_TEST
+
+TEST(test_multimatch_random) {
+    static char storage[2000][8];
+    static const char* patterns[2000];
+    static size_t lens[2000];
+    char text[300];
+    multimatch automaton = MULTIMATCH_INIT;
+    size_t round, i, j, num_patterns, len;
+    for (round = 0; round != 400; ++round) {
+        unsigned alphabet = 2 + multimatch_test_rand() % 4;
+        num_patterns = 1 + multimatch_test_rand() % (round % 8 == 0 ? 2000 : 40);
+        len = multimatch_test_rand() % sizeof(text);
+        for (i = 0; i != num_patterns; ++i) {
+            lens[i] = 1 + multimatch_test_rand() % (round % 3 ? 7 : 3);
+            if (round % 2 && lens[i] == 1) {
+                lens[i] = 2;
+            }
+            for (j = 0; j != lens[i]; ++j) {
+                storage[i][j] = (char)('a' + multimatch_test_rand() % alphabet);
+            }
+            patterns[i] = storage[i];
+        }
+        for (i = 0; i != len; ++i) {
+            /* Sprinkle in bytes no pattern uses, so the prefilter has
+             * something to skip. */
+            text[i] = (char)(multimatch_test_rand() % 4 ? 'x'
+                                                        : 'a' + multimatch_test_rand() % alphabet);
+        }
+        ASSERT(!multimatch_build(&automaton, patterns, lens, num_patterns), cleanup);
+        ASSERT(automaton._prefilter == 0 || num_patterns <= MULTIMATCH_TEDDY_MAX,
+               cleanup);
+        if (num_patterns * len < 200000) {
+            ASSERT(multimatch_test_check(&automaton, patterns, lens, num_patterns,
+                                         text, len),
+                   cleanup);
+            automaton._prefilter = 0;
+            ASSERT(multimatch_test_check(&automaton, patterns, lens, num_patterns,
+                                         text, len),
+                   cleanup);
+        }
+    }
+cleanup:
+    multimatch_destroy(&automaton);
+}
+END_TEST
+
+TEST(test_multimatch_all_bytes) {
+    /* Every byte value used, so there is no spare class. */
+    static char storage[256][2];
+    static const char* patterns[256];
+    static size_t lens[256];
+    char text[512];
+    multimatch automaton = MULTIMATCH_INIT;
+    size_t i;
+    for (i = 0; i != 256; ++i) {
+        storage[i][0] = (char)i;
+        storage[i][1] = (char)(255 - i);
+        patterns[i] = storage[i];
+        lens[i] = 2;
+    }
+    for (i = 0; i != sizeof(text); ++i) {
+        text[i] = (char)(i * 7);
+    }
+    ASSERT(!multimatch_build(&automaton, patterns, lens, 256), cleanup);
+    ASSERT(automaton._num_classes == 256, cleanup);
+    ASSERT(multimatch_test_check(&automaton, patterns, lens, 256, text, sizeof(text)),
+           cleanup);
+cleanup:
+    multimatch_destroy(&automaton);
+}
+END_TEST
+
+void test_multimatch(void) {
+    RUN(test_multimatch_basic);
+    RUN(test_multimatch_random);
+    RUN(test_multimatch_all_bytes);
+}
+#endif
@@ -0,0 +1,381 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2017 Chris Gregory czipperz@gmail.com
+ */
+
+#include "../reader.h"
+#include "../rpmalloc.h"
+#include "../utf8.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <io.h>
+typedef int reader_ssize;
+#define reader_read(fd, buf, len)                                    \
+    _read((fd), (buf), (unsigned)((len) > INT_MAX ? INT_MAX : (len)))
+#define reader_open(path) _open((path), _O_RDONLY | _O_BINARY)
+#define reader_close _close
+#else
+#include <unistd.h>
+typedef ssize_t reader_ssize;
+#define reader_read read
+#define reader_open(path) open((path), O_RDONLY)
+#define reader_close close
+#endif
+
+int
+reader_init(reader* self, int fd) {
+    self->_buffer = rpmalloc(READER_CHUNK);
+    if (!self->_buffer) {
+        return -1;
+    }
+    self->_fd = fd;
+    self->_cap = READER_CHUNK;
+    self->_begin = 0;
+    self->_end = 0;
+    self->_eof = 0;
+    return 0;
+}
+
+void
+reader_destroy(reader* self) {
+    rpfree(self->_buffer);
+    self->_buffer = 0;
+    self->_cap = 0;
+    self->_begin = 0;
+    self->_end = 0;
+}
+
+/*! \brief Read more data after the data not yet returned.
+ *
+ * \return The number of bytes read, 0 at the end of the input or -1
+ * on error. */
+static reader_ssize
+reader_fill(reader* self) {
+    size_t want;
+    reader_ssize n;
+    if (self->_begin) {
+        /* Move the partial line to the front. */
+        memmove(self->_buffer, self->_buffer + self->_begin,
+                self->_end - self->_begin);
+        self->_end -= self->_begin;
+        self->_begin = 0;
+    }
+    if (self->_cap - self->_end < READER_CHUNK / 2) {
+        /* The line nearly fills the buffer.  Grow it now rather than
+         * reading the little space left. */
+        char* buffer = rprealloc(self->_buffer, self->_cap * 2);
+        if (!buffer) {
+            return -1;
+        }
+        self->_buffer = buffer;
+        self->_cap *= 2;
+    }
+    want = self->_cap - self->_end;
+    if (want > READER_CHUNK) {
+        want = READER_CHUNK;
+    }
+    do {
+        n = reader_read(self->_fd, self->_buffer + self->_end, want);
+    } while (n < 0 && errno == EINTR);
+    if (n > 0) {
+        self->_end += (size_t)n;
+    }
+    return n;
+}
+
+int
+reader_next_line(reader* self, strview* line) {
+    /* Bytes after _begin known not to contain a newline. */
+    size_t scanned = 0;
+    for (;;) {
+        const char* start = self->_buffer + self->_begin;
+        size_t available = self->_end - self->_begin;
+        const char* newline =
+            available > scanned
+                ? memchr(start + scanned, '\n', available - scanned)
+                : 0;
+        reader_ssize n;
+        if (newline) {
+            *line = strview_new(start, (size_t)(newline - start));
+            self->_begin += (size_t)(newline - start) + 1;
+            return 1;
+        }
+        if (self->_eof) {
+            if (!available) {
+                return 0;
+            }
+            *line = strview_new(start, available);
+            self->_begin = self->_end;
+            return 1;
+        }
+        scanned = available;
+        n = reader_fill(self);
+        if (n < 0) {
+            return -1;
+        }
+        if (n == 0) {
+            self->_eof = 1;
+        }
+    }
+}
+
+/*! \brief Get the size of \c fd if it is a regular file.
+ *
+ * \return 1 if \c size was set, otherwise 0. */
+static int
+reader_file_size(int fd, size_t* size) {
+#ifdef _WIN32
+    struct _stat64 info;
+    if (_fstat64(fd, &info) != 0 || !(info.st_mode & _S_IFREG)) {
+        return 0;
+    }
+#else
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+        return 0;
+    }
+#endif
+    *size = (size_t)info.st_size;
+    return 1;
+}
+
+int
+str_from_file(str* self, const char* path) {
+    str contents = STR_INIT;
+    size_t size;
+    size_t len = 0;
+    int result = -1;
+    int fd;
+
+    do {
+        fd = reader_open(path);
+    } while (fd < 0 && errno == EINTR);
+    if (fd < 0) {
+        return -1;
+    }
+    /* One byte of slack lets the read that finds the end of the file
+     * happen without growing. */
+    if (reader_file_size(fd, &size) && str_reserve(&contents, size + 1)) {
+        goto cleanup;
+    }
+    for (;;) {
+        reader_ssize n;
+        if (len == str_cap(&contents)) {
+            /* The file grew or its size is unknown. */
+            str_set_len_bytes(&contents, len);
+            if (str_reserve(&contents, len < READER_CHUNK ? READER_CHUNK : len * 2)) {
+                goto cleanup;
+            }
+        }
+        n = reader_read(fd, str_begin(&contents) + len, str_cap(&contents) - len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            goto cleanup;
+        }
+        if (n == 0) {
+            break;
+        }
+        len += (size_t)n;
+    }
+    str_set_len_bytes(&contents, len);
+    if (utf8_validate(str_cbegin(&contents), len) != len) {
+        result = 1;
+        goto cleanup;
+    }
+    str_destroy(self);
+    memcpy(self, &contents, sizeof(str));
+    str_init(&contents);
+    result = 0;
+
+cleanup:
+    reader_close(fd);
+    str_destroy(&contents);
+    return result;
+}
+
+#ifdef TEST_MODE
+#include "test.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef _WIN32
+/*! \brief Write \c len bytes to a new temporary file.
+ *
+ * \return The open file, positioned at the start, or -1. */
+static int
+reader_test_file(const char* contents, size_t len, char* path) {
+    int fd;
+    strcpy(path, "/tmp/cutil_reader_XXXXXX");
+    fd = mkstemp(path);
+    if (fd < 0) {
+        return -1;
+    }
+    if (write(fd, contents, len) != (ssize_t)len || lseek(fd, 0, SEEK_SET) != 0) {
+        close(fd);
+        unlink(path);
+        return -1;
+    }
+    return fd;
+}
+
+TEST(test_reader_lines) {
+    static const char contents[] = "a\n\nbc\r\nlast";
+    char path[32];
+    reader r;
+    strview line;
+    int fd = reader_test_file(contents, sizeof(contents) - 1, path);
+    ASSERT(fd >= 0, done);
+    ASSERT(!reader_init(&r, fd), cleanup_fd);
+    ASSERT(reader_next_line(&r, &line) == 1 && strview_eq(line, strview_from_cstr("a")),
+           cleanup);
+    ASSERT(reader_next_line(&r, &line) == 1 && line.len == 0, cleanup);
+    ASSERT(reader_next_line(&r, &line) == 1 &&
+               strview_eq(line, strview_from_cstr("bc\r")),
+           cleanup);
+    ASSERT(reader_next_line(&r, &line) == 1 &&
+               strview_eq(line, strview_from_cstr("last")),
+           cleanup);
+    ASSERT(reader_next_line(&r, &line) == 0, cleanup);
+    ASSERT(reader_next_line(&r, &line) == 0, cleanup);
+cleanup:
+    reader_destroy(&r);
+    reader_destroy(&r);
+cleanup_fd:
+    close(fd);
+    unlink(path);
+done:;
+}
+END_TEST
+
+TEST(test_reader_long_lines) {
+    /* Lines of varying length that cross buffer boundaries, and one
+     * longer than the buffer. */
+    static char contents[600000];
+    static const size_t lens[] = {0, 1, 70000, 5, 200000, 13, 65535, 65536, 3};
+    char path[32];
+    reader r;
+    strview line;
+    size_t len = 0;
+    size_t i, j;
+    int fd;
+    for (i = 0; i != sizeof(lens) / sizeof(*lens); ++i) {
+        for (j = 0; j != lens[i]; ++j) {
+            contents[len++] = (char)('a' + (i + j) % 26);
+        }
+        contents[len++] = '\n';
+    }
+    fd = reader_test_file(contents, len, path);
+    ASSERT(fd >= 0, done);
+    ASSERT(!reader_init(&r, fd), cleanup_fd);
+    len = 0;
+    for (i = 0; i != sizeof(lens) / sizeof(*lens); ++i) {
+        ASSERT(reader_next_line(&r, &line) == 1, cleanup);
+        ASSERT(line.len == lens[i], cleanup);
+        ASSERT(memcmp(line.ptr, contents + len, lens[i]) == 0, cleanup);
+        len += lens[i] + 1;
+    }
+    ASSERT(reader_next_line(&r, &line) == 0, cleanup);
+cleanup:
+    reader_destroy(&r);
+cleanup_fd:
+    close(fd);
+    unlink(path);
+done:;
+}
+END_TEST
+
+TEST(test_reader_grow_early) {
+    /* After the first line, the rest of the second fills all but a
+     * few bytes of the buffer. */
+    static char contents[READER_CHUNK + 100];
+    char path[32];
+    reader r;
+    strview line;
+    int fd;
+    memset(contents, 'x', sizeof(contents));
+    contents[99] = '\n';
+    contents[READER_CHUNK + 50] = '\n';
+    fd = reader_test_file(contents, sizeof(contents), path);
+    ASSERT(fd >= 0, done);
+    ASSERT(!reader_init(&r, fd), cleanup_fd);
+    ASSERT(reader_next_line(&r, &line) == 1 && line.len == 99, cleanup);
+    ASSERT(reader_next_line(&r, &line) == 1 && line.len == READER_CHUNK - 50,
+           cleanup);
+    ASSERT(r._cap == READER_CHUNK * 2, cleanup);
+    ASSERT(reader_next_line(&r, &line) == 1 && line.len == 49, cleanup);
+    ASSERT(reader_next_line(&r, &line) == 0, cleanup);
+cleanup:
+    reader_destroy(&r);
+cleanup_fd:
+    close(fd);
+    unlink(path);
+done:;
+}
+END_TEST
+
+TEST(test_str_from_file) {
+    static char contents[100000];
+    char path[32];
+    str s = STR_INIT;
+    size_t i;
+    int fd;
+    for (i = 0; i != sizeof(contents); ++i) {
+        contents[i] = i % 40 == 39 ? '\n' : (char)('A' + i % 26);
+    }
+    fd = reader_test_file(contents, sizeof(contents), path);
+    ASSERT(fd >= 0, done);
+    close(fd);
+    ASSERT(!str_from_file(&s, path), cleanup);
+    ASSERT(str_len_bytes(&s) == sizeof(contents), cleanup);
+    ASSERT(memcmp(str_cbegin(&s), contents, sizeof(contents)) == 0, cleanup);
+    ASSERT(str_cend(&s)[0] == 0, cleanup);
+    unlink(path);
+
+    fd = reader_test_file("short", 5, path);
+    ASSERT(fd >= 0, cleanup);
+    close(fd);
+    ASSERT(!str_from_file(&s, path), cleanup);
+    ASSERT(strcmp(str_cbegin(&s), "short") == 0, cleanup);
+    unlink(path);
+
+    /* Invalid utf8 and missing files leave the str alone. */
+    fd = reader_test_file("bad \xC3\x28", 6, path);
+    ASSERT(fd >= 0, cleanup);
+    close(fd);
+    ASSERT(str_from_file(&s, path) == 1, cleanup);
+    ASSERT(strcmp(str_cbegin(&s), "short") == 0, cleanup);
+    unlink(path);
+    ASSERT(str_from_file(&s, path) == -1, cleanup);
+    ASSERT(strcmp(str_cbegin(&s), "short") == 0, cleanup);
+
+    fd = reader_test_file("", 0, path);
+    ASSERT(fd >= 0, cleanup);
+    close(fd);
+    ASSERT(!str_from_file(&s, path) && str_len_bytes(&s) == 0, cleanup);
+cleanup:
+    unlink(path);
+    str_destroy(&s);
+done:;
+}
+END_TEST
+
+#endif
+
+void test_reader(void) {
+#ifndef _WIN32
+    RUN(test_reader_lines);
+    RUN(test_reader_long_lines);
+    RUN(test_reader_grow_early);
+    RUN(test_str_from_file);
+#endif
+}
+#endif
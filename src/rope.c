@@ -0,0 +1,730 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2017 Chris Gregory czipperz@gmail.com
+ */
+
+#include "../rope.h"
+#include "../rpmalloc.h"
+#include "../utf8.h"
+#include <assert.h>
+#include <string.h>
+
+/*! \brief A node of the tree.
+ *
+ * Leaves have no children and hold a nonempty chunk of the text.
+ * Internal nodes always have both children and an empty \c text. */
+struct rope_node {
+    /*! \brief First so that it is aligned like a \c str_alloc. */
+    str text;
+    rope_node* left;
+    rope_node* right;
+    size_t bytes;
+    size_t chars;
+    /*! \brief Leaves have height 0. */
+    int height;
+};
+
+/*! \brief Chunks built from new text are at most this long.  Small
+ *  insertions grow a chunk in place until it reaches this size. */
+#define ROPE_LEAF_MAX 1024
+/*! \brief Don't keep more spare nodes around than this. */
+#define ROPE_MAX_SPARE 8
+
+static int
+rope_is_leaf(const rope_node* node) {
+    return !node->left;
+}
+
+static int
+rope_height(const rope_node* node) {
+    return node ? node->height : -1;
+}
+
+static void
+rope_update(rope_node* node) {
+    int left = node->left->height;
+    int right = node->right->height;
+    node->bytes = node->left->bytes + node->right->bytes;
+    node->chars = node->left->chars + node->right->chars;
+    node->height = 1 + (left > right ? left : right);
+}
+
+static rope_node*
+rope_rotate_left(rope_node* node) {
+    rope_node* right = node->right;
+    node->right = right->left;
+    rope_update(node);
+    right->left = node;
+    rope_update(right);
+    return right;
+}
+
+static rope_node*
+rope_rotate_right(rope_node* node) {
+    rope_node* left = node->left;
+    node->left = left->right;
+    rope_update(node);
+    left->right = node;
+    rope_update(left);
+    return left;
+}
+
+/*! \brief Recalculate \c node and restore the AVL property, assuming
+ *  its children differ in height by at most two. */
+static rope_node*
+rope_rebalance(rope_node* node) {
+    int balance;
+    rope_update(node);
+    balance = node->left->height - node->right->height;
+    if (balance > 1) {
+        if (node->left->left->height < node->left->right->height) {
+            node->left = rope_rotate_left(node->left);
+        }
+        return rope_rotate_right(node);
+    } else if (balance < -1) {
+        if (node->right->right->height < node->right->left->height) {
+            node->right = rope_rotate_right(node->right);
+        }
+        return rope_rotate_left(node);
+    }
+    return node;
+}
+
+static void
+rope_release(rope* self, rope_node* node) {
+    if (self->_spare_len < ROPE_MAX_SPARE) {
+        node->left = self->_spare;
+        self->_spare = node;
+        ++self->_spare_len;
+    } else {
+        rpfree(node);
+    }
+}
+
+static rope_node*
+rope_acquire(rope* self) {
+    rope_node* node = self->_spare;
+    assert(node);
+    self->_spare = node->left;
+    --self->_spare_len;
+    node->left = 0;
+    node->right = 0;
+    return node;
+}
+
+/*! \brief Make sure there are \c num spare nodes. */
+static int
+rope_reserve(rope* self, size_t num) {
+    while (self->_spare_len < num) {
+        rope_node* node = rpmalloc(sizeof(rope_node));
+        if (!node) {
+            return -1;
+        }
+        str_init(&node->text);
+        rope_release(self, node);
+    }
+    return 0;
+}
+
+/*! \brief Concatenate \c left and \c right, using \c node as the new
+ *  parent if one is needed.
+ *
+ * Either may be null.  Complexity: O(|height(left) - height(right)|) */
+static rope_node*
+rope_join(rope* self, rope_node* left, rope_node* right, rope_node* node) {
+    if (!left || !right) {
+        rope_release(self, node);
+        return left ? left : right;
+    }
+    if (left->height > right->height + 1) {
+        left->right = rope_join(self, left->right, right, node);
+        return rope_rebalance(left);
+    }
+    if (right->height > left->height + 1) {
+        right->left = rope_join(self, left, right->left, node);
+        return rope_rebalance(right);
+    }
+    node->left = left;
+    node->right = right;
+    rope_update(node);
+    return node;
+}
+
+static void
+rope_free(rope_node* node) {
+    if (node) {
+        rope_free(node->left);
+        rope_free(node->right);
+        str_destroy(&node->text);
+        rpfree(node);
+    }
+}
+
+static rope_node*
+rope_new_leaf(const char* string, size_t len) {
+    rope_node* node = rpmalloc(sizeof(rope_node));
+    if (node) {
+        str_init(&node->text);
+        if (str_copy_n(&node->text, string, len)) {
+            rpfree(node);
+            return 0;
+        }
+        node->left = 0;
+        node->right = 0;
+        node->bytes = len;
+        node->chars = utf8_count_chars(string, len);
+        node->height = 0;
+    }
+    return node;
+}
+
+/*! \brief Build a balanced tree holding \c string.  \c len must be
+ *  positive. */
+static rope_node*
+rope_build(const char* string, size_t len) {
+    rope_node* left;
+    rope_node* right;
+    rope_node* node;
+    size_t mid;
+    if (len <= ROPE_LEAF_MAX) {
+        return rope_new_leaf(string, len);
+    }
+
+    /* Split in half at a character boundary. */
+    mid = len / 2;
+    while (mid > len / 2 - 3 && (string[mid] & 0xC0) == 0x80) {
+        --mid;
+    }
+    left = rope_build(string, mid);
+    right = left ? rope_build(string + mid, len - mid) : 0;
+    node = right ? rpmalloc(sizeof(rope_node)) : 0;
+    if (!node) {
+        rope_free(left);
+        rope_free(right);
+        return 0;
+    }
+    str_init(&node->text);
+    node->left = left;
+    node->right = right;
+    rope_update(node);
+    return node;
+}
+
+/*! \brief Find the leaf holding byte \c *pos, making \c *pos relative
+ *  to it.  If \c *pos is between two leaves this finds the right one.
+ *
+ * If \c path is non-null the nodes above the leaf are stored in it
+ * and their count in \c path_len. */
+static rope_node*
+rope_find_leaf(rope_node* node, size_t* pos, rope_node** path,
+               size_t* path_len) {
+    size_t len = 0;
+    while (!rope_is_leaf(node)) {
+        if (path) {
+            path[len++] = node;
+        }
+        if (*pos < node->left->bytes) {
+            node = node->left;
+        } else {
+            *pos -= node->left->bytes;
+            node = node->right;
+        }
+    }
+    if (path_len) {
+        *path_len = len;
+    }
+    return node;
+}
+
+/*! \brief Allocate the leaf that splitting at \c pos will need.
+ *
+ * If \c pos is already between two leaves, \c *tail is set to null. */
+static int
+rope_prepare_split(rope_node* root, size_t pos, rope_node** tail) {
+    rope_node* leaf;
+    *tail = 0;
+    if (!root || pos == root->bytes) {
+        return 0;
+    }
+    leaf = rope_find_leaf(root, &pos, 0, 0);
+    assert((str_cbegin(&leaf->text)[pos] & 0xC0) != 0x80);
+    if (pos != 0) {
+        *tail = rope_new_leaf(str_cbegin(&leaf->text) + pos, leaf->bytes - pos);
+        if (!*tail) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*! \brief Split \c node at \c pos into \c left and \c right.
+ *
+ * \c tail must be from \c rope_prepare_split.  This can't fail.
+ *
+ * Complexity: O(log n) */
+static void
+rope_split_(rope* self, rope_node* node, size_t pos, rope_node* tail,
+            rope_node** left, rope_node** right) {
+    rope_node* a;
+    rope_node* b;
+    if (!node) {
+        *left = 0;
+        *right = 0;
+    } else if (rope_is_leaf(node)) {
+        if (pos == 0) {
+            *left = 0;
+            *right = node;
+        } else if (pos == node->bytes) {
+            *left = node;
+            *right = 0;
+        } else {
+            assert(tail && tail->bytes == node->bytes - pos);
+            str_set_len_bytes(&node->text, pos);
+            node->bytes = pos;
+            node->chars -= tail->chars;
+            *left = node;
+            *right = tail;
+        }
+    } else if (pos < node->left->bytes) {
+        rope_split_(self, node->left, pos, tail, &a, &b);
+        *left = a;
+        *right = rope_join(self, b, node->right, node);
+    } else {
+        rope_split_(self, node->right, pos - node->left->bytes, tail, &a, &b);
+        *left = rope_join(self, node->left, a, node);
+        *right = b;
+    }
+}
+
+void
+rope_init(rope* self) {
+    self->_root = 0;
+    self->_spare = 0;
+    self->_spare_len = 0;
+}
+
+void
+rope_destroy(rope* self) {
+    rope_free(self->_root);
+    while (self->_spare) {
+        rope_node* next = self->_spare->left;
+        rpfree(self->_spare);
+        self->_spare = next;
+    }
+    rope_init(self);
+}
+
+size_t
+rope_len_bytes(const rope* self) {
+    return self->_root ? self->_root->bytes : 0;
+}
+
+size_t
+rope_len_characters(const rope* self) {
+    return self->_root ? self->_root->chars : 0;
+}
+
+int
+rope_insert(rope* self, size_t pos, const char* string, size_t len_bytes) {
+    rope_node* path[ROPE_MAX_HEIGHT];
+    size_t path_len;
+    rope_node* middle;
+    rope_node* tail;
+    rope_node* left;
+    rope_node* right;
+    assert(pos <= rope_len_bytes(self));
+
+    if (len_bytes == 0) {
+        return 0;
+    }
+
+    if (self->_root) {
+        /* Typing into the middle of a document usually just grows
+         * one chunk.  Prefer the chunk ending at pos over the one
+         * starting there so appends stay in place. */
+        size_t offset = pos;
+        rope_node* leaf;
+        if (pos != 0) {
+            --offset;
+        }
+        leaf = rope_find_leaf(self->_root, &offset, path, &path_len);
+        if (pos != 0) {
+            ++offset;
+        }
+        assert(offset == leaf->bytes ||
+               (str_cbegin(&leaf->text)[offset] & 0xC0) != 0x80);
+        if (leaf->bytes + len_bytes <= ROPE_LEAF_MAX) {
+            size_t chars;
+            size_t i;
+            if (str_insert_sn(&leaf->text, str_cbegin(&leaf->text) + offset,
+                              string, len_bytes)) {
+                return -1;
+            }
+            chars = utf8_count_chars(string, len_bytes);
+            leaf->bytes += len_bytes;
+            leaf->chars += chars;
+            for (i = 0; i != path_len; ++i) {
+                path[i]->bytes += len_bytes;
+                path[i]->chars += chars;
+            }
+            return 0;
+        }
+    }
+
+    middle = rope_build(string, len_bytes);
+    if (!middle) {
+        return -1;
+    }
+    if (rope_reserve(self, 2) || rope_prepare_split(self->_root, pos, &tail)) {
+        rope_free(middle);
+        return -1;
+    }
+    rope_split_(self, self->_root, pos, tail, &left, &right);
+    left = rope_join(self, left, middle, rope_acquire(self));
+    self->_root = rope_join(self, left, right, rope_acquire(self));
+    return 0;
+}
+
+int
+rope_push_sn(rope* self, const char* string, size_t len_bytes) {
+    return rope_insert(self, rope_len_bytes(self), string, len_bytes);
+}
+
+int
+rope_erase(rope* self, size_t pos, size_t num) {
+    rope_node* path[ROPE_MAX_HEIGHT];
+    size_t path_len;
+    size_t offset = pos;
+    rope_node* leaf;
+    rope_node* first_tail;
+    rope_node* second_tail;
+    rope_node* left;
+    rope_node* middle;
+    rope_node* right;
+    assert(pos + num <= rope_len_bytes(self));
+
+    if (num == 0) {
+        return 0;
+    }
+
+    leaf = rope_find_leaf(self->_root, &offset, path, &path_len);
+    if (offset + num <= leaf->bytes && num < leaf->bytes) {
+        /* Erasing inside one chunk. */
+        size_t chars = utf8_count_chars(str_cbegin(&leaf->text) + offset, num);
+        size_t i;
+        str_erase_n_bytes(&leaf->text, offset, num);
+        leaf->bytes -= num;
+        leaf->chars -= chars;
+        for (i = 0; i != path_len; ++i) {
+            path[i]->bytes -= num;
+            path[i]->chars -= chars;
+        }
+        return 0;
+    }
+
+    /* Since the range isn't inside one chunk, the chunk split at pos
+     * is not the one split at pos + num. */
+    if (rope_reserve(self, 1) ||
+        rope_prepare_split(self->_root, pos, &first_tail)) {
+        return -1;
+    }
+    if (rope_prepare_split(self->_root, pos + num, &second_tail)) {
+        rope_free(first_tail);
+        return -1;
+    }
+    rope_split_(self, self->_root, pos, first_tail, &left, &right);
+    rope_split_(self, right, num, second_tail, &middle, &right);
+    rope_free(middle);
+    self->_root = rope_join(self, left, right, rope_acquire(self));
+    return 0;
+}
+
+int
+rope_split(rope* self, size_t pos, rope* tail) {
+    rope_node* tail_leaf;
+    assert(pos <= rope_len_bytes(self));
+    assert(!tail->_root);
+    if (rope_prepare_split(self->_root, pos, &tail_leaf)) {
+        return -1;
+    }
+    rope_split_(self, self->_root, pos, tail_leaf, &self->_root, &tail->_root);
+    return 0;
+}
+
+int
+rope_concat(rope* self, rope* other) {
+    if (rope_reserve(self, 1)) {
+        return -1;
+    }
+    self->_root = rope_join(self, self->_root, other->_root, rope_acquire(self));
+    other->_root = 0;
+    return 0;
+}
+
+size_t
+rope_char_to_byte(const rope* self, size_t char_index) {
+    const rope_node* node = self->_root;
+    size_t bytes = 0;
+    if (!node || char_index >= node->chars) {
+        return rope_len_bytes(self);
+    }
+    while (!rope_is_leaf(node)) {
+        if (char_index < node->left->chars) {
+            node = node->left;
+        } else {
+            char_index -= node->left->chars;
+            bytes += node->left->bytes;
+            node = node->right;
+        }
+    }
+    return bytes + str_char_to_byte(&node->text, char_index);
+}
+
+size_t
+rope_byte_to_char(const rope* self, size_t byte_index) {
+    const rope_node* node = self->_root;
+    size_t chars = 0;
+    assert(byte_index <= rope_len_bytes(self));
+    if (!node || byte_index == node->bytes) {
+        return rope_len_characters(self);
+    }
+    while (!rope_is_leaf(node)) {
+        if (byte_index < node->left->bytes) {
+            node = node->left;
+        } else {
+            byte_index -= node->left->bytes;
+            chars += node->left->chars;
+            node = node->right;
+        }
+    }
+    return chars + str_byte_to_char(&node->text, byte_index);
+}
+
+int
+rope_flatten(const rope* self, str* out) {
+    rope_iterator iterator;
+    rope_chunk chunk;
+    char* dest;
+    if (str_reserve(out, rope_len_bytes(self))) {
+        return -1;
+    }
+    dest = str_begin(out);
+    iterator = rope_iterator_new(self);
+    while ((chunk = rope_iterator_next(&iterator)).str) {
+        memcpy(dest, chunk.str, chunk.len);
+        dest += chunk.len;
+    }
+    str_set_len_bytes(out, rope_len_bytes(self));
+    return 0;
+}
+
+rope_iterator
+rope_iterator_new(const rope* self) {
+    rope_iterator iterator;
+    iterator._depth = 0;
+    if (self->_root) {
+        iterator._stack[iterator._depth++] = self->_root;
+    }
+    return iterator;
+}
+
+rope_chunk
+rope_iterator_next(rope_iterator* iterator) {
+    rope_chunk chunk;
+    const rope_node* node;
+    if (iterator->_depth == 0) {
+        chunk.str = 0;
+        chunk.len = 0;
+        return chunk;
+    }
+    node = iterator->_stack[--iterator->_depth];
+    while (!rope_is_leaf(node)) {
+        assert(iterator->_depth < ROPE_MAX_HEIGHT);
+        iterator->_stack[iterator->_depth++] = node->right;
+        node = node->left;
+    }
+    chunk.str = str_cbegin(&node->text);
+    chunk.len = node->bytes;
+    return chunk;
+}
+
+#ifdef TEST_MODE
+#include "test.h"
+
+/*! \brief Check the structure of the tree.  Returns the height or -2
+ *  if something is wrong. */
+static int
+rope_check(const rope_node* node) {
+    int left;
+    int right;
+    if (rope_is_leaf(node)) {
+        if (node->bytes == 0 || node->bytes != str_len_bytes(&node->text) ||
+            node->chars != str_len_characters(&node->text) || node->height != 0) {
+            return -2;
+        }
+        return 0;
+    }
+    left = rope_check(node->left);
+    right = rope_check(node->right);
+    if (left < 0 || right < 0 || left - right > 1 || right - left > 1 ||
+        node->height != 1 + (left > right ? left : right) ||
+        node->bytes != node->left->bytes + node->right->bytes ||
+        node->chars != node->left->chars + node->right->chars) {
+        return -2;
+    }
+    return node->height;
+}
+
+/*! \brief The ANSI C example rand(), so runs are repeatable. */
+static size_t
+test_rope_rand(unsigned long* seed) {
+    *seed = *seed * 1103515245 + 12345;
+    return (*seed >> 16) & 0x7FFF;
+}
+
+static int
+rope_equals(const rope* self, const char* string, size_t len) {
+    str flat = STR_INIT;
+    int equal = !rope_flatten(self, &flat) && str_len_bytes(&flat) == len &&
+                memcmp(str_cbegin(&flat), string, len) == 0;
+    str_destroy(&flat);
+    return equal && (!self->_root || rope_check(self->_root) >= 0);
+}
+
+TEST(test_rope_insert_erase) {
+    rope r = ROPE_INIT;
+    ASSERT(rope_len_bytes(&r) == 0, cleanup);
+    ASSERT(rope_equals(&r, "", 0), cleanup);
+    ASSERT(!rope_insert(&r, 0, "world", 5), cleanup);
+    ASSERT(!rope_insert(&r, 0, "hello ", 6), cleanup);
+    ASSERT(!rope_push_sn(&r, "!", 1), cleanup);
+    ASSERT(rope_equals(&r, "hello world!", 12), cleanup);
+    ASSERT(!rope_erase(&r, 5, 6), cleanup);
+    ASSERT(rope_equals(&r, "hello!", 6), cleanup);
+    ASSERT(!rope_insert(&r, 5, " \xE2\x82\xAC", 4), cleanup);
+    ASSERT(rope_len_bytes(&r) == 10, cleanup);
+    ASSERT(rope_len_characters(&r) == 8, cleanup);
+    ASSERT(rope_char_to_byte(&r, 7) == 9, cleanup);
+    ASSERT(rope_byte_to_char(&r, 9) == 7, cleanup);
+    ASSERT(!rope_erase(&r, 0, 10), cleanup);
+    ASSERT(rope_len_bytes(&r) == 0, cleanup);
+cleanup:
+    rope_destroy(&r);
+    rope_destroy(&r);
+}
+END_TEST
+
+TEST(test_rope_random_edits) {
+    static const char* const pieces[] = {"a", "bc", "\xC3\xA9", "\xE2\x82\xAC",
+                                         "\xF0\x9D\x84\x9E", "0123456789"};
+    rope r = ROPE_INIT;
+    str expected = STR_INIT;
+    char big[3000];
+    unsigned long seed = 1;
+    size_t i;
+    for (i = 0; i != sizeof(big); ++i) {
+        big[i] = 'A' + i % 26;
+    }
+    for (i = 0; i != 3000; ++i) {
+        size_t len = str_len_bytes(&expected);
+        size_t pos, num;
+        /* Pick a random character boundary. */
+        pos = (test_rope_rand(&seed) << 15 | test_rope_rand(&seed)) % (len + 1);
+        while (pos != len && (str_cbegin(&expected)[pos] & 0xC0) == 0x80) {
+            ++pos;
+        }
+        switch (test_rope_rand(&seed) % 4) {
+        case 0:
+        case 1: {
+            const char* piece = pieces[test_rope_rand(&seed) % 6];
+            ASSERT(!rope_insert(&r, pos, piece, strlen(piece)), cleanup);
+            ASSERT(!str_insert_s(&expected, str_cbegin(&expected) + pos, piece),
+                   cleanup);
+            break;
+        }
+        case 2:
+            num = test_rope_rand(&seed) % 2000;
+            ASSERT(!rope_insert(&r, pos, big, num), cleanup);
+            ASSERT(!str_insert_sn(&expected, str_cbegin(&expected) + pos, big, num),
+                   cleanup);
+            break;
+        case 3:
+            num = test_rope_rand(&seed) % 1500;
+            if (num > len - pos) {
+                num = len - pos;
+            }
+            while (pos + num != len &&
+                   (str_cbegin(&expected)[pos + num] & 0xC0) == 0x80) {
+                ++num;
+            }
+            ASSERT(!rope_erase(&r, pos, num), cleanup);
+            str_erase_n_bytes(&expected, pos, num);
+            break;
+        }
+        if (i % 100 == 0) {
+            ASSERT(rope_equals(&r, str_cbegin(&expected),
+                               str_len_bytes(&expected)),
+                   cleanup);
+        }
+    }
+    ASSERT(rope_equals(&r, str_cbegin(&expected), str_len_bytes(&expected)),
+           cleanup);
+    ASSERT(rope_len_characters(&r) == str_len_characters(&expected), cleanup);
+cleanup:
+    rope_destroy(&r);
+    str_destroy(&expected);
+}
+END_TEST
+
+TEST(test_rope_split_concat) {
+    rope r = ROPE_INIT;
+    rope tail = ROPE_INIT;
+    static char text[10000];
+    rope_iterator iterator;
+    rope_chunk chunk;
+    size_t i;
+    size_t total;
+    for (i = 0; i != sizeof(text); ++i) {
+        text[i] = 'a' + i % 26;
+    }
+    ASSERT(!rope_push_sn(&r, text, sizeof(text)), cleanup);
+    ASSERT(rope_equals(&r, text, sizeof(text)), cleanup);
+
+    iterator = rope_iterator_new(&r);
+    total = 0;
+    while ((chunk = rope_iterator_next(&iterator)).str) {
+        ASSERT(chunk.len > 0 && chunk.len <= ROPE_LEAF_MAX, cleanup);
+        ASSERT(memcmp(chunk.str, text + total, chunk.len) == 0, cleanup);
+        total += chunk.len;
+    }
+    ASSERT(total == sizeof(text), cleanup);
+
+    ASSERT(!rope_split(&r, 4321, &tail), cleanup);
+    ASSERT(rope_equals(&r, text, 4321), cleanup);
+    ASSERT(rope_equals(&tail, text + 4321, sizeof(text) - 4321), cleanup);
+    ASSERT(!rope_concat(&tail, &r), cleanup);
+    ASSERT(rope_len_bytes(&r) == 0, cleanup);
+    ASSERT(rope_len_bytes(&tail) == sizeof(text), cleanup);
+    ASSERT(!rope_split(&tail, sizeof(text) - 4321, &r), cleanup);
+    ASSERT(rope_equals(&r, text, 4321), cleanup);
+    ASSERT(!rope_concat(&r, &tail), cleanup);
+    ASSERT(rope_equals(&r, text, sizeof(text)), cleanup);
+
+    ASSERT(!rope_split(&r, 0, &tail), cleanup);
+    ASSERT(rope_len_bytes(&r) == 0, cleanup);
+    ASSERT(!rope_concat(&r, &tail), cleanup);
+    ASSERT(rope_equals(&r, text, sizeof(text)), cleanup);
+cleanup:
+    rope_destroy(&r);
+    rope_destroy(&tail);
+}
+END_TEST
+
+void test_rope(void) {
+    RUN(test_rope_insert_erase);
+    RUN(test_rope_random_edits);
+    RUN(test_rope_split_concat);
+}
+#endif
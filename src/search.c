@@ -0,0 +1,783 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2017 Chris Gregory czipperz@gmail.com
+ */
+
+#include "../search.h"
+#include "../cpu.h"
+#include <stdint.h>
+#include <string.h>
+
+#ifdef CPU_X86
+#include <immintrin.h>
+#endif
+
+/*! \brief How many bytes of failed verifications are tolerated
+ *  beyond the bytes scanned, in units of the needle length.
+ *
+ * Past this the vector filter is producing too many false
+ * candidates and Two-Way takes over. */
+#define SEARCH_SLACK 32
+
+/*! \brief Needles longer than this go straight to Two-Way.
+ *
+ * Its bad character shift skips close to a needle length per window
+ * on typical text, which outruns the vector filter once needles get
+ * long. */
+#define SEARCH_TWOWAY_MIN 32
+
+/*! \brief The Two-Way algorithm of Crochemore and Perrin.
+ *
+ * The needle is split at a critical factorization and matched right
+ * half first, then left half, shifting by the period or by the
+ * position of the mismatch.  A bad character shift on the last two
+ * bytes of the window skips most windows without any comparison.
+ * Runs in O(n + m) time and O(1) space.
+ *
+ * If \c reverse is set, both \c h and \c n are read back to front so
+ * that the first match found is the last one in \c h.  The offset
+ * returned is always from the start of \c h.  Requires \c l != 0. */
+static inline size_t
+search_twoway_impl(const unsigned char* h, size_t hl, const unsigned char* n,
+                   size_t l, int reverse) {
+#define SEARCH_N(i) (reverse ? n[l - 1 - (i)] : n[i])
+#define SEARCH_H(i) (reverse ? h[hl - 1 - (pos + (i))] : h[pos + (i)])
+#define SEARCH_PAIR(a, b) (((size_t)(b) - ((size_t)(a) << 3)) & 255)
+    size_t shift[256];
+    size_t pos = 0;
+    size_t i, ip, jp, k, p, ms, p0, mem, mem0;
+
+    /* The distance from each pair of adjacent bytes to the end of the
+     * needle, by hash.  Collisions only make shifts shorter. */
+    for (i = 0; i != 256; ++i) {
+        shift[i] = l - 1;
+    }
+    for (i = 1; i < l; ++i) {
+        shift[SEARCH_PAIR(SEARCH_N(i - 1), SEARCH_N(i))] = l - 1 - i;
+    }
+
+    /* The maximal suffix for < and for >.  The later of the two
+     * gives the critical factorization.  \c ip starts at -1 and
+     * relies on unsigned wrap around. */
+    ip = (size_t)-1;
+    jp = 0;
+    k = p = 1;
+    while (jp + k < l) {
+        if (SEARCH_N(ip + k) == SEARCH_N(jp + k)) {
+            if (k == p) {
+                jp += p;
+                k = 1;
+            } else {
+                ++k;
+            }
+        } else if (SEARCH_N(ip + k) > SEARCH_N(jp + k)) {
+            jp += k;
+            k = 1;
+            p = jp - ip;
+        } else {
+            ip = jp++;
+            k = p = 1;
+        }
+    }
+    ms = ip;
+    p0 = p;
+
+    ip = (size_t)-1;
+    jp = 0;
+    k = p = 1;
+    while (jp + k < l) {
+        if (SEARCH_N(ip + k) == SEARCH_N(jp + k)) {
+            if (k == p) {
+                jp += p;
+                k = 1;
+            } else {
+                ++k;
+            }
+        } else if (SEARCH_N(ip + k) < SEARCH_N(jp + k)) {
+            jp += k;
+            k = 1;
+            p = jp - ip;
+        } else {
+            ip = jp++;
+            k = p = 1;
+        }
+    }
+    if (ip + 1 > ms + 1) {
+        ms = ip;
+    } else {
+        p = p0;
+    }
+
+    /* If the left half repeats with period \c p, matched bytes can
+     * be remembered across shifts by \c p.  Otherwise shift by more
+     * than either half. */
+    for (i = 0; i != ms + 1 && SEARCH_N(i) == SEARCH_N(i + p); ++i) {
+    }
+    if (i != ms + 1) {
+        mem0 = 0;
+        p = (ms > l - ms - 1 ? ms : l - ms - 1) + 1;
+    } else {
+        mem0 = l - p;
+    }
+    mem = 0;
+
+    for (;;) {
+        if (hl - pos < l) {
+            return MEM_NPOS;
+        }
+
+        k = l == 1 ? 0 : shift[SEARCH_PAIR(SEARCH_H(l - 2), SEARCH_H(l - 1))];
+        if (k) {
+            pos += k;
+            mem = 0;
+            continue;
+        }
+
+        for (k = ms + 1 > mem ? ms + 1 : mem; k < l && SEARCH_N(k) == SEARCH_H(k);
+             ++k) {
+        }
+        if (k < l) {
+            pos += k - ms;
+            mem = 0;
+            continue;
+        }
+
+        for (k = ms + 1; k > mem && SEARCH_N(k - 1) == SEARCH_H(k - 1); --k) {
+        }
+        if (k <= mem) {
+            return reverse ? hl - pos - l : pos;
+        }
+        pos += p;
+        mem = mem0;
+    }
+#undef SEARCH_PAIR
+#undef SEARCH_N
+#undef SEARCH_H
+}
+
+static size_t
+search_twoway(const unsigned char* h, size_t hl, const unsigned char* n,
+              size_t l, int reverse) {
+    /* Instantiate each direction separately so neither pays for the
+     * test in its inner loops. */
+    if (reverse) {
+        return search_twoway_impl(h, hl, n, l, 1);
+    }
+    return search_twoway_impl(h, hl, n, l, 0);
+}
+
+static size_t
+search_twoway_from(const unsigned char* h, size_t hl, const unsigned char* n,
+                   size_t nl, size_t start) {
+    size_t found = search_twoway(h + start, hl - start, n, nl, 0);
+    return found == MEM_NPOS ? MEM_NPOS : start + found;
+}
+
+/*! \brief Find the first match at or after \c start.
+ *
+ * Candidates come from \c memchr on the first byte.  Requires
+ * \c nl >= 2 and \c nl <= \c hl. */
+static size_t
+search_find_scalar(const unsigned char* h, size_t hl, const unsigned char* n,
+                   size_t nl, size_t start) {
+    size_t last = hl - nl;
+    size_t wasted = 0;
+    size_t pos = start;
+    const unsigned char* found;
+    while (pos <= last) {
+        found = memchr(h + pos, n[0], last - pos + 1);
+        if (!found) {
+            break;
+        }
+        pos = found - h;
+        if (h[pos + nl - 1] == n[nl - 1] &&
+            memcmp(h + pos + 1, n + 1, nl - 2) == 0) {
+            return pos;
+        }
+        ++pos;
+        wasted += nl;
+        if (wasted > pos - start + SEARCH_SLACK * nl) {
+            return search_twoway_from(h, hl, n, nl, pos);
+        }
+    }
+    return MEM_NPOS;
+}
+
+/*! \brief Find the last match before \c end.
+ *
+ * Requires \c nl >= 2 and \c end <= \c hl - \c nl + 1. */
+static size_t
+search_rfind_scalar(const unsigned char* h, const unsigned char* n, size_t nl,
+                    size_t end) {
+    size_t wasted = 0;
+    size_t pos = end;
+    while (pos) {
+        --pos;
+        if (h[pos] == n[0] && h[pos + nl - 1] == n[nl - 1]) {
+            if (memcmp(h + pos + 1, n + 1, nl - 2) == 0) {
+                return pos;
+            }
+            wasted += nl;
+            if (wasted > end - pos + SEARCH_SLACK * nl) {
+                return search_twoway(h, pos + nl - 1, n, nl, 1);
+            }
+        }
+    }
+    return MEM_NPOS;
+}
+
+#ifdef CPU_X86
+/* The vector filters test a block of consecutive positions at once:
+ * a lane is a candidate if the haystack matches the first byte of
+ * the needle there and the last byte \c nl - 1 bytes later. */
+
+__attribute__((target("sse2"))) static size_t
+search_find_sse2(const unsigned char* h, size_t hl, const unsigned char* n,
+                 size_t nl) {
+    const __m128i first = _mm_set1_epi8((char)n[0]);
+    const __m128i last = _mm_set1_epi8((char)n[nl - 1]);
+    size_t wasted = 0;
+    size_t i;
+    for (i = 0; hl - i >= nl + 15; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(h + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(h + i + nl - 1));
+        unsigned mask = (unsigned)_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+        while (mask) {
+            size_t pos = i + __builtin_ctz(mask);
+            if (memcmp(h + pos + 1, n + 1, nl - 2) == 0) {
+                return pos;
+            }
+            wasted += nl;
+            mask &= mask - 1;
+        }
+        if (wasted > i + SEARCH_SLACK * nl) {
+            return search_twoway_from(h, hl, n, nl, i + 16);
+        }
+    }
+    return search_find_scalar(h, hl, n, nl, i);
+}
+
+__attribute__((target("avx2"))) static size_t
+search_find_avx2(const unsigned char* h, size_t hl, const unsigned char* n,
+                 size_t nl) {
+    const __m256i first = _mm256_set1_epi8((char)n[0]);
+    const __m256i last = _mm256_set1_epi8((char)n[nl - 1]);
+    size_t wasted = 0;
+    size_t i;
+    for (i = 0; hl - i >= nl + 31; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(h + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(h + i + nl - 1));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(
+            _mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+        while (mask) {
+            size_t pos = i + __builtin_ctz(mask);
+            if (memcmp(h + pos + 1, n + 1, nl - 2) == 0) {
+                return pos;
+            }
+            wasted += nl;
+            mask &= mask - 1;
+        }
+        if (wasted > i + SEARCH_SLACK * nl) {
+            return search_twoway_from(h, hl, n, nl, i + 32);
+        }
+    }
+    return search_find_scalar(h, hl, n, nl, i);
+}
+
+__attribute__((target("sse2"))) static size_t
+search_rfind_sse2(const unsigned char* h, size_t hl, const unsigned char* n,
+                  size_t nl) {
+    const __m128i first = _mm_set1_epi8((char)n[0]);
+    const __m128i last = _mm_set1_epi8((char)n[nl - 1]);
+    const size_t positions = hl - nl + 1;
+    size_t wasted = 0;
+    size_t end;
+    for (end = positions; end >= 16; end -= 16) {
+        size_t base = end - 16;
+        __m128i a = _mm_loadu_si128((const __m128i*)(h + base));
+        __m128i b = _mm_loadu_si128((const __m128i*)(h + base + nl - 1));
+        unsigned mask = (unsigned)_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+        while (mask) {
+            unsigned bit = 31 - __builtin_clz(mask);
+            if (memcmp(h + base + bit + 1, n + 1, nl - 2) == 0) {
+                return base + bit;
+            }
+            wasted += nl;
+            mask ^= 1u << bit;
+        }
+        if (wasted > positions - base + SEARCH_SLACK * nl) {
+            return search_twoway(h, base + nl - 1, n, nl, 1);
+        }
+    }
+    return search_rfind_scalar(h, n, nl, end);
+}
+
+__attribute__((target("avx2"))) static size_t
+search_rfind_avx2(const unsigned char* h, size_t hl, const unsigned char* n,
+                  size_t nl) {
+    const __m256i first = _mm256_set1_epi8((char)n[0]);
+    const __m256i last = _mm256_set1_epi8((char)n[nl - 1]);
+    const size_t positions = hl - nl + 1;
+    size_t wasted = 0;
+    size_t end;
+    for (end = positions; end >= 32; end -= 32) {
+        size_t base = end - 32;
+        __m256i a = _mm256_loadu_si256((const __m256i*)(h + base));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(h + base + nl - 1));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(
+            _mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+        while (mask) {
+            unsigned bit = 31 - __builtin_clz(mask);
+            if (memcmp(h + base + bit + 1, n + 1, nl - 2) == 0) {
+                return base + bit;
+            }
+            wasted += nl;
+            mask ^= (uint32_t)1 << bit;
+        }
+        if (wasted > positions - base + SEARCH_SLACK * nl) {
+            return search_twoway(h, base + nl - 1, n, nl, 1);
+        }
+    }
+    return search_rfind_scalar(h, n, nl, end);
+}
+
+__attribute__((target("sse2"))) static size_t
+search_rfind_byte_sse2(const unsigned char* h, size_t hl, unsigned char byte) {
+    const __m128i needle = _mm_set1_epi8((char)byte);
+    size_t end;
+    for (end = hl; end >= 16; end -= 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*)(h + end - 16));
+        unsigned mask =
+            (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(block, needle));
+        if (mask) {
+            return end - 16 + (31 - __builtin_clz(mask));
+        }
+    }
+    while (end) {
+        --end;
+        if (h[end] == byte) {
+            return end;
+        }
+    }
+    return MEM_NPOS;
+}
+
+/*! \brief Test every byte for membership in a set at once.
+ *
+ * \c low_rows[x] has bit \c y set if the byte \c 0xYX is in the set,
+ * for \c y < 8, and \c high_rows likewise for \c y >= 8.  \c pshufb
+ * zeroes lanes whose index has the top bit set, which selects the
+ * right table for free. */
+__attribute__((target("ssse3"))) static size_t
+search_find_any_ssse3(const unsigned char* h, size_t hl,
+                      const unsigned char* low_rows,
+                      const unsigned char* high_rows,
+                      const unsigned char* bitset) {
+    const __m128i low = _mm_loadu_si128((const __m128i*)low_rows);
+    const __m128i high = _mm_loadu_si128((const __m128i*)high_rows);
+    const __m128i bits =
+        _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    const __m128i top = _mm_set1_epi8(-128);
+    size_t i;
+    for (i = 0; i + 16 <= hl; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*)(h + i));
+        __m128i rows = _mm_or_si128(
+            _mm_shuffle_epi8(low, block),
+            _mm_shuffle_epi8(high, _mm_xor_si128(block, top)));
+        __m128i bit = _mm_shuffle_epi8(
+            bits, _mm_and_si128(_mm_srli_epi16(block, 4), nibble));
+        unsigned mask = (unsigned)_mm_movemask_epi8(
+            _mm_cmpeq_epi8(_mm_and_si128(rows, bit), bit));
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    for (; i != hl; ++i) {
+        if (bitset[h[i] >> 3] & (1 << (h[i] & 7))) {
+            return i;
+        }
+    }
+    return MEM_NPOS;
+}
+
+__attribute__((target("sse2"))) static size_t
+search_count_byte_sse2(const unsigned char* h, size_t hl, unsigned char byte) {
+    const __m128i needle = _mm_set1_epi8((char)byte);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i total = _mm_setzero_si128();
+    uint64_t sums[2];
+    size_t count;
+    size_t i = 0;
+    while (hl - i >= 16) {
+        /* Each lane counts down by one per match, so it can only run
+         * 255 blocks before the bytes are summed with psadbw. */
+        __m128i lanes = _mm_setzero_si128();
+        size_t blocks = (hl - i) / 16;
+        if (blocks > 255) {
+            blocks = 255;
+        }
+        for (; blocks; --blocks, i += 16) {
+            __m128i block = _mm_loadu_si128((const __m128i*)(h + i));
+            lanes = _mm_sub_epi8(lanes, _mm_cmpeq_epi8(block, needle));
+        }
+        total = _mm_add_epi64(total, _mm_sad_epu8(lanes, zero));
+    }
+    _mm_storeu_si128((__m128i*)sums, total);
+    count = (size_t)(sums[0] + sums[1]);
+    for (; i != hl; ++i) {
+        count += h[i] == byte;
+    }
+    return count;
+}
+#endif
+
+size_t
+mem_find(const char* haystack, size_t haystack_len, const char* needle,
+         size_t needle_len) {
+    const unsigned char* h = (const unsigned char*)haystack;
+    const unsigned char* n = (const unsigned char*)needle;
+    const void* found;
+    if (needle_len == 0) {
+        return 0;
+    }
+    if (needle_len > haystack_len) {
+        return MEM_NPOS;
+    }
+    if (needle_len == 1) {
+        found = memchr(haystack, needle[0], haystack_len);
+        return found ? (size_t)((const char*)found - haystack) : MEM_NPOS;
+    }
+    if (needle_len > SEARCH_TWOWAY_MIN) {
+        return search_twoway(h, haystack_len, n, needle_len, 0);
+    }
+#ifdef CPU_X86
+    if (cpu_features() & CPU_AVX2) {
+        return search_find_avx2(h, haystack_len, n, needle_len);
+    }
+    if (cpu_features() & CPU_SSE2) {
+        return search_find_sse2(h, haystack_len, n, needle_len);
+    }
+#endif
+    return search_find_scalar(h, haystack_len, n, needle_len, 0);
+}
+
+size_t
+mem_rfind(const char* haystack, size_t haystack_len, const char* needle,
+          size_t needle_len) {
+    const unsigned char* h = (const unsigned char*)haystack;
+    const unsigned char* n = (const unsigned char*)needle;
+    if (needle_len == 0) {
+        return haystack_len;
+    }
+    if (needle_len > haystack_len) {
+        return MEM_NPOS;
+    }
+    if (needle_len == 1) {
+        return mem_rfind_byte(haystack, haystack_len, needle[0]);
+    }
+    if (needle_len > SEARCH_TWOWAY_MIN) {
+        return search_twoway(h, haystack_len, n, needle_len, 1);
+    }
+#ifdef CPU_X86
+    if (cpu_features() & CPU_AVX2) {
+        return search_rfind_avx2(h, haystack_len, n, needle_len);
+    }
+    if (cpu_features() & CPU_SSE2) {
+        return search_rfind_sse2(h, haystack_len, n, needle_len);
+    }
+#endif
+    return search_rfind_scalar(h, n, needle_len, haystack_len - needle_len + 1);
+}
+
+size_t
+mem_rfind_byte(const char* haystack, size_t haystack_len, char byte) {
+    const unsigned char* h = (const unsigned char*)haystack;
+    size_t end = haystack_len;
+#ifdef CPU_X86
+    if (cpu_features() & CPU_SSE2) {
+        return search_rfind_byte_sse2(h, haystack_len, (unsigned char)byte);
+    }
+#endif
+    while (end) {
+        --end;
+        if (h[end] == (unsigned char)byte) {
+            return end;
+        }
+    }
+    return MEM_NPOS;
+}
+
+size_t
+mem_find_any(const char* haystack, size_t haystack_len, const char* set,
+             size_t set_len) {
+    const unsigned char* h = (const unsigned char*)haystack;
+    unsigned char bitset[32];
+    size_t i;
+    if (set_len == 0) {
+        return MEM_NPOS;
+    }
+    if (set_len == 1) {
+        return mem_find(haystack, haystack_len, set, 1);
+    }
+    memset(bitset, 0, sizeof(bitset));
+    for (i = 0; i != set_len; ++i) {
+        unsigned char c = (unsigned char)set[i];
+        bitset[c >> 3] |= 1 << (c & 7);
+    }
+#ifdef CPU_X86
+    if (cpu_features() & CPU_SSSE3) {
+        unsigned char low_rows[16];
+        unsigned char high_rows[16];
+        memset(low_rows, 0, sizeof(low_rows));
+        memset(high_rows, 0, sizeof(high_rows));
+        for (i = 0; i != set_len; ++i) {
+            unsigned char c = (unsigned char)set[i];
+            if (c < 0x80) {
+                low_rows[c & 15] |= 1 << (c >> 4);
+            } else {
+                high_rows[c & 15] |= 1 << ((c >> 4) - 8);
+            }
+        }
+        return search_find_any_ssse3(h, haystack_len, low_rows, high_rows,
+                                     bitset);
+    }
+#endif
+    for (i = 0; i != haystack_len; ++i) {
+        if (bitset[h[i] >> 3] & (1 << (h[i] & 7))) {
+            return i;
+        }
+    }
+    return MEM_NPOS;
+}
+
+size_t
+mem_count(const char* haystack, size_t haystack_len, const char* needle,
+          size_t needle_len) {
+    size_t count = 0;
+    size_t pos = 0;
+    size_t found;
+    if (needle_len == 0) {
+        return haystack_len + 1;
+    }
+    if (needle_len == 1) {
+#ifdef CPU_X86
+        if (cpu_features() & CPU_SSE2) {
+            return search_count_byte_sse2((const unsigned char*)haystack,
+                                          haystack_len, (unsigned char)needle[0]);
+        }
+#endif
+        for (; pos != haystack_len; ++pos) {
+            count += haystack[pos] == needle[0];
+        }
+        return count;
+    }
+    while ((found = mem_find(haystack + pos, haystack_len - pos, needle,
+                             needle_len)) != MEM_NPOS) {
+        ++count;
+        pos += found + needle_len;
+    }
+    return count;
+}
+
+#ifdef TEST_MODE
+#include "test.h"
+
+static unsigned long search_test_seed = 1;
+
+static unsigned
+search_test_rand(void) {
+    search_test_seed = search_test_seed * 1103515245 + 12345;
+    return (unsigned)(search_test_seed / 65536) % 32768;
+}
+
+static size_t
+search_naive_find(const unsigned char* h, size_t hl, const unsigned char* n,
+                  size_t nl) {
+    size_t i;
+    for (i = 0; i + nl <= hl; ++i) {
+        if (memcmp(h + i, n, nl) == 0) {
+            return i;
+        }
+    }
+    return MEM_NPOS;
+}
+
+static size_t
+search_naive_rfind(const unsigned char* h, size_t hl, const unsigned char* n,
+                   size_t nl) {
+    size_t i;
+    for (i = hl - nl + 1; i--;) {
+        if (memcmp(h + i, n, nl) == 0) {
+            return i;
+        }
+    }
+    return MEM_NPOS;
+}
+
+TEST(test_search_random) {
+    unsigned char h[300];
+    unsigned char n[40];
+    size_t round, i, hl, nl, expected, rexpected;
+    for (round = 0; round != 20000; ++round) {
+        /* Small alphabets produce many partial matches. */
+        unsigned alphabet = 2 + search_test_rand() % 3;
+        hl = search_test_rand() % sizeof(h);
+        nl = 2 + search_test_rand() % (round % 4 == 0 ? 38 : 6);
+        for (i = 0; i != hl; ++i) {
+            h[i] = (unsigned char)('a' + search_test_rand() % alphabet);
+        }
+        if (hl >= nl && search_test_rand() % 2) {
+            memcpy(n, h + search_test_rand() % (hl - nl + 1), nl);
+        } else {
+            for (i = 0; i != nl; ++i) {
+                n[i] = (unsigned char)('a' + search_test_rand() % alphabet);
+            }
+        }
+        if (nl > hl) {
+            ASSERT(mem_find((char*)h, hl, (char*)n, nl) == MEM_NPOS, cleanup);
+            ASSERT(mem_rfind((char*)h, hl, (char*)n, nl) == MEM_NPOS, cleanup);
+            continue;
+        }
+        expected = search_naive_find(h, hl, n, nl);
+        rexpected = search_naive_rfind(h, hl, n, nl);
+        ASSERT(mem_find((char*)h, hl, (char*)n, nl) == expected, cleanup);
+        ASSERT(mem_rfind((char*)h, hl, (char*)n, nl) == rexpected, cleanup);
+        ASSERT(search_twoway(h, hl, n, nl, 0) == expected, cleanup);
+        ASSERT(search_twoway(h, hl, n, nl, 1) == rexpected, cleanup);
+        ASSERT(search_find_scalar(h, hl, n, nl, 0) == expected, cleanup);
+        ASSERT(search_rfind_scalar(h, n, nl, hl - nl + 1) == rexpected, cleanup);
+#ifdef CPU_X86
+        ASSERT(search_find_sse2(h, hl, n, nl) == expected, cleanup);
+        ASSERT(search_rfind_sse2(h, hl, n, nl) == rexpected, cleanup);
+        if (cpu_features() & CPU_AVX2) {
+            ASSERT(search_find_avx2(h, hl, n, nl) == expected, cleanup);
+            ASSERT(search_rfind_avx2(h, hl, n, nl) == rexpected, cleanup);
+        }
+#endif
+    }
+cleanup:;
+}
+END_TEST
+
+TEST(test_search_periodic) {
+    /* Every position is a candidate for the vector filter, so these
+     * fall back to Two-Way part way through. */
+    static char h[20000];
+    char n[300];
+    size_t nl;
+    memset(h, 'a', sizeof(h));
+    for (nl = 2; nl <= sizeof(n); nl += nl < 40 ? 1 : 37) {
+        memset(n, 'a', nl);
+        n[nl - 1] = 'b';
+        ASSERT(mem_find(h, sizeof(h), n, nl) == MEM_NPOS, cleanup);
+        h[sizeof(h) - 1] = 'b';
+        ASSERT(mem_find(h, sizeof(h), n, nl) == sizeof(h) - nl, cleanup);
+        ASSERT(mem_rfind(h, sizeof(h), n, nl) == sizeof(h) - nl, cleanup);
+        h[sizeof(h) - 1] = 'a';
+
+        n[nl - 1] = 'a';
+        n[0] = 'b';
+        ASSERT(mem_rfind(h, sizeof(h), n, nl) == MEM_NPOS, cleanup);
+        h[0] = 'b';
+        ASSERT(mem_rfind(h, sizeof(h), n, nl) == 0, cleanup);
+        ASSERT(mem_find(h, sizeof(h), n, nl) == 0, cleanup);
+        h[0] = 'a';
+    }
+cleanup:;
+}
+END_TEST
+
+TEST(test_search_edges) {
+    static const char hay[] = "the quick brown fox jumps over the lazy dog";
+    const size_t len = sizeof(hay) - 1;
+    ASSERT(mem_find(hay, len, "", 0) == 0, cleanup);
+    ASSERT(mem_rfind(hay, len, "", 0) == len, cleanup);
+    ASSERT(mem_find(hay, len, "the", 3) == 0, cleanup);
+    ASSERT(mem_rfind(hay, len, "the", 3) == 31, cleanup);
+    ASSERT(mem_find(hay, len, "o", 1) == 12, cleanup);
+    ASSERT(mem_rfind(hay, len, "o", 1) == 41, cleanup);
+    ASSERT(mem_rfind_byte(hay, len, 't') == 31, cleanup);
+    ASSERT(mem_rfind_byte(hay, len, 'X') == MEM_NPOS, cleanup);
+    ASSERT(mem_find(hay, 3, "quick", 5) == MEM_NPOS, cleanup);
+    ASSERT(mem_find(hay, len, "\0", 1) == MEM_NPOS, cleanup);
+    ASSERT(mem_find("a\0b\0c", 5, "b\0c", 3) == 2, cleanup);
+    ASSERT(mem_count(hay, len, "o", 1) == 4, cleanup);
+    ASSERT(mem_count(hay, len, "the", 3) == 2, cleanup);
+    ASSERT(mem_count("aaaa", 4, "aa", 2) == 2, cleanup);
+    ASSERT(mem_count("aaaaa", 5, "aa", 2) == 2, cleanup);
+    ASSERT(mem_count("abc", 3, "", 0) == 4, cleanup);
+    ASSERT(mem_count("abc", 3, "abcd", 4) == 0, cleanup);
+cleanup:;
+}
+END_TEST
+
+TEST(test_search_count) {
+    static char h[5000];
+    size_t i, hl, expected;
+    for (i = 0; i != sizeof(h); ++i) {
+        h[i] = (char)(search_test_rand() % 4 == 0 ? 'x' : 0xC3);
+    }
+    /* Long enough to flush the byte counters. */
+    for (hl = 0; hl <= sizeof(h); hl += hl < 100 ? 1 : 613) {
+        expected = 0;
+        for (i = 0; i != hl; ++i) {
+            expected += h[i] == 'x';
+        }
+        ASSERT(mem_count(h, hl, "x", 1) == expected, cleanup);
+        expected = 0;
+        for (i = 0; i + 2 <= hl; ++i) {
+            if (h[i] == 'x' && h[i + 1] == 'x') {
+                ++expected;
+                ++i;
+            }
+        }
+        ASSERT(mem_count(h, hl, "xx", 2) == expected, cleanup);
+    }
+cleanup:;
+}
+END_TEST
+
+TEST(test_search_find_any) {
+    char h[100];
+    char set[64];
+    size_t round, i, j, hl, set_len, expected;
+    for (round = 0; round != 5000; ++round) {
+        hl = search_test_rand() % sizeof(h);
+        set_len = search_test_rand() % (round % 2 ? 4 : sizeof(set));
+        for (i = 0; i != hl; ++i) {
+            h[i] = (char)search_test_rand();
+        }
+        for (i = 0; i != set_len; ++i) {
+            set[i] = (char)search_test_rand();
+        }
+        expected = MEM_NPOS;
+        for (i = 0; i != hl && expected == MEM_NPOS; ++i) {
+            for (j = 0; j != set_len; ++j) {
+                if (h[i] == set[j]) {
+                    expected = i;
+                    break;
+                }
+            }
+        }
+        ASSERT(mem_find_any(h, hl, set, set_len) == expected, cleanup);
+    }
+    ASSERT(mem_find_any("hello, world", 12, " ,", 2) == 5, cleanup);
+    ASSERT(mem_find_any("\xC3\xA9t\xC3\xA9", 5, "\xA9t", 2) == 1, cleanup);
+    ASSERT(mem_find_any("hello", 5, "xyz", 3) == MEM_NPOS, cleanup);
+cleanup:;
+}
+END_TEST
+
+void test_search(void) {
+    RUN(test_search_random);
+    RUN(test_search_periodic);
+    RUN(test_search_edges);
+    RUN(test_search_count);
+    RUN(test_search_find_any);
+}
+#endif
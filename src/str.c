@@ -5,13 +5,22 @@
  * Copyright (c) 2017 Chris Gregory czipperz@gmail.com
  */
 
+/* Define the out of line versions of the inline accessors. */
+#undef CUTIL_INLINE
+
 #include "str.h"
+#include "atomic.h"
 #include <assert.h>
 #include <glib.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include "rpmalloc.h"
+#include "utf8.h"
+#include "search.h"
+#include "internal.h"
+#include "str_internal.h"
+#include "hashmap.h"
 
 /*! \brief The representation of a \c str that has allocated its
  *  contents.
@@ -29,38 +38,69 @@ struct str_alloc {
      *
      * To get the capacity use
 \code{.c}
-(str._cap >> 1)
+(str._cap >> 3)
 \endcode
+     * The low bit is always set.  The next bit is set if the contents
+     * are shared (see \c str_shared).  The third bit is set if the
+     * hash slot holds the hash of the contents (see \c
+     * str_hash_cached()).
      */
     size_t _cap;
 };
 typedef struct str_alloc str_alloc;
 
-static void
-str_assert_(int cond, const char* condstr,
-            const char* file, int line) {
-    if (!cond) {
-        printf("%s:%d: Assertion failed: %s", file, line, condstr);
-        abort();
-    }
-}
-#define str_assert(cond) (str_assert_(cond, #cond, __FILE__, __LINE__))
+/*! \brief The header in front of the contents of a shared str.
+ *
+ * Shared contents are never modified.  A str that wants to modify
+ * them copies them first.  The capacity of a shared str is its
+ * length. */
+struct str_shared {
+    /*! \brief The number of strs using the contents. */
+    size_t refs;
+};
+typedef struct str_shared str_shared;
+
+#define STR_SHARED(alloc) ((str_shared*)((alloc)->str - sizeof(str_shared)))
+
+/*! \brief The offset of the hash slot in contents with a capacity of
+ *  \c cap bytes: the first aligned offset after the null terminator. */
+#define STR_HASH_OFFSET(cap) (((cap) + sizeof(size_t)) & ~(sizeof(size_t) - 1))
+
+/*! \brief The number of bytes to allocate for contents with a
+ *  capacity of \c cap bytes, including the hash slot. */
+#define STR_ALLOC_SIZE(cap) (STR_HASH_OFFSET(cap) + sizeof(size_t))
+
+/*! \brief The number of bytes that can be stored inline. */
+#define STR_INLINE_CAP (sizeof(str) - 1)
 
 /*! \brief Test if \c self 's representation is stored in the \c _data
  *  member. */
-static int
+int
 str_is_inline(const str* self) {
     return (((const char*)self)[sizeof(str) - 1] & 1) == 0;
 }
 
-static void
-str_make_inline(str* self) {
-    ((char*)self)[sizeof(str) - 1] &= ~1;
+/*! \brief Get the length of an inline string.
+ *
+ * The last byte stores the unused inline capacity shifted left past
+ * the allocated flag.  Thus a full inline string's last byte is 0
+ * and doubles as its null terminator.
+ *
+ * A zeroed string (\c STR_INIT) also has a last byte of 0.  It is
+ * told apart by its first byte being the null terminator, which is
+ * never true of a nonempty string. */
+static size_t
+str_inline_len(const str* self) {
+    size_t remaining = (unsigned char)self->_data[sizeof(str) - 1] >> 1;
+    return (STR_INLINE_CAP - remaining) * (self->_data[0] != 0);
 }
 
+/*! \brief Mark \c self as inline with a length of \c len. */
 static void
-str_make_alloc(str* self) {
-    ((char*)self)[sizeof(str) - 1] |= 1;
+str_set_inline_len(str* self, size_t len) {
+    assert(len <= STR_INLINE_CAP);
+    self->_data[len] = 0;
+    self->_data[sizeof(str) - 1] = (char)((STR_INLINE_CAP - len) << 1);
 }
 
 static int
@@ -71,7 +111,7 @@ is_little_endian(void) {
 }
 
 static size_t
-str_alloc_cap(const str_alloc* self) {
+str_alloc_flags_cap(const str_alloc* self) {
     size_t cap;
     if (is_little_endian()) {
         /* On little endian, since shift right shifts left, we have to
@@ -85,13 +125,16 @@ str_alloc_cap(const str_alloc* self) {
         /* On big endian, shift right actually shifts right one. */
         cap = self->_cap;
     }
-    return cap >> 1;
+    return cap;
+}
+
+static size_t
+str_alloc_cap(const str_alloc* self) {
+    return str_alloc_flags_cap(self) >> 3;
 }
 
 static void
-str_alloc_set_cap(str_alloc* self, size_t cap) {
-    cap <<= 1;
-    cap |= 1;
+str_alloc_set_flags_cap(str_alloc* self, size_t cap) {
     if (is_little_endian()) {
         /* Put first byte at the end */
         char* _cap = (char*)&self->_cap;
@@ -103,16 +146,89 @@ str_alloc_set_cap(str_alloc* self, size_t cap) {
     }
 }
 
+static void
+str_alloc_set_cap(str_alloc* self, size_t cap) {
+    str_alloc_set_flags_cap(self, cap << 3 | 1);
+}
+
+/*! \brief Test if \c self 's contents are shared with other strs. */
+static int
+str_is_shared(const str* self) {
+    return !str_is_inline(self) &&
+           (str_alloc_flags_cap((const str_alloc*)self) & 2) != 0;
+}
+
+/*! \brief Test if \c self 's hash slot holds the hash of its
+ *  contents. */
+static int
+str_is_hashed(const str* self) {
+    return !str_is_inline(self) &&
+           (str_alloc_flags_cap((const str_alloc*)self) & 4) != 0;
+}
+
+static size_t*
+str_hash_slot(const str_alloc* self) {
+    return (size_t*)(self->str + STR_HASH_OFFSET(str_alloc_cap(self)));
+}
+
+/*! \brief Get the cached hash of \c self, which must be hashed. */
+static size_t
+str_cached_hash(const str* self) {
+    size_t* slot = str_hash_slot((const str_alloc*)self);
+    /* Sharers may be storing the same hash concurrently. */
+    return str_is_shared(self) ? ATOMIC_LOAD_SIZE(slot) : *slot;
+}
+
+/*! \brief Forget the cached hash before the contents change. */
+static void
+str_drop_hash(str* self) {
+    if (str_is_hashed(self)) {
+        str_alloc* alloc = (str_alloc*)self;
+        str_alloc_set_flags_cap(alloc, str_alloc_flags_cap(alloc) & ~(size_t)4);
+    }
+}
+
+/*! \brief Drop a reference to shared contents, freeing them if it was
+ *  the last. */
+static void
+str_release_shared(str_alloc* self) {
+    str_shared* shared = STR_SHARED(self);
+    if (ATOMIC_FETCH_ADD_SIZE(&shared->refs, (size_t)-1) == 1) {
+        rpfree(shared);
+    }
+}
+
+/*! \brief Copy shared contents into a private allocation of \c
+ *  new_cap bytes, or the length if that is more. */
+static int
+str_unshare_cap(str* self, size_t new_cap) {
+    str_alloc* alloc = (str_alloc*)self;
+    char* ptr;
+    if (new_cap < alloc->blen) {
+        new_cap = alloc->blen;
+    }
+    if (!(ptr = rpmalloc(STR_ALLOC_SIZE(new_cap)))) {
+        return -1;
+    }
+    memcpy(ptr, alloc->str, alloc->blen + 1);
+    str_release_shared(alloc);
+    alloc->str = ptr;
+    str_alloc_set_cap(alloc, new_cap);
+    return 0;
+}
+
 static int
 str_reserve_internal(str* self, size_t new_cap_bytes) {
     char* ptr;
+    if (str_is_shared(self)) {
+        return str_unshare_cap(self, new_cap_bytes);
+    }
     if (str_is_inline(self)) {
-        if (new_cap_bytes < sizeof(str) - 1) {
+        if (new_cap_bytes <= STR_INLINE_CAP) {
             return 0;
         }
-        if ((ptr = rpmalloc(new_cap_bytes * sizeof(char)))) {
-            /* use bytes strlen */
-            const size_t len = strlen(self->_data);
+        if ((ptr = rpmalloc(STR_ALLOC_SIZE(new_cap_bytes)))) {
+            const size_t len = str_inline_len(self);
             memcpy(ptr, self, len + 1);
             ((str_alloc*)self)->blen = len;
         }
@@ -121,8 +237,7 @@ str_reserve_internal(str* self, size_t new_cap_bytes) {
             /* _cap has a 1 bit at the end */
             new_cap_bytes = str_alloc_cap((str_alloc*)self) * 2;
         }
-        ptr = rprealloc(((str_alloc*)self)->str,
-                        new_cap_bytes * sizeof(char));
+        ptr = rprealloc(((str_alloc*)self)->str, STR_ALLOC_SIZE(new_cap_bytes));
     } else {
         return 0;
     }
@@ -134,6 +249,15 @@ str_reserve_internal(str* self, size_t new_cap_bytes) {
     return 0;
 }
 
+int
+str_reserve_more(str* self, size_t len) {
+    size_t self_len = str_len_bytes(self);
+    if (len > (size_t)-1 - 1 - self_len) {
+        return -1;
+    }
+    return str_reserve_internal(self, self_len + len);
+}
+
 static int
 _utf32_v(uint32_t character) {
     return g_unichar_validate(character);
@@ -141,7 +265,7 @@ _utf32_v(uint32_t character) {
 
 static int
 _utf8_v(const char* str, size_t len) {
-    return g_utf8_validate(str, len, 0);
+    return utf8_validate(str, len) == len;
 }
 
 static size_t
@@ -151,7 +275,7 @@ _utf32_to_utf8(uint32_t elem, char* outbuf) {
 
 static size_t
 _utf8_strlen_characters(const char* str, size_t len) {
-    return g_utf8_strlen(str, len);
+    return utf8_count_chars(str, len);
 }
 
 void
@@ -159,7 +283,9 @@ str_init(str* self) { memset(self, 0, sizeof(str)); }
 
 void
 str_destroy(str* self) {
-    if (!str_is_inline(self)) {
+    if (str_is_shared(self)) {
+        str_release_shared((str_alloc*)self);
+    } else if (!str_is_inline(self)) {
         rpfree(((str_alloc*)self)->str);
     }
     str_init(self);
@@ -175,6 +301,8 @@ str_cbegin(const str* self) {
 }
 char*
 str_begin(str* self) {
+    /* The contents may be modified through the pointer. */
+    str_drop_hash(self);
     return (char*)str_cbegin(self);
 }
 
@@ -184,13 +312,14 @@ str_cend(const str* self) {
 }
 char*
 str_end(str* self) {
+    str_drop_hash(self);
     return (char*)str_cend(self);
 }
 
 size_t
 str_len_bytes(const str* self) {
     if (str_is_inline(self)) {
-        return strlen(self->_data);
+        return str_inline_len(self);
     } else {
         return ((const str_alloc*)self)->blen;
     }
@@ -201,10 +330,22 @@ str_len_characters(const str* self) {
     return _utf8_strlen_characters(str_cbegin(self), str_len_bytes(self));
 }
 
+size_t
+str_char_to_byte(const str* self, size_t char_index) {
+    return utf8_char_to_byte(str_cbegin(self), str_len_bytes(self),
+                             char_index);
+}
+
+size_t
+str_byte_to_char(const str* self, size_t byte_index) {
+    cutil_assert(byte_index <= str_len_bytes(self));
+    return utf8_byte_to_char(str_cbegin(self), byte_index);
+}
+
 size_t
 str_cap(const str* self) {
     if (str_is_inline(self)) {
-        return sizeof(str) - 1;
+        return STR_INLINE_CAP;
     } else {
         return str_alloc_cap((const str_alloc*)self);
     }
@@ -213,23 +354,24 @@ str_cap(const str* self) {
 int
 str_reserve(str* self, size_t new_cap) {
     char* ptr;
-    if (new_cap < str_cap(self)) {
+    if (str_is_shared(self)) {
+        return str_unshare_cap(self, new_cap);
+    }
+    if (new_cap <= str_cap(self)) {
         /* If the new_cap can be stored inline and we are inline,
          * immediately return */
         return 0;
     }
     if (str_is_inline(self)) {
         /* Inline -> Allocated */
-        if ((ptr = rpmalloc((new_cap + 1) * sizeof(char)))) {
-            /* use bytes strlen */
-            const size_t len = strlen((const char*)self);
+        if ((ptr = rpmalloc(STR_ALLOC_SIZE(new_cap)))) {
+            const size_t len = str_inline_len(self);
             memcpy(ptr, self, len + 1);
             ((str_alloc*)self)->blen = len;
         }
     } else {
         /* Expand allocated space */
-        ptr = rprealloc(((str_alloc*)self)->str,
-                        (new_cap + 1) * sizeof(char));
+        ptr = rprealloc(((str_alloc*)self)->str, STR_ALLOC_SIZE(new_cap));
     }
     if (!ptr) {
         return -1;
@@ -243,19 +385,20 @@ int
 str_shrink_to_size(str* self) {
     assert(self);
 
-    if (str_is_inline(self)) {
+    if (str_is_inline(self) || str_is_shared(self)) {
         /* do nothing */
-    } else if (((str_alloc*)self)->blen * sizeof(char) < sizeof(str) - 1) {
+    } else if (((str_alloc*)self)->blen <= STR_INLINE_CAP) {
         /* Allocated -> Inline */
         char* ptr = ((str_alloc*)self)->str;
-        str_make_inline(self);
-        memcpy(self->_data, ptr, ((str_alloc*)self)->blen);
+        size_t len = ((str_alloc*)self)->blen;
+        memcpy(self->_data, ptr, len);
+        str_set_inline_len(self, len);
         rpfree(ptr);
     } else {
         /* reallocate */
         char* ptr;
         ptr = rprealloc(((str_alloc*)self)->str,
-                        ((str_alloc*)self)->blen * sizeof(char));
+                        STR_ALLOC_SIZE(((str_alloc*)self)->blen));
         if (!ptr) {
             return -1;
         }
@@ -267,9 +410,16 @@ str_shrink_to_size(str* self) {
 
 size_t
 str_set_len_bytes(str* self, size_t len_bytes) {
+    if (str_is_shared(self)) {
+        if (len_bytes == ((str_alloc*)self)->blen) {
+            return len_bytes;
+        }
+        cutil_assert(!str_unshare_cap(self, len_bytes));
+    }
     if (str_is_inline(self)) {
-        self->_data[len_bytes] = 0;
+        str_set_inline_len(self, len_bytes);
     } else {
+        str_drop_hash(self);
         ((str_alloc*)self)->str[len_bytes] = 0;
         ((str_alloc*)self)->blen = len_bytes;
     }
@@ -281,7 +431,7 @@ str_push_sn(str* self, const char* string, size_t len_bytes) {
     size_t self_len;
     assert(self);
     assert(string);
-    str_assert(_utf8_v(string, len_bytes));
+    cutil_assert(_utf8_v(string, len_bytes));
 
     self_len = str_len_bytes(self);
     if (str_reserve_internal(self, self_len + len_bytes)) {
@@ -307,30 +457,126 @@ int
 str_push(str* self, uint32_t elem) {
     char outbuf[6];
     size_t size;
-    str_assert(_utf32_v(elem));
+    cutil_assert(_utf32_v(elem));
 
     size = _utf32_to_utf8(elem, outbuf);
     return str_push_sn(self, outbuf, size);
 }
 
+int
+str_vappendf(str* self, const char* format, va_list args) {
+    size_t len = str_len_bytes(self);
+    size_t avail = str_cap(self) - len;
+    va_list copy;
+    int written;
+    assert(format);
+
+    if (str_is_shared(self)) {
+        if (str_unshare(self)) {
+            return -1;
+        }
+    }
+
+    /* The inline buffer and heap allocations both have room for a
+     * null terminator past the capacity. */
+    va_copy(copy, args);
+    written = vsnprintf(str_begin(self) + len, avail + 1, format, copy);
+    va_end(copy);
+    if (written >= 0 && (size_t)written > avail) {
+        /* A truncated attempt overwrote the terminator and maybe the
+         * inline length. */
+        str_set_len_bytes(self, len);
+        if (str_reserve_internal(self, len + written)) {
+            return -1;
+        }
+        written = vsnprintf(str_begin(self) + len, written + 1, format, args);
+    }
+    if (written < 0) {
+        str_set_len_bytes(self, len);
+        return -1;
+    }
+    cutil_assert(_utf8_v(str_cbegin(self) + len, written));
+    str_set_len_bytes(self, len + written);
+    return 0;
+}
+int
+str_appendf(str* self, const char* format, ...) {
+    va_list args;
+    int result;
+    va_start(args, format);
+    result = str_vappendf(self, format, args);
+    va_end(args);
+    return result;
+}
+
+int
+str_push_utf16(str* self, const uint16_t* string, size_t len) {
+    size_t self_len = str_len_bytes(self);
+    size_t written;
+    assert(string || !len);
+
+    if (str_reserve_internal(self,
+                             self_len + utf8_len_from_utf16(string, len))) {
+        return -1;
+    }
+    if (utf8_from_utf16(string, len, str_begin(self) + self_len, &written) !=
+        len) {
+        /* Restore the null terminator. */
+        str_set_len_bytes(self, self_len);
+        return 1;
+    }
+    str_set_len_bytes(self, self_len + written);
+    return 0;
+}
+int
+str_push_utf32(str* self, const uint32_t* string, size_t len) {
+    size_t self_len = str_len_bytes(self);
+    size_t written;
+    assert(string || !len);
+
+    if (str_reserve_internal(self,
+                             self_len + utf8_len_from_utf32(string, len))) {
+        return -1;
+    }
+    if (utf8_from_utf32(string, len, str_begin(self) + self_len, &written) !=
+        len) {
+        str_set_len_bytes(self, self_len);
+        return 1;
+    }
+    str_set_len_bytes(self, self_len + written);
+    return 0;
+}
+
+size_t
+str_to_utf32(const str* self, uint32_t* out, size_t out_len) {
+    size_t count = str_len_characters(self);
+    if (count <= out_len) {
+        utf8_to_utf32(str_cbegin(self), str_len_bytes(self), out);
+    }
+    return count;
+}
+
 int
 str_insert_sn(str* self, const char* pos,
               const char* string, size_t len_bytes) {
     size_t self_len;
+    size_t offset;
+    char* ptr;
     assert(self);
     assert(pos);
     assert(str_cbegin(self) <= pos);
     assert(pos <= str_cend(self));
-    str_assert(_utf8_v(string, len_bytes));
+    cutil_assert(_utf8_v(string, len_bytes));
 
     self_len = str_len_bytes(self);
+    offset = pos - str_cbegin(self);
     if (str_reserve_internal(self, self_len + len_bytes)) {
         return -1;
     }
-    /* removing const is safe because it is held as non-const by
-     * self. */
-    memmove((char*)pos + len_bytes, pos, self_len - (pos - str_cbegin(self)));
-    memcpy((char*)pos, string, len_bytes);
+    /* pos is invalidated if the string moved out of line. */
+    ptr = str_begin(self) + offset;
+    memmove(ptr + len_bytes, ptr, self_len - offset);
+    memcpy(ptr, string, len_bytes);
     str_set_len_bytes(self, self_len + len_bytes);
     return 0;
 }
@@ -349,7 +595,7 @@ int
 str_insert(str* self, const char* pos, uint32_t elem) {
     char outbuf[6];
     int size;
-    str_assert(_utf32_v(elem));
+    cutil_assert(_utf32_v(elem));
 
     size = _utf32_to_utf8(elem, outbuf);
     return str_insert_sn(self, pos, outbuf, size);
@@ -359,13 +605,27 @@ int
 str_copy_n(str* self, const char* string, size_t len_bytes) {
     assert(self);
     assert(string);
-    str_assert(_utf8_v(string, len_bytes));
+    cutil_assert(_utf8_v(string, len_bytes));
 
-    if (len_bytes <= sizeof(str_alloc) - 1) {
+    if (str_is_shared(self)) {
+        /* Keep the old contents alive in case string points into
+         * them. */
+        str old = *self;
+        int result;
+        str_init(self);
+        result = str_copy_n(self, string, len_bytes);
+        if (result) {
+            *self = old;
+        } else {
+            str_destroy(&old);
+        }
+        return result;
+    }
+
+    if (len_bytes <= STR_INLINE_CAP) {
         str_destroy(self);
         memcpy(self->_data, string, len_bytes);
-        self->_data[len_bytes] = 0;
-        str_make_inline(self);
+        str_set_inline_len(self, len_bytes);
         return 0;
     } else {
         if (str_reserve(self, len_bytes)) {
@@ -387,9 +647,49 @@ str_copy_str(str* self, const str* string) {
     assert(self);
     assert(string);
 
+    if (str_is_shared(string)) {
+        if (self != string) {
+            ATOMIC_FETCH_ADD_SIZE(&STR_SHARED((const str_alloc*)string)->refs, 1);
+            str_destroy(self);
+            memcpy(self, string, sizeof(str));
+        }
+        return 0;
+    }
     return str_copy_n(self, str_cbegin(string), str_len_bytes(string));
 }
 
+int
+str_share(str* self, str* source) {
+    str_alloc* alloc = (str_alloc*)source;
+    str_shared* shared;
+    assert(self);
+    assert(source);
+
+    if (self == source || str_is_shared(source) ||
+        str_len_bytes(source) <= STR_INLINE_CAP) {
+        return str_copy_str(self, source);
+    }
+    /* Move the contents behind a reference count. */
+    shared = rpmalloc(sizeof(str_shared) + STR_ALLOC_SIZE(alloc->blen));
+    if (!shared) {
+        return -1;
+    }
+    shared->refs = 1;
+    memcpy(shared + 1, alloc->str, alloc->blen + 1);
+    rpfree(alloc->str);
+    alloc->str = (char*)(shared + 1);
+    str_alloc_set_flags_cap(alloc, alloc->blen << 3 | 3);
+    return str_copy_str(self, source);
+}
+
+int
+str_unshare(str* self) {
+    if (!str_is_shared(self)) {
+        return 0;
+    }
+    return str_unshare_cap(self, ((str_alloc*)self)->blen);
+}
+
 void
 str_erase(str* self, size_t begin, size_t end) {
     str_erase_n_bytes(self, begin, end - begin);
@@ -410,14 +710,225 @@ str_erase_n_bytes(str* self, size_t begin, size_t num) {
     /*             len + 1 - begin - num); */
     /*     str_set_len_bytes(self, len - num); */
     /* } */
-    char* ptr = str_begin(self);
-    size_t len = str_len_bytes(self);
+    char* ptr;
+    size_t len;
+    if (str_is_shared(self)) {
+        cutil_assert(!str_unshare(self));
+    }
+    ptr = str_begin(self);
+    len = str_len_bytes(self);
     memmove(ptr + begin, ptr + begin + num,
             len + 1 - begin - num);
     str_set_len_bytes(self, len - num);
     assert(ptr[len-num] == 0);
 }
 
+size_t
+str_find(const str* self, size_t start, const char* needle,
+         size_t needle_len) {
+    size_t len = str_len_bytes(self);
+    size_t found;
+    cutil_assert(start <= len);
+    found = mem_find(str_cbegin(self) + start, len - start, needle, needle_len);
+    return found == MEM_NPOS ? STR_NPOS : start + found;
+}
+
+size_t
+str_rfind(const str* self, size_t end, const char* needle,
+          size_t needle_len) {
+    cutil_assert(end <= str_len_bytes(self));
+    return mem_rfind(str_cbegin(self), end, needle, needle_len);
+}
+
+size_t
+str_find_any(const str* self, size_t start, const char* set,
+             size_t set_len) {
+    size_t len = str_len_bytes(self);
+    size_t found;
+    cutil_assert(start <= len);
+    found = mem_find_any(str_cbegin(self) + start, len - start, set, set_len);
+    return found == MEM_NPOS ? STR_NPOS : start + found;
+}
+
+size_t
+str_count(const str* self, const char* needle, size_t needle_len) {
+    return mem_count(str_cbegin(self), str_len_bytes(self), needle,
+                     needle_len);
+}
+
+int
+str_eq(const str* a, const str* b) {
+    size_t len = str_len_bytes(a);
+    if (len != str_len_bytes(b)) {
+        return 0;
+    }
+    if (str_is_hashed(a) && str_is_hashed(b) &&
+        str_cached_hash(a) != str_cached_hash(b)) {
+        return 0;
+    }
+    /* Strs sharing contents are trivially equal. */
+    return str_cbegin(a) == str_cbegin(b) ||
+           memcmp(str_cbegin(a), str_cbegin(b), len) == 0;
+}
+
+int
+str_cmp(const str* a, const str* b) {
+    size_t a_len = str_len_bytes(a);
+    size_t b_len = str_len_bytes(b);
+    int cmp = memcmp(str_cbegin(a), str_cbegin(b), a_len < b_len ? a_len : b_len);
+    if (cmp) {
+        return cmp;
+    }
+    return (a_len > b_len) - (a_len < b_len);
+}
+
+size_t
+str_hash_cached(str* self) {
+    str_alloc* alloc = (str_alloc*)self;
+    size_t hash;
+    if (str_is_inline(self)) {
+        return mem_hash(self->_data, str_inline_len(self));
+    }
+    if (str_is_hashed(self)) {
+        return str_cached_hash(self);
+    }
+    hash = mem_hash(alloc->str, alloc->blen);
+    if (str_is_shared(self)) {
+        /* Every sharer stores the same value. */
+        ATOMIC_STORE_SIZE(str_hash_slot(alloc), hash);
+    } else {
+        *str_hash_slot(alloc) = hash;
+    }
+    str_alloc_set_flags_cap(alloc, str_alloc_flags_cap(alloc) | 4);
+    return hash;
+}
+
+static int
+str_points_into(const str* self, const char* ptr) {
+    return str_cbegin(self) <= ptr && ptr <= str_cend(self);
+}
+
+/*! \brief Is \c offset at the start of a character or the end. */
+static int
+str_is_boundary(const char* text, size_t len, size_t offset) {
+    return offset == len || ((unsigned char)text[offset] & 0xC0) != 0x80;
+}
+
+int
+str_replace_all(str* self, const char* needle, size_t needle_len,
+                const char* replacement, size_t replacement_len) {
+    const char* text = str_cbegin(self);
+    size_t len = str_len_bytes(self);
+    size_t count, new_len, found;
+    size_t pos = 0;
+    char* out;
+    str result;
+    assert(needle);
+    assert(replacement || !replacement_len);
+    cutil_assert(needle_len);
+    cutil_assert(_utf8_v(needle, needle_len));
+    cutil_assert(_utf8_v(replacement, replacement_len));
+
+    count = mem_count(text, len, needle, needle_len);
+    if (!count) {
+        return 0;
+    }
+
+    if (replacement_len <= needle_len && !str_is_shared(self) &&
+        !str_points_into(self, needle) && !str_points_into(self, replacement)) {
+        /* The output never catches up with the search, so compact the
+         * str in place. */
+        char* begin = str_begin(self);
+        out = begin;
+        for (; count; --count) {
+            found = mem_find(begin + pos, len - pos, needle, needle_len);
+            memmove(out, begin + pos, found);
+            out += found;
+            memcpy(out, replacement, replacement_len);
+            out += replacement_len;
+            pos += found + needle_len;
+        }
+        memmove(out, begin + pos, len - pos);
+        str_set_len_bytes(self, (out - begin) + (len - pos));
+        return 0;
+    }
+
+    if (replacement_len > needle_len &&
+        replacement_len - needle_len > (SIZE_MAX - 1 - len) / count) {
+        return -1;
+    }
+    new_len = len - count * needle_len + count * replacement_len;
+    str_init(&result);
+    if (str_reserve(&result, new_len)) {
+        return -1;
+    }
+    out = str_begin(&result);
+    for (; count; --count) {
+        found = mem_find(text + pos, len - pos, needle, needle_len);
+        memcpy(out, text + pos, found);
+        out += found;
+        memcpy(out, replacement, replacement_len);
+        out += replacement_len;
+        pos += found + needle_len;
+    }
+    memcpy(out, text + pos, len - pos);
+    str_set_len_bytes(&result, new_len);
+    /* Only now can needle and replacement be freed with self. */
+    str_destroy(self);
+    *self = result;
+    return 0;
+}
+
+int
+str_apply_edits(str* self, const str_edit* edits, size_t num_edits) {
+    const char* text = str_cbegin(self);
+    size_t len = str_len_bytes(self);
+    size_t new_len = len;
+    size_t pos = 0;
+    size_t i;
+    char* out;
+    str result;
+    assert(edits || !num_edits);
+
+    for (i = 0; i != num_edits; ++i) {
+        const str_edit* edit = &edits[i];
+        cutil_assert(pos <= edit->begin && edit->begin <= edit->end &&
+                   edit->end <= len);
+        cutil_assert(str_is_boundary(text, len, edit->begin) &&
+                   str_is_boundary(text, len, edit->end));
+        assert(edit->text || !edit->text_len);
+        cutil_assert(_utf8_v(edit->text, edit->text_len));
+        new_len -= edit->end - edit->begin;
+        if (edit->text_len > SIZE_MAX - 1 - new_len) {
+            return -1;
+        }
+        new_len += edit->text_len;
+        pos = edit->end;
+    }
+    if (!num_edits) {
+        return 0;
+    }
+
+    str_init(&result);
+    if (str_reserve(&result, new_len)) {
+        return -1;
+    }
+    out = str_begin(&result);
+    pos = 0;
+    for (i = 0; i != num_edits; ++i) {
+        memcpy(out, text + pos, edits[i].begin - pos);
+        out += edits[i].begin - pos;
+        memcpy(out, edits[i].text, edits[i].text_len);
+        out += edits[i].text_len;
+        pos = edits[i].end;
+    }
+    memcpy(out, text + pos, len - pos);
+    str_set_len_bytes(&result, new_len);
+    str_destroy(self);
+    *self = result;
+    return 0;
+}
+
 #ifdef TEST_MODE
 #include "test.h"
 
@@ -602,6 +1113,479 @@ TEST(test_str_insert) {
 
     ASSERT(strcmp(str_cbegin(&s), "hello") == 0, cleanup);
 
+    /* Inserting into an inline string so it has to allocate. */
+    ASSERT(!str_insert_s(&s, str_cbegin(&s) + 2, "0123456789abcdefghijklmnop"),
+           cleanup);
+    ASSERT(!str_is_inline(&s), cleanup);
+    ASSERT(strcmp(str_cbegin(&s), "he0123456789abcdefghijklmnopllo") == 0, cleanup);
+
+cleanup:
+    str_destroy(&s);
+}
+END_TEST
+
+TEST(test_str_inline_len) {
+    str s = STR_INIT;
+    size_t i;
+    ASSERT(str_len_bytes(&s) == 0, cleanup);
+    for (i = 1; i <= STR_INLINE_CAP; ++i) {
+        ASSERT(!str_push(&s, 'a' + (i % 26)), cleanup);
+        ASSERT(str_is_inline(&s), cleanup);
+        ASSERT(str_len_bytes(&s) == i, cleanup);
+        ASSERT(strlen(str_cbegin(&s)) == i, cleanup);
+        ASSERT(str_cend(&s) == str_cbegin(&s) + i, cleanup);
+    }
+    ASSERT(!str_push(&s, 'z'), cleanup);
+    ASSERT(!str_is_inline(&s), cleanup);
+    ASSERT(str_len_bytes(&s) == STR_INLINE_CAP + 1, cleanup);
+    ASSERT(strlen(str_cbegin(&s)) == STR_INLINE_CAP + 1, cleanup);
+
+    str_erase_n_bytes(&s, 0, 1);
+    ASSERT(!str_shrink_to_size(&s), cleanup);
+    ASSERT(str_is_inline(&s), cleanup);
+    ASSERT(str_len_bytes(&s) == STR_INLINE_CAP, cleanup);
+    ASSERT(strlen(str_cbegin(&s)) == STR_INLINE_CAP, cleanup);
+
+    str_erase_n_bytes(&s, 0, STR_INLINE_CAP);
+    ASSERT(str_len_bytes(&s) == 0, cleanup);
+    ASSERT(str_cbegin(&s)[0] == '\0', cleanup);
+    ASSERT(!str_copy(&s, "short"), cleanup);
+    ASSERT(str_len_bytes(&s) == 5, cleanup);
+cleanup:
+    str_destroy(&s);
+}
+END_TEST
+
+TEST(test_str_char_offsets) {
+    str s = STR_INIT;
+    /* "a\u00e9\u20ac\U0001d11e" followed by 40 more 'x'. */
+    ASSERT(!str_copy(&s, "a\xC3\xA9\xE2\x82\xAC\xF0\x9D\x84\x9E"
+                         "xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx"), cleanup);
+    ASSERT(str_len_characters(&s) == 44, cleanup);
+    ASSERT(str_char_to_byte(&s, 0) == 0, cleanup);
+    ASSERT(str_char_to_byte(&s, 1) == 1, cleanup);
+    ASSERT(str_char_to_byte(&s, 2) == 3, cleanup);
+    ASSERT(str_char_to_byte(&s, 3) == 6, cleanup);
+    ASSERT(str_char_to_byte(&s, 4) == 10, cleanup);
+    ASSERT(str_char_to_byte(&s, 43) == 49, cleanup);
+    ASSERT(str_char_to_byte(&s, 44) == 50, cleanup);
+    ASSERT(str_char_to_byte(&s, 100) == 50, cleanup);
+    ASSERT(str_byte_to_char(&s, 0) == 0, cleanup);
+    ASSERT(str_byte_to_char(&s, 6) == 3, cleanup);
+    ASSERT(str_byte_to_char(&s, 10) == 4, cleanup);
+    ASSERT(str_byte_to_char(&s, 50) == 44, cleanup);
+cleanup:
+    str_destroy(&s);
+}
+END_TEST
+
+TEST(test_str_find) {
+    str s = STR_INIT;
+    size_t pos;
+    size_t hits = 0;
+    ASSERT(!str_copy(&s, "one fish, two fish, red fish, blue fish"), cleanup);
+    ASSERT(str_find(&s, 0, "fish", 4) == 4, cleanup);
+    ASSERT(str_find(&s, 5, "fish", 4) == 14, cleanup);
+    ASSERT(str_find(&s, 0, "cat", 3) == STR_NPOS, cleanup);
+    ASSERT(str_find(&s, str_len_bytes(&s), "", 0) == str_len_bytes(&s), cleanup);
+    ASSERT(str_rfind(&s, str_len_bytes(&s), "fish", 4) == 35, cleanup);
+    ASSERT(str_rfind(&s, 38, "fish", 4) == 24, cleanup);
+    ASSERT(str_rfind(&s, 3, "fish", 4) == STR_NPOS, cleanup);
+    ASSERT(str_find_any(&s, 0, ",.", 2) == 8, cleanup);
+    ASSERT(str_find_any(&s, 9, ",.", 2) == 18, cleanup);
+    ASSERT(str_count(&s, "fish", 4) == 4, cleanup);
+    ASSERT(str_count(&s, ",", 1) == 3, cleanup);
+    for (pos = str_find(&s, 0, "fish", 4); pos != STR_NPOS;
+         pos = str_find(&s, pos + 4, "fish", 4)) {
+        ++hits;
+    }
+    ASSERT(hits == 4, cleanup);
+cleanup:
+    str_destroy(&s);
+}
+END_TEST
+
+TEST(test_str_replace_all) {
+    static const char alphabet[] = "ab\xC3\xA9";
+    str s = STR_INIT;
+    str t = STR_INIT;
+    str expected = STR_INIT;
+    unsigned seed = 3;
+    size_t round;
+    ASSERT(!str_copy(&s, "one fish, two fish, red fish, blue fish"), cleanup);
+    ASSERT(!str_replace_all(&s, "fish", 4, "cat", 3), cleanup);
+    ASSERT(strcmp(str_cbegin(&s), "one cat, two cat, red cat, blue cat") == 0,
+           cleanup);
+    ASSERT(!str_replace_all(&s, "cat", 3, "\xC3\xA9l\xC3\xA9phant", 10), cleanup);
+    ASSERT(strcmp(str_cbegin(&s), "one \xC3\xA9l\xC3\xA9phant, two "
+                                  "\xC3\xA9l\xC3\xA9phant, red \xC3\xA9l"
+                                  "\xC3\xA9phant, blue \xC3\xA9l\xC3\xA9phant") == 0,
+           cleanup);
+    ASSERT(!str_replace_all(&s, "dog", 3, "x", 1), cleanup);
+    ASSERT(!str_replace_all(&s, ", ", 2, "", 0), cleanup);
+    ASSERT(strcmp(str_cbegin(&s), "one \xC3\xA9l\xC3\xA9phanttwo \xC3\xA9l"
+                                  "\xC3\xA9phantred \xC3\xA9l\xC3\xA9phantblue "
+                                  "\xC3\xA9l\xC3\xA9phant") == 0,
+           cleanup);
+
+    /* Occurrences don't overlap. */
+    ASSERT(!str_copy(&s, "aaaaa"), cleanup);
+    ASSERT(!str_replace_all(&s, "aa", 2, "b", 1), cleanup);
+    ASSERT(strcmp(str_cbegin(&s), "bba") == 0, cleanup);
+
+    /* The needle and replacement may be in the str. */
+    ASSERT(!str_copy(&s, "xyxyxyxyxyxyxyxyxyxyxyxyxyxyxy"), cleanup);
+    ASSERT(!str_replace_all(&s, str_cbegin(&s), 1, str_cbegin(&s) + 1, 1),
+           cleanup);
+    ASSERT(strcmp(str_cbegin(&s), "yyyyyyyyyyyyyyyyyyyyyyyyyyyyyy") == 0,
+           cleanup);
+
+    /* A shared str is copied, leaving the other sharer alone. */
+    ASSERT(!str_copy(&s, "a shared string long enough to be on the heap"), cleanup);
+    ASSERT(!str_share(&t, &s), cleanup);
+    ASSERT(!str_replace_all(&s, "e", 1, "E", 1), cleanup);
+    ASSERT(strcmp(str_cbegin(&s), "a sharEd string long Enough to bE on thE hEap") ==
+               0,
+           cleanup);
+    ASSERT(strcmp(str_cbegin(&t), "a shared string long enough to be on the heap") ==
+               0,
+           cleanup);
+
+    for (round = 0; round < 500; ++round) {
+        size_t len, needle_len, replacement_len, i, pos;
+        char needle[4], replacement[8];
+        /* Random strings of a, b and é so matches are frequent. */
+        str_set_len_bytes(&s, 0);
+        seed = seed * 1103515245 + 12345;
+        len = (seed >> 16) % 200;
+        for (i = 0; i < len; ++i) {
+            seed = seed * 1103515245 + 12345;
+            ASSERT(!str_push(&s, (uint32_t)((seed >> 16) % 3 == 2 ? 0xE9 :
+                                           alphabet[(seed >> 16) % 3])),
+                   cleanup);
+        }
+        for (needle_len = 0, i = 1 + round % 3; i; --i) {
+            seed = seed * 1103515245 + 12345;
+            needle[needle_len++] = (seed >> 16) % 2 ? 'a' : 'b';
+        }
+        for (replacement_len = 0, i = round % 7; i; --i) {
+            seed = seed * 1103515245 + 12345;
+            replacement[replacement_len++] = (seed >> 16) % 2 ? 'a' : 'b';
+        }
+
+        ASSERT(!str_copy_str(&expected, &s), cleanup);
+        for (pos = str_find(&expected, 0, needle, needle_len); pos != STR_NPOS;
+             pos = str_find(&expected, pos + replacement_len, needle,
+                            needle_len)) {
+            str_erase(&expected, pos, pos + needle_len);
+            ASSERT(!str_insert_sn(&expected, str_cbegin(&expected) + pos,
+                                  replacement, replacement_len),
+                   cleanup);
+        }
+        ASSERT(!str_replace_all(&s, needle, needle_len, replacement,
+                                replacement_len),
+               cleanup);
+        ASSERT(str_len_bytes(&s) == str_len_bytes(&expected), cleanup);
+        ASSERT(memcmp(str_cbegin(&s), str_cbegin(&expected),
+                      str_len_bytes(&s) + 1) == 0,
+               cleanup);
+    }
+cleanup:
+    str_destroy(&s);
+    str_destroy(&t);
+    str_destroy(&expected);
+}
+END_TEST
+
+TEST(test_str_apply_edits) {
+    str s = STR_INIT;
+    str_edit edits[4];
+    ASSERT(!str_copy(&s, "int main(void) { return 0; }"), cleanup);
+    edits[0].begin = 0;
+    edits[0].end = 3;
+    edits[0].text = "long";
+    edits[0].text_len = 4;
+    edits[1].begin = 9;
+    edits[1].end = 13;
+    edits[1].text = "";
+    edits[1].text_len = 0;
+    edits[2].begin = 24;
+    edits[2].end = 24;
+    edits[2].text = "1";
+    edits[2].text_len = 1;
+    edits[3].begin = 24;
+    edits[3].end = 25;
+    edits[3].text = "\xC3\xA9";
+    edits[3].text_len = 2;
+    ASSERT(!str_apply_edits(&s, edits, 4), cleanup);
+    ASSERT(strcmp(str_cbegin(&s), "long main() { return 1\xC3\xA9; }") == 0,
+           cleanup);
+    ASSERT(!str_apply_edits(&s, edits, 0), cleanup);
+    ASSERT(str_len_bytes(&s) == 27, cleanup);
+
+    edits[0].begin = 0;
+    edits[0].end = 27;
+    edits[0].text = "x";
+    edits[0].text_len = 1;
+    ASSERT(!str_apply_edits(&s, edits, 1), cleanup);
+    ASSERT(str_is_inline(&s) && strcmp(str_cbegin(&s), "x") == 0, cleanup);
+cleanup:
+    str_destroy(&s);
+}
+END_TEST
+
+TEST(test_str_eq_cmp) {
+    str a = STR_INIT;
+    str b = STR_INIT;
+    ASSERT(str_eq(&a, &b) && str_cmp(&a, &b) == 0, cleanup);
+    ASSERT(!str_copy(&a, "apple"), cleanup);
+    ASSERT(!str_copy(&b, "apples"), cleanup);
+    ASSERT(!str_eq(&a, &b) && str_cmp(&a, &b) < 0 && str_cmp(&b, &a) > 0,
+           cleanup);
+    ASSERT(!str_copy(&b, "apply"), cleanup);
+    ASSERT(!str_eq(&a, &b) && str_cmp(&a, &b) < 0, cleanup);
+    /* Bytes compare unsigned, so é orders after z. */
+    ASSERT(!str_copy(&b, "appl\xC3\xA9"), cleanup);
+    ASSERT(str_cmp(&b, &a) > 0, cleanup);
+    ASSERT(!str_copy(&a, "a long string that lives on the heap"), cleanup);
+    ASSERT(!str_copy(&b, "a long string that lives on the heap"), cleanup);
+    ASSERT(str_eq(&a, &b) && str_cmp(&a, &b) == 0, cleanup);
+    str_hash_cached(&a);
+    str_hash_cached(&b);
+    ASSERT(str_eq(&a, &b), cleanup);
+    str_begin(&b)[0] = 'A';
+    str_hash_cached(&b);
+    ASSERT(!str_eq(&a, &b) && str_cmp(&a, &b) > 0, cleanup);
+cleanup:
+    str_destroy(&a);
+    str_destroy(&b);
+}
+END_TEST
+
+TEST(test_str_hash_cached) {
+    str s = STR_INIT;
+    str t = STR_INIT;
+    size_t i;
+    ASSERT(str_hash_cached(&s) == mem_hash("", 0), cleanup);
+    ASSERT(!str_copy(&s, "short"), cleanup);
+    ASSERT(str_hash_cached(&s) == mem_hash("short", 5), cleanup);
+
+    ASSERT(!str_copy(&s, "a string long enough to be allocated"), cleanup);
+    for (i = 0; i < 2; ++i) {
+        ASSERT(str_hash_cached(&s) == mem_hash(str_cbegin(&s), str_len_bytes(&s)),
+               cleanup);
+    }
+    /* Every kind of modification forgets the hash. */
+    ASSERT(!str_push_s(&s, "!"), cleanup);
+    ASSERT(str_hash_cached(&s) == mem_hash(str_cbegin(&s), str_len_bytes(&s)),
+           cleanup);
+    str_begin(&s)[0] = 'A';
+    ASSERT(str_hash_cached(&s) == mem_hash(str_cbegin(&s), str_len_bytes(&s)),
+           cleanup);
+    str_erase(&s, 0, 2);
+    ASSERT(str_hash_cached(&s) == mem_hash(str_cbegin(&s), str_len_bytes(&s)),
+           cleanup);
+    ASSERT(!str_insert_s(&s, str_cbegin(&s) + 3, "xyz"), cleanup);
+    ASSERT(str_hash_cached(&s) == mem_hash(str_cbegin(&s), str_len_bytes(&s)),
+           cleanup);
+    ASSERT(!str_reserve(&s, 1000), cleanup);
+    ASSERT(str_hash_cached(&s) == mem_hash(str_cbegin(&s), str_len_bytes(&s)),
+           cleanup);
+    ASSERT(!str_replace_all(&s, "o", 1, "0", 1), cleanup);
+    ASSERT(str_hash_cached(&s) == mem_hash(str_cbegin(&s), str_len_bytes(&s)),
+           cleanup);
+    ASSERT(!str_shrink_to_size(&s), cleanup);
+    ASSERT(str_hash_cached(&s) == mem_hash(str_cbegin(&s), str_len_bytes(&s)),
+           cleanup);
+    str_set_len_bytes(&s, 30);
+    ASSERT(str_hash_cached(&s) == mem_hash(str_cbegin(&s), str_len_bytes(&s)),
+           cleanup);
+
+    /* Sharing keeps the hash until one side is modified. */
+    ASSERT(!str_share(&t, &s), cleanup);
+    ASSERT(str_hash_cached(&s) == mem_hash(str_cbegin(&s), 30), cleanup);
+    ASSERT(!str_copy_str(&t, &s), cleanup);
+    ASSERT(str_hash_cached(&t) == str_hash_cached(&s), cleanup);
+    ASSERT(!str_push_s(&t, "?"), cleanup);
+    ASSERT(str_hash_cached(&t) == mem_hash(str_cbegin(&t), 31), cleanup);
+    ASSERT(str_hash_cached(&s) == mem_hash(str_cbegin(&s), 30), cleanup);
+    ASSERT(!str_eq(&s, &t), cleanup);
+cleanup:
+    str_destroy(&s);
+    str_destroy(&t);
+}
+END_TEST
+
+/*! \brief Test that the inline accessors agree with str.c. */
+static int
+str_inline_accessors_agree(const str* self) {
+    return str_is_inline_inline(self) == str_is_inline(self) &&
+           str_cbegin_inline(self) == str_cbegin(self) &&
+           str_len_bytes_inline(self) == str_len_bytes(self) &&
+           str_cap_inline(self) == str_cap(self);
+}
+
+TEST(test_str_inline_accessors) {
+    str s = STR_INIT;
+    str t = STR_INIT;
+    size_t i;
+    ASSERT(str_inline_accessors_agree(&s), cleanup);
+    for (i = 0; i < 100; ++i) {
+        ASSERT(!str_push(&s, i % 2 ? 'x' : 0xE9), cleanup);
+        ASSERT(str_inline_accessors_agree(&s), cleanup);
+    }
+    str_hash_cached(&s);
+    ASSERT(str_inline_accessors_agree(&s), cleanup);
+    ASSERT(!str_share(&t, &s), cleanup);
+    ASSERT(str_inline_accessors_agree(&s) && str_inline_accessors_agree(&t),
+           cleanup);
+    ASSERT(!str_reserve(&s, (size_t)1 << 20), cleanup);
+    ASSERT(str_inline_accessors_agree(&s), cleanup);
+    str_set_len_bytes(&s, STR_INLINE_CAP);
+    ASSERT(!str_shrink_to_size(&s), cleanup);
+    ASSERT(str_is_inline(&s) && str_inline_accessors_agree(&s), cleanup);
+cleanup:
+    str_destroy(&s);
+    str_destroy(&t);
+}
+END_TEST
+
+TEST(test_str_appendf) {
+    str s = STR_INIT;
+    size_t i;
+    ASSERT(!str_appendf(&s, "%d-%s", 42, "abc"), cleanup);
+    ASSERT(str_is_inline(&s), cleanup);
+    ASSERT(strcmp(str_cbegin(&s), "42-abc") == 0, cleanup);
+    ASSERT(str_len_bytes(&s) == 6, cleanup);
+    /* Exactly filling the inline buffer. */
+    ASSERT(!str_appendf(&s, "%017d", 7), cleanup);
+    ASSERT(str_is_inline(&s) && str_len_bytes(&s) == STR_INLINE_CAP, cleanup);
+    ASSERT(strcmp(str_cbegin(&s) + 6, "00000000000000007") == 0, cleanup);
+    /* Spilling to the heap formats twice. */
+    ASSERT(!str_appendf(&s, "|%s|", "\xC3\xA9t\xC3\xA9"), cleanup);
+    ASSERT(!str_is_inline(&s), cleanup);
+    ASSERT(str_len_bytes(&s) == STR_INLINE_CAP + 7, cleanup);
+    ASSERT(strcmp(str_cbegin(&s) + STR_INLINE_CAP, "|\xC3\xA9t\xC3\xA9|") == 0,
+           cleanup);
+    ASSERT(!str_appendf(&s, "%s", ""), cleanup);
+    ASSERT(str_len_bytes(&s) == STR_INLINE_CAP + 7, cleanup);
+    str_destroy(&s);
+    for (i = 0; i != 1000; ++i) {
+        ASSERT(!str_appendf(&s, "%zu,", i), cleanup);
+    }
+    ASSERT(str_len_bytes(&s) == 10 * 2 + 90 * 3 + 900 * 4, cleanup);
+    ASSERT(strncmp(str_cbegin(&s) + str_len_bytes(&s) - 8, "998,999,", 8) == 0,
+           cleanup);
+cleanup:
+    str_destroy(&s);
+}
+END_TEST
+
+TEST(test_str_share) {
+    const char* long_string = "a string too long to be stored inline in a str";
+    str a = STR_INIT;
+    str b = STR_INIT;
+    str c = STR_INIT;
+    ASSERT(!str_copy(&a, long_string), cleanup);
+    ASSERT(!str_share(&b, &a), cleanup);
+    ASSERT(str_is_shared(&a) && str_is_shared(&b), cleanup);
+    ASSERT(str_cbegin(&a) == str_cbegin(&b), cleanup);
+    ASSERT(strcmp(str_cbegin(&a), long_string) == 0, cleanup);
+    ASSERT(str_cap(&a) == str_len_bytes(&a), cleanup);
+
+    /* Copying a shared str shares it. */
+    ASSERT(!str_copy_str(&c, &b), cleanup);
+    ASSERT(str_cbegin(&c) == str_cbegin(&a), cleanup);
+    ASSERT(STR_SHARED((str_alloc*)&a)->refs == 3, cleanup);
+    ASSERT(!str_copy_str(&c, &c), cleanup);
+    ASSERT(STR_SHARED((str_alloc*)&a)->refs == 3, cleanup);
+
+    /* Modifying one copies it. */
+    ASSERT(!str_push_s(&b, "!"), cleanup);
+    ASSERT(!str_is_shared(&b), cleanup);
+    ASSERT(str_cbegin(&b) != str_cbegin(&a), cleanup);
+    ASSERT(strcmp(str_cbegin(&a), long_string) == 0, cleanup);
+    ASSERT(strcmp(str_cbegin(&c), long_string) == 0, cleanup);
+    ASSERT(str_len_bytes(&b) == strlen(long_string) + 1, cleanup);
+    ASSERT(STR_SHARED((str_alloc*)&a)->refs == 2, cleanup);
+
+    str_erase_n_bytes(&c, 0, 2);
+    ASSERT(!str_is_shared(&c), cleanup);
+    ASSERT(strcmp(str_cbegin(&c), long_string + 2) == 0, cleanup);
+    ASSERT(strcmp(str_cbegin(&a), long_string) == 0, cleanup);
+    ASSERT(STR_SHARED((str_alloc*)&a)->refs == 1, cleanup);
+
+    ASSERT(!str_copy_str(&b, &a), cleanup);
+    ASSERT(!str_insert_s(&b, str_cbegin(&b) + 1, "x"), cleanup);
+    ASSERT(!str_copy_str(&c, &a), cleanup);
+    ASSERT(!str_appendf(&c, "%d", 5), cleanup);
+    ASSERT(strncmp(str_cbegin(&b), "ax ", 3) == 0, cleanup);
+    ASSERT(str_cend(&c)[-1] == '5', cleanup);
+    ASSERT(strcmp(str_cbegin(&a), long_string) == 0, cleanup);
+
+    /* Copying part of the contents into a str sharing them. */
+    ASSERT(!str_copy_str(&b, &a), cleanup);
+    ASSERT(!str_copy_n(&b, str_cbegin(&b) + 2, 30), cleanup);
+    ASSERT(strncmp(str_cbegin(&b), long_string + 2, 30) == 0, cleanup);
+    ASSERT(str_len_bytes(&b) == 30, cleanup);
+
+    ASSERT(!str_copy_str(&b, &a), cleanup);
+    str_set_len_bytes(&b, 5);
+    ASSERT(strcmp(str_cbegin(&b), "a str") == 0, cleanup);
+    ASSERT(!str_copy_str(&b, &a), cleanup);
+    ASSERT(!str_shrink_to_size(&b), cleanup);
+    ASSERT(!str_unshare(&b), cleanup);
+    ASSERT(!str_is_shared(&b) && str_is_shared(&a), cleanup);
+    str_begin(&b)[0] = 'A';
+    ASSERT(strcmp(str_cbegin(&a), long_string) == 0, cleanup);
+
+    /* The last owner frees it. */
+    ASSERT(!str_copy_str(&b, &a), cleanup);
+    str_destroy(&a);
+    ASSERT(strcmp(str_cbegin(&b), long_string) == 0, cleanup);
+    ASSERT(STR_SHARED((str_alloc*)&b)->refs == 1, cleanup);
+
+    /* Short strings are copied. */
+    ASSERT(!str_copy(&a, "short"), cleanup);
+    ASSERT(!str_share(&c, &a), cleanup);
+    ASSERT(!str_is_shared(&a) && str_is_inline(&c), cleanup);
+    ASSERT(strcmp(str_cbegin(&c), "short") == 0, cleanup);
+cleanup:
+    str_destroy(&a);
+    str_destroy(&b);
+    str_destroy(&c);
+}
+END_TEST
+
+TEST(test_str_push_utf) {
+    static const uint16_t utf16[] = {'h', 0xE9, 0x20AC, 0xD834, 0xDD1E, '!'};
+    static const uint32_t utf32[] = {'h', 0xE9, 0x20AC, 0x1D11E, '!'};
+    static const uint16_t lone[] = {'a', 0xDD1E};
+    static const uint32_t surrogate[] = {'a', 0xD800};
+    static const char expected[] = "h\xC3\xA9\xE2\x82\xAC\xF0\x9D\x84\x9E!";
+    uint32_t out[10];
+    str s = STR_INIT;
+    ASSERT(!str_push_utf16(&s, utf16, 6), cleanup);
+    ASSERT(str_is_inline(&s), cleanup);
+    ASSERT(strcmp(str_cbegin(&s), expected) == 0, cleanup);
+    ASSERT(!str_push_utf32(&s, utf32, 5), cleanup);
+    ASSERT(str_len_bytes(&s) == 2 * (sizeof(expected) - 1), cleanup);
+    ASSERT(strcmp(str_cbegin(&s) + sizeof(expected) - 1, expected) == 0, cleanup);
+
+    ASSERT(str_to_utf32(&s, 0, 0) == 10, cleanup);
+    ASSERT(str_to_utf32(&s, out, 10) == 10, cleanup);
+    ASSERT(memcmp(out, utf32, sizeof(utf32)) == 0, cleanup);
+    ASSERT(memcmp(out + 5, utf32, sizeof(utf32)) == 0, cleanup);
+
+    /* Invalid input leaves the str unchanged. */
+    ASSERT(str_push_utf16(&s, lone, 2) == 1, cleanup);
+    ASSERT(str_push_utf32(&s, surrogate, 2) == 1, cleanup);
+    ASSERT(str_len_bytes(&s) == 2 * (sizeof(expected) - 1), cleanup);
+    ASSERT(str_cend(&s)[0] == 0, cleanup);
+    str_destroy(&s);
+    ASSERT(str_push_utf16(&s, lone, 2) == 1, cleanup);
+    ASSERT(str_len_bytes(&s) == 0 && str_cbegin(&s)[0] == 0, cleanup);
+    ASSERT(!str_push_utf16(&s, lone, 0), cleanup);
 cleanup:
     str_destroy(&s);
 }
@@ -616,5 +1600,16 @@ void test_str(void) {
     RUN(test_str_copy_2);
     RUN(test_str_erase_n_bytes);
     RUN(test_str_insert);
+    RUN(test_str_inline_len);
+    RUN(test_str_char_offsets);
+    RUN(test_str_find);
+    RUN(test_str_replace_all);
+    RUN(test_str_apply_edits);
+    RUN(test_str_eq_cmp);
+    RUN(test_str_hash_cached);
+    RUN(test_str_inline_accessors);
+    RUN(test_str_appendf);
+    RUN(test_str_share);
+    RUN(test_str_push_utf);
 }
 #endif
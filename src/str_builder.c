@@ -0,0 +1,176 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2017 Chris Gregory czipperz@gmail.com
+ */
+
+#include "../str_builder.h"
+#include "../utf8.h"
+#include "str_internal.h"
+#include <assert.h>
+#include <string.h>
+
+str_builder
+str_builder_new(str* target) {
+    str_builder builder;
+    assert(target);
+    builder._target = target;
+    builder._data = str_begin(target);
+    builder._len = str_len_bytes(target);
+    /* A shared target's capacity is its length, so the first push
+     * reserves, which copies it. */
+    builder._cap = str_cap(target);
+    builder._begin = builder._len;
+    return builder;
+}
+
+/*! \brief Make room for \c needed bytes. */
+static int
+str_builder_grow(str_builder* self, size_t needed) {
+    /* Reserving copies the contents by the target's length. */
+    str_set_len_bytes(self->_target, self->_len);
+    if (str_reserve_more(self->_target, needed - self->_len)) {
+        return -1;
+    }
+    self->_data = str_begin(self->_target);
+    self->_cap = str_cap(self->_target);
+    return 0;
+}
+
+int
+str_builder_push_sn(str_builder* self, const char* string, size_t len) {
+    assert(string || !len);
+    if (len > self->_cap - self->_len &&
+        str_builder_grow(self, self->_len + len)) {
+        return -1;
+    }
+    memcpy(self->_data + self->_len, string, len);
+    self->_len += len;
+    return 0;
+}
+
+int
+str_builder_push_s(str_builder* self, const char* string) {
+    assert(string);
+    return str_builder_push_sn(self, string, strlen(string));
+}
+
+int
+str_builder_push_byte(str_builder* self, char byte) {
+    if (self->_len == self->_cap &&
+        str_builder_grow(self, self->_len + 1)) {
+        return -1;
+    }
+    self->_data[self->_len++] = byte;
+    return 0;
+}
+
+size_t
+str_builder_len(const str_builder* self) {
+    return self->_len - self->_begin;
+}
+
+int
+str_builder_finish(str_builder* self, size_t* invalid_offset) {
+    size_t appended = self->_len - self->_begin;
+    size_t valid;
+    str_set_len_bytes(self->_target, self->_len);
+    valid = utf8_validate(str_cbegin(self->_target) + self->_begin, appended);
+    if (valid == appended) {
+        return 0;
+    }
+    str_set_len_bytes(self->_target, self->_begin);
+    if (invalid_offset) {
+        *invalid_offset = valid;
+    }
+    return 1;
+}
+
+#ifdef TEST_MODE
+#include "test.h"
+
+TEST(test_str_builder_push) {
+    str s = STR_INIT;
+    str_builder builder;
+    size_t i;
+    size_t invalid;
+    ASSERT(!str_copy(&s, "x="), cleanup);
+    builder = str_builder_new(&s);
+    for (i = 0; i != 10000; ++i) {
+        ASSERT(!str_builder_push_s(&builder, i % 2 ? "\xC3\xA9" : "ab"), cleanup);
+        ASSERT(!str_builder_push_byte(&builder, ','), cleanup);
+    }
+    ASSERT(str_builder_len(&builder) == 30000, cleanup);
+    ASSERT(str_builder_finish(&builder, &invalid) == 0, cleanup);
+    ASSERT(str_len_bytes(&s) == 30002, cleanup);
+    ASSERT(strncmp(str_cbegin(&s), "x=ab,\xC3\xA9,ab,", 11) == 0, cleanup);
+    ASSERT(strcmp(str_cend(&s) - 3, "\xC3\xA9,") == 0, cleanup);
+
+    /* A character split across pushes is fine. */
+    builder = str_builder_new(&s);
+    ASSERT(!str_builder_push_sn(&builder, "\xE2\x82", 2), cleanup);
+    ASSERT(!str_builder_push_sn(&builder, "\xAC", 1), cleanup);
+    ASSERT(str_builder_finish(&builder, 0) == 0, cleanup);
+    ASSERT(str_len_bytes(&s) == 30005, cleanup);
+
+    /* Invalid bytes roll back everything since the builder started. */
+    builder = str_builder_new(&s);
+    ASSERT(!str_builder_push_s(&builder, "fine \xC3\xA9 "), cleanup);
+    ASSERT(!str_builder_push_s(&builder, "bad \xC3\x28"), cleanup);
+    ASSERT(str_builder_finish(&builder, &invalid) == 1, cleanup);
+    ASSERT(invalid == 12, cleanup);
+    ASSERT(str_len_bytes(&s) == 30005, cleanup);
+    ASSERT(strcmp(str_cend(&s) - 3, "\xE2\x82\xAC") == 0, cleanup);
+
+    /* Inline targets and truncated characters. */
+    ASSERT(!str_copy(&s, "ab"), cleanup);
+    builder = str_builder_new(&s);
+    ASSERT(!str_builder_push_s(&builder, "cd"), cleanup);
+    ASSERT(!str_builder_push_byte(&builder, (char)0xF0), cleanup);
+    ASSERT(str_builder_finish(&builder, &invalid) == 1 && invalid == 2, cleanup);
+    ASSERT(strcmp(str_cbegin(&s), "ab") == 0, cleanup);
+    builder = str_builder_new(&s);
+    for (i = 0; i != 30; ++i) {
+        ASSERT(!str_builder_push_byte(&builder, (char)('a' + i % 26)), cleanup);
+    }
+    ASSERT(str_builder_finish(&builder, 0) == 0, cleanup);
+    ASSERT(str_len_bytes(&s) == 32, cleanup);
+    ASSERT(strncmp(str_cbegin(&s), "ababcdefghijklmnopqrstuvwxyzabcd", 32) == 0,
+           cleanup);
+    builder = str_builder_new(&s);
+    ASSERT(str_builder_finish(&builder, 0) == 0 && str_len_bytes(&s) == 32,
+           cleanup);
+cleanup:
+    str_destroy(&s);
+}
+END_TEST
+
+TEST(test_str_builder_shared) {
+    str a = STR_INIT;
+    str b = STR_INIT;
+    str_builder builder;
+    ASSERT(!str_copy(&a, "a string too long to be stored inline"), cleanup);
+    ASSERT(!str_share(&b, &a), cleanup);
+    builder = str_builder_new(&b);
+    ASSERT(!str_builder_push_s(&builder, "!"), cleanup);
+    ASSERT(str_builder_finish(&builder, 0) == 0, cleanup);
+    ASSERT(strcmp(str_cbegin(&a), "a string too long to be stored inline") == 0,
+           cleanup);
+    ASSERT(strcmp(str_cbegin(&b), "a string too long to be stored inline!") == 0,
+           cleanup);
+    ASSERT(!str_share(&b, &a), cleanup);
+    builder = str_builder_new(&b);
+    ASSERT(str_builder_finish(&builder, 0) == 0, cleanup);
+    ASSERT(str_cbegin(&a) == str_cbegin(&b), cleanup);
+cleanup:
+    str_destroy(&a);
+    str_destroy(&b);
+}
+END_TEST
+
+void test_str_builder(void) {
+    RUN(test_str_builder_push);
+    RUN(test_str_builder_shared);
+}
+#endif
@@ -0,0 +1,526 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2017 Chris Gregory czipperz@gmail.com
+ */
+
+/* Case mapping for str.
+ *
+ * Runs of ASCII are mapped a vector at a time: bytes in 'A'-'Z' (or
+ * 'a'-'z') are found with one signed compare and have their 0x20 bit
+ * flipped.  A vector containing any non ASCII byte falls back to
+ * decoding characters one at a time and mapping them with glib. */
+
+#include "../str.h"
+#include "../cpu.h"
+#include "../hashmap.h"
+#include "../utf8.h"
+#include "str_internal.h"
+#include <assert.h>
+#include <glib.h>
+#include <string.h>
+
+#ifdef CPU_X86
+#include <immintrin.h>
+#endif
+
+/*! \brief Map an ASCII byte to lower or upper case. */
+static unsigned char
+str_case_ascii_byte(unsigned char c, int upper) {
+    unsigned char first = upper ? 'a' : 'A';
+    return (unsigned char)(c - first) < 26 ? c ^ 0x20 : c;
+}
+
+/*! \brief Decode the multibyte character at \c s, which is valid. */
+static size_t
+str_case_decode(const unsigned char* s, uint32_t* character) {
+    if (s[0] < 0xE0) {
+        *character = (uint32_t)(s[0] & 0x1F) << 6 | (s[1] & 0x3F);
+        return 2;
+    }
+    if (s[0] < 0xF0) {
+        *character = (uint32_t)(s[0] & 0x0F) << 12 |
+                     (uint32_t)(s[1] & 0x3F) << 6 | (s[2] & 0x3F);
+        return 3;
+    }
+    *character = (uint32_t)(s[0] & 0x07) << 18 | (uint32_t)(s[1] & 0x3F) << 12 |
+                 (uint32_t)(s[2] & 0x3F) << 6 | (s[3] & 0x3F);
+    return 4;
+}
+
+static uint32_t
+str_case_map_char(uint32_t character, int upper) {
+    return upper ? g_unichar_toupper(character) : g_unichar_tolower(character);
+}
+
+/*! \brief Simple case folding: characters that are equal ignoring
+ *  case fold to the same character. */
+static uint32_t
+str_case_fold(uint32_t character) {
+    return g_unichar_tolower(g_unichar_toupper(character));
+}
+
+#ifdef CPU_X86
+__attribute__((target("sse2"))) static __m128i
+str_case_vector_sse2(__m128i v, __m128i shift) {
+    /* Shift the letters to the bottom of the signed range. */
+    __m128i letter = _mm_cmplt_epi8(_mm_add_epi8(v, shift),
+                                    _mm_set1_epi8((char)(-128 + 26)));
+    return _mm_xor_si128(v, _mm_and_si128(letter, _mm_set1_epi8(0x20)));
+}
+
+__attribute__((target("sse2"))) static size_t
+str_case_ascii_sse2(unsigned char* dst, const unsigned char* src, size_t len,
+                    int upper) {
+    const __m128i shift = _mm_set1_epi8((char)(0x80 - (upper ? 'a' : 'A')));
+    size_t i;
+    for (i = 0; len - i >= 16; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+        if (_mm_movemask_epi8(v)) {
+            break;
+        }
+        _mm_storeu_si128((__m128i*)(dst + i), str_case_vector_sse2(v, shift));
+    }
+    return i;
+}
+
+__attribute__((target("sse2"))) static size_t
+str_case_equal_prefix_sse2(const unsigned char* a, const unsigned char* b,
+                           size_t len) {
+    const __m128i shift = _mm_set1_epi8((char)(0x80 - 'A'));
+    size_t i;
+    for (i = 0; len - i >= 16; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+        unsigned equal;
+        if (_mm_movemask_epi8(_mm_or_si128(va, vb))) {
+            break;
+        }
+        equal = (unsigned)_mm_movemask_epi8(
+            _mm_cmpeq_epi8(str_case_vector_sse2(va, shift),
+                           str_case_vector_sse2(vb, shift)));
+        if (equal != 0xFFFF) {
+            return i + __builtin_ctz(~equal);
+        }
+    }
+    return i;
+}
+
+__attribute__((target("avx2"))) static __m256i
+str_case_vector_avx2(__m256i v, __m256i shift) {
+    __m256i letter = _mm256_cmpgt_epi8(_mm256_set1_epi8((char)(-128 + 26)),
+                                       _mm256_add_epi8(v, shift));
+    return _mm256_xor_si256(v, _mm256_and_si256(letter, _mm256_set1_epi8(0x20)));
+}
+
+__attribute__((target("avx2"))) static size_t
+str_case_ascii_avx2(unsigned char* dst, const unsigned char* src, size_t len,
+                    int upper) {
+    const __m256i shift = _mm256_set1_epi8((char)(0x80 - (upper ? 'a' : 'A')));
+    size_t i;
+    for (i = 0; len - i >= 32; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(src + i));
+        if (_mm256_movemask_epi8(v)) {
+            break;
+        }
+        _mm256_storeu_si256((__m256i*)(dst + i), str_case_vector_avx2(v, shift));
+    }
+    return i;
+}
+
+__attribute__((target("avx2"))) static size_t
+str_case_equal_prefix_avx2(const unsigned char* a, const unsigned char* b,
+                           size_t len) {
+    const __m256i shift = _mm256_set1_epi8((char)(0x80 - 'A'));
+    size_t i;
+    for (i = 0; len - i >= 32; i += 32) {
+        __m256i va = _mm256_loadu_si256((const __m256i*)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i*)(b + i));
+        unsigned equal;
+        if (_mm256_movemask_epi8(_mm256_or_si256(va, vb))) {
+            break;
+        }
+        equal = (unsigned)_mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(str_case_vector_avx2(va, shift),
+                              str_case_vector_avx2(vb, shift)));
+        if (equal != 0xFFFFFFFF) {
+            return i + __builtin_ctz(~equal);
+        }
+    }
+    return i;
+}
+#endif
+
+/*! \brief Map the case of whole vectors of ASCII from \c src to \c
+ *  dst, stopping at the first vector with a non ASCII byte.
+ *
+ * \c dst may equal \c src.
+ *
+ * \return The number of bytes mapped. */
+static size_t
+str_case_ascii(unsigned char* dst, const unsigned char* src, size_t len,
+               int upper) {
+#ifdef CPU_X86
+    if (cpu_features() & CPU_AVX2) {
+        return str_case_ascii_avx2(dst, src, len, upper);
+    }
+    if (cpu_features() & CPU_SSE2) {
+        return str_case_ascii_sse2(dst, src, len, upper);
+    }
+#endif
+    (void)dst;
+    (void)src;
+    (void)len;
+    (void)upper;
+    return 0;
+}
+
+/*! \brief Find how many bytes of \c a and \c b are equal ignoring
+ *  case, a vector of ASCII at a time.
+ *
+ * Stops at a mismatch or at the first vector with a non ASCII
+ * byte. */
+static size_t
+str_case_equal_prefix(const unsigned char* a, const unsigned char* b,
+                      size_t len) {
+#ifdef CPU_X86
+    if (cpu_features() & CPU_AVX2) {
+        return str_case_equal_prefix_avx2(a, b, len);
+    }
+    if (cpu_features() & CPU_SSE2) {
+        return str_case_equal_prefix_sse2(a, b, len);
+    }
+#endif
+    (void)a;
+    (void)b;
+    (void)len;
+    return 0;
+}
+
+/*! \brief Append \c len bytes of \c src to \c out with their case
+ *  mapped. */
+static int
+str_case_map_append(str* out, const unsigned char* src, size_t len,
+                    int upper) {
+    size_t o = str_len_bytes(out);
+    size_t i = 0;
+    unsigned char* dst;
+    if (str_reserve_more(out, len)) {
+        return -1;
+    }
+    dst = (unsigned char*)str_begin(out);
+    /* There is always room for the rest of src mapped as ASCII. */
+    while (i != len) {
+        size_t n = str_case_ascii(dst + o, src + i, len - i, upper);
+        uint32_t character;
+        i += n;
+        o += n;
+        for (; i != len && src[i] < 0x80; ++i) {
+            dst[o++] = str_case_ascii_byte(src[i], upper);
+        }
+        if (i == len) {
+            break;
+        }
+        /* Mapping can make a character one byte longer. */
+        if (str_cap(out) - o < len - i + 4) {
+            str_set_len_bytes(out, o);
+            if (str_reserve_more(out, len - i + 4)) {
+                return -1;
+            }
+            dst = (unsigned char*)str_begin(out);
+        }
+        i += str_case_decode(src + i, &character);
+        o += utf8_encode(str_case_map_char(character, upper), (char*)dst + o);
+    }
+    str_set_len_bytes(out, o);
+    return 0;
+}
+
+static int
+str_case_map_in_place(str* self, int upper) {
+    unsigned char* s;
+    size_t len = str_len_bytes(self);
+    size_t i = 0;
+    if (str_unshare(self)) {
+        return -1;
+    }
+    s = (unsigned char*)str_begin(self);
+    while (i != len) {
+        char encoded[4];
+        uint32_t character;
+        size_t width, mapped_width;
+        i += str_case_ascii(s + i, s + i, len - i, upper);
+        for (; i != len && s[i] < 0x80; ++i) {
+            s[i] = str_case_ascii_byte(s[i], upper);
+        }
+        if (i == len) {
+            break;
+        }
+        width = str_case_decode(s + i, &character);
+        mapped_width = utf8_encode(str_case_map_char(character, upper), encoded);
+        if (mapped_width != width) {
+            /* The length changes, so finish in a new buffer. */
+            str result = STR_INIT;
+            if (str_reserve(&result, len + 4)) {
+                return -1;
+            }
+            memcpy(str_begin(&result), s, i);
+            str_set_len_bytes(&result, i);
+            if (str_case_map_append(&result, s + i, len - i, upper)) {
+                str_destroy(&result);
+                return -1;
+            }
+            str_destroy(self);
+            memcpy(self, &result, sizeof(str));
+            return 0;
+        }
+        memcpy(s + i, encoded, width);
+        i += width;
+    }
+    return 0;
+}
+
+static int
+str_case_map_copy(str* self, const str* source, int upper) {
+    str result = STR_INIT;
+    if (self == source) {
+        return str_case_map_in_place(self, upper);
+    }
+    if (str_case_map_append(&result, (const unsigned char*)str_cbegin(source),
+                            str_len_bytes(source), upper)) {
+        str_destroy(&result);
+        return -1;
+    }
+    str_destroy(self);
+    memcpy(self, &result, sizeof(str));
+    return 0;
+}
+
+int
+str_to_lower(str* self) {
+    return str_case_map_in_place(self, 0);
+}
+
+int
+str_to_upper(str* self) {
+    return str_case_map_in_place(self, 1);
+}
+
+int
+str_copy_lower(str* self, const str* source) {
+    return str_case_map_copy(self, source, 0);
+}
+
+int
+str_copy_upper(str* self, const str* source) {
+    return str_case_map_copy(self, source, 1);
+}
+
+int
+str_casecmp(const str* a, const str* b) {
+    const unsigned char* sa = (const unsigned char*)str_cbegin(a);
+    const unsigned char* sb = (const unsigned char*)str_cbegin(b);
+    size_t len_a = str_len_bytes(a);
+    size_t len_b = str_len_bytes(b);
+    size_t i = 0;
+    size_t j = 0;
+    for (;;) {
+        uint32_t ca, cb;
+        /* Folding can change the width of a character, so the offsets
+         * into a and b drift apart after non ASCII characters. */
+        size_t n = str_case_equal_prefix(sa + i, sb + j,
+                                         len_a - i < len_b - j ? len_a - i
+                                                               : len_b - j);
+        i += n;
+        j += n;
+        if (i == len_a || j == len_b) {
+            return (i != len_a) - (j != len_b);
+        }
+        if (sa[i] < 0x80) {
+            ca = str_case_ascii_byte(sa[i++], 0);
+        } else {
+            i += str_case_decode(sa + i, &ca);
+            ca = str_case_fold(ca);
+        }
+        if (sb[j] < 0x80) {
+            cb = str_case_ascii_byte(sb[j++], 0);
+        } else {
+            j += str_case_decode(sb + j, &cb);
+            cb = str_case_fold(cb);
+        }
+        if (ca != cb) {
+            return ca < cb ? -1 : 1;
+        }
+    }
+}
+
+size_t
+str_hash_ci(const str* self) {
+    const size_t mul2 = MEM_HASH_MUL * MEM_HASH_MUL;
+    size_t total = MEM_HASH_SEED;
+    const unsigned char* s = (const unsigned char*)str_cbegin(self);
+    size_t len = str_len_bytes(self);
+    size_t i = 0;
+    while (i != len) {
+        unsigned char folded[64];
+        size_t n = len - i < sizeof(folded) ? len - i : sizeof(folded);
+        size_t k = 0;
+        uint32_t character;
+        n = str_case_ascii(folded, s + i, n, 0);
+        /* Four bytes at a time shortens the multiply chain. */
+        for (; n - k >= 4; k += 4) {
+            total = total * (mul2 * mul2) +
+                    (size_t)(char)folded[k] * (mul2 * MEM_HASH_MUL) +
+                    (size_t)(char)folded[k + 1] * mul2 +
+                    (size_t)(char)folded[k + 2] * MEM_HASH_MUL +
+                    (size_t)(char)folded[k + 3];
+        }
+        for (; k != n; ++k) {
+            total = total * MEM_HASH_MUL + (size_t)(char)folded[k];
+        }
+        i += n;
+        if (i == len) {
+            break;
+        }
+        if (s[i] < 0x80) {
+            total = total * MEM_HASH_MUL + (size_t)(char)str_case_ascii_byte(s[i++], 0);
+            continue;
+        }
+        i += str_case_decode(s + i, &character);
+        n = utf8_encode(str_case_fold(character), (char*)folded);
+        for (k = 0; k != n; ++k) {
+            total = total * MEM_HASH_MUL + (size_t)(char)folded[k];
+        }
+    }
+    return total;
+}
+
+#ifdef TEST_MODE
+#include "test.h"
+#include "../hashmap.h"
+
+TEST(test_str_case_ascii) {
+    str s = STR_INIT;
+    str t = STR_INIT;
+    char expected[128];
+    size_t i;
+    for (i = 0; i != 100; ++i) {
+        expected[i] = (char)(" AbZz@[`{09xY"[i % 13]);
+    }
+    ASSERT(!str_copy_n(&s, expected, 100), cleanup);
+    ASSERT(!str_copy_upper(&t, &s), cleanup);
+    ASSERT(!str_to_lower(&s), cleanup);
+    ASSERT(str_len_bytes(&s) == 100 && str_len_bytes(&t) == 100, cleanup);
+    for (i = 0; i != 100; ++i) {
+        char c = expected[i];
+        ASSERT(str_cbegin(&s)[i] == (c >= 'A' && c <= 'Z' ? c + 32 : c), cleanup);
+        ASSERT(str_cbegin(&t)[i] == (c >= 'a' && c <= 'z' ? c - 32 : c), cleanup);
+    }
+    ASSERT(str_cbegin(&s)[100] == 0, cleanup);
+    ASSERT(!str_copy(&s, "MiXeD"), cleanup);
+    ASSERT(!str_to_upper(&s) && strcmp(str_cbegin(&s), "MIXED") == 0, cleanup);
+    ASSERT(!str_copy_lower(&s, &s) && strcmp(str_cbegin(&s), "mixed") == 0,
+           cleanup);
+    str_destroy(&s);
+    ASSERT(!str_to_upper(&s) && str_len_bytes(&s) == 0, cleanup);
+cleanup:
+    str_destroy(&s);
+    str_destroy(&t);
+}
+END_TEST
+
+TEST(test_str_case_unicode) {
+    str s = STR_INIT;
+    str t = STR_INIT;
+    ASSERT(!str_copy(&s, "H\xC3\x89LLO \xCE\xA3\xCE\x91\xCE\xA3 and some more ASCII text"),
+           cleanup);
+    ASSERT(!str_to_lower(&s), cleanup);
+    ASSERT(strcmp(str_cbegin(&s),
+                  "h\xC3\xA9llo \xCF\x83\xCE\xB1\xCF\x83 and some more ascii text") == 0,
+           cleanup);
+    ASSERT(!str_copy_upper(&t, &s), cleanup);
+    ASSERT(strcmp(str_cbegin(&t),
+                  "H\xC3\x89LLO \xCE\xA3\xCE\x91\xCE\xA3 AND SOME MORE ASCII TEXT") == 0,
+           cleanup);
+
+    /* Dotted capital I lowers to a one byte i. */
+    ASSERT(!str_copy(&s, "\xC4\xB0STANBUL IS A CITY WITH A LONG NAME \xC3\x89"), cleanup);
+    ASSERT(!str_share(&t, &s), cleanup);
+    ASSERT(!str_to_lower(&s), cleanup);
+    ASSERT(strcmp(str_cbegin(&s), "istanbul is a city with a long name \xC3\xA9") == 0,
+           cleanup);
+    ASSERT(strcmp(str_cbegin(&t),
+                  "\xC4\xB0STANBUL IS A CITY WITH A LONG NAME \xC3\x89") == 0,
+           cleanup);
+    /* Dotless i uppers to a one byte I. */
+    ASSERT(!str_copy(&s, "\xC4\xB1l\xC4\xB1k"), cleanup);
+    ASSERT(!str_copy_upper(&t, &s), cleanup);
+    ASSERT(strcmp(str_cbegin(&t), "ILIK") == 0, cleanup);
+    ASSERT(!str_to_upper(&s), cleanup);
+    ASSERT(strcmp(str_cbegin(&s), "ILIK") == 0, cleanup);
+cleanup:
+    str_destroy(&s);
+    str_destroy(&t);
+}
+END_TEST
+
+static int
+str_case_test_cmp(const char* a, const char* b) {
+    str sa = STR_INIT;
+    str sb = STR_INIT;
+    int result = 2;
+    if (!str_copy(&sa, a) && !str_copy(&sb, b)) {
+        result = str_casecmp(&sa, &sb);
+        result = (result > 0) - (result < 0);
+        if (result == 0 && str_hash_ci(&sa) != str_hash_ci(&sb)) {
+            result = 2;
+        }
+        if (-result != str_casecmp(&sb, &sa)) {
+            result = 2;
+        }
+    }
+    str_destroy(&sa);
+    str_destroy(&sb);
+    return result;
+}
+
+TEST(test_str_casecmp) {
+    str s = STR_INIT;
+    ASSERT(str_case_test_cmp("", "") == 0, cleanup);
+    ASSERT(str_case_test_cmp("Hello", "hELLO") == 0, cleanup);
+    ASSERT(str_case_test_cmp("abc", "ABD") < 0, cleanup);
+    ASSERT(str_case_test_cmp("ab", "ABC") < 0, cleanup);
+    ASSERT(str_case_test_cmp("[", "a") < 0, cleanup);
+    ASSERT(str_case_test_cmp("The Quick Brown Fox Jumps Over The Lazy Dog!",
+                             "tHE qUICK bROWN fOX jUMPS oVER tHE lAZY dOG!") == 0,
+           cleanup);
+    ASSERT(str_case_test_cmp("The Quick Brown Fox Jumps Over The Lazy Dog!",
+                             "tHE qUICK bROWN fOX jUMPS oVER tHE lAZY cOG!") > 0,
+           cleanup);
+    ASSERT(str_case_test_cmp("caf\xC3\xA9 au lait, and a very long ASCII tail",
+                             "CAF\xC3\x89 AU LAIT, AND A VERY LONG ascii TAIL") == 0,
+           cleanup);
+    ASSERT(str_case_test_cmp("\xCE\xA3\xCE\xB1", "\xCF\x83\xCE\x91") == 0, cleanup);
+    /* Folding changes widths: both of these fold to "i". */
+    ASSERT(str_case_test_cmp("\xC4\xB1 0123456789012345678901234567890123456789",
+                             "I 0123456789012345678901234567890123456789") == 0,
+           cleanup);
+    ASSERT(str_case_test_cmp("x\xC4\xB0yz", "XIYZ") == 0, cleanup);
+    ASSERT(str_case_test_cmp("\xC3\xA9", "z") > 0, cleanup);
+
+    ASSERT(!str_copy(&s, "Some ASCII Key With Enough Bytes To Vectorize"), cleanup);
+    ASSERT(str_hash_ci(&s) ==
+               mem_hash("some ascii key with enough bytes to vectorize", 45),
+           cleanup);
+cleanup:
+    str_destroy(&s);
+}
+END_TEST
+
+void test_str_case(void) {
+    RUN(test_str_case_ascii);
+    RUN(test_str_case_unicode);
+    RUN(test_str_casecmp);
+}
+#endif
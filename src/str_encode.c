@@ -0,0 +1,680 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2017 Chris Gregory czipperz@gmail.com
+ */
+
+/* Base64 and hex encoding for str.
+ *
+ * The vector kernels follow Wojciech Mula's base64 algorithms.  To
+ * encode, each group of 3 bytes is shuffled into a 32 bit lane and
+ * split into four 6 bit indices with two multiplies, and the indices
+ * are mapped to characters by adding an offset looked up with pshufb.
+ * To decode, pshufb lookups on the low and high nibbles of each
+ * character both validate it and find the offset back to its 6 bit
+ * value, and two multiply adds pack four values into 3 bytes.
+ *
+ * Hex digits are looked up with pshufb, and decoded with range checks
+ * and a multiply add joining each pair of nibbles.
+ *
+ * The encoders write straight into the str, reserving room for the
+ * whole output up front. */
+
+#include "../str.h"
+#include "../cpu.h"
+#include "../rpmalloc.h"
+#include "str_internal.h"
+#include <assert.h>
+#include <string.h>
+
+#ifdef CPU_X86
+#include <immintrin.h>
+#endif
+
+static const char str_base64_chars[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+const char str_hex_chars[] = "0123456789abcdef";
+
+/*! \brief The 6 bit value of a base64 character, or -1. */
+static int
+str_base64_value(unsigned char c) {
+    if ((unsigned)(c - 'A') < 26) {
+        return c - 'A';
+    }
+    if ((unsigned)(c - 'a') < 26) {
+        return c - 'a' + 26;
+    }
+    if ((unsigned)(c - '0') < 10) {
+        return c - '0' + 52;
+    }
+    if (c == '+') {
+        return 62;
+    }
+    if (c == '/') {
+        return 63;
+    }
+    return -1;
+}
+
+int
+str_hex_value(unsigned char c) {
+    if ((unsigned)(c - '0') < 10) {
+        return c - '0';
+    }
+    c |= 0x20;
+    if ((unsigned)(c - 'a') < 6) {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+#ifdef CPU_X86
+__attribute__((target("ssse3"))) static __m128i
+str_base64_encode_ssse3_vector(__m128i in) {
+    const __m128i offsets = _mm_setr_epi8(
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    __m128i indices, reduced;
+    /* Bytes abc become the 32 bit lane bcab. */
+    in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3,
+                                           4, 1, 2, 0, 1));
+    indices = _mm_or_si128(
+        _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0FC0FC00)),
+                        _mm_set1_epi32(0x04000040)),
+        _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003F03F0)),
+                        _mm_set1_epi32(0x01000010)));
+    /* 0-25 map to 13, 26-51 to 0, 52-61 to 1-10, 62 to 11, 63 to 12. */
+    reduced = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    reduced = _mm_or_si128(
+        reduced, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), indices),
+                               _mm_set1_epi8(13)));
+    return _mm_add_epi8(indices, _mm_shuffle_epi8(offsets, reduced));
+}
+
+__attribute__((target("ssse3"))) static size_t
+str_base64_encode_ssse3(char* dst, const unsigned char* src, size_t len) {
+    size_t i, o = 0;
+    /* Each step reads 16 bytes and uses 12 of them. */
+    for (i = 0; len - i >= 16; i += 12, o += 16) {
+        __m128i in = _mm_loadu_si128((const __m128i*)(src + i));
+        _mm_storeu_si128((__m128i*)(dst + o), str_base64_encode_ssse3_vector(in));
+    }
+    return i;
+}
+
+/*! \brief Decode 16 characters to 12 bytes in the low lanes.
+ *
+ * \return 0 if a character is invalid. */
+__attribute__((target("ssse3"))) static int
+str_base64_decode_ssse3_vector(__m128i in, __m128i* out) {
+    const __m128i lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                         0x11, 0x11, 0x11, 0x11, 0x13, 0x1A,
+                                         0x1B, 0x1B, 0x1B, 0x1A);
+    const __m128i lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08,
+                                         0x04, 0x08, 0x10, 0x10, 0x10, 0x10,
+                                         0x10, 0x10, 0x10, 0x10);
+    const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0,
+                                           0, 0, 0, 0, 0, 0, 0);
+    const __m128i mask_2f = _mm_set1_epi8(0x2F);
+    __m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(in, 4), mask_2f);
+    __m128i lo_nibbles = _mm_and_si128(in, mask_2f);
+    __m128i lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+    __m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+    __m128i roll;
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(lo, hi),
+                                         _mm_setzero_si128())) != 0xFFFF) {
+        return 0;
+    }
+    /* '/' shares its high nibble with '+' but needs another offset. */
+    roll = _mm_shuffle_epi8(
+        lut_roll, _mm_add_epi8(_mm_cmpeq_epi8(in, mask_2f), hi_nibbles));
+    in = _mm_add_epi8(in, roll);
+    in = _mm_maddubs_epi16(in, _mm_set1_epi32(0x01400140));
+    in = _mm_madd_epi16(in, _mm_set1_epi32(0x00011000));
+    *out = _mm_shuffle_epi8(in, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14,
+                                              13, 12, -1, -1, -1, -1));
+    return 1;
+}
+
+__attribute__((target("ssse3"))) static size_t
+str_base64_decode_ssse3(unsigned char* dst, const char* src, size_t len) {
+    size_t i, o = 0;
+    /* Each step writes 16 bytes but only 12 are output, so stop while
+     * the 4 past them still belong to later characters. */
+    for (i = 0; len - i >= 24; i += 16, o += 12) {
+        __m128i out;
+        if (!str_base64_decode_ssse3_vector(
+                _mm_loadu_si128((const __m128i*)(src + i)), &out)) {
+            break;
+        }
+        _mm_storeu_si128((__m128i*)(dst + o), out);
+    }
+    return i;
+}
+
+__attribute__((target("avx2"))) static __m256i
+str_base64_encode_avx2_vector(__m256i in) {
+    const __m256i offsets = _mm256_setr_epi8(
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    __m256i indices, reduced;
+    in = _mm256_shuffle_epi8(
+        in, _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+                            10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    indices = _mm256_or_si256(
+        _mm256_mulhi_epu16(_mm256_and_si256(in, _mm256_set1_epi32(0x0FC0FC00)),
+                           _mm256_set1_epi32(0x04000040)),
+        _mm256_mullo_epi16(_mm256_and_si256(in, _mm256_set1_epi32(0x003F03F0)),
+                           _mm256_set1_epi32(0x01000010)));
+    reduced = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+    reduced = _mm256_or_si256(
+        reduced,
+        _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices),
+                         _mm256_set1_epi8(13)));
+    return _mm256_add_epi8(indices, _mm256_shuffle_epi8(offsets, reduced));
+}
+
+__attribute__((target("avx2"))) static size_t
+str_base64_encode_avx2(char* dst, const unsigned char* src, size_t len) {
+    size_t i, o = 0;
+    /* Each lane takes 12 bytes, loaded 16 at a time. */
+    for (i = 0; len - i >= 28; i += 24, o += 32) {
+        __m256i in = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(src + i))),
+            _mm_loadu_si128((const __m128i*)(src + i + 12)), 1);
+        _mm256_storeu_si256((__m256i*)(dst + o),
+                            str_base64_encode_avx2_vector(in));
+    }
+    return i;
+}
+
+__attribute__((target("avx2"))) static size_t
+str_base64_decode_avx2(unsigned char* dst, const char* src, size_t len) {
+    const __m256i lut_lo = _mm256_setr_epi8(
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A,
+        0x1B, 0x1B, 0x1B, 0x1A, 0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+        0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m256i lut_hi = _mm256_setr_epi8(
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m256i lut_roll = _mm256_setr_epi8(
+        0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0, 0, 16, 19, 4,
+        -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i mask_2f = _mm256_set1_epi8(0x2F);
+    size_t i, o = 0;
+    /* Each step writes 32 bytes but only 24 are output. */
+    for (i = 0; len - i >= 44; i += 32, o += 24) {
+        __m256i in = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(in, 4), mask_2f);
+        __m256i lo = _mm256_shuffle_epi8(lut_lo, _mm256_and_si256(in, mask_2f));
+        __m256i hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+        __m256i roll;
+        if (!_mm256_testz_si256(lo, hi)) {
+            break;
+        }
+        roll = _mm256_shuffle_epi8(
+            lut_roll,
+            _mm256_add_epi8(_mm256_cmpeq_epi8(in, mask_2f), hi_nibbles));
+        in = _mm256_add_epi8(in, roll);
+        in = _mm256_maddubs_epi16(in, _mm256_set1_epi32(0x01400140));
+        in = _mm256_madd_epi16(in, _mm256_set1_epi32(0x00011000));
+        in = _mm256_shuffle_epi8(
+            in, _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1,
+                                 -1, -1, 2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12,
+                                 -1, -1, -1, -1));
+        /* Join the 12 bytes at the bottom of each lane. */
+        in = _mm256_permutevar8x32_epi32(in,
+                                         _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+        _mm256_storeu_si256((__m256i*)(dst + o), in);
+    }
+    return i;
+}
+
+__attribute__((target("ssse3"))) static size_t
+str_hex_encode_ssse3(char* dst, const unsigned char* src, size_t len) {
+    const __m128i digits = _mm_loadu_si128((const __m128i*)str_hex_chars);
+    const __m128i mask = _mm_set1_epi8(0x0F);
+    size_t i;
+    for (i = 0; len - i >= 16; i += 16) {
+        __m128i in = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i hi = _mm_shuffle_epi8(
+            digits, _mm_and_si128(_mm_srli_epi16(in, 4), mask));
+        __m128i lo = _mm_shuffle_epi8(digits, _mm_and_si128(in, mask));
+        _mm_storeu_si128((__m128i*)(dst + 2 * i), _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128((__m128i*)(dst + 2 * i + 16), _mm_unpackhi_epi8(hi, lo));
+    }
+    return i;
+}
+
+__attribute__((target("avx2"))) static size_t
+str_hex_encode_avx2(char* dst, const unsigned char* src, size_t len) {
+    const __m256i digits = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i*)str_hex_chars));
+    const __m256i mask = _mm256_set1_epi16(0x0F);
+    size_t i;
+    for (i = 0; len - i >= 16; i += 16) {
+        /* Widen each byte so its high nibble ends up first. */
+        __m256i in = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(src + i)));
+        __m256i nibbles = _mm256_or_si256(
+            _mm256_srli_epi16(in, 4),
+            _mm256_slli_epi16(_mm256_and_si256(in, mask), 8));
+        _mm256_storeu_si256((__m256i*)(dst + 2 * i),
+                            _mm256_shuffle_epi8(digits, nibbles));
+    }
+    return i;
+}
+
+/*! \brief Convert 16 hex digits to their values.
+ *
+ * \return 0 if a character is not a hex digit. */
+__attribute__((target("ssse3"))) static int
+str_hex_values_ssse3(__m128i in, __m128i* values) {
+    const __m128i flip = _mm_set1_epi8((char)0x80);
+    __m128i digit = _mm_sub_epi8(in, _mm_set1_epi8('0'));
+    __m128i letter = _mm_sub_epi8(_mm_or_si128(in, _mm_set1_epi8(0x20)),
+                                  _mm_set1_epi8('a'));
+    __m128i is_digit = _mm_cmplt_epi8(_mm_xor_si128(digit, flip),
+                                      _mm_set1_epi8((char)(-128 + 10)));
+    __m128i is_letter = _mm_cmplt_epi8(_mm_xor_si128(letter, flip),
+                                       _mm_set1_epi8((char)(-128 + 6)));
+    if (_mm_movemask_epi8(_mm_or_si128(is_digit, is_letter)) != 0xFFFF) {
+        return 0;
+    }
+    *values = _mm_or_si128(
+        _mm_and_si128(is_digit, digit),
+        _mm_and_si128(is_letter, _mm_add_epi8(letter, _mm_set1_epi8(10))));
+    return 1;
+}
+
+__attribute__((target("ssse3"))) static size_t
+str_hex_decode_ssse3(unsigned char* dst, const char* src, size_t len) {
+    const __m128i weights = _mm_set1_epi16(0x0110);
+    size_t i;
+    for (i = 0; len - i >= 32; i += 32) {
+        __m128i a, b;
+        if (!str_hex_values_ssse3(_mm_loadu_si128((const __m128i*)(src + i)),
+                                  &a) ||
+            !str_hex_values_ssse3(
+                _mm_loadu_si128((const __m128i*)(src + i + 16)), &b)) {
+            break;
+        }
+        /* Each pair becomes high * 16 + low in a 16 bit lane. */
+        a = _mm_maddubs_epi16(a, weights);
+        b = _mm_maddubs_epi16(b, weights);
+        _mm_storeu_si128((__m128i*)(dst + i / 2), _mm_packus_epi16(a, b));
+    }
+    return i;
+}
+
+__attribute__((target("avx2"))) static int
+str_hex_values_avx2(__m256i in, __m256i* values) {
+    const __m256i flip = _mm256_set1_epi8((char)0x80);
+    __m256i digit = _mm256_sub_epi8(in, _mm256_set1_epi8('0'));
+    __m256i letter = _mm256_sub_epi8(_mm256_or_si256(in, _mm256_set1_epi8(0x20)),
+                                     _mm256_set1_epi8('a'));
+    __m256i is_digit = _mm256_cmpgt_epi8(_mm256_set1_epi8((char)(-128 + 10)),
+                                         _mm256_xor_si256(digit, flip));
+    __m256i is_letter = _mm256_cmpgt_epi8(_mm256_set1_epi8((char)(-128 + 6)),
+                                          _mm256_xor_si256(letter, flip));
+    if (~_mm256_movemask_epi8(_mm256_or_si256(is_digit, is_letter))) {
+        return 0;
+    }
+    *values = _mm256_or_si256(
+        _mm256_and_si256(is_digit, digit),
+        _mm256_and_si256(is_letter, _mm256_add_epi8(letter, _mm256_set1_epi8(10))));
+    return 1;
+}
+
+__attribute__((target("avx2"))) static size_t
+str_hex_decode_avx2(unsigned char* dst, const char* src, size_t len) {
+    const __m256i weights = _mm256_set1_epi16(0x0110);
+    size_t i;
+    for (i = 0; len - i >= 64; i += 64) {
+        __m256i a, b;
+        if (!str_hex_values_avx2(_mm256_loadu_si256((const __m256i*)(src + i)),
+                                 &a) ||
+            !str_hex_values_avx2(
+                _mm256_loadu_si256((const __m256i*)(src + i + 32)), &b)) {
+            break;
+        }
+        a = _mm256_maddubs_epi16(a, weights);
+        b = _mm256_maddubs_epi16(b, weights);
+        /* Packing interleaves the lanes of a and b. */
+        _mm256_storeu_si256(
+            (__m256i*)(dst + i / 2),
+            _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8));
+    }
+    return i;
+}
+#endif
+
+int
+str_push_base64(str* self, const void* data, size_t len) {
+    const unsigned char* src = data;
+    size_t self_len = str_len_bytes(self);
+    size_t out_len = (len + 2) / 3 * 4;
+    char* dst;
+    size_t i = 0;
+    assert(data || !len);
+
+    if (len > (SIZE_MAX - self_len) / 4 * 3 - 2 ||
+        str_reserve_more(self, out_len)) {
+        return -1;
+    }
+    dst = str_begin(self) + self_len;
+
+#ifdef CPU_X86
+    if (cpu_features() & CPU_AVX2) {
+        i = str_base64_encode_avx2(dst, src, len);
+    }
+    if (cpu_features() & CPU_SSSE3) {
+        i += str_base64_encode_ssse3(dst + i / 3 * 4, src + i, len - i);
+    }
+#endif
+
+    dst += i / 3 * 4;
+    for (; len - i >= 3; i += 3, dst += 4) {
+        uint32_t group = (uint32_t)src[i] << 16 | (uint32_t)src[i + 1] << 8 |
+                         src[i + 2];
+        dst[0] = str_base64_chars[group >> 18];
+        dst[1] = str_base64_chars[group >> 12 & 0x3F];
+        dst[2] = str_base64_chars[group >> 6 & 0x3F];
+        dst[3] = str_base64_chars[group & 0x3F];
+    }
+    if (i != len) {
+        uint32_t group = (uint32_t)src[i] << 16;
+        if (len - i == 2) {
+            group |= (uint32_t)src[i + 1] << 8;
+        }
+        dst[0] = str_base64_chars[group >> 18];
+        dst[1] = str_base64_chars[group >> 12 & 0x3F];
+        dst[2] = len - i == 2 ? str_base64_chars[group >> 6 & 0x3F] : '=';
+        dst[3] = '=';
+    }
+    str_set_len_bytes(self, self_len + out_len);
+    return 0;
+}
+
+int
+str_decode_base64(const char* string, size_t len, void* out, size_t* out_len) {
+    const unsigned char* src = (const unsigned char*)string;
+    unsigned char* dst = out;
+    size_t padding = 0;
+    size_t body;
+    size_t i = 0;
+    assert(string || !len);
+
+    if (len % 4) {
+        return 1;
+    }
+    if (len && src[len - 1] == '=') {
+        padding = src[len - 2] == '=' ? 2 : 1;
+    }
+    /* The quad holding the padding is decoded on its own. */
+    body = padding ? len - 4 : len;
+
+#ifdef CPU_X86
+    if (cpu_features() & CPU_AVX2) {
+        i = str_base64_decode_avx2(dst, string, body);
+    }
+    if (cpu_features() & CPU_SSSE3) {
+        i += str_base64_decode_ssse3(dst + i / 4 * 3, string + i, body - i);
+    }
+#endif
+
+    dst += i / 4 * 3;
+    for (; i != body; i += 4, dst += 3) {
+        int a = str_base64_value(src[i]);
+        int b = str_base64_value(src[i + 1]);
+        int c = str_base64_value(src[i + 2]);
+        int d = str_base64_value(src[i + 3]);
+        uint32_t group;
+        if ((a | b | c | d) < 0) {
+            return 1;
+        }
+        group = (uint32_t)a << 18 | (uint32_t)b << 12 | (uint32_t)c << 6 |
+                (uint32_t)d;
+        dst[0] = (unsigned char)(group >> 16);
+        dst[1] = (unsigned char)(group >> 8);
+        dst[2] = (unsigned char)group;
+    }
+    if (padding) {
+        int a = str_base64_value(src[i]);
+        int b = str_base64_value(src[i + 1]);
+        int c = padding == 1 ? str_base64_value(src[i + 2]) : 0;
+        uint32_t group;
+        if ((a | b | c) < 0) {
+            return 1;
+        }
+        group = (uint32_t)a << 18 | (uint32_t)b << 12 | (uint32_t)c << 6;
+        *dst++ = (unsigned char)(group >> 16);
+        if (padding == 1) {
+            *dst++ = (unsigned char)(group >> 8);
+        }
+    }
+    *out_len = (size_t)(dst - (unsigned char*)out);
+    return 0;
+}
+
+int
+str_push_hex(str* self, const void* data, size_t len) {
+    const unsigned char* src = data;
+    size_t self_len = str_len_bytes(self);
+    char* dst;
+    size_t i = 0;
+    assert(data || !len);
+
+    if (len > (SIZE_MAX - self_len) / 2 || str_reserve_more(self, len * 2)) {
+        return -1;
+    }
+    dst = str_begin(self) + self_len;
+
+#ifdef CPU_X86
+    if (cpu_features() & CPU_AVX2) {
+        i = str_hex_encode_avx2(dst, src, len);
+    } else if (cpu_features() & CPU_SSSE3) {
+        i = str_hex_encode_ssse3(dst, src, len);
+    }
+#endif
+
+    for (; i != len; ++i) {
+        dst[2 * i] = str_hex_chars[src[i] >> 4];
+        dst[2 * i + 1] = str_hex_chars[src[i] & 0x0F];
+    }
+    str_set_len_bytes(self, self_len + len * 2);
+    return 0;
+}
+
+int
+str_decode_hex(const char* string, size_t len, void* out) {
+    const unsigned char* src = (const unsigned char*)string;
+    unsigned char* dst = out;
+    size_t i = 0;
+    assert(string || !len);
+
+    if (len % 2) {
+        return 1;
+    }
+
+#ifdef CPU_X86
+    if (cpu_features() & CPU_AVX2) {
+        i = str_hex_decode_avx2(dst, string, len);
+    }
+    if (cpu_features() & CPU_SSSE3) {
+        i += str_hex_decode_ssse3(dst + i / 2, string + i, len - i);
+    }
+#endif
+
+    for (; i != len; i += 2) {
+        int hi = str_hex_value(src[i]);
+        int lo = str_hex_value(src[i + 1]);
+        if ((hi | lo) < 0) {
+            return 1;
+        }
+        dst[i / 2] = (unsigned char)(hi << 4 | lo);
+    }
+    return 0;
+}
+
+#ifdef TEST_MODE
+#include "test.h"
+
+TEST(test_str_base64_known) {
+    /* Test vectors from RFC 4648. */
+    static const char* const plain[] = {"", "f", "fo", "foo", "foob", "fooba",
+                                        "foobar"};
+    static const char* const encoded[] = {"", "Zg==", "Zm8=", "Zm9v",
+                                          "Zm9vYg==", "Zm9vYmE=", "Zm9vYmFy"};
+    str s = STR_INIT;
+    unsigned char buffer[16];
+    size_t i, len;
+    for (i = 0; i < sizeof(plain) / sizeof(*plain); ++i) {
+        str_set_len_bytes(&s, 0);
+        ASSERT(!str_push_base64(&s, plain[i], strlen(plain[i])), cleanup);
+        ASSERT(strcmp(str_cbegin(&s), encoded[i]) == 0, cleanup);
+        ASSERT(!str_decode_base64(encoded[i], strlen(encoded[i]), buffer, &len),
+               cleanup);
+        ASSERT(len == strlen(plain[i]), cleanup);
+        ASSERT(memcmp(buffer, plain[i], len) == 0, cleanup);
+    }
+    ASSERT(str_decode_base64("Zm9", 3, buffer, &len) == 1, cleanup);
+    ASSERT(str_decode_base64("Zm9v\n", 5, buffer, &len) == 1, cleanup);
+    ASSERT(str_decode_base64("Zm=v", 4, buffer, &len) == 1, cleanup);
+    ASSERT(str_decode_base64("Z===", 4, buffer, &len) == 1, cleanup);
+    ASSERT(str_decode_base64("Zg==Zg==", 8, buffer, &len) == 1, cleanup);
+
+    str_set_len_bytes(&s, 0);
+    ASSERT(!str_push_hex(&s, "\x01\xAB\xff", 3), cleanup);
+    ASSERT(strcmp(str_cbegin(&s), "01abff") == 0, cleanup);
+    ASSERT(!str_decode_hex("01AbfF", 6, buffer), cleanup);
+    ASSERT(memcmp(buffer, "\x01\xAB\xff", 3) == 0, cleanup);
+    ASSERT(str_decode_hex("012", 3, buffer) == 1, cleanup);
+    ASSERT(str_decode_hex("0g", 2, buffer) == 1, cleanup);
+    ASSERT(str_decode_hex("", 0, buffer) == 0, cleanup);
+cleanup:
+    str_destroy(&s);
+}
+END_TEST
+
+TEST(test_str_encode_random) {
+    str s = STR_INIT;
+    unsigned char* data = 0;
+    unsigned char* decoded = 0;
+    unsigned seed = 7;
+    size_t round;
+    data = rpmalloc(1000);
+    decoded = rpmalloc(1000);
+    ASSERT(data && decoded, cleanup);
+    for (round = 0; round < 400; ++round) {
+        size_t len = round < 200 ? round : (seed >> 16) % 1000;
+        size_t decoded_len, i, saved;
+        char* text;
+        for (i = 0; i < len; ++i) {
+            seed = seed * 1103515245 + 12345;
+            data[i] = (unsigned char)(seed >> 16);
+        }
+
+        /* Encoding appends to what is already there. */
+        str_set_len_bytes(&s, 0);
+        ASSERT(!str_copy(&s, "x:"), cleanup);
+        ASSERT(!str_push_base64(&s, data, len), cleanup);
+        ASSERT(str_len_bytes(&s) == 2 + (len + 2) / 3 * 4, cleanup);
+        for (i = 0; i < len / 3; ++i) {
+            uint32_t group = (uint32_t)data[3 * i] << 16 |
+                             (uint32_t)data[3 * i + 1] << 8 | data[3 * i + 2];
+            ASSERT(str_cbegin(&s)[2 + 4 * i] == str_base64_chars[group >> 18] &&
+                       str_cbegin(&s)[5 + 4 * i] ==
+                           str_base64_chars[group & 0x3F],
+                   cleanup);
+        }
+        ASSERT(!str_decode_base64(str_cbegin(&s) + 2, str_len_bytes(&s) - 2,
+                                  decoded, &decoded_len),
+               cleanup);
+        ASSERT(decoded_len == len && memcmp(decoded, data, len) == 0, cleanup);
+
+        /* Corrupting any character is caught, by vector or scalar. */
+        if (len >= 3) {
+            text = str_begin(&s) + 2;
+            seed = seed * 1103515245 + 12345;
+            i = (seed >> 16) % (len / 3 * 4);
+            saved = (unsigned char)text[i];
+            text[i] = round % 2 ? '\x80' : '-';
+            ASSERT(str_decode_base64(text, str_len_bytes(&s) - 2, decoded,
+                                     &decoded_len) == 1,
+                   cleanup);
+            text[i] = (char)saved;
+        }
+
+        str_set_len_bytes(&s, 0);
+        ASSERT(!str_push_hex(&s, data, len), cleanup);
+        ASSERT(str_len_bytes(&s) == 2 * len, cleanup);
+        for (i = 0; i < len; ++i) {
+            ASSERT(str_cbegin(&s)[2 * i] == str_hex_chars[data[i] >> 4] &&
+                       str_cbegin(&s)[2 * i + 1] ==
+                           str_hex_chars[data[i] & 0x0F],
+                   cleanup);
+        }
+        if (round % 2) {
+            str_to_upper(&s);
+        }
+        memset(decoded, 0, len);
+        ASSERT(!str_decode_hex(str_cbegin(&s), 2 * len, decoded), cleanup);
+        ASSERT(memcmp(decoded, data, len) == 0, cleanup);
+        if (len) {
+            seed = seed * 1103515245 + 12345;
+            i = (seed >> 16) % (2 * len);
+            str_begin(&s)[i] = round % 3 == 0 ? 'g' : round % 3 == 1 ? '/' : ':';
+            ASSERT(str_decode_hex(str_cbegin(&s), 2 * len, decoded) == 1,
+                   cleanup);
+        }
+    }
+cleanup:
+    str_destroy(&s);
+    rpfree(data);
+    rpfree(decoded);
+}
+END_TEST
+
+TEST(test_str_base64_characters) {
+    /* Every byte value in every position of a vector block. */
+    char text[64];
+    unsigned char decoded[48];
+    size_t len, i;
+    int c, position;
+    for (c = 0; c < 256; ++c) {
+        int value = str_base64_value((unsigned char)c);
+        for (position = 0; position < 64; ++position) {
+            memset(text, 'A', sizeof(text));
+            text[position] = (char)c;
+            if (c == '=' && position == 63) {
+                /* Padding. */
+                ASSERT(!str_decode_base64(text, 64, decoded, &len) && len == 47,
+                       cleanup);
+            } else if (value < 0) {
+                ASSERT(str_decode_base64(text, 64, decoded, &len) == 1, cleanup);
+            } else {
+                uint32_t group = (uint32_t)value << (18 - 6 * (position % 4));
+                ASSERT(!str_decode_base64(text, 64, decoded, &len), cleanup);
+                ASSERT(len == 48, cleanup);
+                for (i = 0; i < 3; ++i) {
+                    ASSERT(decoded[position / 4 * 3 + i] ==
+                               (unsigned char)(group >> (16 - 8 * i)),
+                           cleanup);
+                }
+            }
+        }
+    }
+cleanup:;
+}
+END_TEST
+
+void test_str_encode(void) {
+    RUN(test_str_base64_known);
+    RUN(test_str_encode_random);
+    RUN(test_str_base64_characters);
+}
+#endif
@@ -0,0 +1,32 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2017 Chris Gregory czipperz@gmail.com
+ */
+
+/* Functions shared by the str source files.  This header is not
+ * installed. */
+
+#ifndef CUTIL_STR_INTERNAL_H
+#define CUTIL_STR_INTERNAL_H
+
+#include "../str.h"
+
+/*! \brief Make room to write \c len more bytes after the end of \c
+ *  self through \c str_begin().
+ *
+ * The capacity grows geometrically so repeated appends are amortized
+ * O(1), and shared contents are copied so they can be written to.
+ *
+ * If an error occured, return -1 (the str is not changed).
+ * Otherwise returns 0. */
+int str_reserve_more(str* self, size_t len);
+
+/*! \brief The lower case hex digits, for formatting. */
+extern const char str_hex_chars[];
+
+/*! \brief The value of a hex digit in either case, or -1. */
+int str_hex_value(unsigned char c);
+
+#endif
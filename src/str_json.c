@@ -0,0 +1,441 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2017 Chris Gregory czipperz@gmail.com
+ */
+
+/* JSON string escapes for str.
+ *
+ * Most text has nothing to escape, so both directions scan a vector
+ * at a time for the next byte needing attention: a quote, a backslash,
+ * a control character, or when asked for, a non ASCII byte.  Runs
+ * before it are copied in bulk and only the special bytes are handled
+ * one at a time. */
+
+#include "../str.h"
+#include "../cpu.h"
+#include "../utf8.h"
+#include "str_internal.h"
+#include <assert.h>
+#include <string.h>
+
+#ifdef CPU_X86
+#include <immintrin.h>
+#endif
+
+static int
+str_json_is_special(unsigned char c, int ascii_only) {
+    return c == '"' || c == '\\' || c < 0x20 || (ascii_only && c >= 0x80);
+}
+
+#ifdef CPU_X86
+__attribute__((target("sse2"))) static size_t
+str_json_scan_sse2(const unsigned char* s, size_t len, int ascii_only) {
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i flip = _mm_set1_epi8((char)0x80);
+    /* Unsigned less than 0x20 as a signed compare. */
+    const __m128i control = _mm_set1_epi8((char)(0x20 ^ 0x80));
+    const __m128i high = ascii_only ? flip : _mm_setzero_si128();
+    size_t i;
+    for (i = 0; len - i >= 16; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+        __m128i special = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+            _mm_or_si128(_mm_cmplt_epi8(_mm_xor_si128(v, flip), control),
+                         _mm_and_si128(v, high)));
+        unsigned mask = (unsigned)_mm_movemask_epi8(special);
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i;
+}
+
+__attribute__((target("avx2"))) static size_t
+str_json_scan_avx2(const unsigned char* s, size_t len, int ascii_only) {
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i flip = _mm256_set1_epi8((char)0x80);
+    const __m256i control = _mm256_set1_epi8((char)(0x20 ^ 0x80));
+    const __m256i high = ascii_only ? flip : _mm256_setzero_si256();
+    size_t i;
+    for (i = 0; len - i >= 32; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(s + i));
+        __m256i special = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, quote),
+                            _mm256_cmpeq_epi8(v, backslash)),
+            _mm256_or_si256(
+                _mm256_cmpgt_epi8(control, _mm256_xor_si256(v, flip)),
+                _mm256_and_si256(v, high)));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(special);
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i;
+}
+#endif
+
+/*! \brief Find the first special byte, or \c len if there is none. */
+static size_t
+str_json_scan(const unsigned char* s, size_t len, int ascii_only) {
+    size_t i = 0;
+#ifdef CPU_X86
+    /* The kernels stop at a special byte or before a partial vector. */
+    if (cpu_features() & CPU_AVX2) {
+        i = str_json_scan_avx2(s, len, ascii_only);
+    }
+    if (cpu_features() & CPU_SSE2) {
+        i += str_json_scan_sse2(s + i, len - i, ascii_only);
+    }
+#endif
+    while (i != len && !str_json_is_special(s[i], ascii_only)) {
+        ++i;
+    }
+    return i;
+}
+
+static char*
+str_json_write_u(char* out, uint32_t unit) {
+    out[0] = '\\';
+    out[1] = 'u';
+    out[2] = str_hex_chars[unit >> 12];
+    out[3] = str_hex_chars[unit >> 8 & 0xF];
+    out[4] = str_hex_chars[unit >> 4 & 0xF];
+    out[5] = str_hex_chars[unit & 0xF];
+    return out + 6;
+}
+
+/*! \brief Write the escape for the character at \c s to \c out.
+ *
+ * \c *consumed is set to the length of the character.
+ *
+ * \return The end of the escape. */
+static char*
+str_json_escape(const unsigned char* s, char* out, size_t* consumed) {
+    uint32_t character;
+    char short_escape;
+    *consumed = 1;
+    switch (s[0]) {
+    case '"':
+    case '\\':
+        short_escape = (char)s[0];
+        break;
+    case '\b':
+        short_escape = 'b';
+        break;
+    case '\f':
+        short_escape = 'f';
+        break;
+    case '\n':
+        short_escape = 'n';
+        break;
+    case '\r':
+        short_escape = 'r';
+        break;
+    case '\t':
+        short_escape = 't';
+        break;
+    default:
+        short_escape = 0;
+        break;
+    }
+    if (short_escape) {
+        out[0] = '\\';
+        out[1] = short_escape;
+        return out + 2;
+    }
+    if (s[0] < 0x80) {
+        return str_json_write_u(out, s[0]);
+    }
+    if (s[0] < 0xE0) {
+        character = (uint32_t)(s[0] & 0x1F) << 6 | (s[1] & 0x3F);
+        *consumed = 2;
+    } else if (s[0] < 0xF0) {
+        character = (uint32_t)(s[0] & 0x0F) << 12 |
+                    (uint32_t)(s[1] & 0x3F) << 6 | (s[2] & 0x3F);
+        *consumed = 3;
+    } else {
+        character = (uint32_t)(s[0] & 0x07) << 18 |
+                    (uint32_t)(s[1] & 0x3F) << 12 |
+                    (uint32_t)(s[2] & 0x3F) << 6 | (s[3] & 0x3F);
+        *consumed = 4;
+    }
+    if (character < 0x10000) {
+        return str_json_write_u(out, character);
+    }
+    character -= 0x10000;
+    out = str_json_write_u(out, 0xD800 | character >> 10);
+    return str_json_write_u(out, 0xDC00 | (character & 0x3FF));
+}
+
+int
+str_push_json_escaped(str* self, const str* string, int ascii_only) {
+    const unsigned char* s = (const unsigned char*)str_cbegin(string);
+    size_t len = str_len_bytes(string);
+    size_t self_len = str_len_bytes(self);
+    size_t out_len = self_len;
+    size_t i = 0;
+    assert(self != string);
+
+    /* Escaping only lengthens the text. */
+    if (str_reserve_more(self, len)) {
+        return -1;
+    }
+    for (;;) {
+        size_t run = str_json_scan(s + i, len - i, ascii_only);
+        size_t consumed;
+        char* out;
+        /* Leave room for the longest escape after the run.  Most text
+         * has few escapes, so the first reservation usually fits all
+         * of it. */
+        if (str_cap(self) - out_len < run + 12) {
+            /* Only the length is kept when moving out of line. */
+            str_set_len_bytes(self, out_len);
+            if (str_reserve_more(self, run + 12 > len - i ? run + 12 : len - i)) {
+                str_set_len_bytes(self, self_len);
+                return -1;
+            }
+        }
+        out = str_begin(self) + out_len;
+        memcpy(out, s + i, run);
+        out_len += run;
+        i += run;
+        if (i == len) {
+            break;
+        }
+        out_len += (size_t)(str_json_escape(s + i, out + run, &consumed) -
+                            (out + run));
+        i += consumed;
+    }
+    str_set_len_bytes(self, out_len);
+    return 0;
+}
+
+/*! \brief Parse the 4 hex digits of a \\u escape at \c s.
+ *
+ * \return The code unit, or -1 if the digits are invalid. */
+static int32_t
+str_json_parse_u(const unsigned char* s) {
+    int a = str_hex_value(s[0]);
+    int b = str_hex_value(s[1]);
+    int c = str_hex_value(s[2]);
+    int d = str_hex_value(s[3]);
+    if ((a | b | c | d) < 0) {
+        return -1;
+    }
+    return a << 12 | b << 8 | c << 4 | d;
+}
+
+int
+str_json_unescape(str* self, const char* string, size_t len) {
+    const unsigned char* s = (const unsigned char*)string;
+    size_t self_len = str_len_bytes(self);
+    size_t i = 0;
+    char* begin;
+    char* out;
+    assert(string || !len);
+
+    /* Escapes are never shorter than what they decode to. */
+    if (len > SIZE_MAX - 1 - self_len || str_reserve_more(self, len)) {
+        return -1;
+    }
+    begin = str_begin(self) + self_len;
+    out = begin;
+    for (;;) {
+        size_t run = str_json_scan(s + i, len - i, 0);
+        size_t encoded;
+        int32_t unit;
+        memcpy(out, s + i, run);
+        out += run;
+        i += run;
+        if (i == len) {
+            break;
+        }
+        /* Raw quotes and control characters are not allowed. */
+        if (s[i] != '\\' || len - i < 2) {
+            goto invalid;
+        }
+        switch (s[i + 1]) {
+        case '"':
+        case '\\':
+        case '/':
+            *out++ = (char)s[i + 1];
+            break;
+        case 'b':
+            *out++ = '\b';
+            break;
+        case 'f':
+            *out++ = '\f';
+            break;
+        case 'n':
+            *out++ = '\n';
+            break;
+        case 'r':
+            *out++ = '\r';
+            break;
+        case 't':
+            *out++ = '\t';
+            break;
+        case 'u':
+            if (len - i < 6 || (unit = str_json_parse_u(s + i + 2)) < 0) {
+                goto invalid;
+            }
+            if ((unit & 0xFC00) == 0xD800) {
+                /* A high surrogate must be followed by a low one. */
+                int32_t low;
+                if (len - i < 12 || s[i + 6] != '\\' || s[i + 7] != 'u' ||
+                    (low = str_json_parse_u(s + i + 8)) < 0 ||
+                    (low & 0xFC00) != 0xDC00) {
+                    goto invalid;
+                }
+                unit = 0x10000 + ((unit - 0xD800) << 10) + (low - 0xDC00);
+                i += 6;
+            }
+            /* Lone low surrogates fail to encode, and U+0000 fails
+             * validation below. */
+            if (!(encoded = utf8_encode((uint32_t)unit, out))) {
+                goto invalid;
+            }
+            out += encoded;
+            i += 4;
+            break;
+        default:
+            goto invalid;
+        }
+        i += 2;
+    }
+    if (utf8_validate(begin, (size_t)(out - begin)) != (size_t)(out - begin)) {
+        goto invalid;
+    }
+    str_set_len_bytes(self, self_len + (size_t)(out - begin));
+    return 0;
+
+invalid:
+    /* Restore the null terminator. */
+    str_set_len_bytes(self, self_len);
+    return 1;
+}
+
+#ifdef TEST_MODE
+#include "test.h"
+
+TEST(test_str_json_escape) {
+    str s = STR_INIT;
+    str out = STR_INIT;
+    str shared = STR_INIT;
+    ASSERT(!str_copy(&s, "say \"hi\"\\\n\t\x01 caf\xC3\xA9 \xF0\x9F\x98\x80/"),
+           cleanup);
+    ASSERT(!str_push_json_escaped(&out, &s, 0), cleanup);
+    ASSERT(strcmp(str_cbegin(&out), "say \\\"hi\\\"\\\\\\n\\t\\u0001 caf\xC3\xA9 "
+                                    "\xF0\x9F\x98\x80/") == 0,
+           cleanup);
+    str_set_len_bytes(&out, 0);
+    ASSERT(!str_push_json_escaped(&out, &s, 1), cleanup);
+    ASSERT(strcmp(str_cbegin(&out), "say \\\"hi\\\"\\\\\\n\\t\\u0001 caf\\u00e9 "
+                                    "\\ud83d\\ude00/") == 0,
+           cleanup);
+
+    str_set_len_bytes(&s, 0);
+    ASSERT(!str_json_unescape(&s, str_cbegin(&out), str_len_bytes(&out)), cleanup);
+    ASSERT(strcmp(str_cbegin(&s),
+                  "say \"hi\"\\\n\t\x01 caf\xC3\xA9 \xF0\x9F\x98\x80/") == 0,
+           cleanup);
+    str_set_len_bytes(&s, 0);
+    ASSERT(!str_json_unescape(&s, "\\/\\b\\f\\r\\u00E9\\uD83D\\uDE00", 26),
+           cleanup);
+    ASSERT(strcmp(str_cbegin(&s), "/\b\f\r\xC3\xA9\xF0\x9F\x98\x80") == 0, cleanup);
+
+    /* Sharers of the str are left alone. */
+    ASSERT(!str_copy(&shared, "a shared string long enough to be on the heap"),
+           cleanup);
+    ASSERT(!str_reserve(&shared, 100), cleanup);
+    ASSERT(!str_share(&out, &shared), cleanup);
+    ASSERT(!str_push_json_escaped(&out, &s, 1), cleanup);
+    ASSERT(strcmp(str_cbegin(&shared),
+                  "a shared string long enough to be on the heap") == 0,
+           cleanup);
+    ASSERT(str_len_bytes(&out) == 45 + 25, cleanup);
+    ASSERT(!str_share(&out, &shared), cleanup);
+    ASSERT(!str_json_unescape(&out, "\\n", 2), cleanup);
+    ASSERT(strcmp(str_cbegin(&out),
+                  "a shared string long enough to be on the heap\n") == 0,
+           cleanup);
+    ASSERT(strcmp(str_cbegin(&shared),
+                  "a shared string long enough to be on the heap") == 0,
+           cleanup);
+
+    /* Invalid escapes leave the str unchanged. */
+    ASSERT(str_json_unescape(&s, "ab\\", 3) == 1, cleanup);
+    ASSERT(str_json_unescape(&s, "\\x", 2) == 1, cleanup);
+    ASSERT(str_json_unescape(&s, "\\u12", 4) == 1, cleanup);
+    ASSERT(str_json_unescape(&s, "\\u12g4", 6) == 1, cleanup);
+    ASSERT(str_json_unescape(&s, "\\ud83d", 6) == 1, cleanup);
+    ASSERT(str_json_unescape(&s, "\\ud83d\\u0041", 12) == 1, cleanup);
+    ASSERT(str_json_unescape(&s, "\\ude00", 6) == 1, cleanup);
+    ASSERT(str_json_unescape(&s, "\\u0000", 6) == 1, cleanup);
+    ASSERT(str_json_unescape(&s, "a\"b", 3) == 1, cleanup);
+    ASSERT(str_json_unescape(&s, "a\nb", 3) == 1, cleanup);
+    ASSERT(str_json_unescape(&s, "a\xC3", 2) == 1, cleanup);
+    ASSERT(strcmp(str_cbegin(&s), "/\b\f\r\xC3\xA9\xF0\x9F\x98\x80") == 0, cleanup);
+cleanup:
+    str_destroy(&s);
+    str_destroy(&out);
+    str_destroy(&shared);
+}
+END_TEST
+
+TEST(test_str_json_random) {
+    static const char* const pieces[] = {"a", "b", " ", "\"", "\\", "\n",
+                                         "\x1F", "\x7F", "\xC3\xA9",
+                                         "\xE2\x82\xAC", "\xF0\x9F\x98\x80"};
+    str s = STR_INIT;
+    str escaped = STR_INIT;
+    str back = STR_INIT;
+    unsigned seed = 11;
+    size_t round;
+    for (round = 0; round < 400; ++round) {
+        int ascii_only = round % 2;
+        size_t len, i;
+        str_set_len_bytes(&s, 0);
+        seed = seed * 1103515245 + 12345;
+        len = (seed >> 16) % 300;
+        for (i = 0; i < len; ++i) {
+            /* Mostly plain text, so runs cross vector boundaries. */
+            seed = seed * 1103515245 + 12345;
+            ASSERT(!str_push_s(&s, (seed >> 16) % 8 ? pieces[(seed >> 20) % 3]
+                                                    : pieces[(seed >> 20) % 11]),
+                   cleanup);
+        }
+
+        ASSERT(!str_copy(&escaped, "\""), cleanup);
+        ASSERT(!str_push_json_escaped(&escaped, &s, ascii_only), cleanup);
+        for (i = 1; i < str_len_bytes(&escaped); ++i) {
+            unsigned char c = (unsigned char)str_cbegin(&escaped)[i];
+            ASSERT(c >= 0x20 && !(ascii_only && c >= 0x80), cleanup);
+            ASSERT(c != '"' || str_cbegin(&escaped)[i - 1] == '\\', cleanup);
+        }
+
+        ASSERT(!str_copy(&back, "x"), cleanup);
+        ASSERT(!str_json_unescape(&back, str_cbegin(&escaped) + 1,
+                                  str_len_bytes(&escaped) - 1),
+               cleanup);
+        ASSERT(str_len_bytes(&back) == 1 + str_len_bytes(&s), cleanup);
+        ASSERT(memcmp(str_cbegin(&back) + 1, str_cbegin(&s),
+                      str_len_bytes(&s) + 1) == 0,
+               cleanup);
+    }
+cleanup:
+    str_destroy(&s);
+    str_destroy(&escaped);
+    str_destroy(&back);
+}
+END_TEST
+
+void test_str_json(void) {
+    RUN(test_str_json_escape);
+    RUN(test_str_json_random);
+}
+#endif
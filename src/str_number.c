@@ -0,0 +1,1228 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2017 Chris Gregory czipperz@gmail.com
+ */
+
+/* Number formatting for str.
+ *
+ * Integers are written two digits at a time from a table of digit
+ * pairs.  Doubles use the Ryu algorithm by Ulf Adams, which finds the
+ * shortest digits that read back as the same double using only
+ * 64 bit integer arithmetic and a table of powers of five. */
+
+#include "../str.h"
+#include "str_internal.h"
+#include <assert.h>
+#include <string.h>
+
+static const char str_digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+/*! \brief Append \c len bytes of ASCII without validating them. */
+static int
+str_push_ascii(str* self, const char* ascii, size_t len) {
+    size_t self_len = str_len_bytes(self);
+    if (str_reserve_more(self, len)) {
+        return -1;
+    }
+    memcpy(str_begin(self) + self_len, ascii, len);
+    str_set_len_bytes(self, self_len + len);
+    return 0;
+}
+
+/*! \brief Write the digits of \c value so they end just before \c end.
+ *
+ * \return The number of digits written. */
+static size_t
+str_format_uint(char* end, uint64_t value) {
+    char* p = end;
+    while (value >= 100) {
+        size_t pair = (size_t)(value % 100) * 2;
+        value /= 100;
+        p -= 2;
+        memcpy(p, str_digit_pairs + pair, 2);
+    }
+    if (value >= 10) {
+        p -= 2;
+        memcpy(p, str_digit_pairs + value * 2, 2);
+    } else {
+        *--p = (char)('0' + value);
+    }
+    return end - p;
+}
+
+int
+str_push_uint(str* self, uint64_t value) {
+    char buffer[20];
+    size_t len = str_format_uint(buffer + sizeof(buffer), value);
+    return str_push_ascii(self, buffer + sizeof(buffer) - len, len);
+}
+
+int
+str_push_int(str* self, int64_t value) {
+    char buffer[21];
+    uint64_t magnitude = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+    size_t len = str_format_uint(buffer + sizeof(buffer), magnitude);
+    if (value < 0) {
+        buffer[sizeof(buffer) - ++len] = '-';
+    }
+    return str_push_ascii(self, buffer + sizeof(buffer) - len, len);
+}
+
+#define STR_DOUBLE_MANTISSA_BITS 52
+#define STR_DOUBLE_EXPONENT_BITS 11
+#define STR_DOUBLE_BIAS 1023
+#define STR_POW5_INV_BITCOUNT 125
+#define STR_POW5_BITCOUNT 125
+
+/* str_pow5_inv_split[i] is floor(2^(bits(5^i) - 1 + 125) / 5^i) + 1
+ * and str_pow5_split[i] is 5^i shifted to 125 bits, as {low, high}
+ * halves. */
+static const uint64_t str_pow5_inv_split[342][2] = {
+    {0x1U, 0x2000000000000000U},
+    {0x999999999999999AU, 0x1999999999999999U},
+    {0x47AE147AE147AE15U, 0x147AE147AE147AE1U},
+    {0x6C8B4395810624DEU, 0x10624DD2F1A9FBE7U},
+    {0x7A786C226809D496U, 0x1A36E2EB1C432CA5U},
+    {0x61F9F01B866E43ABU, 0x14F8B588E368F084U},
+    {0xB4C7F34938583622U, 0x10C6F7A0B5ED8D36U},
+    {0x87A6520EC08D236AU, 0x1AD7F29ABCAF4857U},
+    {0x9FB841A566D74F88U, 0x15798EE2308C39DFU},
+    {0xE62D01511F12A607U, 0x112E0BE826D694B2U},
+    {0xD6AE6881CB5109A4U, 0x1B7CDFD9D7BDBAB7U},
+    {0xDEF1ED34A2A73AEAU, 0x15FD7FE17964955FU},
+    {0x7F27F0F6E885C8BBU, 0x119799812DEA1119U},
+    {0x650CB4BE40D60DF8U, 0x1C25C268497681C2U},
+    {0xEA70909833DE7193U, 0x16849B86A12B9B01U},
+    {0x21F3A6E0297EC143U, 0x1203AF9EE756159BU},
+    {0x6985D7CD0F313537U, 0x1CD2B297D889BC2BU},
+    {0x2137DFD73F5A90F9U, 0x170EF54646D49689U},
+    {0xE75FE645CC4873FAU, 0x12725DD1D243ABA0U},
+    {0xA5663D3C7A0D865DU, 0x1D83C94FB6D2AC34U},
+    {0x511E976394D79EB1U, 0x179CA10C9242235DU},
+    {0xDA7EDF82DD794BC1U, 0x12E3B40A0E9B4F7DU},
+    {0x2A6498D1625BAC68U, 0x1E392010175EE596U},
+    {0xEEB6E0A781E2F053U, 0x182DB34012B25144U},
+    {0x58924D52CE4F26A9U, 0x1357C299A88EA76AU},
+    {0x27507BB7B07EA441U, 0x1EF2D0F5DA7DD8AAU},
+    {0x52A6C95FC0655034U, 0x18C240C4AECB13BBU},
+    {0xEEBD44C99EAA690U, 0x13CE9A36F23C0FC9U},
+    {0xB17953ADC3110A80U, 0x1FB0F6BE50601941U},
+    {0xC12DDC8B02740867U, 0x195A5EFEA6B34767U},
+    {0x3424B06F3529A052U, 0x14484BFEEBC29F86U},
+    {0x901D59F290EE19DBU, 0x1039D66589687F9EU},
+    {0x4CFBC31DB4B0295FU, 0x19F623D5A8A73297U},
+    {0x3D9635B15D59BAB2U, 0x14C4E977BA1F5BACU},
+    {0x97AB5E277DE16228U, 0x109D8792FB4C4956U},
+    {0xF2ABC9D8C9689D0DU, 0x1A95A5B7F87A0EF0U},
+    {0x5BBCA17A3ABA173EU, 0x154484932D2E725AU},
+    {0xAFCA1AC82EFB45CBU, 0x11039D428A8B8EAEU},
+    {0xB2DCF7A6B1920945U, 0x1B38FB9DAA78E44AU},
+    {0xF57D92EBC141A104U, 0x15C72FB1552D836EU},
+    {0xC46475896767B403U, 0x116C262777579C58U},
+    {0x6D6D88DBD8A5ECD2U, 0x1BE03D0BF225C6F4U},
+    {0x8ABE071646EB23DBU, 0x164CFDA3281E38C3U},
+    {0x6EFE6C11D255B649U, 0x11D7314F534B609CU},
+    {0xB197134FB6EF8A0EU, 0x1C8B821885456760U},
+    {0x27AC0F72F8BFA1A5U, 0x16D601AD376AB91AU},
+    {0xB95672C260994E1EU, 0x1244CE242C5560E1U},
+    {0xF5571E03CDC21695U, 0x1D3AE36D13BBCE35U},
+    {0x2AAC18030B01ABABU, 0x17624F8A762FD82BU},
+    {0xBBBCE0026F348956U, 0x12B50C6EC4F31355U},
+    {0x92C7CCD0B1EDA889U, 0x1DEE7A4AD4B81EEFU},
+    {0xDBD30A408E57BA07U, 0x17F1FB6F10934BF2U},
+    {0x7CA8D50071DFC806U, 0x1327FC58DA0F6FF5U},
+    {0xFAA7BB33E9660CD6U, 0x1EA6608E29B24CBBU},
+    {0x9552FC298784D711U, 0x18851A0B548EA3C9U},
+    {0xAAA8C9BAD2D0AC0EU, 0x139DAE6F76D88307U},
+    {0xDDDADC5E1E1AACE3U, 0x1F62B0B257C0D1A5U},
+    {0x7E48B04B4B488A4FU, 0x191BC08EAC9A4151U},
+    {0xCB6D59D5D5D3A1D9U, 0x141633A556E1CDDAU},
+    {0x3C577B1177DC817BU, 0x1011C2EAABE7D7E2U},
+    {0xC6F25E825960CF2AU, 0x19B604AAACA62636U},
+    {0x6BF518684780A5BBU, 0x14919D5556EB51C5U},
+    {0x232A79ED06008496U, 0x10747DDDDF22A7D1U},
+    {0xD1DD8FE1A3340756U, 0x1A53FC9631D10C81U},
+    {0xA7E4731AE8F66C45U, 0x150FFD44F4A73D34U},
+    {0x531D28E253F8569EU, 0x10D9976A5D52975DU},
+    {0xEB61DB03B98D5762U, 0x1AF5BF109550F22EU},
+    {0xBC4E48CFC7A445E8U, 0x159165A6DDDA5B58U},
+    {0x6371D3D96C836B20U, 0x11411E1F17E1E2ADU},
+    {0x9F1C8628AD9F11CDU, 0x1B9B6364F3030448U},
+    {0xE5B06B53BE18DB0BU, 0x1615E91D8F359D06U},
+    {0xEAF3890FCB4715A2U, 0x11AB20E472914A6BU},
+    {0x44B8DB4C7871BC37U, 0x1C45016D841BAA46U},
+    {0x3C715D6C6C1635FU, 0x169D9ABE03495505U},
+    {0x3638DE456BCDE919U, 0x1217AEFE69077737U},
+    {0x56C163A2461641C1U, 0x1CF2B1970E725858U},
+    {0xDF011C81D1AB67CEU, 0x17288E1271F51379U},
+    {0x7F3416CE4155ECA5U, 0x1286D80EC190DC61U},
+    {0x6520247D3556476EU, 0x1DA48CE468E7C702U},
+    {0xEA801D30F7783925U, 0x17B6D71D20B96C01U},
+    {0xBB99B0F3F92CFA84U, 0x12F8AC174D612334U},
+    {0x5F5C4E532847F739U, 0x1E5AACF215683854U},
+    {0x7F7D0B75B9D32C2EU, 0x18488A5B44536043U},
+    {0x9930D5F7C7DC2358U, 0x136D3B7C36A919CFU},
+    {0x8EB4898C72F9D226U, 0x1F152BF9F10E8FB2U},
+    {0x722A07A38F2E41B8U, 0x18DDBCC7F40BA628U},
+    {0xC1BB394FA5BE9AFAU, 0x13E497065CD61E86U},
+    {0x9C5EC2190930F7F6U, 0x1FD424D6FAF030D7U},
+    {0x49E56814075A5FF8U, 0x197683DF2F268D79U},
+    {0x6E51201005E1E660U, 0x145ECFE5BF520AC7U},
+    {0xF1DA800CD181851AU, 0x104BD984990E6F05U},
+    {0x4FC400148268D4F5U, 0x1A12F5A0F4E3E4D6U},
+    {0xD96999AA01ED772BU, 0x14DBF7B3F71CB711U},
+    {0xADEE1488018AC5BCU, 0x10AFF95CC5B09274U},
+    {0x497CEDA668DE092CU, 0x1AB328946F80EA54U},
+    {0x3ACA57B853E4D424U, 0x155C2076BF9A5510U},
+    {0x623B7960431D7683U, 0x1116805EFFAEAA73U},
+    {0x9D2BF566D1C8BD9EU, 0x1B5733CB32B110B8U},
+    {0x7DBCC452416D647FU, 0x15DF5CA28EF40D60U},
+    {0xCAFD69DB678AB6CCU, 0x117F7D4ED8C33DE6U},
+    {0xAB2F0FC572778ADFU, 0x1BFF2EE48E052FD7U},
+    {0x88F273045B92D580U, 0x1665BF1D3E6A8CACU},
+    {0xD3F528D049424466U, 0x11EAFF4A98553D56U},
+    {0xB988414D4203A0A3U, 0x1CAB3210F3BB9557U},
+    {0x6139CDD76802E6E9U, 0x16EF5B40C2FC7779U},
+    {0xE761717920025254U, 0x125915CD68C9F92DU},
+    {0xA568B58E999D5086U, 0x1D5B561574765B7CU},
+    {0x5120913EE14AA6D2U, 0x177C44DDF6C515FDU},
+    {0xA74D40FF1AA21F0EU, 0x12C9D0B1923744CAU},
+    {0xBAECE64F769CB4AU, 0x1E0FB44F50586E11U},
+    {0x3C8BD850C5EE3C3BU, 0x180C903F7379F1A7U},
+    {0xCA0979DA37F1C9C9U, 0x133D4032C2C7F485U},
+    {0xA9A8C2F6BFE942DBU, 0x1EC866B79E0CBA6FU},
+    {0x2153CF2BCCBA9BE3U, 0x18A0522C7E709526U},
+    {0x1AA9728970954982U, 0x13B374F06526DDB8U},
+    {0xF775840F1A88759DU, 0x1F8587E7083E2F8CU},
+    {0x5F9136727BA05E17U, 0x19379FEC0698260AU},
+    {0x1940F85B9619E4DFU, 0x142C7FF0054684D5U},
+    {0xE100C6AFAB47EA4CU, 0x1023998CD1053710U},
+    {0xCE67A44C453FDD47U, 0x19D28F47B4D524E7U},
+    {0xD852E9D69DCCB106U, 0x14A8729FC3DDB71FU},
+    {0x79DBEE454B0A2738U, 0x1086C219697E2C19U},
+    {0x295FE3A211A9D859U, 0x1A71368F0F30468FU},
+    {0xBAB31C81A7BB137AU, 0x15275ED8D8F36BA5U},
+    {0x6228E39AEC95A92FU, 0x10EC4BE0AD8F8951U},
+    {0x9D0E38F7E0EF7517U, 0x1B13AC9AAF4C0EE8U},
+    {0xB0D82D931A592A79U, 0x15A956E225D67253U},
+    {0x8D79BE0F4847552EU, 0x11544581B7DEC1DCU},
+    {0x158F967EDA0BBB7CU, 0x1BBA08CF8C979C94U},
+    {0x77A611FF14D62F97U, 0x162E6D72D6DFB076U},
+    {0xF951A7FF43DE8C79U, 0x11BEBDF578B2F391U},
+    {0xC21C3FFED2FDAD8EU, 0x1C6463225AB7EC1CU},
+    {0x1B0333242648AD8U, 0x16B6B5B5155FF017U},
+    {0x159C28E9B83A246U, 0x122BC490DDE659ACU},
+    {0xCEF604175F3903A3U, 0x1D12D41AFCA3C2ACU},
+    {0x725E69AC4C2D9C83U, 0x17424348CA1C9BBDU},
+    {0xF5185489D68AE39CU, 0x129B69070816E2FDU},
+    {0xEE8D540FBDAB05C6U, 0x1DC574D80CF16B2FU},
+    {0xBED77672FE226B05U, 0x17D12A4670C1228CU},
+    {0xFF12C528CB4EBC04U, 0x130DBB6B8D674ED6U},
+    {0xCB513B74787DF9A0U, 0x1E7C5F127BD87E24U},
+    {0x90DC929F9FE614DU, 0x18637F41FCAD31B7U},
+    {0xA0D7D42194CB810AU, 0x1382CC34CA2427C5U},
+    {0x67BFB9CF5478CE77U, 0x1F37AD21436D0C6FU},
+    {0x1FCC94A5DD2D71F9U, 0x18F9574DCF8A7059U},
+    {0x7FD6DD517DBDF4C7U, 0x13FAAC3E3FA1F37AU},
+    {0xFFBE2EE8C92FEE0BU, 0x1FF779FD329CB8C3U},
+    {0x6631BF20A0F324D6U, 0x1992C7FDC216FA36U},
+    {0xB827CC1A1A5C1D78U, 0x14756CCB01ABFB5EU},
+    {0x935309AE7B7CE460U, 0x105DF0A267BCC918U},
+    {0x1EEB42B0C594A099U, 0x1A2FE76A3F9474F4U},
+    {0xE58902270476E6E1U, 0x14F31F8832DD2A5CU},
+    {0xB7A0CE859D2BEBE7U, 0x10C27FA028B0EEB0U},
+    {0x59014A6F61DFDFD8U, 0x1AD0CC33744E4AB4U},
+    {0xE0CDD525E7E64CADU, 0x1573D68F903EA229U},
+    {0x4D7177518651D6F1U, 0x11297872D9CBB4EEU},
+    {0x7BE8BEE8D6E957E8U, 0x1B758D848FAC54B0U},
+    {0xFCBA3253DF211320U, 0x15F7A46A0C89DD59U},
+    {0x63C8284318E74280U, 0x1192E9EE706E4AAEU},
+    {0x60D0D3827D86A66U, 0x1C1E43171A4A1117U},
+    {0x6B3DA42CECAD21EBU, 0x167E9C127B6E7412U},
+    {0x88FE1CF0BD574E56U, 0x11FEE341FC585CDBU},
+    {0x419694B462254A23U, 0x1CCB0536608D615FU},
+    {0x67ABAA29E81DD4E9U, 0x1708D0F84D3DE77FU},
+    {0xB95621BB2017DD87U, 0x126D73F9D764B932U},
+    {0xC223692B668C95A5U, 0x1D7BECC2F23AC1EAU},
+    {0xCE82BA891ED6DE1DU, 0x179657025B6234BBU},
+    {0xA53562074BDF1818U, 0x12DEAC01E2B4F6FCU},
+    {0x3B889CD87964F359U, 0x1E3113363787F194U},
+    {0xFC6D4A46C783F5E1U, 0x18274291C6065ADCU},
+    {0x30576E9F06032B1AU, 0x13529BA7D19EAF17U},
+    {0x1A257DCB3CD1DE90U, 0x1EEA92A61C311825U},
+    {0x481DFE3C30A7E540U, 0x18BBA884E35A79B7U},
+    {0xD34B31C9C0865100U, 0x13C9539D82AEC7C5U},
+    {0x5211E942CDA3B4CDU, 0x1FA885C8D117A609U},
+    {0x74DB21023E1C90A4U, 0x19539E3A40DFB807U},
+    {0xF715B401CB4A0D50U, 0x1442E4FB67196005U},
+    {0xF8DE299B09080AA7U, 0x103583FC527AB337U},
+    {0x8E304291A80CDDD7U, 0x19EF3993B72AB859U},
+    {0x3E8D020E200A4B13U, 0x14BF6142F8EEF9E1U},
+    {0x653D9B3E80083C0FU, 0x10991A9BFA58C7E7U},
+    {0x6EC8F864000D2CE4U, 0x1A8E90F9908E0CA5U},
+    {0x8BD3F9E999A423EAU, 0x153EDA614071A3B7U},
+    {0x3CA994BAE1501CBBU, 0x10FF151A99F482F9U},
+    {0xC775BAC49BB3612BU, 0x1B31BB5DC320D18EU},
+    {0xD2C4956A16291A89U, 0x15C162B168E70E0BU},
+    {0xDBD0778811BA7BA1U, 0x11678227871F3E6FU},
+    {0x2C80BF401C5D929BU, 0x1BD8D03F3E9863E6U},
+    {0xBD33CC3349E47549U, 0x16470CFF6546B651U},
+    {0xCA8FD68F6E505DD4U, 0x11D270CC51055EA7U},
+    {0x4419574BE3B3C953U, 0x1C83E7AD4E6EFDD9U},
+    {0x347790982F63AA9U, 0x16CFEC8AA52597E1U},
+    {0xCF6C60D468C4FBBAU, 0x123FF06EEA847980U},
+    {0xE57A34870E07F92AU, 0x1D331A4B10D3F59AU},
+    {0x512E906C0B399422U, 0x175C1508DA432AE2U},
+    {0xDA8BA6BCD5C7A9B5U, 0x12B010D3E1CF5581U},
+    {0x90DF712E22D90F87U, 0x1DE6815302E5559CU},
+    {0xDA4C5A8B4F140C6CU, 0x17EB9AA8CF1DDE16U},
+    {0xAEA37BA2A5A9A38AU, 0x1322E220A5B17E78U},
+    {0x7DD25F6AA2A905A9U, 0x1E9E369AA2B59727U},
+    {0x97DB7F888220D154U, 0x187E92154EF7AC1FU},
+    {0x797C6606CE80A777U, 0x139874DDD8C6234CU},
+    {0x8F2D700AE4010BF1U, 0x1F5A549627A36BADU},
+    {0xC2459A25000D65AU, 0x191510781FB5EFBEU},
+    {0x701D1481D99A4515U, 0x1410D9F9B2F7F2FEU},
+    {0xC017439B147B6A77U, 0x100D7B2E28C65BFEU},
+    {0xCCF205C4ED9243F2U, 0x19AF2B7D0E0A2CCAU},
+    {0xA5B37D0BE0E9CC2U, 0x148C22CA71A1BD6FU},
+    {0x848F973CB3EE3CEU, 0x10701BD527B4978CU},
+    {0xDA0E5BEC78649FB0U, 0x1A4CF9550C5425ACU},
+    {0x7B3EAFF060507FC0U, 0x150A6110D6A9B7BDU},
+    {0x95CBBFF380406633U, 0x10D51A73DEEE2C97U},
+    {0xEFAC665266CD7052U, 0x1AEE90B964B04758U},
+    {0x2623850EB8A459DBU, 0x158BA6FAB6F36C47U},
+    {0x1E82D0D893B6AE49U, 0x113C85955F29236CU},
+    {0xFD9E1AF41F8AB075U, 0x1B9408EEFEA838ACU},
+    {0x97B1AF29B2D559F7U, 0x16100725988693BDU},
+    {0xAC8E25BAF5777B2CU, 0x11A66C1E139EDC97U},
+    {0x7A7D092B2258C513U, 0x1C3D79C9B8FE2DBFU},
+    {0x61FDA0EF4EAD6A76U, 0x169794A160CB57CCU},
+    {0xE7FE1A590BBDEEC5U, 0x1212DD4DE7091309U},
+    {0xA6635D5B45FCB13AU, 0x1CEAFBAFD80E84DCU},
+    {0x851C4AAF6B308DC8U, 0x172262F3133ED0B0U},
+    {0xD0E36EF2BC26D7D4U, 0x1281E8C275CBDA26U},
+    {0xB49F17EAC6A48C86U, 0x1D9CA79D894629D7U},
+    {0x2A18DFEF0550706BU, 0x17B08617A104EE46U},
+    {0x54E0B3259DD9F389U, 0x12F39E794D9D8B6BU},
+    {0x87CDEB6F62F65274U, 0x1E5297287C2F4578U},
+    {0xD30B22BF825EA85DU, 0x18421286C9BF6AC6U},
+    {0xF3C1BCC684BB9E4U, 0x13680ED23AFF889FU},
+    {0x18602C7A4079296DU, 0x1F0CE4839198DA98U},
+    {0x46B356C833942124U, 0x18D71D360E13E213U},
+    {0x388F78A029434DB6U, 0x13DF4A91A4DCB4DCU},
+    {0x5A7F2766A86BAF8AU, 0x1FCBAA82A1612160U},
+    {0x153285EBB9EFBFA2U, 0x196FBB9BB44DB44DU},
+    {0xAA8ED189618C994EU, 0x145962E2F6A4903DU},
+    {0xEED8A7A11AD6E10CU, 0x1047824F2BB6D9CAU},
+    {0x7E27729B5E249B45U, 0x1A0C03B1DF8AF611U},
+    {0xFE85F549181D4904U, 0x14D6695B193BF80DU},
+    {0xCB9E5DD4134AA0D0U, 0x10AB877C142FF9A4U},
+    {0xDF63C9535211014DU, 0x1AAC0BF9B9E65C3AU},
+    {0x191CA10F74DA6771U, 0x15566FFAFB1EB02FU},
+    {0xADB080D92A4852C1U, 0x1111F32F2F4BC025U},
+    {0x15E7348EAA0D5134U, 0x1B4FEB7EB212CD09U},
+    {0xAB1F5D3EEE710DC4U, 0x15D98932280F0A6DU},
+    {0xBC1917658B8DA49DU, 0x117AD428200C0857U},
+    {0x2CF4F23C127C3A94U, 0x1BF7B9D9CCE00D59U},
+    {0xF0C3F4FCDB969543U, 0x165FC7E170B33DE0U},
+    {0x5A365D9716121103U, 0x11E6398126F5CB1AU},
+    {0x9056FC24F01CE804U, 0x1CA38F350B22DE90U},
+    {0xD9DF301D8CE3ECD0U, 0x16E93F5DA2824BA6U},
+    {0xE17F59B13D8323DAU, 0x125432B14ECEA2EBU},
+    {0x68CBC2B52F38395CU, 0x1D53844EE47DD179U},
+    {0x53D6355DBF602DE3U, 0x177603725064A794U},
+    {0xA9782AB165E68B1CU, 0x12C4CF8EA6B6EC76U},
+    {0xF26AAB56FD744FAU, 0x1E07B27DD78B13F1U},
+    {0x3F52222ABFDF6A62U, 0x18062864AC6F4327U},
+    {0x65DB4E88997F884EU, 0x1338205089F29C1FU},
+    {0x6FC54A7428CC0D4AU, 0x1EC033B40FEA9365U},
+    {0x596AA1F68709A43BU, 0x1899C2F673220F84U},
+    {0xADEEE7F86C07B696U, 0x13AE3591F5B4D936U},
+    {0x497E3FF3E00C5756U, 0x1F7D228322BAF524U},
+    {0xD464FFF64CD6AC45U, 0x1930E868E89590E9U},
+    {0x4383FFF83D7889D1U, 0x14272053ED4473EEU},
+    {0xCF9CCCC69793A174U, 0x101F4D0FF1038FF1U},
+    {0x7F6147A425B90252U, 0x19CBAE7FE805B31CU},
+    {0xCC4DD2E9B7C7350FU, 0x14A2F1FFECD15C16U},
+    {0x3D0B0F215FD290D9U, 0x10825B3323DAB012U},
+    {0x61AB4B689950E7C1U, 0x1A6A2B85062AB350U},
+    {0x4E22A2BA1440B967U, 0x1521BC6A6B555C40U},
+    {0xB4EE894DD009453U, 0x10E7C9EEBC4449CDU},
+    {0x1217DA87C800ED51U, 0x1B0C764AC6D3A948U},
+    {0xDB46486CA000BDDAU, 0x15A391D56BDC876CU},
+    {0x490506BD4CCD64AFU, 0x114FA7DDEFE39F8AU},
+    {0xA8080AC87AE23AB1U, 0x1BB2A62FE638FF43U},
+    {0x5339A239FBE82EF4U, 0x162884F31E93FF69U},
+    {0x75C7B4FB2FECF25DU, 0x11BA03F5B20FFF87U},
+    {0x22D92191E647EA2EU, 0x1C5CD322B67FFF3FU},
+    {0xB57A8141850654F2U, 0x16B0A8E891FFFF65U},
+    {0xC4620101373843F5U, 0x1226ED86DB3332B7U},
+    {0x3A366801F1F39FEEU, 0x1D0B15A491EB8459U},
+    {0xFB5EB99B27F6198BU, 0x173C115074BC69E0U},
+    {0x2F7EFAE2865E7AD6U, 0x129674405D6387E7U},
+    {0xE597F7D0D6FD9156U, 0x1DBD86CD6238D971U},
+    {0x8479930D78CADAABU, 0x17CAD23DE82D7AC1U},
+    {0xD06142712D6F1556U, 0x1308A831868AC89AU},
+    {0x4D686A4EAF182222U, 0x1E74404F3DAADA91U},
+    {0xA453883EF279B4E8U, 0x185D003F6488AEDAU},
+    {0xE9DC6CFF28615D87U, 0x137D99CC506D58AEU},
+    {0xA960AE650D6895A4U, 0x1F2F5C7A1A488DE4U},
+    {0xBAB3BEB73DED4483U, 0x18F2B061AEA07183U},
+    {0x2EF6322C318A9D36U, 0x13F559E7BEE6C136U},
+    {0xE4BD1D13827761F0U, 0x1FEEF63F97D79B89U},
+    {0x83CA7DA9352C4E5AU, 0x198BF832DFDFAFA1U},
+    {0x9CA1FE20F756A515U, 0x146FF9C24CB2F2E7U},
+    {0x4A1B31B3F9121DAAU, 0x1059949B708F28B9U},
+    {0x435EB5ECC1B695DDU, 0x1A28EDC580E50DF5U},
+    {0x35E55E57015EDE4AU, 0x14ED8B04671DA4C4U},
+    {0xC4B77EAC0118B1D5U, 0x10BE08D0527E1D69U},
+    {0xA12597799B5AB622U, 0x1AC9A7B3B7302F0FU},
+    {0x4DB7AC6149155E81U, 0x156E1FC2F8F358D9U},
+    {0xD7C6238107444B9BU, 0x1124E63593F5E0ADU},
+    {0x593D059B3ED3AC2BU, 0x1B6E3D2286563449U},
+    {0xE0FD9E15CBDC89BCU, 0x15F1CA820511C36DU},
+    {0xB3FE18116FE3A163U, 0x118E3B9B37416924U},
+    {0x866359B57FD29BD1U, 0x1C16C5C525357507U},
+    {0xD1E91491330EE30EU, 0x16789E3750F790D2U},
+    {0x74BA76DA8F3F1C0BU, 0x11FA182C40C60D75U},
+    {0xEDF72490E531C678U, 0x1CC359E067A348BBU},
+    {0x8B2C1D40B75B052DU, 0x1702AE4D1FB5D3C9U},
+    {0x6F567DCD5F7C0424U, 0x12688B70E62B0FD4U},
+    {0x7EF0C94898C66D06U, 0x1D74124E3D11B2EDU},
+    {0x98C0A106E09EBD9FU, 0x17900EA4FDA7C257U},
+    {0x470080D24D4BCAE6U, 0x12D9A550CAEC9B79U},
+    {0xD800CE1D487944A2U, 0x1E29088144ADC58EU},
+    {0x1333D8176D2DD082U, 0x1820D39A9D57D13FU},
+    {0xA8F646792424A6CEU, 0x134D76154AACA765U},
+    {0x74BD3D8EA03AA47DU, 0x1EE25688777AA56FU},
+    {0x5D64313EE6955064U, 0x18B51206C5FBB78CU},
+    {0x4AB68DCBEBAAA6B7U, 0x13C40E6BD1962C70U},
+    {0x1124161312AAA457U, 0x1FA01712E8F0471AU},
+    {0xDA8344DC0EEEE9DFU, 0x194CDF4253F36C14U},
+    {0xE2029D7CD8BF2180U, 0x143D7F6843292343U},
+    {0x4E687DFD7A328133U, 0x103132B9CF541C36U},
+    {0x4A40C9959050CEB8U, 0x19E851294BB9C6BDU},
+    {0x833D477A6A70BC6U, 0x14B9DA876FC7D231U},
+    {0xA02976C61EEC096BU, 0x1094AED2BFD30E8DU},
+    {0x4257A364ACDBDFU, 0x1A877E1DFFB81749U},
+    {0xCD01DFB5EA23E319U, 0x153931B1996012A0U},
+    {0x70CE4C91881CB5AEU, 0x10FA8E27ADE6754DU},
+    {0x1AE3ADB5A69455E2U, 0x1B2A7D0C4970BBAFU},
+    {0x7BE957C4854377E8U, 0x15BB973D078D62F2U},
+    {0xC987796A0435F987U, 0x1162DF64060AB58EU},
+    {0x75A58F1006BCC271U, 0x1BD1656CD67788E4U},
+    {0xF7B7A5A66BCA3527U, 0x16411DF0AB92D3E9U},
+    {0x5FC61E1EBCA1C41FU, 0x11CDB18D560F0FEEU},
+    {0xFFA363646102D365U, 0x1C7C4F4889B1B316U},
+    {0x32E91C504D9BDC51U, 0x16C9D906D48E28DFU},
+    {0x8F20E37371497D0EU, 0x123B140576D820B2U},
+    {0x7E9B0585820F2E7CU, 0x1D2B533BF159CDEAU},
+    {0xCBAF379E01A5BECAU, 0x1755DC2FF447D7EEU},
+    {0x958F94B348498A1U, 0x12AB168CC36CACBFU}
+};
+
+static const uint64_t str_pow5_split[326][2] = {
+    {0x0U, 0x1000000000000000U},
+    {0x0U, 0x1400000000000000U},
+    {0x0U, 0x1900000000000000U},
+    {0x0U, 0x1F40000000000000U},
+    {0x0U, 0x1388000000000000U},
+    {0x0U, 0x186A000000000000U},
+    {0x0U, 0x1E84800000000000U},
+    {0x0U, 0x1312D00000000000U},
+    {0x0U, 0x17D7840000000000U},
+    {0x0U, 0x1DCD650000000000U},
+    {0x0U, 0x12A05F2000000000U},
+    {0x0U, 0x174876E800000000U},
+    {0x0U, 0x1D1A94A200000000U},
+    {0x0U, 0x12309CE540000000U},
+    {0x0U, 0x16BCC41E90000000U},
+    {0x0U, 0x1C6BF52634000000U},
+    {0x0U, 0x11C37937E0800000U},
+    {0x0U, 0x16345785D8A00000U},
+    {0x0U, 0x1BC16D674EC80000U},
+    {0x0U, 0x1158E460913D0000U},
+    {0x0U, 0x15AF1D78B58C4000U},
+    {0x0U, 0x1B1AE4D6E2EF5000U},
+    {0x0U, 0x10F0CF064DD59200U},
+    {0x0U, 0x152D02C7E14AF680U},
+    {0x0U, 0x1A784379D99DB420U},
+    {0x0U, 0x108B2A2C28029094U},
+    {0x0U, 0x14ADF4B7320334B9U},
+    {0x4000000000000000U, 0x19D971E4FE8401E7U},
+    {0x8800000000000000U, 0x1027E72F1F128130U},
+    {0xAA00000000000000U, 0x1431E0FAE6D7217CU},
+    {0xD480000000000000U, 0x193E5939A08CE9DBU},
+    {0xC9A0000000000000U, 0x1F8DEF8808B02452U},
+    {0xBE04000000000000U, 0x13B8B5B5056E16B3U},
+    {0xAD85000000000000U, 0x18A6E32246C99C60U},
+    {0xD8E6400000000000U, 0x1ED09BEAD87C0378U},
+    {0x878FE80000000000U, 0x13426172C74D822BU},
+    {0x6973E20000000000U, 0x1812F9CF7920E2B6U},
+    {0x3D0DA8000000000U, 0x1E17B84357691B64U},
+    {0x8262889000000000U, 0x12CED32A16A1B11EU},
+    {0x22FB2AB400000000U, 0x178287F49C4A1D66U},
+    {0xABB9F56100000000U, 0x1D6329F1C35CA4BFU},
+    {0xCB54395CA0000000U, 0x125DFA371A19E6F7U},
+    {0xBE2947B3C8000000U, 0x16F578C4E0A060B5U},
+    {0x2DB399A0BA000000U, 0x1CB2D6F618C878E3U},
+    {0xFC90400474400000U, 0x11EFC659CF7D4B8DU},
+    {0x7BB4500591500000U, 0x166BB7F0435C9E71U},
+    {0xDAA16406F5A40000U, 0x1C06A5EC5433C60DU},
+    {0xA8A4DE8459868000U, 0x118427B3B4A05BC8U},
+    {0xD2CE16256FE82000U, 0x15E531A0A1C872BAU},
+    {0x87819BAECBE22800U, 0x1B5E7E08CA3A8F69U},
+    {0xF4B1014D3F6D5900U, 0x111B0EC57E6499A1U},
+    {0x71DD41A08F48AF40U, 0x1561D276DDFDC00AU},
+    {0xE549208B31ADB10U, 0x1ABA4714957D300DU},
+    {0x28F4DB456FF0C8EAU, 0x10B46C6CDD6E3E08U},
+    {0x33321216CBECFB24U, 0x14E1878814C9CD8AU},
+    {0xBFFE969C7EE839EDU, 0x1A19E96A19FC40ECU},
+    {0xF7FF1E21CF512434U, 0x105031E2503DA893U},
+    {0xF5FEE5AA43256D41U, 0x14643E5AE44D12B8U},
+    {0x337E9F14D3EEC892U, 0x197D4DF19D605767U},
+    {0x5E46DA08EA7AB6U, 0x1FDCA16E04B86D41U},
+    {0xA03AEC4845928CB2U, 0x13E9E4E4C2F34448U},
+    {0xC849A75A56F72FDEU, 0x18E45E1DF3B0155AU},
+    {0x7A5C1130ECB4FBD6U, 0x1F1D75A5709C1AB1U},
+    {0xEC798ABE93F11D65U, 0x13726987666190AEU},
+    {0xA797ED6E38ED64BFU, 0x184F03E93FF9F4DAU},
+    {0x517DE8C9C728BDEFU, 0x1E62C4E38FF87211U},
+    {0xD2EEB17E1C7976B5U, 0x12FDBB0E39FB474AU},
+    {0x87AA5DDDA397D462U, 0x17BD29D1C87A191DU},
+    {0xE994F5550C7DC97BU, 0x1DAC74463A989F64U},
+    {0x11FD195527CE9DEDU, 0x128BC8ABE49F639FU},
+    {0xD67C5FAA71C24568U, 0x172EBAD6DDC73C86U},
+    {0x8C1B77950E32D6C2U, 0x1CFA698C95390BA8U},
+    {0x57912ABD28DFC639U, 0x121C81F7DD43A749U},
+    {0xAD75756C7317B7C8U, 0x16A3A275D494911BU},
+    {0x98D2D2C78FDDA5BAU, 0x1C4C8B1349B9B562U},
+    {0x9F83C3BCB9EA8794U, 0x11AFD6EC0E14115DU},
+    {0x764B4ABE8652979U, 0x161BCCA7119915B5U},
+    {0x493DE1D6E27E73D7U, 0x1BA2BFD0D5FF5B22U},
+    {0x6DC6AD264D8F0866U, 0x1145B7E285BF98F5U},
+    {0xC938586FE0F2CA80U, 0x159725DB272F7F32U},
+    {0x7B866E8BD92F7D20U, 0x1AFCEF51F0FB5EFFU},
+    {0xAD34051767BDAE34U, 0x10DE1593369D1B5FU},
+    {0x9881065D41AD19C1U, 0x15159AF804446237U},
+    {0x7EA147F492186032U, 0x1A5B01B605557AC5U},
+    {0x6F24CCF8DB4F3C1FU, 0x1078E111C3556CBBU},
+    {0x4AEE003712230B27U, 0x14971956342AC7EAU},
+    {0xDDA98044D6ABCDF0U, 0x19BCDFABC13579E4U},
+    {0xA89F02B062B60B6U, 0x10160BCB58C16C2FU},
+    {0xCD2C6C35C7B638E4U, 0x141B8EBE2EF1C73AU},
+    {0x8077874339A3C71DU, 0x1922726DBAAE3909U},
+    {0xE0956914080CB8E4U, 0x1F6B0F092959C74BU},
+    {0x6C5D61AC8507F38EU, 0x13A2E965B9D81C8FU},
+    {0x4774BA17A649F072U, 0x188BA3BF284E23B3U},
+    {0x1951E89D8FDC6C8FU, 0x1EAE8CAEF261ACA0U},
+    {0xFD3316279E9C3D9U, 0x132D17ED577D0BE4U},
+    {0x13C7FDBB186434CFU, 0x17F85DE8AD5C4EDDU},
+    {0x58B9FD29DE7D4203U, 0x1DF67562D8B36294U},
+    {0xB7743E3A2B0E4942U, 0x12BA095DC7701D9CU},
+    {0xE5514DC8B5D1DB92U, 0x17688BB5394C2503U},
+    {0xDEA5A13AE3465277U, 0x1D42AEA2879F2E44U},
+    {0xB2784C4CE0BF38AU, 0x1249AD2594C37CEBU},
+    {0xCDF165F6018EF06DU, 0x16DC186EF9F45C25U},
+    {0x416DBF7381F2AC88U, 0x1C931E8AB871732FU},
+    {0x88E497A83137ABD5U, 0x11DBF316B346E7FDU},
+    {0xEB1DBD923D8596CAU, 0x1652EFDC6018A1FCU},
+    {0x25E52CF6CCE6FC7DU, 0x1BE7ABD3781ECA7CU},
+    {0x97AF3C1A40105DCEU, 0x1170CB642B133E8DU},
+    {0xFD9B0B20D0147542U, 0x15CCFE3D35D80E30U},
+    {0x3D01CDE904199292U, 0x1B403DCC834E11BDU},
+    {0x462120B1A28FFB9BU, 0x1108269FD210CB16U},
+    {0xD7A968DE0B33FA82U, 0x154A3047C694FDDBU},
+    {0xCD93C3158E00F923U, 0x1A9CBC59B83A3D52U},
+    {0xC07C59ED78C09BB6U, 0x10A1F5B813246653U},
+    {0xB09B7068D6F0C2A3U, 0x14CA732617ED7FE8U},
+    {0xDCC24C830CACF34CU, 0x19FD0FEF9DE8DFE2U},
+    {0xC9F96FD1E7EC180FU, 0x103E29F5C2B18BEDU},
+    {0x3C77CBC661E71E13U, 0x144DB473335DEEE9U},
+    {0x8B95BEB7FA60E598U, 0x1961219000356AA3U},
+    {0x6E7B2E65F8F91EFEU, 0x1FB969F40042C54CU},
+    {0xC50CFCFFBB9BB35FU, 0x13D3E2388029BB4FU},
+    {0xB6503C3FAA82A037U, 0x18C8DAC6A0342A23U},
+    {0xA3E44B4F95234844U, 0x1EFB1178484134ACU},
+    {0xE66EAF11BD360D2BU, 0x135CEAEB2D28C0EBU},
+    {0xE00A5AD62C839075U, 0x183425A5F872F126U},
+    {0x980CF18BB7A47493U, 0x1E412F0F768FAD70U},
+    {0x5F0816F752C6C8DCU, 0x12E8BD69AA19CC66U},
+    {0xF6CA1CB527787B13U, 0x17A2ECC414A03F7FU},
+    {0xF47CA3E2715699D7U, 0x1D8BA7F519C84F5FU},
+    {0xF8CDE66D86D62026U, 0x127748F9301D319BU},
+    {0xF7016008E88BA830U, 0x17151B377C247E02U},
+    {0xB4C1B80B22AE923CU, 0x1CDA62055B2D9D83U},
+    {0x50F91306F5AD1B65U, 0x12087D4358FC8272U},
+    {0xE53757C8B318623FU, 0x168A9C942F3BA30EU},
+    {0x9E852DBADFDE7ACFU, 0x1C2D43B93B0A8BD2U},
+    {0xA3133C94CBEB0CC1U, 0x119C4A53C4E69763U},
+    {0x8BD80BB9FEE5CFF1U, 0x16035CE8B6203D3CU},
+    {0xAECE0EA87E9F43EEU, 0x1B843422E3A84C8BU},
+    {0x4D40C9294F238A75U, 0x1132A095CE492FD7U},
+    {0x2090FB73A2EC6D12U, 0x157F48BB41DB7BCDU},
+    {0x68B53A508BA78856U, 0x1ADF1AEA12525AC0U},
+    {0x417144725748B536U, 0x10CB70D24B7378B8U},
+    {0x51CD958EED1AE283U, 0x14FE4D06DE5056E6U},
+    {0xE640FAF2A8619B24U, 0x1A3DE04895E46C9FU},
+    {0xEFE89CD7A93D00F7U, 0x1066AC2D5DAEC3E3U},
+    {0xEBE2C40D938C4134U, 0x14805738B51A74DCU},
+    {0x26DB7510F86F5181U, 0x19A06D06E2611214U},
+    {0x9849292A9B4592F1U, 0x100444244D7CAB4CU},
+    {0xBE5B73754216F7ADU, 0x1405552D60DBD61FU},
+    {0xADF25052929CB598U, 0x1906AA78B912CBA7U},
+    {0x996EE4673743E2FFU, 0x1F485516E7577E91U},
+    {0xFFE54EC0828A6DDFU, 0x138D352E5096AF1AU},
+    {0xBFDEA270A32D0957U, 0x18708279E4BC5AE1U},
+    {0x2FD64B0CCBF84BADU, 0x1E8CA3185DEB719AU},
+    {0x5DE5EEE7FF7B2F4CU, 0x1317E5EF3AB32700U},
+    {0x755F6AA1FF59FB1FU, 0x17DDDF6B095FF0C0U},
+    {0x92B7454A7F3079E7U, 0x1DD55745CBB7ECF0U},
+    {0x5BB28B4E8F7E4C30U, 0x12A5568B9F52F416U},
+    {0xF29F2E22335DDF3CU, 0x174EAC2E8727B11BU},
+    {0xEF46F9AAC035570BU, 0x1D22573A28F19D62U},
+    {0xD58C5C0AB8215667U, 0x123576845997025DU},
+    {0x4AEF730D6629AC01U, 0x16C2D4256FFCC2F5U},
+    {0x9DAB4FD0BFB41701U, 0x1C73892ECBFBF3B2U},
+    {0xA28B11E277D08E60U, 0x11C835BD3F7D784FU},
+    {0x8B2DD65B15C4B1F9U, 0x163A432C8F5CD663U},
+    {0x6DF94BF1DB35DE77U, 0x1BC8D3F7B3340BFCU},
+    {0xC4BBCF772901AB0AU, 0x115D847AD000877DU},
+    {0x35EAC354F34215CDU, 0x15B4E5998400A95DU},
+    {0x8365742A30129B40U, 0x1B221EFFE500D3B4U},
+    {0xD21F689A5E0BA108U, 0x10F5535FEF208450U},
+    {0x6A742C0F58E894AU, 0x1532A837EAE8A565U},
+    {0x4851137132F22B9DU, 0x1A7F5245E5A2CEBEU},
+    {0xED32AC26BFD75B42U, 0x108F936BAF85C136U},
+    {0xA87F57306FCD3212U, 0x14B378469B673184U},
+    {0xD29F2CFC8BC07E97U, 0x19E056584240FDE5U},
+    {0xA3A37C1DD7584F1EU, 0x102C35F729689EAFU},
+    {0x8C8C5B254D2E62E6U, 0x14374374F3C2C65BU},
+    {0x6FAF71EEA079FB9FU, 0x1945145230B377F2U},
+    {0xB9B4E6A48987A87U, 0x1F965966BCE055EFU},
+    {0x674111026D5F4C94U, 0x13BDF7E0360C35B5U},
+    {0xC111554308B71FBAU, 0x18AD75D8438F4322U},
+    {0x7155AA93CAE4E7A8U, 0x1ED8D34E547313EBU},
+    {0x26D58A9C5ECF10C9U, 0x13478410F4C7EC73U},
+    {0xF08AED437682D4FBU, 0x1819651531F9E78FU},
+    {0xECADA89454238A3AU, 0x1E1FBE5A7E786173U},
+    {0x73EC895CB4963664U, 0x12D3D6F88F0B3CE8U},
+    {0x90E7ABB3E1BBC3FDU, 0x1788CCB6B2CE0C22U},
+    {0x352196A0DA2AB4FDU, 0x1D6AFFE45F818F2BU},
+    {0x134FE24885AB11EU, 0x1262DFEEBBB0F97BU},
+    {0xC1823DADAA715D65U, 0x16FB97EA6A9D37D9U},
+    {0x31E2CD19150DB4BFU, 0x1CBA7DE5054485D0U},
+    {0x1F2DC02FAD2890F7U, 0x11F48EAF234AD3A2U},
+    {0xA6F9303B9872B535U, 0x1671B25AEC1D888AU},
+    {0x50B77C4A7E8F6282U, 0x1C0E1EF1A724EAADU},
+    {0x5272ADAE8F199D91U, 0x1188D357087712ACU},
+    {0x670F591A32E004F6U, 0x15EB082CCA94D757U},
+    {0x40D32F60BF980633U, 0x1B65CA37FD3A0D2DU},
+    {0x4883FD9C77BF03E0U, 0x111F9E62FE44483CU},
+    {0x5AA4FD0395AEC4D8U, 0x156785FBBDD55A4BU},
+    {0x314E3C447B1A760EU, 0x1AC1677AAD4AB0DEU},
+    {0xDED0E5AACCF089C9U, 0x10B8E0ACAC4EAE8AU},
+    {0x96851F15802CAC3BU, 0x14E718D7D7625A2DU},
+    {0xFC2666DAE037D74AU, 0x1A20DF0DCD3AF0B8U},
+    {0x9D980048CC22E68EU, 0x10548B68A044D673U},
+    {0x84FE005AFF2BA032U, 0x1469AE42C8560C10U},
+    {0xA63D8071BEF6883EU, 0x198419D37A6B8F14U},
+    {0xCFCCE08E2EB42A4EU, 0x1FE52048590672D9U},
+    {0x21E00C58DD309A70U, 0x13EF342D37A407C8U},
+    {0x2A580F6F147CC10DU, 0x18EB0138858D09BAU},
+    {0xB4EE134AD99BF150U, 0x1F25C186A6F04C28U},
+    {0x7114CC0EC80176D2U, 0x137798F428562F99U},
+    {0xCD59FF127A01D486U, 0x18557F31326BBB7FU},
+    {0xC0B07ED7188249A8U, 0x1E6ADEFD7F06AA5FU},
+    {0xD86E4F466F516E09U, 0x1302CB5E6F642A7BU},
+    {0xCE89E3180B25C98BU, 0x17C37E360B3D351AU},
+    {0x822C5BDE0DEF3BEEU, 0x1DB45DC38E0C8261U},
+    {0xF15BB96AC8B58575U, 0x1290BA9A38C7D17CU},
+    {0x2DB2A7C57AE2E6D2U, 0x1734E940C6F9C5DCU},
+    {0x391F51B6D99BA086U, 0x1D022390F8B83753U},
+    {0x3B3931248014454U, 0x1221563A9B732294U},
+    {0x4A077D6DA019569U, 0x16A9ABC9424FEB39U},
+    {0x45C895CC9081FAC3U, 0x1C5416BB92E3E607U},
+    {0x8B9D5D9FDA513CBAU, 0x11B48E353BCE6FC4U},
+    {0xAE84B507D0E58BE8U, 0x1621B1C28AC20BB5U},
+    {0x1A25E249C51EEEE3U, 0x1BAA1E332D728EA3U},
+    {0xF057AD6E1B33554DU, 0x114A52DFFC679925U},
+    {0x6C6D98C9A2002AA1U, 0x159CE797FB817F6FU},
+    {0x4788FEFC0A803549U, 0x1B04217DFA61DF4BU},
+    {0xCB59F5D8690214EU, 0x10E294EEBC7D2B8FU},
+    {0xCFE30734E83429A1U, 0x151B3A2A6B9C7672U},
+    {0x83DBC9022241340AU, 0x1A6208B50683940FU},
+    {0xB2695DA15568C086U, 0x107D457124123C89U},
+    {0x1F03B509AAC2F0A7U, 0x149C96CD6D16CBACU},
+    {0x26C4A24C1573ACD1U, 0x19C3BC80C85C7E97U},
+    {0x783AE56F8D684C03U, 0x101A55D07D39CF1EU},
+    {0x16499ECB70C25F03U, 0x1420EB449C8842E6U},
+    {0x9BDC067E4CF2F6C4U, 0x19292615C3AA539FU},
+    {0x82D3081DE02FB476U, 0x1F736F9B3494E887U},
+    {0xB1C3E512AC1DD0C9U, 0x13A825C100DD1154U},
+    {0xDE34DE57572544FCU, 0x18922F31411455A9U},
+    {0x55C215ED2CEE963BU, 0x1EB6BAFD91596B14U},
+    {0xB5994DB43C151DE5U, 0x133234DE7AD7E2ECU},
+    {0xE2FFA1214B1A655EU, 0x17FEC216198DDBA7U},
+    {0xDBBF89699DE0FEB6U, 0x1DFE729B9FF15291U},
+    {0x2957B5E202AC9F31U, 0x12BF07A143F6D39BU},
+    {0xF3ADA35A8357C6FEU, 0x176EC98994F48881U},
+    {0x70990C31242DB8BDU, 0x1D4A7BEBFA31AAA2U},
+    {0x865FA79EB69C9376U, 0x124E8D737C5F0AA5U},
+    {0xE7F791866443B854U, 0x16E230D05B76CD4EU},
+    {0xA1F575E7FD54A669U, 0x1C9ABD04725480A2U},
+    {0xA53969B0FE54E801U, 0x11E0B622C774D065U},
+    {0xE87C41D3DEA2202U, 0x1658E3AB7952047FU},
+    {0xD229B5248D64AA82U, 0x1BEF1C9657A6859EU},
+    {0x435A1136D85EEA91U, 0x117571DDF6C81383U},
+    {0x143095848E76A536U, 0x15D2CE55747A1864U},
+    {0x193CBAE5B2144E83U, 0x1B4781EAD1989E7DU},
+    {0x2FC5F4CF8F4CB112U, 0x110CB132C2FF630EU},
+    {0xBBB77203731FDD56U, 0x154FDD7F73BF3BD1U},
+    {0x2AA54E844FE7D4ACU, 0x1AA3D4DF50AF0AC6U},
+    {0xDAA75112B1F0E4EBU, 0x10A6650B926D66BBU},
+    {0xD15125575E6D1E26U, 0x14CFFE4E7708C06AU},
+    {0x85A56EAD360865B0U, 0x1A03FDE214CAF085U},
+    {0x7387652C41C53F8EU, 0x10427EAD4CFED653U},
+    {0x50693E7752368F71U, 0x14531E58A03E8BE8U},
+    {0x64838E1526C4334EU, 0x1967E5EEC84E2EE2U},
+    {0xFDA4719A70754022U, 0x1FC1DF6A7A61BA9AU},
+    {0xDE86C70086494815U, 0x13D92BA28C7D14A0U},
+    {0x162878C0A7DB9A1AU, 0x18CF768B2F9C59C9U},
+    {0x5BB296F0D1D280A1U, 0x1F03542DFB83703BU},
+    {0x194F9E5683239064U, 0x1362149CBD322625U},
+    {0x5FA385EC23EC747EU, 0x183A99C3EC7EAFAEU},
+    {0xF78C67672CE7919DU, 0x1E494034E79E5B99U},
+    {0x3AB7C0A07C10BB02U, 0x12EDC82110C2F940U},
+    {0x4965B0C89B14E9C3U, 0x17A93A2954F3B790U},
+    {0x5BBF1CFAC1DA2433U, 0x1D9388B3AA30A574U},
+    {0xB957721CB92856A0U, 0x127C35704A5E6768U},
+    {0xE7AD4EA3E7726C48U, 0x171B42CC5CF60142U},
+    {0xA198A24CE14F075AU, 0x1CE2137F74338193U},
+    {0x44FF65700CD16498U, 0x120D4C2FA8A030FCU},
+    {0x563F3ECC1005BDBEU, 0x16909F3B92C83D3BU},
+    {0x2BCF0E7F14072D2EU, 0x1C34C70A777A4C8AU},
+    {0x5B61690F6C847C3DU, 0x11A0FC668AAC6FD6U},
+    {0xF239C35347A59B4CU, 0x16093B802D578BCBU},
+    {0xEEC83428198F021FU, 0x1B8B8A6038AD6EBEU},
+    {0x553D20990FF96153U, 0x1137367C236C6537U},
+    {0x2A8C68BF53F7B9A8U, 0x1585041B2C477E85U},
+    {0x752F82EF28F5A812U, 0x1AE64521F7595E26U},
+    {0x93DB1D57999890BU, 0x10CFEB353A97DAD8U},
+    {0xB8D1E4AD7FFEB4EU, 0x1503E602893DD18EU},
+    {0x8E7065DD8DFFE622U, 0x1A44DF832B8D45F1U},
+    {0xF9063FAA78BFEFD5U, 0x106B0BB1FB384BB6U},
+    {0xB747CF9516EFEBCAU, 0x1485CE9E7A065EA4U},
+    {0xE519C37A5CABE6BDU, 0x19A742461887F64DU},
+    {0xAF301A2C79EB7036U, 0x1008896BCF54F9F0U},
+    {0xDAFC20B798664C43U, 0x140AABC6C32A386CU},
+    {0x11BB28E57E7FDF54U, 0x190D56B873F4C688U},
+    {0x1629F31EDE1FD72AU, 0x1F50AC6690F1F82AU},
+    {0x4DDA37F34AD3E67AU, 0x13926BC01A973B1AU},
+    {0xE150C5F01D88E019U, 0x187706B0213D09E0U},
+    {0x19A4F76C24EB181FU, 0x1E94C85C298C4C59U},
+    {0xB0071AA39712EF13U, 0x131CFD3999F7AFB7U},
+    {0x9C08E14C7CD7AAD8U, 0x17E43C8800759BA5U},
+    {0x30B199F9C0D958EU, 0x1DDD4BAA0093028FU},
+    {0x61E6F003C1887D79U, 0x12AA4F4A405BE199U},
+    {0xBA60AC04B1EA9CD7U, 0x1754E31CD072D9FFU},
+    {0xA8F8D705DE65440DU, 0x1D2A1BE4048F907FU},
+    {0xC99B8663AAFF4A88U, 0x123A516E82D9BA4FU},
+    {0xBC0267FC95BF1D2AU, 0x16C8E5CA239028E3U},
+    {0xAB0301FBBB2EE474U, 0x1C7B1F3CAC74331CU},
+    {0xEAE1E13D54FD4EC9U, 0x11CCF385EBC89FF1U},
+    {0x659A598CAA3CA27BU, 0x1640306766BAC7EEU},
+    {0xFF00EFEFD4CBCB1AU, 0x1BD03C81406979E9U},
+    {0x3F6095F5E4FF5EF0U, 0x116225D0C841EC32U},
+    {0xCF38BB735E3F36ACU, 0x15BAAF44FA52673EU},
+    {0x8306EA5035CF0457U, 0x1B295B1638E7010EU},
+    {0x11E4527221A162B6U, 0x10F9D8EDE39060A9U},
+    {0x565D670EAA09BB64U, 0x15384F295C7478D3U},
+    {0x2BF4C0D2548C2A3DU, 0x1A8662F3B3919708U},
+    {0x1B78F88374D79A66U, 0x1093FDD8503AFE65U},
+    {0x625736A4520D8100U, 0x14B8FD4E6449BDFEU},
+    {0xFAED044D6690E140U, 0x19E73CA1FD5C2D7DU},
+    {0xBCD422B0601A8CC8U, 0x103085E53E599C6EU},
+    {0x6C092B5C78212FFAU, 0x143CA75E8DF0038AU},
+    {0x70B763396297BF8U, 0x194BD136316C046DU},
+    {0x48CE53C07BB3DAF6U, 0x1F9EC583BDC70588U},
+    {0x2D80F4584D5068DAU, 0x13C33B72569C6375U},
+    {0x78E1316E60A48310U, 0x18B40A4EEC437C52U}
+};
+
+/*! \brief Get ceil(log2(5^e)) for 0 < e <= 3528, or 1 for e = 0. */
+static int32_t
+str_pow5_bits(int32_t e) {
+    return (int32_t)(((uint32_t)e * 1217359) >> 19) + 1;
+}
+
+/*! \brief Get floor(log10(2^e)) for 0 <= e <= 1650. */
+static uint32_t
+str_log10_pow2(int32_t e) {
+    return ((uint32_t)e * 78913) >> 18;
+}
+
+/*! \brief Get floor(log10(5^e)) for 0 <= e <= 2620. */
+static uint32_t
+str_log10_pow5(int32_t e) {
+    return ((uint32_t)e * 732923) >> 20;
+}
+
+static int
+str_multiple_of_pow5(uint64_t value, uint32_t p) {
+    uint32_t count = 0;
+    while (value % 5 == 0) {
+        value /= 5;
+        ++count;
+    }
+    return count >= p;
+}
+
+static int
+str_multiple_of_pow2(uint64_t value, uint32_t p) {
+    return (value & (((uint64_t)1 << p) - 1)) == 0;
+}
+
+#ifdef __SIZEOF_INT128__
+__extension__ typedef unsigned __int128 str_uint128;
+#endif
+
+/*! \brief Get (m * mul) >> j, where \c mul is 128 bits, \c m is at most
+ *  55 bits and 64 <= j < 128. */
+static uint64_t
+str_mul_shift64(uint64_t m, const uint64_t* mul, int32_t j) {
+#ifdef __SIZEOF_INT128__
+    str_uint128 b0 = (str_uint128)m * mul[0];
+    str_uint128 b2 = (str_uint128)m * mul[1];
+    return (uint64_t)(((b0 >> 64) + b2) >> (j - 64));
+#else
+    /* Schoolbook multiplication on 32 bit halves. */
+    uint64_t m_lo = m & 0xFFFFFFFF;
+    uint64_t m_hi = m >> 32;
+    uint64_t b0_hi, b2_lo, b2_hi, sum_lo, sum_hi;
+    uint64_t a, b, c, d, mid;
+
+    a = m_lo * (mul[0] & 0xFFFFFFFF);
+    b = m_lo * (mul[0] >> 32);
+    c = m_hi * (mul[0] & 0xFFFFFFFF);
+    d = m_hi * (mul[0] >> 32);
+    mid = (a >> 32) + (b & 0xFFFFFFFF) + (c & 0xFFFFFFFF);
+    b0_hi = d + (b >> 32) + (c >> 32) + (mid >> 32);
+
+    a = m_lo * (mul[1] & 0xFFFFFFFF);
+    b = m_lo * (mul[1] >> 32);
+    c = m_hi * (mul[1] & 0xFFFFFFFF);
+    d = m_hi * (mul[1] >> 32);
+    mid = (a >> 32) + (b & 0xFFFFFFFF) + (c & 0xFFFFFFFF);
+    b2_lo = (a & 0xFFFFFFFF) | (mid << 32);
+    b2_hi = d + (b >> 32) + (c >> 32) + (mid >> 32);
+
+    sum_lo = b0_hi + b2_lo;
+    sum_hi = b2_hi + (sum_lo < b0_hi);
+    j -= 64;
+    if (j == 0) {
+        return sum_lo;
+    }
+    if (j >= 64) {
+        return sum_hi >> (j - 64);
+    }
+    return (sum_hi << (64 - j)) | (sum_lo >> j);
+#endif
+}
+
+/*! \brief Find the shortest decimal \c digits * 10^\c exponent in the
+ *  rounding interval of a finite, nonzero double. */
+static void
+str_ryu(uint64_t ieee_mantissa, uint32_t ieee_exponent, uint64_t* digits,
+        int32_t* exponent) {
+    int32_t e2;
+    uint64_t m2;
+    int accept_bounds;
+    uint64_t mv;
+    uint32_t mm_shift;
+    uint64_t vr, vp, vm;
+    int32_t e10;
+    int vm_is_trailing_zeros = 0;
+    int vr_is_trailing_zeros = 0;
+    int32_t removed = 0;
+    uint32_t last_removed_digit = 0;
+    uint64_t output;
+
+    if (ieee_exponent == 0) {
+        e2 = 1 - STR_DOUBLE_BIAS - STR_DOUBLE_MANTISSA_BITS - 2;
+        m2 = ieee_mantissa;
+    } else {
+        e2 = (int32_t)ieee_exponent - STR_DOUBLE_BIAS -
+             STR_DOUBLE_MANTISSA_BITS - 2;
+        m2 = ((uint64_t)1 << STR_DOUBLE_MANTISSA_BITS) | ieee_mantissa;
+    }
+    /* Round half to even means the bounds themselves read back as
+     * this double when the mantissa is even. */
+    accept_bounds = (m2 & 1) == 0;
+
+    /* The interval is [mv - 1 - mm_shift, mv + 2] / 4 * 2^e2.  The
+     * lower half is narrower at powers of two. */
+    mv = 4 * m2;
+    mm_shift = ieee_mantissa != 0 || ieee_exponent <= 1;
+
+    /* Convert the interval to decimal, tracking whether digits
+     * dropped by the truncating multiply were all zero. */
+    if (e2 >= 0) {
+        uint32_t q = str_log10_pow2(e2) - (e2 > 3);
+        int32_t k = STR_POW5_INV_BITCOUNT + str_pow5_bits((int32_t)q) - 1;
+        int32_t i = -e2 + (int32_t)q + k;
+        e10 = (int32_t)q;
+        vr = str_mul_shift64(4 * m2, str_pow5_inv_split[q], i);
+        vp = str_mul_shift64(4 * m2 + 2, str_pow5_inv_split[q], i);
+        vm = str_mul_shift64(4 * m2 - 1 - mm_shift, str_pow5_inv_split[q], i);
+        if (q <= 21) {
+            /* Only one of mv, mv + 2 and mv - 1 - mm_shift can be a
+             * multiple of 5. */
+            if (mv % 5 == 0) {
+                vr_is_trailing_zeros = str_multiple_of_pow5(mv, q);
+            } else if (accept_bounds) {
+                vm_is_trailing_zeros = str_multiple_of_pow5(mv - 1 - mm_shift, q);
+            } else {
+                vp -= str_multiple_of_pow5(mv + 2, q);
+            }
+        }
+    } else {
+        uint32_t q = str_log10_pow5(-e2) - (-e2 > 1);
+        int32_t i = -e2 - (int32_t)q;
+        int32_t k = str_pow5_bits(i) - STR_POW5_BITCOUNT;
+        int32_t j = (int32_t)q - k;
+        e10 = (int32_t)q + e2;
+        vr = str_mul_shift64(4 * m2, str_pow5_split[i], j);
+        vp = str_mul_shift64(4 * m2 + 2, str_pow5_split[i], j);
+        vm = str_mul_shift64(4 * m2 - 1 - mm_shift, str_pow5_split[i], j);
+        if (q <= 1) {
+            /* mv has at least q trailing zero bits, and so do the
+             * bounds unless mm_shift makes the lower one odd. */
+            vr_is_trailing_zeros = 1;
+            if (accept_bounds) {
+                vm_is_trailing_zeros = mm_shift == 1;
+            } else {
+                --vp;
+            }
+        } else if (q < 63) {
+            vr_is_trailing_zeros = str_multiple_of_pow2(mv, q);
+        }
+    }
+
+    /* Drop digits while the interval still holds a shorter number. */
+    if (vm_is_trailing_zeros || vr_is_trailing_zeros) {
+        /* Rare: exact ties need every dropped digit. */
+        while (vp / 10 > vm / 10) {
+            vm_is_trailing_zeros &= vm % 10 == 0;
+            vr_is_trailing_zeros &= last_removed_digit == 0;
+            last_removed_digit = (uint32_t)(vr % 10);
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            ++removed;
+        }
+        if (vm_is_trailing_zeros) {
+            while (vm % 10 == 0) {
+                vr_is_trailing_zeros &= last_removed_digit == 0;
+                last_removed_digit = (uint32_t)(vr % 10);
+                vr /= 10;
+                vp /= 10;
+                vm /= 10;
+                ++removed;
+            }
+        }
+        if (vr_is_trailing_zeros && last_removed_digit == 5 && vr % 2 == 0) {
+            /* Exactly halfway, so round to even. */
+            last_removed_digit = 4;
+        }
+        output = vr + ((vr == vm && (!accept_bounds || !vm_is_trailing_zeros)) ||
+                       last_removed_digit >= 5);
+    } else {
+        int round_up = 0;
+        if (vp / 100 > vm / 100) {
+            round_up = vr % 100 >= 50;
+            vr /= 100;
+            vp /= 100;
+            vm /= 100;
+            removed += 2;
+        }
+        while (vp / 10 > vm / 10) {
+            round_up = vr % 10 >= 5;
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            ++removed;
+        }
+        output = vr + (vr == vm || round_up);
+    }
+    *digits = output;
+    *exponent = e10 + removed;
+}
+
+/*! \brief Write \c value into \c out, which must hold 32 bytes.
+ *
+ * \return The number of bytes written. */
+static size_t
+str_format_double(char* out, double value) {
+    uint64_t bits;
+    uint64_t ieee_mantissa;
+    uint32_t ieee_exponent;
+    uint64_t digits;
+    int32_t exponent;
+    int32_t point;
+    char buffer[20];
+    size_t num_digits;
+    const char* d;
+    char* p = out;
+
+    memcpy(&bits, &value, sizeof(bits));
+    ieee_mantissa = bits & (((uint64_t)1 << STR_DOUBLE_MANTISSA_BITS) - 1);
+    ieee_exponent = (uint32_t)(bits >> STR_DOUBLE_MANTISSA_BITS) &
+                    ((1u << STR_DOUBLE_EXPONENT_BITS) - 1);
+
+    if (ieee_exponent == (1u << STR_DOUBLE_EXPONENT_BITS) - 1) {
+        if (ieee_mantissa) {
+            memcpy(p, "nan", 3);
+            return 3;
+        }
+        if (bits >> 63) {
+            *p++ = '-';
+        }
+        memcpy(p, "inf", 3);
+        return p + 3 - out;
+    }
+    if (bits >> 63) {
+        *p++ = '-';
+    }
+    if (ieee_exponent == 0 && ieee_mantissa == 0) {
+        *p++ = '0';
+        return p - out;
+    }
+
+    /* Integers below 2^53 are exact, so their digits are the
+     * answer. */
+    if (ieee_exponent >= STR_DOUBLE_BIAS &&
+        ieee_exponent <= STR_DOUBLE_BIAS + STR_DOUBLE_MANTISSA_BITS) {
+        uint32_t shift =
+            STR_DOUBLE_BIAS + STR_DOUBLE_MANTISSA_BITS - ieee_exponent;
+        uint64_t m2 = ((uint64_t)1 << STR_DOUBLE_MANTISSA_BITS) | ieee_mantissa;
+        if ((m2 & (((uint64_t)1 << shift) - 1)) == 0) {
+            num_digits = str_format_uint(buffer + sizeof(buffer), m2 >> shift);
+            memcpy(p, buffer + sizeof(buffer) - num_digits, num_digits);
+            return p + num_digits - out;
+        }
+    }
+
+    str_ryu(ieee_mantissa, ieee_exponent, &digits, &exponent);
+    num_digits = str_format_uint(buffer + sizeof(buffer), digits);
+    d = buffer + sizeof(buffer) - num_digits;
+    /* The value is 0.d * 10^point. */
+    point = (int32_t)num_digits + exponent;
+
+    if ((int32_t)num_digits <= point && point <= 21) {
+        memcpy(p, d, num_digits);
+        p += num_digits;
+        memset(p, '0', point - num_digits);
+        p += point - num_digits;
+    } else if (0 < point && point <= 21) {
+        memcpy(p, d, point);
+        p += point;
+        *p++ = '.';
+        memcpy(p, d + point, num_digits - point);
+        p += num_digits - point;
+    } else if (-6 < point && point <= 0) {
+        *p++ = '0';
+        *p++ = '.';
+        memset(p, '0', -point);
+        p += -point;
+        memcpy(p, d, num_digits);
+        p += num_digits;
+    } else {
+        int32_t e = point - 1;
+        *p++ = d[0];
+        if (num_digits > 1) {
+            *p++ = '.';
+            memcpy(p, d + 1, num_digits - 1);
+            p += num_digits - 1;
+        }
+        *p++ = 'e';
+        *p++ = e < 0 ? '-' : '+';
+        if (e < 0) {
+            e = -e;
+        }
+        p += str_format_uint(p + (e >= 100 ? 3 : e >= 10 ? 2 : 1), (uint64_t)e);
+    }
+    return p - out;
+}
+
+int
+str_push_double(str* self, double value) {
+    char buffer[32];
+    size_t len = str_format_double(buffer, value);
+    return str_push_ascii(self, buffer, len);
+}
+
+#ifdef TEST_MODE
+#include "test.h"
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static int
+str_number_test_is(double value, const char* expected) {
+    str s = STR_INIT;
+    int result = !str_push_double(&s, value) &&
+                 strcmp(str_cbegin(&s), expected) == 0;
+    str_destroy(&s);
+    return result;
+}
+
+TEST(test_str_push_int) {
+    str s = STR_INIT;
+    ASSERT(!str_push_int(&s, 0), cleanup);
+    ASSERT(!str_push_s(&s, " "), cleanup);
+    ASSERT(!str_push_int(&s, -7), cleanup);
+    ASSERT(!str_push_s(&s, " "), cleanup);
+    ASSERT(!str_push_int(&s, INT64_MIN), cleanup);
+    ASSERT(!str_push_s(&s, " "), cleanup);
+    ASSERT(!str_push_int(&s, INT64_MAX), cleanup);
+    ASSERT(!str_push_s(&s, " "), cleanup);
+    ASSERT(!str_push_uint(&s, UINT64_MAX), cleanup);
+    ASSERT(!str_push_s(&s, " "), cleanup);
+    ASSERT(!str_push_uint(&s, 10), cleanup);
+    ASSERT(strcmp(str_cbegin(&s),
+                  "0 -7 -9223372036854775808 9223372036854775807 "
+                  "18446744073709551615 10") == 0,
+           cleanup);
+cleanup:
+    str_destroy(&s);
+}
+END_TEST
+
+TEST(test_str_push_int_digits) {
+    char expected[32];
+    str s = STR_INIT;
+    uint64_t value;
+    for (value = 1; value < UINT64_MAX / 3; value = value * 3 + value % 7) {
+        str_set_len_bytes(&s, 0);
+        ASSERT(!str_push_uint(&s, value), cleanup);
+        sprintf(expected, "%llu", (unsigned long long)value);
+        ASSERT(strcmp(str_cbegin(&s), expected) == 0, cleanup);
+        str_set_len_bytes(&s, 0);
+        ASSERT(!str_push_int(&s, -(int64_t)(value >> 1)), cleanup);
+        sprintf(expected, "%lld", -(long long)(value >> 1));
+        ASSERT(strcmp(str_cbegin(&s), expected) == 0, cleanup);
+    }
+cleanup:
+    str_destroy(&s);
+}
+END_TEST
+
+TEST(test_str_push_double) {
+    ASSERT(str_number_test_is(0.0, "0"), cleanup);
+    ASSERT(str_number_test_is(-0.0, "-0"), cleanup);
+    ASSERT(str_number_test_is(1.0, "1"), cleanup);
+    ASSERT(str_number_test_is(-123.0, "-123"), cleanup);
+    ASSERT(str_number_test_is(1.5, "1.5"), cleanup);
+    ASSERT(str_number_test_is(0.1, "0.1"), cleanup);
+    ASSERT(str_number_test_is(0.1 + 0.2, "0.30000000000000004"), cleanup);
+    ASSERT(str_number_test_is(1e-7, "1e-7"), cleanup);
+    ASSERT(str_number_test_is(1.5e-6, "0.0000015"), cleanup);
+    ASSERT(str_number_test_is(1e21, "1e+21"), cleanup);
+    ASSERT(str_number_test_is(1e20, "100000000000000000000"), cleanup);
+    ASSERT(str_number_test_is(9007199254740993.0, "9007199254740992"), cleanup);
+    ASSERT(str_number_test_is(123456789012345680000.0, "123456789012345680000"),
+           cleanup);
+    ASSERT(str_number_test_is(5e-324, "5e-324"), cleanup);
+    ASSERT(str_number_test_is(DBL_MAX, "1.7976931348623157e+308"), cleanup);
+    ASSERT(str_number_test_is(DBL_MIN, "2.2250738585072014e-308"), cleanup);
+    ASSERT(str_number_test_is(HUGE_VAL, "inf"), cleanup);
+    ASSERT(str_number_test_is(-HUGE_VAL, "-inf"), cleanup);
+    ASSERT(str_number_test_is(HUGE_VAL - HUGE_VAL, "nan"), cleanup);
+cleanup:;
+}
+END_TEST
+
+/*! \brief The length of the shortest %e output that reads back. */
+static size_t
+str_number_test_shortest(double value) {
+    char buffer[40];
+    int precision;
+    for (precision = 0; precision != 17; ++precision) {
+        sprintf(buffer, "%.*e", precision, value);
+        if (strtod(buffer, 0) == value) {
+            break;
+        }
+    }
+    return (size_t)precision + 1;
+}
+
+TEST(test_str_push_double_round_trip) {
+    static unsigned long seed = 1;
+    str s = STR_INIT;
+    size_t round;
+    for (round = 0; round != 100000; ++round) {
+        uint64_t bits = 0;
+        double value;
+        double parsed;
+        size_t i, num_digits;
+        const char* p;
+        for (i = 0; i != 4; ++i) {
+            seed = seed * 1103515245 + 12345;
+            bits = bits << 16 | (seed >> 16 & 0xFFFF);
+        }
+        if (round % 4 == 0) {
+            /* Short decimals, which hit the exact cases. */
+            seed = seed * 1103515245 + 12345;
+            value = (double)(seed >> 16 & 0x7FFF) / 1000.0;
+        } else {
+            memcpy(&value, &bits, sizeof(value));
+        }
+        if (value != value || value - value != 0) {
+            continue;
+        }
+        str_set_len_bytes(&s, 0);
+        ASSERT(!str_push_double(&s, value), cleanup);
+        parsed = strtod(str_cbegin(&s), 0);
+        ASSERT(memcmp(&parsed, &value, sizeof(value)) == 0, cleanup);
+        /* Count significant digits. */
+        num_digits = 0;
+        for (p = str_cbegin(&s); *p && *p != 'e'; ++p) {
+            if (*p >= '1' && *p <= '9') {
+                num_digits = num_digits ? num_digits + 1 : 1;
+            } else if (*p == '0' && num_digits) {
+                ++num_digits;
+            }
+        }
+        /* Trailing zeros of integers aren't significant. */
+        for (--p; num_digits > 1 && *p == '0'; --p) {
+            --num_digits;
+        }
+        ASSERT(num_digits <= str_number_test_shortest(value), cleanup);
+    }
+cleanup:
+    str_destroy(&s);
+}
+END_TEST
+
+void test_str_number(void) {
+    RUN(test_str_push_int);
+    RUN(test_str_push_int_digits);
+    RUN(test_str_push_double);
+    RUN(test_str_push_double_round_trip);
+}
+#endif
@@ -0,0 +1,407 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2017 Chris Gregory czipperz@gmail.com
+ */
+
+#include "../strmap.h"
+#include "../hashmap.h"
+#include "../rpmalloc.h"
+#include "../vec.h"
+#include "internal.h"
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+/*! \brief An entry in the table.  The key is stored at \c offset in
+ *  the slab, immediately followed by the value. */
+typedef struct strmap_slot strmap_slot;
+struct strmap_slot {
+    size_t hash;
+    /*! \brief Either an offset into the slab, \c STRMAP_EMPTY or \c
+     *  STRMAP_ERASED. */
+    size_t offset;
+    uint32_t key_len;
+    uint32_t value_len;
+};
+
+struct strmap {
+    strmap_slot* slots;
+    /*! \brief The number of slots.  Always a power of two. */
+    size_t cap;
+    /*! \brief The number of live entries. */
+    size_t elems;
+    /*! \brief The number of slots that are not \c STRMAP_EMPTY. */
+    size_t used;
+    bytevec slab;
+    /*! \brief The number of bytes in the slab used by erased entries. */
+    size_t garbage;
+};
+
+#define STRMAP_MIN_CAP 16
+/* Filling the slots with 0xFF bytes marks them all as empty. */
+#define STRMAP_EMPTY ((size_t)-1)
+#define STRMAP_ERASED ((size_t)-2)
+
+static strmap_slot* strmap_alloc_slots(size_t cap) {
+    strmap_slot* slots = rpmalloc(cap * sizeof(strmap_slot));
+    if (slots) {
+        memset(slots, 0xFF, cap * sizeof(strmap_slot));
+    }
+    return slots;
+}
+
+strmap*
+strmap_new(void) {
+    strmap* map = rpmalloc(sizeof(struct strmap));
+    if (map) {
+        map->cap = STRMAP_MIN_CAP;
+        map->slots = strmap_alloc_slots(map->cap);
+        if (!map->slots) {
+            rpfree(map);
+            return 0;
+        }
+        map->elems = 0;
+        map->used = 0;
+        map->slab.bytes = 0;
+        map->slab.len = 0;
+        map->slab.cap = 0;
+        map->garbage = 0;
+    }
+    return map;
+}
+
+void
+strmap_destroy(strmap* map) {
+    rpfree(map->slots);
+    rpfree(map->slab.bytes);
+    rpfree(map);
+}
+
+size_t
+strmap_size(const strmap* map) {
+    return map->elems;
+}
+
+/*! \brief Find the slot holding \c key.
+ *
+ * If it isn't present, this instead returns the slot it should be
+ * inserted into. */
+static size_t strmap_find(const strmap* map, const char* key,
+                          size_t key_len, size_t hash, int* contains) {
+    size_t mask = map->cap - 1;
+    size_t i = hash & mask;
+    size_t insert = STRMAP_EMPTY;
+    *contains = 0;
+    for (;; i = (i + 1) & mask) {
+        const strmap_slot* slot = &map->slots[i];
+        if (slot->offset == STRMAP_EMPTY) {
+            return insert == STRMAP_EMPTY ? i : insert;
+        } else if (slot->offset == STRMAP_ERASED) {
+            if (insert == STRMAP_EMPTY) {
+                insert = i;
+            }
+        } else if (slot->hash == hash && slot->key_len == key_len &&
+                   memcmp(map->slab.bytes + slot->offset, key, key_len) == 0) {
+            *contains = 1;
+            return i;
+        }
+    }
+}
+
+static int strmap_rehash(strmap* map, size_t new_cap) {
+    strmap_slot* slots = strmap_alloc_slots(new_cap);
+    size_t i;
+    if (!slots) {
+        return -1;
+    }
+    for (i = 0; i != map->cap; ++i) {
+        const strmap_slot* slot = &map->slots[i];
+        if (slot->offset != STRMAP_EMPTY && slot->offset != STRMAP_ERASED) {
+            size_t j = slot->hash & (new_cap - 1);
+            while (slots[j].offset != STRMAP_EMPTY) {
+                j = (j + 1) & (new_cap - 1);
+            }
+            slots[j] = *slot;
+        }
+    }
+    rpfree(map->slots);
+    map->slots = slots;
+    map->cap = new_cap;
+    map->used = map->elems;
+    return 0;
+}
+
+int
+strmap_contains(const strmap* map, const char* key, size_t key_len) {
+    int contains;
+    strmap_find(map, key, key_len, mem_hash(key, key_len), &contains);
+    return contains;
+}
+
+int
+strmap_insert(strmap* map, const char* key, size_t key_len,
+              const void* value, size_t value_len) {
+    size_t hash = mem_hash(key, key_len);
+    size_t index;
+    size_t new_len;
+    int contains;
+    strmap_slot* slot;
+
+    if (key_len > UINT32_MAX || value_len > UINT32_MAX) {
+        return -1;
+    }
+    /* Keep at least a quarter of the slots empty so probes stay
+     * short.  If most used slots are erased entries, rehashing at
+     * the same size is enough to clear them out. */
+    if ((map->used + 1) * 4 > map->cap * 3) {
+        if (strmap_rehash(map, (map->elems + 1) * 2 > map->cap
+                                   ? map->cap * 2 : map->cap)) {
+            return -1;
+        }
+    }
+
+    index = strmap_find(map, key, key_len, hash, &contains);
+    if (contains) {
+        return 1;
+    }
+
+    new_len = map->slab.len + key_len + value_len;
+    /* The slab is allocated even for an empty key and value so that
+     * strmap_lookup() never returns null for a present key. */
+    if (new_len > map->slab.cap || !map->slab.bytes) {
+        size_t new_cap = new_len < map->slab.cap * 2 ? map->slab.cap * 2 : new_len;
+        if (vec_reserve(&map->slab, 1, new_cap ? new_cap : 1)) {
+            return -1;
+        }
+    }
+
+    slot = &map->slots[index];
+    if (slot->offset == STRMAP_EMPTY) {
+        ++map->used;
+    }
+    slot->hash = hash;
+    slot->offset = map->slab.len;
+    slot->key_len = (uint32_t)key_len;
+    slot->value_len = (uint32_t)value_len;
+    memcpy(map->slab.bytes + map->slab.len, key, key_len);
+    memcpy(map->slab.bytes + map->slab.len + key_len, value, value_len);
+    map->slab.len = new_len;
+    ++map->elems;
+    return 0;
+}
+
+int
+strmap_erase(strmap* map, const char* key, size_t key_len) {
+    int contains;
+    size_t index = strmap_find(map, key, key_len, mem_hash(key, key_len),
+                               &contains);
+    if (contains) {
+        strmap_slot* slot = &map->slots[index];
+        map->garbage += slot->key_len + slot->value_len;
+        slot->offset = STRMAP_ERASED;
+        --map->elems;
+    }
+    return !contains;
+}
+
+void*
+strmap_lookup(strmap* map, const char* key, size_t key_len,
+              size_t* value_len) {
+    int contains;
+    size_t index = strmap_find(map, key, key_len, mem_hash(key, key_len),
+                               &contains);
+    if (contains) {
+        const strmap_slot* slot = &map->slots[index];
+        if (value_len) {
+            *value_len = slot->value_len;
+        }
+        return map->slab.bytes + slot->offset + slot->key_len;
+    } else {
+        return 0;
+    }
+}
+
+void
+strmap_clear(strmap* map) {
+    memset(map->slots, 0xFF, map->cap * sizeof(strmap_slot));
+    map->elems = 0;
+    map->used = 0;
+    map->slab.len = 0;
+    map->garbage = 0;
+}
+
+int
+strmap_compact(strmap* map) {
+    bytevec slab = VEC_INIT;
+    size_t i;
+    if (map->garbage == 0) {
+        return 0;
+    }
+    /* Live entries may all be empty, but the slab must still be
+     * allocated so strmap_lookup() doesn't return null for them. */
+    if (map->elems != 0 &&
+        vec_reserve(&slab, 1, map->slab.len != map->garbage
+                                  ? map->slab.len - map->garbage : 1)) {
+        return -1;
+    }
+    for (i = 0; i != map->cap; ++i) {
+        strmap_slot* slot = &map->slots[i];
+        if (slot->offset != STRMAP_EMPTY && slot->offset != STRMAP_ERASED) {
+            size_t size = slot->key_len + slot->value_len;
+            memcpy(slab.bytes + slab.len, map->slab.bytes + slot->offset, size);
+            slot->offset = slab.len;
+            slab.len += size;
+        }
+    }
+    rpfree(map->slab.bytes);
+    map->slab = slab;
+    map->garbage = 0;
+    return 0;
+}
+
+void
+strmap_iterate(strmap* map,
+               void (*fun)(const char*, size_t, void*, size_t, void*),
+               void* userdata) {
+    size_t i;
+    for (i = 0; i != map->cap; ++i) {
+        const strmap_slot* slot = &map->slots[i];
+        if (slot->offset != STRMAP_EMPTY && slot->offset != STRMAP_ERASED) {
+            char* key = map->slab.bytes + slot->offset;
+            fun(key, slot->key_len, key + slot->key_len, slot->value_len,
+                userdata);
+        }
+    }
+}
+
+#ifdef TEST_MODE
+#include "test.h"
+#include <stdio.h>
+
+TEST(test_strmap_insert) {
+    strmap* map = strmap_new();
+    size_t len;
+    char* value;
+    ASSERT(map, cleanup);
+    ASSERT(!strmap_insert(map, "hello", 5, "world", 5), cleanup);
+    ASSERT(!strmap_insert(map, "hell", 4, "o", 1), cleanup);
+    ASSERT(!strmap_insert(map, "", 0, "empty", 5), cleanup);
+    ASSERT(strmap_insert(map, "hello", 5, "again", 5) == 1, cleanup);
+    ASSERT(strmap_size(map) == 3, cleanup);
+
+    value = strmap_lookup(map, "hello", 5, &len);
+    ASSERT(value, cleanup);
+    ASSERT(len == 5 && memcmp(value, "world", 5) == 0, cleanup);
+    value = strmap_lookup(map, "hell", 4, &len);
+    ASSERT(value, cleanup);
+    ASSERT(len == 1 && memcmp(value, "o", 1) == 0, cleanup);
+    value = strmap_lookup(map, "", 0, &len);
+    ASSERT(value, cleanup);
+    ASSERT(len == 5 && memcmp(value, "empty", 5) == 0, cleanup);
+    ASSERT(!strmap_lookup(map, "hellos", 6, &len), cleanup);
+    ASSERT(!strmap_contains(map, "he", 2), cleanup);
+cleanup:
+    strmap_destroy(map);
+}
+END_TEST
+
+TEST(test_strmap_erase_and_compact) {
+    strmap* map = strmap_new();
+    char key[32];
+    size_t i;
+    ASSERT(map, cleanup);
+    for (i = 0; i != 1000; ++i) {
+        int len = sprintf(key, "key number %lu", (unsigned long)i);
+        ASSERT(!strmap_insert(map, key, len, &i, sizeof(size_t)), cleanup);
+    }
+    ASSERT(strmap_size(map) == 1000, cleanup);
+    for (i = 0; i != 1000; i += 2) {
+        int len = sprintf(key, "key number %lu", (unsigned long)i);
+        ASSERT(!strmap_erase(map, key, len), cleanup);
+        ASSERT(strmap_erase(map, key, len) == 1, cleanup);
+    }
+    ASSERT(strmap_size(map) == 500, cleanup);
+    ASSERT(map->garbage != 0, cleanup);
+    if (strmap_compact(map)) {
+        goto cleanup;
+    }
+    ASSERT(map->garbage == 0, cleanup);
+    for (i = 0; i != 1000; ++i) {
+        int len = sprintf(key, "key number %lu", (unsigned long)i);
+        size_t* value = strmap_lookup(map, key, len, 0);
+        if (i % 2 == 0) {
+            ASSERT(!value, cleanup);
+        } else {
+            size_t v;
+            ASSERT(value, cleanup);
+            memcpy(&v, value, sizeof(size_t));
+            ASSERT(v == i, cleanup);
+        }
+    }
+    strmap_clear(map);
+    ASSERT(strmap_size(map) == 0, cleanup);
+    ASSERT(!strmap_contains(map, "key number 1", 12), cleanup);
+cleanup:
+    strmap_destroy(map);
+}
+END_TEST
+
+TEST(test_strmap_reuse_erased) {
+    strmap* map = strmap_new();
+    size_t i;
+    size_t cap;
+    ASSERT(map, cleanup);
+    cap = map->cap;
+    for (i = 0; i != 100; ++i) {
+        ASSERT(!strmap_insert(map, "a", 1, "b", 1), cleanup);
+        ASSERT(!strmap_erase(map, "a", 1), cleanup);
+    }
+    ASSERT(map->cap == cap, cleanup);
+cleanup:
+    strmap_destroy(map);
+}
+END_TEST
+
+TEST(test_strmap_empty_key_and_value) {
+    strmap* map = strmap_new();
+    size_t len = 1;
+    ASSERT(map, cleanup);
+    ASSERT(!strmap_insert(map, "", 0, "", 0), cleanup);
+    ASSERT(strmap_lookup(map, "", 0, &len), cleanup);
+    ASSERT(len == 0, cleanup);
+
+    /* Compacting away every live byte frees the slab. */
+    ASSERT(!strmap_insert(map, "a", 1, "b", 1), cleanup);
+    ASSERT(!strmap_erase(map, "", 0), cleanup);
+    ASSERT(!strmap_erase(map, "a", 1), cleanup);
+    ASSERT(!strmap_compact(map), cleanup);
+    ASSERT(!map->slab.bytes, cleanup);
+    ASSERT(!strmap_lookup(map, "", 0, &len), cleanup);
+
+    ASSERT(!strmap_insert(map, "", 0, "", 0), cleanup);
+    len = 1;
+    ASSERT(strmap_lookup(map, "", 0, &len), cleanup);
+    ASSERT(len == 0, cleanup);
+
+    /* Compacting when every live entry is empty keeps them present. */
+    ASSERT(!strmap_insert(map, "a", 1, "b", 1), cleanup);
+    ASSERT(!strmap_erase(map, "a", 1), cleanup);
+    ASSERT(!strmap_compact(map), cleanup);
+    ASSERT(strmap_contains(map, "", 0), cleanup);
+    len = 1;
+    ASSERT(strmap_lookup(map, "", 0, &len), cleanup);
+    ASSERT(len == 0, cleanup);
+cleanup:
+    strmap_destroy(map);
+}
+END_TEST
+
+void test_strmap(void) {
+    RUN(test_strmap_insert);
+    RUN(test_strmap_empty_key_and_value);
+    RUN(test_strmap_erase_and_compact);
+    RUN(test_strmap_reuse_erased);
+}
+#endif
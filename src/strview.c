@@ -0,0 +1,277 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2017 Chris Gregory czipperz@gmail.com
+ */
+
+#include "../strview.h"
+#include "../hashmap.h"
+#include "../search.h"
+#include <assert.h>
+#include <string.h>
+
+strview
+strview_new(const char* ptr, size_t len) {
+    strview view;
+    view.ptr = ptr;
+    view.len = len;
+    return view;
+}
+
+strview
+strview_from_cstr(const char* string) {
+    return strview_new(string, strlen(string));
+}
+
+strview
+strview_from_str(const str* string) {
+    return strview_new(str_cbegin(string), str_len_bytes(string));
+}
+
+strview
+strview_substr(strview self, size_t pos, size_t len) {
+    if (pos > self.len) {
+        pos = self.len;
+    }
+    if (len > self.len - pos) {
+        len = self.len - pos;
+    }
+    return strview_new(self.ptr + pos, len);
+}
+
+size_t
+strview_find(strview self, strview needle) {
+    return mem_find(self.ptr, self.len, needle.ptr, needle.len);
+}
+
+size_t
+strview_rfind(strview self, strview needle) {
+    return mem_rfind(self.ptr, self.len, needle.ptr, needle.len);
+}
+
+size_t
+strview_find_byte(strview self, char byte) {
+    const char* found = self.len ? memchr(self.ptr, byte, self.len) : 0;
+    return found ? (size_t)(found - self.ptr) : STRVIEW_NPOS;
+}
+
+int
+strview_starts_with(strview self, strview prefix) {
+    return prefix.len <= self.len &&
+           memcmp(self.ptr, prefix.ptr, prefix.len) == 0;
+}
+
+int
+strview_ends_with(strview self, strview suffix) {
+    return suffix.len <= self.len &&
+           memcmp(self.ptr + self.len - suffix.len, suffix.ptr, suffix.len) == 0;
+}
+
+static int
+strview_is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' ||
+           c == '\f';
+}
+
+strview
+strview_trim_left(strview self) {
+    while (self.len && strview_is_space(self.ptr[0])) {
+        ++self.ptr;
+        --self.len;
+    }
+    return self;
+}
+
+strview
+strview_trim_right(strview self) {
+    while (self.len && strview_is_space(self.ptr[self.len - 1])) {
+        --self.len;
+    }
+    return self;
+}
+
+strview
+strview_trim(strview self) {
+    return strview_trim_right(strview_trim_left(self));
+}
+
+int
+strview_cmp(strview a, strview b) {
+    int cmp = memcmp(a.ptr, b.ptr, a.len < b.len ? a.len : b.len);
+    if (cmp) {
+        return cmp;
+    }
+    return (a.len > b.len) - (a.len < b.len);
+}
+
+int
+strview_eq(strview a, strview b) {
+    return a.len == b.len && memcmp(a.ptr, b.ptr, a.len) == 0;
+}
+
+size_t
+strview_hash(strview self) {
+    return mem_hash(self.ptr, self.len);
+}
+
+int
+strview_to_str(strview self, str* out) {
+    return str_copy_n(out, self.ptr, self.len);
+}
+
+strview_split
+strview_split_new(strview self, strview separator) {
+    strview_split iterator;
+    assert(separator.len != 0);
+    iterator._rest = self;
+    iterator._separator = separator;
+    iterator._done = 0;
+    return iterator;
+}
+
+int
+strview_split_next(strview_split* iterator, strview* piece) {
+    size_t index;
+    if (iterator->_done) {
+        return 0;
+    }
+    index = strview_find(iterator->_rest, iterator->_separator);
+    if (index == STRVIEW_NPOS) {
+        *piece = iterator->_rest;
+        iterator->_done = 1;
+    } else {
+        *piece = strview_new(iterator->_rest.ptr, index);
+        iterator->_rest = strview_substr(iterator->_rest,
+                                         index + iterator->_separator.len,
+                                         STRVIEW_NPOS);
+    }
+    return 1;
+}
+
+#define STRVIEW_IS_DELIMITER(iterator, c)                            \
+    ((iterator)->_delimiters[(unsigned char)(c) >> 3] &              \
+     (1 << ((unsigned char)(c) & 7)))
+
+strview_tokenizer
+strview_tokenizer_new(strview self, const char* delimiters) {
+    strview_tokenizer iterator;
+    iterator._rest = self;
+    memset(iterator._delimiters, 0, sizeof(iterator._delimiters));
+    for (; *delimiters; ++delimiters) {
+        unsigned char c = (unsigned char)*delimiters;
+        iterator._delimiters[c >> 3] |= 1 << (c & 7);
+    }
+    return iterator;
+}
+
+int
+strview_tokenizer_next(strview_tokenizer* iterator, strview* token) {
+    strview rest = iterator->_rest;
+    size_t len = 0;
+    while (rest.len && STRVIEW_IS_DELIMITER(iterator, rest.ptr[0])) {
+        ++rest.ptr;
+        --rest.len;
+    }
+    if (!rest.len) {
+        iterator->_rest = rest;
+        return 0;
+    }
+    while (len != rest.len && !STRVIEW_IS_DELIMITER(iterator, rest.ptr[len])) {
+        ++len;
+    }
+    *token = strview_new(rest.ptr, len);
+    iterator->_rest = strview_new(rest.ptr + len, rest.len - len);
+    return 1;
+}
+
+#ifdef TEST_MODE
+#include "test.h"
+
+#define SV(literal) strview_new(literal, sizeof(literal) - 1)
+
+TEST(test_strview_find) {
+    strview hay = SV("the quick brown fox jumps over the lazy dog");
+    ASSERT(strview_find(hay, SV("the")) == 0, cleanup);
+    ASSERT(strview_find(hay, SV("fox")) == 16, cleanup);
+    ASSERT(strview_find(hay, SV("dog")) == hay.len - 3, cleanup);
+    ASSERT(strview_find(hay, SV("cat")) == STRVIEW_NPOS, cleanup);
+    ASSERT(strview_find(hay, SV("")) == 0, cleanup);
+    ASSERT(strview_find(SV("ab"), SV("abc")) == STRVIEW_NPOS, cleanup);
+    ASSERT(strview_find(SV("aaab"), SV("aab")) == 1, cleanup);
+    ASSERT(strview_rfind(hay, SV("the")) == 31, cleanup);
+    ASSERT(strview_rfind(hay, SV("cat")) == STRVIEW_NPOS, cleanup);
+    ASSERT(strview_find_byte(hay, 'q') == 4, cleanup);
+    ASSERT(strview_find_byte(hay, 'Q') == STRVIEW_NPOS, cleanup);
+    ASSERT(strview_find_byte(SV(""), 'a') == STRVIEW_NPOS, cleanup);
+    ASSERT(strview_starts_with(hay, SV("the quick")), cleanup);
+    ASSERT(!strview_starts_with(SV("th"), SV("the")), cleanup);
+    ASSERT(strview_ends_with(hay, SV("lazy dog")), cleanup);
+    ASSERT(!strview_ends_with(hay, SV("lazy cat")), cleanup);
+    ASSERT(strview_eq(strview_substr(hay, 4, 5), SV("quick")), cleanup);
+    ASSERT(strview_substr(hay, 100, 5).len == 0, cleanup);
+    ASSERT(strview_eq(strview_substr(hay, 40, 100), SV("dog")), cleanup);
+cleanup:;
+}
+END_TEST
+
+TEST(test_strview_compare) {
+    str s = STR_INIT;
+    ASSERT(!str_copy(&s, "hello"), cleanup);
+    ASSERT(strview_eq(strview_from_str(&s), strview_from_cstr("hello")), cleanup);
+    ASSERT(strview_hash(strview_from_str(&s)) == mem_hash("hello", 5), cleanup);
+    ASSERT(strview_cmp(SV("abc"), SV("abd")) < 0, cleanup);
+    ASSERT(strview_cmp(SV("abc"), SV("ab")) > 0, cleanup);
+    ASSERT(strview_cmp(SV("ab"), SV("abc")) < 0, cleanup);
+    ASSERT(strview_cmp(SV("abc"), SV("abc")) == 0, cleanup);
+    ASSERT(!strview_eq(SV("abc"), SV("ab")), cleanup);
+    ASSERT(strview_eq(strview_trim(SV(" \t hi there\r\n")), SV("hi there")), cleanup);
+    ASSERT(strview_eq(strview_trim_left(SV("  x ")), SV("x ")), cleanup);
+    ASSERT(strview_eq(strview_trim_right(SV("  x ")), SV("  x")), cleanup);
+    ASSERT(strview_trim(SV("   ")).len == 0, cleanup);
+    ASSERT(!strview_to_str(SV("quick brown"), &s), cleanup);
+    ASSERT(strcmp(str_cbegin(&s), "quick brown") == 0, cleanup);
+cleanup:
+    str_destroy(&s);
+}
+END_TEST
+
+TEST(test_strview_split) {
+    strview_split split = strview_split_new(SV("a,,b, c"), SV(","));
+    strview_tokenizer tokens;
+    strview piece;
+    ASSERT(strview_split_next(&split, &piece) && strview_eq(piece, SV("a")), cleanup);
+    ASSERT(strview_split_next(&split, &piece) && strview_eq(piece, SV("")), cleanup);
+    ASSERT(strview_split_next(&split, &piece) && strview_eq(piece, SV("b")), cleanup);
+    ASSERT(strview_split_next(&split, &piece) && strview_eq(piece, SV(" c")), cleanup);
+    ASSERT(!strview_split_next(&split, &piece), cleanup);
+
+    split = strview_split_new(SV("key::value::"), SV("::"));
+    ASSERT(strview_split_next(&split, &piece) && strview_eq(piece, SV("key")), cleanup);
+    ASSERT(strview_split_next(&split, &piece) && strview_eq(piece, SV("value")),
+           cleanup);
+    ASSERT(strview_split_next(&split, &piece) && piece.len == 0, cleanup);
+    ASSERT(!strview_split_next(&split, &piece), cleanup);
+
+    tokens = strview_tokenizer_new(SV("  GET /index.html\tHTTP/1.1\r\n"), " \t\r\n");
+    ASSERT(strview_tokenizer_next(&tokens, &piece) && strview_eq(piece, SV("GET")),
+           cleanup);
+    ASSERT(strview_tokenizer_next(&tokens, &piece) &&
+               strview_eq(piece, SV("/index.html")),
+           cleanup);
+    ASSERT(strview_tokenizer_next(&tokens, &piece) &&
+               strview_eq(piece, SV("HTTP/1.1")),
+           cleanup);
+    ASSERT(!strview_tokenizer_next(&tokens, &piece), cleanup);
+    tokens = strview_tokenizer_new(SV(""), " ");
+    ASSERT(!strview_tokenizer_next(&tokens, &piece), cleanup);
+cleanup:;
+}
+END_TEST
+
+void test_strview(void) {
+    RUN(test_strview_find);
+    RUN(test_strview_compare);
+    RUN(test_strview_split);
+}
+#endif
@@ -24,7 +24,24 @@ int main() {
     rpmalloc_initialize();
     run(test_vec);
     run(test_str);
+    run(test_str_number);
+    run(test_str_parse);
+    run(test_str_builder);
+    run(test_str_case);
+    run(test_str_encode);
+    run(test_str_json);
+    run(test_utf8);
+    run(test_search);
+    run(test_multimatch);
+    run(test_reader);
+    run(test_rope);
+    run(test_gapbuf);
+    run(test_strview);
     run(test_hashmap);
+    run(test_multimap);
+    run(test_strmap);
+    run(test_counter_map);
+    run(test_intern);
     printf("%d of %d succeeded.\n", successes, failures + successes);
     printf("%d assertions succeeded.\n", successes_assert);
     rpmalloc_finalize();
@@ -0,0 +1,1184 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2017 Chris Gregory czipperz@gmail.com
+ */
+
+#include "../utf8.h"
+#include "../cpu.h"
+#include "../rpmalloc.h"
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef CPU_X86
+#include <immintrin.h>
+#endif
+
+/*! \brief Get the length of the valid sequence starting at \c i.
+ *
+ * Returns 0 if it is invalid or cut off by \c len. */
+static size_t
+utf8_sequence_length(const unsigned char* s, size_t i, size_t len) {
+    unsigned char c = s[i];
+    unsigned char lo = 0x80;
+    unsigned char hi = 0xBF;
+    size_t n;
+    size_t j;
+    if (c < 0x80) {
+        return c != 0;
+    } else if (c < 0xC2) {
+        /* Either a continuation byte or an overlong 2 byte lead. */
+        return 0;
+    } else if (c < 0xE0) {
+        n = 2;
+    } else if (c < 0xF0) {
+        n = 3;
+        if (c == 0xE0) {
+            lo = 0xA0; /* overlong */
+        } else if (c == 0xED) {
+            hi = 0x9F; /* surrogate */
+        }
+    } else if (c < 0xF5) {
+        n = 4;
+        if (c == 0xF0) {
+            lo = 0x90; /* overlong */
+        } else if (c == 0xF4) {
+            hi = 0x8F; /* above U+10FFFF */
+        }
+    } else {
+        return 0;
+    }
+
+    if (len - i < n || s[i + 1] < lo || s[i + 1] > hi) {
+        return 0;
+    }
+    for (j = 2; j < n; ++j) {
+        if ((s[i + j] & 0xC0) != 0x80) {
+            return 0;
+        }
+    }
+    return n;
+}
+
+static size_t
+utf8_validate_scalar(const unsigned char* s, size_t i, size_t len) {
+    while (i != len) {
+        size_t n;
+        if (len - i >= 8) {
+            /* Skip eight ASCII bytes at a time.  The second term
+             * sets the high bit of any null byte. */
+            uint64_t word;
+            memcpy(&word, s + i, 8);
+            if (((word | ((word - UINT64_C(0x0101010101010101)) & ~word)) &
+                 UINT64_C(0x8080808080808080)) == 0) {
+                i += 8;
+                continue;
+            }
+        }
+        n = utf8_sequence_length(s, i, len);
+        if (!n) {
+            break;
+        }
+        i += n;
+    }
+    return i;
+}
+
+/*! \brief A vectorized kernel.
+ *
+ * Returns the offset of the first block containing an error, or the
+ * end of the last block checked.  Either way every byte before the
+ * sequence straddling that offset is valid. */
+typedef size_t (*utf8_kernel)(const unsigned char*, size_t);
+
+static size_t
+utf8_kernel_scalar(const unsigned char* s, size_t len) {
+    (void)s;
+    (void)len;
+    return 0;
+}
+
+#ifdef CPU_X86
+/* The lookup algorithm from Keiser and Lemire, "Validating UTF-8 In
+ * Less Than One Instruction Per Byte".  Each pair of adjacent bytes
+ * is classified by three 16 entry tables indexed by the high and low
+ * nibbles of the first byte and the high nibble of the second.  The
+ * bitwise and of the three entries is nonzero only if the pair is
+ * invalid. */
+#define UTF8_TOO_SHORT (1 << 0)
+#define UTF8_TOO_LONG (1 << 1)
+#define UTF8_OVERLONG_3 (1 << 2)
+#define UTF8_TOO_LARGE (1 << 3)
+#define UTF8_SURROGATE (1 << 4)
+#define UTF8_OVERLONG_2 (1 << 5)
+#define UTF8_TOO_LARGE_1000 (1 << 6)
+#define UTF8_OVERLONG_4 (1 << 6)
+#define UTF8_TWO_CONTS (1 << 7)
+#define UTF8_CARRY (UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS)
+
+static const unsigned char utf8_byte_1_high[16] = {
+    /* 0xxx: ASCII */
+    UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+    UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+    /* 10xx: continuation */
+    UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS,
+    /* 1100: 2 byte lead, possibly overlong */
+    UTF8_TOO_SHORT | UTF8_OVERLONG_2,
+    /* 1101: 2 byte lead */
+    UTF8_TOO_SHORT,
+    /* 1110: 3 byte lead */
+    UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+    /* 1111: 4 byte lead */
+    UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,
+};
+
+static const unsigned char utf8_byte_1_low[16] = {
+    /* xxxx0000 */
+    UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4,
+    /* xxxx0001 */
+    UTF8_CARRY | UTF8_OVERLONG_2,
+    /* xxxx001x */
+    UTF8_CARRY,
+    UTF8_CARRY,
+    /* xxxx0100 */
+    UTF8_CARRY | UTF8_TOO_LARGE,
+    /* xxxx0101 to xxxx1100 */
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    /* xxxx1101 */
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE,
+    /* xxxx111x */
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+};
+
+static const unsigned char utf8_byte_2_high[16] = {
+    /* 0xxx: ASCII */
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+    /* 1000 */
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 |
+        UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,
+    /* 1001 */
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 |
+        UTF8_TOO_LARGE,
+    /* 101x */
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE |
+        UTF8_TOO_LARGE,
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE |
+        UTF8_TOO_LARGE,
+    /* 11xx: lead */
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+};
+
+/*! \brief Subtracting this with saturation leaves a nonzero byte
+ *  where the last three bytes of a block start a sequence that runs
+ *  into the next block. */
+static const unsigned char utf8_incomplete_max[32] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xF0 - 1, 0xE0 - 1, 0xC0 - 1,
+};
+
+__attribute__((target("ssse3")))
+static size_t
+utf8_kernel_ssse3(const unsigned char* s, size_t len) {
+    const __m128i byte_1_high = _mm_loadu_si128((const __m128i*)utf8_byte_1_high);
+    const __m128i byte_1_low = _mm_loadu_si128((const __m128i*)utf8_byte_1_low);
+    const __m128i byte_2_high = _mm_loadu_si128((const __m128i*)utf8_byte_2_high);
+    const __m128i incomplete_max =
+        _mm_loadu_si128((const __m128i*)(utf8_incomplete_max + 16));
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i third_min = _mm_set1_epi8((char)(0xE0 - 1));
+    const __m128i fourth_min = _mm_set1_epi8((char)(0xF0 - 1));
+    const __m128i high_bit = _mm_set1_epi8((char)0x80);
+    __m128i prev_input = zero;
+    __m128i prev_incomplete = zero;
+    size_t i;
+
+    for (i = 0; len - i >= 16; i += 16) {
+        __m128i input = _mm_loadu_si128((const __m128i*)(s + i));
+        __m128i nul = _mm_cmpeq_epi8(input, zero);
+        __m128i error;
+        if (!_mm_movemask_epi8(_mm_or_si128(input, nul))) {
+            /* Pure ASCII is only wrong if the last block was cut off. */
+            error = prev_incomplete;
+            prev_incomplete = zero;
+        } else {
+            __m128i prev1 = _mm_alignr_epi8(input, prev_input, 15);
+            __m128i prev2 = _mm_alignr_epi8(input, prev_input, 14);
+            __m128i prev3 = _mm_alignr_epi8(input, prev_input, 13);
+            __m128i special = _mm_and_si128(
+                _mm_and_si128(
+                    _mm_shuffle_epi8(byte_1_high,
+                                     _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble)),
+                    _mm_shuffle_epi8(byte_1_low, _mm_and_si128(prev1, nibble))),
+                _mm_shuffle_epi8(byte_2_high,
+                                 _mm_and_si128(_mm_srli_epi16(input, 4), nibble)));
+            /* Bytes two or three after a 3 or 4 byte lead must be
+             * continuations; the tables can't see that far back. */
+            __m128i must_be_cont = _mm_cmpgt_epi8(
+                _mm_or_si128(_mm_subs_epu8(prev2, third_min),
+                             _mm_subs_epu8(prev3, fourth_min)),
+                zero);
+            error = _mm_xor_si128(_mm_and_si128(must_be_cont, high_bit), special);
+            error = _mm_or_si128(error, nul);
+            prev_incomplete = _mm_subs_epu8(input, incomplete_max);
+        }
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(error, zero)) != 0xFFFF) {
+            break;
+        }
+        prev_input = input;
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t
+utf8_kernel_avx2(const unsigned char* s, size_t len) {
+    const __m256i byte_1_high = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i*)utf8_byte_1_high));
+    const __m256i byte_1_low = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i*)utf8_byte_1_low));
+    const __m256i byte_2_high = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i*)utf8_byte_2_high));
+    const __m256i incomplete_max =
+        _mm256_loadu_si256((const __m256i*)utf8_incomplete_max);
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i third_min = _mm256_set1_epi8((char)(0xE0 - 1));
+    const __m256i fourth_min = _mm256_set1_epi8((char)(0xF0 - 1));
+    const __m256i high_bit = _mm256_set1_epi8((char)0x80);
+    __m256i prev_input = zero;
+    __m256i prev_incomplete = zero;
+    size_t i;
+
+    for (i = 0; len - i >= 32; i += 32) {
+        __m256i input = _mm256_loadu_si256((const __m256i*)(s + i));
+        __m256i nul = _mm256_cmpeq_epi8(input, zero);
+        __m256i error;
+        if (!_mm256_movemask_epi8(_mm256_or_si256(input, nul))) {
+            error = prev_incomplete;
+            prev_incomplete = zero;
+        } else {
+            /* alignr works within each 128 bit lane, so first line
+             * up the high lane of the last block with the low lane of
+             * this one. */
+            __m256i shifted = _mm256_permute2x128_si256(prev_input, input, 0x21);
+            __m256i prev1 = _mm256_alignr_epi8(input, shifted, 15);
+            __m256i prev2 = _mm256_alignr_epi8(input, shifted, 14);
+            __m256i prev3 = _mm256_alignr_epi8(input, shifted, 13);
+            __m256i special = _mm256_and_si256(
+                _mm256_and_si256(
+                    _mm256_shuffle_epi8(byte_1_high,
+                                        _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble)),
+                    _mm256_shuffle_epi8(byte_1_low, _mm256_and_si256(prev1, nibble))),
+                _mm256_shuffle_epi8(byte_2_high,
+                                    _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble)));
+            __m256i must_be_cont = _mm256_cmpgt_epi8(
+                _mm256_or_si256(_mm256_subs_epu8(prev2, third_min),
+                                _mm256_subs_epu8(prev3, fourth_min)),
+                zero);
+            error = _mm256_xor_si256(_mm256_and_si256(must_be_cont, high_bit), special);
+            error = _mm256_or_si256(error, nul);
+            prev_incomplete = _mm256_subs_epu8(input, incomplete_max);
+        }
+        if (!_mm256_testz_si256(error, error)) {
+            break;
+        }
+        prev_input = input;
+    }
+    return i;
+}
+#endif
+
+static utf8_kernel
+utf8_select_kernel(void) {
+#ifdef CPU_X86
+    unsigned features = cpu_features();
+    if (features & CPU_AVX2) {
+        return utf8_kernel_avx2;
+    }
+    if (features & CPU_SSSE3) {
+        return utf8_kernel_ssse3;
+    }
+#endif
+    return utf8_kernel_scalar;
+}
+
+static size_t
+utf8_validate_with(utf8_kernel kernel, const unsigned char* s, size_t len) {
+    size_t i = kernel(s, len);
+    size_t j;
+    /* The kernel stopped in the middle of a block or ran out of
+     * blocks.  Either way a sequence may straddle \c i, so back up
+     * to its lead byte and let the scalar loop find the exact end. */
+    for (j = 1; j <= 3 && j <= i; ++j) {
+        if (s[i - j] >= 0xC0) {
+            i -= j;
+            break;
+        }
+    }
+    return utf8_validate_scalar(s, i, len);
+}
+
+size_t
+utf8_validate(const char* string, size_t len) {
+    return utf8_validate_with(utf8_select_kernel(),
+                              (const unsigned char*)string, len);
+}
+
+size_t
+utf8_encode(uint32_t character, char* out) {
+    unsigned char* o = (unsigned char*)out;
+    if (character < 0x80) {
+        o[0] = (unsigned char)character;
+        return 1;
+    } else if (character < 0x800) {
+        o[0] = (unsigned char)(0xC0 | (character >> 6));
+        o[1] = (unsigned char)(0x80 | (character & 0x3F));
+        return 2;
+    } else if (character < 0x10000) {
+        if ((character & 0xF800) == 0xD800) {
+            return 0;
+        }
+        o[0] = (unsigned char)(0xE0 | (character >> 12));
+        o[1] = (unsigned char)(0x80 | ((character >> 6) & 0x3F));
+        o[2] = (unsigned char)(0x80 | (character & 0x3F));
+        return 3;
+    } else if (character < 0x110000) {
+        o[0] = (unsigned char)(0xF0 | (character >> 18));
+        o[1] = (unsigned char)(0x80 | ((character >> 12) & 0x3F));
+        o[2] = (unsigned char)(0x80 | ((character >> 6) & 0x3F));
+        o[3] = (unsigned char)(0x80 | (character & 0x3F));
+        return 4;
+    } else {
+        return 0;
+    }
+}
+
+/* Counting characters is counting the bytes that aren't
+ * continuations.  As signed chars continuation bytes are exactly
+ * those at most (char)0xBF. */
+#define UTF8_CONT_MAX ((char)0xBF)
+
+static size_t
+utf8_count_chars_scalar(const unsigned char* s, size_t len) {
+    size_t count = 0;
+    size_t i;
+    for (i = 0; i != len; ++i) {
+        count += (s[i] & 0xC0) != 0x80;
+    }
+    return count;
+}
+
+static size_t
+utf8_char_to_byte_scalar(const unsigned char* s, size_t len, size_t n) {
+    size_t i;
+    for (i = 0; i != len; ++i) {
+        if ((s[i] & 0xC0) != 0x80) {
+            if (!n) {
+                return i;
+            }
+            --n;
+        }
+    }
+    return len;
+}
+
+#ifdef CPU_X86
+/*! \brief Find the offset of the \c n th set bit of \c mask.  There
+ *  must be more than \c n bits set. */
+static size_t
+utf8_nth_bit(uint32_t mask, size_t n) {
+    while (n--) {
+        mask &= mask - 1;
+    }
+    return __builtin_ctz(mask);
+}
+
+__attribute__((target("sse2")))
+static size_t
+utf8_count_chars_sse2(const unsigned char* s, size_t len) {
+    const __m128i cont_max = _mm_set1_epi8(UTF8_CONT_MAX);
+    const __m128i zero = _mm_setzero_si128();
+    size_t count = 0;
+    size_t i = 0;
+    while (len - i >= 16) {
+        /* Each byte of the accumulator counts up to 255 blocks before
+         * it has to be summed. */
+        size_t blocks = (len - i) / 16;
+        __m128i acc = zero;
+        __m128i sums;
+        if (blocks > 255) {
+            blocks = 255;
+        }
+        for (; blocks; --blocks, i += 16) {
+            __m128i input = _mm_loadu_si128((const __m128i*)(s + i));
+            acc = _mm_sub_epi8(acc, _mm_cmpgt_epi8(input, cont_max));
+        }
+        sums = _mm_sad_epu8(acc, zero);
+        count += (size_t)_mm_cvtsi128_si32(sums) +
+                 (size_t)_mm_cvtsi128_si32(_mm_srli_si128(sums, 8));
+    }
+    return count + utf8_count_chars_scalar(s + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t
+utf8_count_chars_avx2(const unsigned char* s, size_t len) {
+    const __m256i cont_max = _mm256_set1_epi8(UTF8_CONT_MAX);
+    const __m256i zero = _mm256_setzero_si256();
+    size_t count = 0;
+    size_t i = 0;
+    while (len - i >= 32) {
+        size_t blocks = (len - i) / 32;
+        __m256i acc = zero;
+        __m256i wide_sums;
+        __m128i sums;
+        if (blocks > 255) {
+            blocks = 255;
+        }
+        for (; blocks; --blocks, i += 32) {
+            __m256i input = _mm256_loadu_si256((const __m256i*)(s + i));
+            acc = _mm256_sub_epi8(acc, _mm256_cmpgt_epi8(input, cont_max));
+        }
+        wide_sums = _mm256_sad_epu8(acc, zero);
+        sums = _mm_add_epi64(_mm256_castsi256_si128(wide_sums),
+                             _mm256_extracti128_si256(wide_sums, 1));
+        count += (size_t)_mm_cvtsi128_si32(sums) +
+                 (size_t)_mm_cvtsi128_si32(_mm_srli_si128(sums, 8));
+    }
+    return count + utf8_count_chars_scalar(s + i, len - i);
+}
+
+__attribute__((target("sse2")))
+static size_t
+utf8_char_to_byte_sse2(const unsigned char* s, size_t len, size_t n) {
+    const __m128i cont_max = _mm_set1_epi8(UTF8_CONT_MAX);
+    size_t i;
+    for (i = 0; len - i >= 16; i += 16) {
+        __m128i input = _mm_loadu_si128((const __m128i*)(s + i));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_cmpgt_epi8(input, cont_max));
+        size_t count = (size_t)__builtin_popcount(mask);
+        if (n < count) {
+            return i + utf8_nth_bit(mask, n);
+        }
+        n -= count;
+    }
+    return i + utf8_char_to_byte_scalar(s + i, len - i, n);
+}
+
+__attribute__((target("avx2")))
+static size_t
+utf8_char_to_byte_avx2(const unsigned char* s, size_t len, size_t n) {
+    const __m256i cont_max = _mm256_set1_epi8(UTF8_CONT_MAX);
+    size_t i;
+    for (i = 0; len - i >= 32; i += 32) {
+        __m256i input = _mm256_loadu_si256((const __m256i*)(s + i));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpgt_epi8(input, cont_max));
+        size_t count = (size_t)__builtin_popcount(mask);
+        if (n < count) {
+            return i + utf8_nth_bit(mask, n);
+        }
+        n -= count;
+    }
+    return i + utf8_char_to_byte_scalar(s + i, len - i, n);
+}
+#endif
+
+size_t
+utf8_count_chars(const char* string, size_t len) {
+    const unsigned char* s = (const unsigned char*)string;
+#ifdef CPU_X86
+    if (cpu_features() & CPU_AVX2) {
+        return utf8_count_chars_avx2(s, len);
+    }
+    if (cpu_features() & CPU_SSE2) {
+        return utf8_count_chars_sse2(s, len);
+    }
+#endif
+    return utf8_count_chars_scalar(s, len);
+}
+
+size_t
+utf8_char_to_byte(const char* string, size_t len, size_t char_index) {
+    const unsigned char* s = (const unsigned char*)string;
+#ifdef CPU_X86
+    if (cpu_features() & CPU_AVX2) {
+        return utf8_char_to_byte_avx2(s, len, char_index);
+    }
+    if (cpu_features() & CPU_SSE2) {
+        return utf8_char_to_byte_sse2(s, len, char_index);
+    }
+#endif
+    return utf8_char_to_byte_scalar(s, len, char_index);
+}
+
+size_t
+utf8_byte_to_char(const char* string, size_t byte_index) {
+    return utf8_count_chars(string, byte_index);
+}
+
+/* Transcoding converts whole vectors of ASCII at a time, since that
+ * is most text, and everything else a character at a time. */
+
+/*! \brief Convert characters at a time for up to this many code
+ *  units before trying vectors again. */
+#define UTF8_SCALAR_RUN 16
+
+static size_t
+utf8_len_from_utf16_scalar(const uint16_t* s, size_t len) {
+    size_t total = 0;
+    size_t i;
+    for (i = 0; i != len; ++i) {
+        /* Each half of a surrogate pair makes 2 of its 4 bytes. */
+        total += 1 + (s[i] >= 0x80) +
+                 (s[i] >= 0x800 && (s[i] & 0xF800) != 0xD800);
+    }
+    return total;
+}
+
+static size_t
+utf8_len_from_utf32_scalar(const uint32_t* s, size_t len) {
+    size_t total = 0;
+    size_t i;
+    for (i = 0; i != len; ++i) {
+        total += 1 + (s[i] >= 0x80) + (s[i] >= 0x800) + (s[i] >= 0x10000);
+    }
+    return total;
+}
+
+#ifdef CPU_X86
+__attribute__((target("sse2")))
+static size_t
+utf8_len_from_utf16_sse2(const uint16_t* s, size_t len) {
+    /* Flipping the top bit makes signed compares unsigned. */
+    const __m128i flip = _mm_set1_epi16((short)0x8000);
+    const __m128i max_1 = _mm_set1_epi16((short)(0x7F ^ 0x8000));
+    const __m128i max_2 = _mm_set1_epi16((short)(0x7FF ^ 0x8000));
+    const __m128i surrogate_mask = _mm_set1_epi16((short)0xF800);
+    const __m128i surrogate = _mm_set1_epi16((short)0xD800);
+    const __m128i ones = _mm_set1_epi16(1);
+    size_t total = len;
+    size_t i = 0;
+    while (len - i >= 8) {
+        /* Each lane grows by at most 2 per block. */
+        size_t blocks = (len - i) / 8;
+        __m128i acc = _mm_setzero_si128();
+        __m128i sums;
+        if (blocks > 16000) {
+            blocks = 16000;
+        }
+        for (; blocks; --blocks, i += 8) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+            __m128i flipped = _mm_xor_si128(v, flip);
+            __m128i two = _mm_cmpgt_epi16(flipped, max_1);
+            __m128i three = _mm_andnot_si128(
+                _mm_cmpeq_epi16(_mm_and_si128(v, surrogate_mask), surrogate),
+                _mm_cmpgt_epi16(flipped, max_2));
+            acc = _mm_sub_epi16(_mm_sub_epi16(acc, two), three);
+        }
+        sums = _mm_madd_epi16(acc, ones);
+        sums = _mm_add_epi32(sums, _mm_srli_si128(sums, 8));
+        sums = _mm_add_epi32(sums, _mm_srli_si128(sums, 4));
+        total += (size_t)(uint32_t)_mm_cvtsi128_si32(sums);
+    }
+    return total - (len - i) + utf8_len_from_utf16_scalar(s + i, len - i);
+}
+
+__attribute__((target("sse2")))
+static size_t
+utf8_len_from_utf32_sse2(const uint32_t* s, size_t len) {
+    const __m128i max_1 = _mm_set1_epi32(0x7F);
+    const __m128i max_2 = _mm_set1_epi32(0x7FF);
+    const __m128i max_3 = _mm_set1_epi32(0xFFFF);
+    __m128i acc = _mm_setzero_si128();
+    size_t total = 0;
+    size_t i;
+    /* Values past 0x7FFFFFFF are invalid and count as 1 byte. */
+    for (i = 0; len - i >= 4; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+        acc = _mm_sub_epi32(acc, _mm_cmpgt_epi32(v, max_1));
+        acc = _mm_sub_epi32(acc, _mm_cmpgt_epi32(v, max_2));
+        acc = _mm_sub_epi32(acc, _mm_cmpgt_epi32(v, max_3));
+        /* Each lane grows by at most 3 per block. */
+        if ((i & 0xFFFFF) == 0) {
+            acc = _mm_add_epi32(acc, _mm_srli_si128(acc, 8));
+            acc = _mm_add_epi32(acc, _mm_srli_si128(acc, 4));
+            total += (size_t)(uint32_t)_mm_cvtsi128_si32(acc);
+            acc = _mm_setzero_si128();
+        }
+    }
+    acc = _mm_add_epi32(acc, _mm_srli_si128(acc, 8));
+    acc = _mm_add_epi32(acc, _mm_srli_si128(acc, 4));
+    total += (size_t)(uint32_t)_mm_cvtsi128_si32(acc);
+    return total + i + utf8_len_from_utf32_scalar(s + i, len - i);
+}
+
+/*! \brief Convert whole vectors of ASCII other than 0, stopping at
+ *  the first vector with anything else. */
+__attribute__((target("sse2")))
+static size_t
+utf8_ascii_from_utf16_sse2(const uint16_t* s, size_t len, unsigned char* out) {
+    const __m128i high = _mm_set1_epi16((short)0xFF80);
+    const __m128i zero = _mm_setzero_si128();
+    size_t i;
+    for (i = 0; len - i >= 16; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(s + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(s + i + 8));
+        __m128i ascii =
+            _mm_cmpeq_epi16(_mm_and_si128(_mm_or_si128(a, b), high), zero);
+        if (_mm_movemask_epi8(ascii) != 0xFFFF ||
+            _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi16(a, zero),
+                                           _mm_cmpeq_epi16(b, zero)))) {
+            break;
+        }
+        _mm_storeu_si128((__m128i*)(out + i), _mm_packus_epi16(a, b));
+    }
+    return i;
+}
+
+__attribute__((target("sse2")))
+static size_t
+utf8_ascii_from_utf32_sse2(const uint32_t* s, size_t len, unsigned char* out) {
+    const __m128i high = _mm_set1_epi32(~0x7F);
+    const __m128i zero = _mm_setzero_si128();
+    size_t i;
+    for (i = 0; len - i >= 16; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(s + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(s + i + 4));
+        __m128i c = _mm_loadu_si128((const __m128i*)(s + i + 8));
+        __m128i d = _mm_loadu_si128((const __m128i*)(s + i + 12));
+        __m128i all = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
+        __m128i zeros = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi32(a, zero), _mm_cmpeq_epi32(b, zero)),
+            _mm_or_si128(_mm_cmpeq_epi32(c, zero), _mm_cmpeq_epi32(d, zero)));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(all, high), zero)) !=
+                0xFFFF ||
+            _mm_movemask_epi8(zeros)) {
+            break;
+        }
+        _mm_storeu_si128((__m128i*)(out + i),
+                         _mm_packus_epi16(_mm_packs_epi32(a, b),
+                                          _mm_packs_epi32(c, d)));
+    }
+    return i;
+}
+
+__attribute__((target("sse2")))
+static size_t
+utf8_ascii_to_utf32_sse2(const unsigned char* s, size_t len, uint32_t* out) {
+    const __m128i zero = _mm_setzero_si128();
+    size_t i;
+    for (i = 0; len - i >= 16; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+        __m128i lo, hi;
+        if (_mm_movemask_epi8(v)) {
+            break;
+        }
+        lo = _mm_unpacklo_epi8(v, zero);
+        hi = _mm_unpackhi_epi8(v, zero);
+        _mm_storeu_si128((__m128i*)(out + i), _mm_unpacklo_epi16(lo, zero));
+        _mm_storeu_si128((__m128i*)(out + i + 4), _mm_unpackhi_epi16(lo, zero));
+        _mm_storeu_si128((__m128i*)(out + i + 8), _mm_unpacklo_epi16(hi, zero));
+        _mm_storeu_si128((__m128i*)(out + i + 12), _mm_unpackhi_epi16(hi, zero));
+    }
+    return i;
+}
+#endif
+
+size_t
+utf8_len_from_utf16(const uint16_t* string, size_t len) {
+#ifdef CPU_X86
+    if (cpu_features() & CPU_SSE2) {
+        return utf8_len_from_utf16_sse2(string, len);
+    }
+#endif
+    return utf8_len_from_utf16_scalar(string, len);
+}
+
+size_t
+utf8_len_from_utf32(const uint32_t* string, size_t len) {
+#ifdef CPU_X86
+    if (cpu_features() & CPU_SSE2) {
+        return utf8_len_from_utf32_sse2(string, len);
+    }
+#endif
+    return utf8_len_from_utf32_scalar(string, len);
+}
+
+size_t
+utf8_from_utf16(const uint16_t* string, size_t len, char* out,
+                size_t* written) {
+    unsigned char* o = (unsigned char*)out;
+    size_t i = 0;
+    size_t w = 0;
+    while (i != len) {
+        size_t stop;
+#ifdef CPU_X86
+        if (cpu_features() & CPU_SSE2) {
+            size_t n = utf8_ascii_from_utf16_sse2(string + i, len - i, o + w);
+            i += n;
+            w += n;
+        }
+#endif
+        stop = len - i < UTF8_SCALAR_RUN ? len : i + UTF8_SCALAR_RUN;
+        while (i < stop) {
+            uint32_t character = string[i];
+            if ((character & 0xF800) == 0xD800) {
+                /* A high surrogate followed by a low surrogate. */
+                if (character >= 0xDC00 || i + 1 == len ||
+                    (string[i + 1] & 0xFC00) != 0xDC00) {
+                    goto done;
+                }
+                character = 0x10000 + ((character - 0xD800) << 10) +
+                            (string[i + 1] - 0xDC00u);
+                ++i;
+            } else if (character == 0) {
+                goto done;
+            }
+            ++i;
+            w += utf8_encode(character, (char*)o + w);
+        }
+    }
+done:
+    *written = w;
+    return i;
+}
+
+size_t
+utf8_from_utf32(const uint32_t* string, size_t len, char* out,
+                size_t* written) {
+    unsigned char* o = (unsigned char*)out;
+    size_t i = 0;
+    size_t w = 0;
+    while (i != len) {
+        size_t stop;
+#ifdef CPU_X86
+        if (cpu_features() & CPU_SSE2) {
+            size_t n = utf8_ascii_from_utf32_sse2(string + i, len - i, o + w);
+            i += n;
+            w += n;
+        }
+#endif
+        stop = len - i < UTF8_SCALAR_RUN ? len : i + UTF8_SCALAR_RUN;
+        for (; i < stop; ++i) {
+            size_t n;
+            if (string[i] == 0 || !(n = utf8_encode(string[i], (char*)o + w))) {
+                goto done;
+            }
+            w += n;
+        }
+    }
+done:
+    *written = w;
+    return i;
+}
+
+size_t
+utf8_to_utf32(const char* string, size_t len, uint32_t* out) {
+    const unsigned char* s = (const unsigned char*)string;
+    size_t i = 0;
+    size_t n = 0;
+    while (i != len) {
+        size_t stop;
+#ifdef CPU_X86
+        if (cpu_features() & CPU_SSE2) {
+            size_t k = utf8_ascii_to_utf32_sse2(s + i, len - i, out + n);
+            i += k;
+            n += k;
+        }
+#endif
+        stop = len - i < UTF8_SCALAR_RUN ? len : i + UTF8_SCALAR_RUN;
+        while (i < stop) {
+            unsigned char c = s[i];
+            if (c < 0x80) {
+                out[n] = c;
+                i += 1;
+            } else if (c < 0xE0) {
+                out[n] = (uint32_t)(c & 0x1F) << 6 | (s[i + 1] & 0x3F);
+                i += 2;
+            } else if (c < 0xF0) {
+                out[n] = (uint32_t)(c & 0x0F) << 12 |
+                         (uint32_t)(s[i + 1] & 0x3F) << 6 | (s[i + 2] & 0x3F);
+                i += 3;
+            } else {
+                out[n] = (uint32_t)(c & 0x07) << 18 |
+                         (uint32_t)(s[i + 1] & 0x3F) << 12 |
+                         (uint32_t)(s[i + 2] & 0x3F) << 6 | (s[i + 3] & 0x3F);
+                i += 4;
+            }
+            ++n;
+        }
+    }
+    return n;
+}
+
+int
+utf8_index_build(utf8_index* self, const char* string, size_t len,
+                 size_t stride) {
+    size_t num = 1;
+    size_t offset = 0;
+    size_t* checkpoints;
+    size_t i;
+
+    assert(stride != 0);
+    /* One pass to size the array and one to fill it is still cheaper
+     * than growing it, since both passes are vectorized. */
+    num += utf8_count_chars(string, len) / stride;
+    checkpoints = rprealloc(self->checkpoints, num * sizeof(size_t));
+    if (!checkpoints) {
+        return -1;
+    }
+    checkpoints[0] = 0;
+    for (i = 1; i != num; ++i) {
+        offset += utf8_char_to_byte(string + offset, len - offset, stride);
+        checkpoints[i] = offset;
+    }
+    self->checkpoints = checkpoints;
+    self->len = num;
+    self->stride = stride;
+    return 0;
+}
+
+void
+utf8_index_destroy(utf8_index* self) {
+    rpfree(self->checkpoints);
+    self->checkpoints = 0;
+    self->len = 0;
+    self->stride = 0;
+}
+
+size_t
+utf8_index_char_to_byte(const utf8_index* self, const char* string,
+                        size_t len, size_t char_index) {
+    size_t k = char_index / self->stride;
+    size_t base;
+    if (k >= self->len) {
+        k = self->len - 1;
+    }
+    base = self->checkpoints[k];
+    return base + utf8_char_to_byte(string + base, len - base,
+                                    char_index - k * self->stride);
+}
+
+size_t
+utf8_index_byte_to_char(const utf8_index* self, const char* string,
+                        size_t byte_index) {
+    /* Find the last checkpoint at or before byte_index. */
+    size_t lo = 0;
+    size_t hi = self->len;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (self->checkpoints[mid] <= byte_index) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo * self->stride +
+           utf8_count_chars(string + self->checkpoints[lo],
+                            byte_index - self->checkpoints[lo]);
+}
+
+#ifdef TEST_MODE
+#include "test.h"
+
+TEST(test_utf8_validate_valid) {
+    ASSERT(utf8_validate("", 0) == 0, cleanup);
+    ASSERT(utf8_validate("hello", 5) == 5, cleanup);
+    /* U+007F, U+0080, U+07FF, U+0800 */
+    ASSERT(utf8_validate("\x7F\xC2\x80\xDF\xBF\xE0\xA0\x80", 8) == 8, cleanup);
+    /* U+D7FF, U+E000, U+FFFF */
+    ASSERT(utf8_validate("\xED\x9F\xBF\xEE\x80\x80\xEF\xBF\xBF", 9) == 9, cleanup);
+    /* U+10000, U+10FFFF */
+    ASSERT(utf8_validate("\xF0\x90\x80\x80\xF4\x8F\xBF\xBF", 8) == 8, cleanup);
+cleanup:;
+}
+END_TEST
+
+TEST(test_utf8_validate_invalid) {
+    ASSERT(utf8_validate("a\x80", 2) == 1, cleanup);
+    ASSERT(utf8_validate("a\xC0\x80", 3) == 1, cleanup);
+    ASSERT(utf8_validate("a\xC1\xBF", 3) == 1, cleanup);
+    ASSERT(utf8_validate("\xC3\x28", 2) == 0, cleanup);
+    ASSERT(utf8_validate("\xE0\x9F\xBF", 3) == 0, cleanup);
+    ASSERT(utf8_validate("\xED\xA0\x80", 3) == 0, cleanup);
+    ASSERT(utf8_validate("\xF0\x8F\xBF\xBF", 4) == 0, cleanup);
+    ASSERT(utf8_validate("\xF4\x90\x80\x80", 4) == 0, cleanup);
+    ASSERT(utf8_validate("\xF5\x80\x80\x80", 4) == 0, cleanup);
+    ASSERT(utf8_validate("\xFF", 1) == 0, cleanup);
+    ASSERT(utf8_validate("ab\xE2\x82", 4) == 2, cleanup);
+    ASSERT(utf8_validate("ab\0c", 4) == 2, cleanup);
+cleanup:;
+}
+END_TEST
+
+TEST(test_utf8_validate_kernels) {
+    static const char pattern[] = "ab\xC3\xA9" "c\xE2\x82\xAC" "\xF0\x9D\x84\x9E";
+    static const unsigned char bad[] = {0x00, 0x80, 0xBF, 0xC2, 0xE0, 0xED,
+                                        0xF0, 0xF4, 0xFF, 'x'};
+    unsigned char buffer[200];
+    unsigned char copy[200];
+    utf8_kernel kernels[3];
+    size_t num_kernels = 0;
+    size_t i, k, b, len;
+
+    kernels[num_kernels++] = utf8_kernel_scalar;
+#ifdef CPU_X86
+    if (cpu_features() & CPU_SSSE3) {
+        kernels[num_kernels++] = utf8_kernel_ssse3;
+    }
+    if (cpu_features() & CPU_AVX2) {
+        kernels[num_kernels++] = utf8_kernel_avx2;
+    }
+#endif
+
+    for (i = 0; i != sizeof(buffer); ++i) {
+        buffer[i] = pattern[i % (sizeof(pattern) - 1)];
+    }
+    /* Every truncation, so sequences get cut off at every offset
+     * into a block. */
+    for (len = 0; len <= sizeof(buffer); ++len) {
+        size_t expected = utf8_validate_scalar(buffer, 0, len);
+        for (k = 0; k != num_kernels; ++k) {
+            ASSERT(utf8_validate_with(kernels[k], buffer, len) == expected, cleanup);
+        }
+    }
+    /* Every corruption at every position. */
+    for (i = 0; i != sizeof(buffer); ++i) {
+        for (b = 0; b != sizeof(bad); ++b) {
+            size_t expected;
+            memcpy(copy, buffer, sizeof(buffer));
+            copy[i] = bad[b];
+            expected = utf8_validate_scalar(copy, 0, sizeof(copy));
+            for (k = 0; k != num_kernels; ++k) {
+                ASSERT(utf8_validate_with(kernels[k], copy, sizeof(copy)) == expected,
+                       cleanup);
+            }
+        }
+    }
+cleanup:;
+}
+END_TEST
+
+TEST(test_utf8_encode) {
+    char out[4];
+    ASSERT(utf8_encode('a', out) == 1 && out[0] == 'a', cleanup);
+    ASSERT(utf8_encode(0xE9, out) == 2 && memcmp(out, "\xC3\xA9", 2) == 0, cleanup);
+    ASSERT(utf8_encode(0x20AC, out) == 3 && memcmp(out, "\xE2\x82\xAC", 3) == 0,
+           cleanup);
+    ASSERT(utf8_encode(0x1D11E, out) == 4 &&
+               memcmp(out, "\xF0\x9D\x84\x9E", 4) == 0,
+           cleanup);
+    ASSERT(utf8_encode(0xD800, out) == 0, cleanup);
+    ASSERT(utf8_encode(0xDFFF, out) == 0, cleanup);
+    ASSERT(utf8_encode(0x110000, out) == 0, cleanup);
+cleanup:;
+}
+END_TEST
+
+TEST(test_utf8_count_chars) {
+    static const char pattern[] = "ab\xC3\xA9" "c\xE2\x82\xAC" "\xF0\x9D\x84\x9E";
+    static char buffer[10000];
+    size_t i, len;
+    for (i = 0; i != sizeof(buffer); ++i) {
+        buffer[i] = pattern[i % (sizeof(pattern) - 1)];
+    }
+    /* Long enough for the vector accumulators to be flushed. */
+    for (len = 0; len <= sizeof(buffer); len += len < 200 ? 1 : 997) {
+        const unsigned char* s = (const unsigned char*)buffer;
+        size_t expected = utf8_count_chars_scalar(s, len);
+        ASSERT(utf8_count_chars(buffer, len) == expected, cleanup);
+#ifdef CPU_X86
+        ASSERT(utf8_count_chars_sse2(s, len) == expected, cleanup);
+        if (cpu_features() & CPU_AVX2) {
+            ASSERT(utf8_count_chars_avx2(s, len) == expected, cleanup);
+        }
+#endif
+    }
+    ASSERT(utf8_count_chars(buffer, sizeof(buffer)) == sizeof(buffer) / 12 * 6 + 3,
+           cleanup);
+cleanup:;
+}
+END_TEST
+
+TEST(test_utf8_char_to_byte) {
+    static const char pattern[] = "ab\xC3\xA9" "c\xE2\x82\xAC" "\xF0\x9D\x84\x9E";
+    char buffer[200];
+    size_t i, n;
+    for (i = 0; i != sizeof(buffer); ++i) {
+        buffer[i] = pattern[i % (sizeof(pattern) - 1)];
+    }
+    for (i = 0, n = 0; i <= sizeof(buffer); ++i) {
+        const unsigned char* s = (const unsigned char*)buffer;
+        if (i != sizeof(buffer) && (s[i] & 0xC0) == 0x80) {
+            continue;
+        }
+        ASSERT(utf8_char_to_byte(buffer, sizeof(buffer), n) == i, cleanup);
+        ASSERT(utf8_byte_to_char(buffer, i) == n, cleanup);
+#ifdef CPU_X86
+        ASSERT(utf8_char_to_byte_sse2(s, sizeof(buffer), n) == i, cleanup);
+        if (cpu_features() & CPU_AVX2) {
+            ASSERT(utf8_char_to_byte_avx2(s, sizeof(buffer), n) == i, cleanup);
+        }
+#endif
+        ++n;
+    }
+    ASSERT(utf8_char_to_byte(buffer, sizeof(buffer), n + 5) == sizeof(buffer),
+           cleanup);
+cleanup:;
+}
+END_TEST
+
+TEST(test_utf8_index) {
+    static const char pattern[] = "ab\xC3\xA9" "c\xE2\x82\xAC" "\xF0\x9D\x84\x9E";
+    char buffer[1000];
+    utf8_index index = UTF8_INDEX_INIT;
+    size_t i, n;
+    for (i = 0; i != sizeof(buffer); ++i) {
+        buffer[i] = pattern[i % (sizeof(pattern) - 1)];
+    }
+    ASSERT(!utf8_index_build(&index, buffer, sizeof(buffer), 7), cleanup);
+    ASSERT(index.len == utf8_count_chars(buffer, sizeof(buffer)) / 7 + 1, cleanup);
+    for (i = 0, n = 0; i <= sizeof(buffer); ++i) {
+        if (i != sizeof(buffer) && (buffer[i] & 0xC0) == 0x80) {
+            continue;
+        }
+        ASSERT(utf8_index_char_to_byte(&index, buffer, sizeof(buffer), n) == i,
+               cleanup);
+        ASSERT(utf8_index_byte_to_char(&index, buffer, i) == n, cleanup);
+        ++n;
+    }
+    ASSERT(utf8_index_char_to_byte(&index, buffer, sizeof(buffer), n + 100) ==
+               sizeof(buffer),
+           cleanup);
+
+    /* Rebuilding replaces the old checkpoints. */
+    ASSERT(!utf8_index_build(&index, "abc", 3, 1), cleanup);
+    ASSERT(index.len == 4, cleanup);
+    ASSERT(utf8_index_char_to_byte(&index, "abc", 3, 2) == 2, cleanup);
+    ASSERT(!utf8_index_build(&index, "", 0, 16), cleanup);
+    ASSERT(utf8_index_char_to_byte(&index, "", 0, 0) == 0, cleanup);
+    ASSERT(utf8_index_byte_to_char(&index, "", 0) == 0, cleanup);
+cleanup:
+    utf8_index_destroy(&index);
+    utf8_index_destroy(&index);
+}
+END_TEST
+
+TEST(test_utf8_transcode) {
+    static uint32_t utf32[3000];
+    static uint32_t decoded[3000];
+    static uint16_t utf16[6001];
+    static size_t starts16[3000];
+    static size_t starts8[3000];
+    static char utf8[12000];
+    static char expected[12000];
+    static const uint32_t bad[] = {0, 0xD800, 0xDFFF, 0x110000, 0xFFFFFFFF};
+    static unsigned long seed = 1;
+    size_t round;
+    for (round = 0; round != 300; ++round) {
+        size_t len, n16 = 0, n8 = 0, written, i;
+        seed = seed * 1103515245 + 12345;
+        len = (seed >> 16) % 3000;
+        for (i = 0; i != len; ++i) {
+            uint32_t c;
+            unsigned long r;
+            seed = seed * 1103515245 + 12345;
+            r = seed >> 16;
+            /* Mostly ASCII, and only ASCII every fourth round. */
+            if (round % 4 == 0 || r % 16 < 12) {
+                c = 1 + (uint32_t)(r >> 4) % 0x7F;
+            } else if (r % 16 == 12) {
+                c = 0x80 + (uint32_t)(r >> 4) % 0x780;
+            } else if (r % 16 == 13) {
+                c = 0x800 + (uint32_t)(r >> 4) % 0xF800;
+                if ((c & 0xF800) == 0xD800) {
+                    c += 0x800;
+                }
+            } else {
+                seed = seed * 1103515245 + 12345;
+                c = 0x10000 + (uint32_t)((r >> 4) << 15 ^ (seed >> 16)) % 0x100000;
+            }
+            utf32[i] = c;
+            starts8[i] = n8;
+            n8 += utf8_encode(c, expected + n8);
+            starts16[i] = n16;
+            if (c >= 0x10000) {
+                utf16[n16++] = (uint16_t)(0xD800 + ((c - 0x10000) >> 10));
+                utf16[n16++] = (uint16_t)(0xDC00 + ((c - 0x10000) & 0x3FF));
+            } else {
+                utf16[n16++] = (uint16_t)c;
+            }
+        }
+
+        ASSERT(utf8_len_from_utf32(utf32, len) == n8, cleanup);
+        ASSERT(utf8_from_utf32(utf32, len, utf8, &written) == len, cleanup);
+        ASSERT(written == n8 && memcmp(utf8, expected, n8) == 0, cleanup);
+        ASSERT(utf8_len_from_utf16(utf16, n16) == n8, cleanup);
+        ASSERT(utf8_from_utf16(utf16, n16, utf8, &written) == n16, cleanup);
+        ASSERT(written == n8 && memcmp(utf8, expected, n8) == 0, cleanup);
+        ASSERT(utf8_validate(utf8, n8) == n8, cleanup);
+        ASSERT(utf8_to_utf32(utf8, n8, decoded) == len, cleanup);
+        ASSERT(memcmp(decoded, utf32, len * sizeof(uint32_t)) == 0, cleanup);
+
+        /* A lone high surrogate at the end. */
+        utf16[n16] = 0xD800;
+        ASSERT(utf8_from_utf16(utf16, n16 + 1, utf8, &written) == n16 &&
+                   written == n8,
+               cleanup);
+        if (len) {
+            uint32_t saved;
+            uint16_t saved16;
+            seed = seed * 1103515245 + 12345;
+            i = (seed >> 16) % len;
+            saved = utf32[i];
+            utf32[i] = bad[round % (sizeof(bad) / sizeof(*bad))];
+            ASSERT(utf8_from_utf32(utf32, len, utf8, &written) == i &&
+                       written == starts8[i],
+                   cleanup);
+            utf32[i] = saved;
+            /* A lone low surrogate, or a high one without its pair. */
+            saved16 = utf16[starts16[i]];
+            if (round % 3 == 0 && starts16[i] + 1 != n16) {
+                utf16[starts16[i]] = 0xD800;
+                saved = utf16[starts16[i] + 1];
+                utf16[starts16[i] + 1] = 'x';
+                ASSERT(utf8_from_utf16(utf16, n16, utf8, &written) == starts16[i],
+                       cleanup);
+                utf16[starts16[i] + 1] = (uint16_t)saved;
+            }
+            utf16[starts16[i]] = round % 2 ? 0xDC00 : 0;
+            ASSERT(utf8_from_utf16(utf16, n16, utf8, &written) == starts16[i] &&
+                       written == starts8[i],
+                   cleanup);
+            utf16[starts16[i]] = saved16;
+        }
+    }
+cleanup:;
+}
+END_TEST
+
+void test_utf8(void) {
+    RUN(test_utf8_validate_valid);
+    RUN(test_utf8_validate_invalid);
+    RUN(test_utf8_validate_kernels);
+    RUN(test_utf8_encode);
+    RUN(test_utf8_count_chars);
+    RUN(test_utf8_char_to_byte);
+    RUN(test_utf8_index);
+    RUN(test_utf8_transcode);
+}
+#endif
@@ -5,6 +5,9 @@
  * Copyright (c) 2017 Chris Gregory czipperz@gmail.com
  */
 
+/* Define the out of line version of vec_push(). */
+#undef CUTIL_INLINE
+
 #include "vec.h"
 
 #include <assert.h>
@@ -99,9 +102,8 @@ void vec_remove(void* s, size_t size, size_t index) {
     assert(self->ptr);
     assert(index < self->len);
     --self->len;
-    memmove(self->ptr + index, self->ptr + index + 1,
+    memmove(self->ptr + size * index, self->ptr + size * (index + 1),
             size * (self->len - index));
-    --self->len;
 }
 
 #ifdef TEST_MODE
@@ -278,10 +280,51 @@ cleanup:
 }
 END_TEST
 
+TEST(test_vec_remove) {
+    struct ivec v = VEC_INIT;
+    int el;
+
+    for (el = 0; el != 4; ++el) {
+        ASSERT(!vec_push(&v, sizeof(int), &el), cleanup);
+    }
+    vec_remove(&v, sizeof(int), 1);
+    ASSERT(v.len == 3, cleanup);
+    ASSERT(v.ptr[0] == 0, cleanup);
+    ASSERT(v.ptr[1] == 2, cleanup);
+    ASSERT(v.ptr[2] == 3, cleanup);
+    vec_remove(&v, sizeof(int), 2);
+    ASSERT(v.len == 2, cleanup);
+    ASSERT(v.ptr[0] == 0, cleanup);
+    ASSERT(v.ptr[1] == 2, cleanup);
+
+cleanup:
+    rpfree(v.ptr);
+}
+END_TEST
+
+TEST(test_vec_push_inline) {
+    struct ivec v = VEC_INIT;
+    int el;
+
+    for (el = 0; el != 1000; ++el) {
+        ASSERT(!vec_push_inline(&v, sizeof(int), &el), cleanup);
+        ASSERT(v.len == (size_t)el + 1 && v.cap >= v.len, cleanup);
+    }
+    for (el = 0; el != 1000; ++el) {
+        ASSERT(v.ptr[el] == el, cleanup);
+    }
+
+cleanup:
+    rpfree(v.ptr);
+}
+END_TEST
+
 void test_vec(void) {
     RUN(test_vec_push);
     RUN(test_vec_reserve);
     RUN(test_vec_shrink_to_size);
     RUN(test_vec_insert);
+    RUN(test_vec_remove);
+    RUN(test_vec_push_inline);
 }
 #endif
@@ -10,9 +10,10 @@
  * \brief This file defines the \c str structure, a utf8 string with
  * short string optimization.
  *
- * utf8 conformity is established using glib, using Debug and Release
- * assertions.  Argument validity is checked in Debug builds, such as
- * pointers being in the correct area of the string.
+ * utf8 conformity is established using \c utf8_validate and glib,
+ * using Debug and Release assertions.  Argument validity is checked
+ * in Debug builds, such as pointers being in the correct area of the
+ * string.
  *
  * Functions return -1 on allocation failure.
  *
@@ -21,6 +22,16 @@
  *
  * Destroying the string is safe to call multiple times.  It
  * essentially sets the string to \c STR_INIT once complete.
+ *
+ * Long strings can share their contents with \c str_share.  Shared
+ * contents are reference counted and copied by the first str that
+ * modifies them, so copying a shared str is O(1).
+ *
+ * Defining \c CUTIL_INLINE before including this file replaces calls
+ * to \c str_cbegin(), \c str_len_bytes(), \c str_is_inline() and \c
+ * str_cap() with inline versions, so they can be used in tight loops
+ * without a call each.  The library defines the out of line versions
+ * either way, so code built with and without it can be mixed.
  */
 
 #ifndef CUTIL_STR_H
@@ -30,9 +41,17 @@
 extern "C" {
 #endif
 
+#include <stdarg.h>
 #include <stddef.h>
 #include <stdint.h>
 
+#ifdef __GNUC__
+#define STR_PRINTF_FORMAT(format_index, first_arg)                   \
+    __attribute__((format(printf, format_index, first_arg)))
+#else
+#define STR_PRINTF_FORMAT(format_index, first_arg)
+#endif
+
 /*! \brief A utf8 string with short string optimization.
  *
  * Every function but \c str_set_len_bytes() that modifies the string
@@ -41,7 +60,8 @@ extern "C" {
  * It is NOT compliant with the \c vec concept.
  *
  * The string will automatically inline itself when its length is
- * less than \c sizeof(str). */
+ * less than \c sizeof(str).  The inline length is kept in the last
+ * byte, so retrieving it is O(1). */
 struct str {
     /*! \brief The inline representation. */
     char _data[sizeof(struct {
@@ -67,7 +87,10 @@ void str_init(str* self);
  * It is SAFE to call this multiple times. */
 void str_destroy(str* self);
 
-/*! \brief Get a mutable pointer to the end of the str. */
+/*! \brief Get a mutable pointer to the beginning of the str.
+ *
+ * Writing through it while the str is shared modifies every str
+ * sharing it.  Call \c str_unshare() or \c str_reserve() first. */
 char* str_begin(str* self);
 
 /*! \brief Get a constant pointer to the beginning of the str. */
@@ -81,7 +104,7 @@ const char* str_cend(const str* self);
 
 /*! \brief Get the number of bytes used by the str.
  *
- * Complexity: O(1) to O(sizeof(str)) */
+ * Complexity: O(1) */
 size_t str_len_bytes(const str* self);
 
 /*! \brief Calculate the number of characters in the str.
@@ -89,12 +112,32 @@ size_t str_len_bytes(const str* self);
  * Complexity: O(n) where n = str_len_bytes(self) */
 size_t str_len_characters(const str* self);
 
+/*! \brief Get the byte offset of the character at \c char_index.
+ *
+ * Returns \c str_len_bytes(self) if there are no more than \c
+ * char_index characters.  Use a \c utf8_index for repeated lookups in
+ * a long string.
+ *
+ * Complexity: O(n) where n is the returned offset */
+size_t str_char_to_byte(const str* self, size_t char_index);
+
+/*! \brief Get the index of the character starting at \c byte_index.
+ *
+ * Complexity: O(byte_index) */
+size_t str_byte_to_char(const str* self, size_t byte_index);
+
 /*! \brief Retrieve the capacity in bytes of the string. */
 size_t str_cap(const str* self);
 
+/*! \brief Test if the contents are stored in the str itself rather
+ *  than on the heap. */
+int str_is_inline(const str* self);
+
 /*! \brief Increase the capacity of the string to be at least
  *  \c new_cap.
  *
+ * A shared str gets its own copy of its contents.
+ *
  * \return -1 on reallocation failure. */
 int str_reserve(str* self, size_t new_cap);
 
@@ -133,6 +176,166 @@ int str_push_sn(str* self, const char* string, size_t len_bytes);
  * \return -1 on reallocation failure. */
 int str_push_str(str* self, const str* string);
 
+/*! \brief Insert formatted output at the end of the str, like \c
+ *  printf.
+ *
+ * The output is written straight into the spare capacity.  If it
+ * doesn't fit, the str grows once and formats again.
+ *
+ * This verifies that the output is a valid utf8 string.
+ *
+ * \return -1 on reallocation failure or if formatting fails. */
+int str_appendf(str* self, const char* format, ...) STR_PRINTF_FORMAT(2, 3);
+
+/*! \brief Insert formatted output at the end of the str, like \c
+ *  vprintf.  See \c str_appendf(). */
+int str_vappendf(str* self, const char* format, va_list args);
+
+/*! \brief Insert \c len utf16 code units of \c string at the end of
+ *  the str, converted to utf8.
+ *
+ * The str grows once, by the exact converted length, and the input is
+ * validated while it is converted.
+ *
+ * \return -1 on reallocation failure, or 1 if \c string is not valid
+ * utf16, in which case the str is unchanged. */
+int str_push_utf16(str* self, const uint16_t* string, size_t len);
+
+/*! \brief Insert \c len utf32 characters of \c string at the end of
+ *  the str, converted to utf8.  See \c str_push_utf16(). */
+int str_push_utf32(str* self, const uint32_t* string, size_t len);
+
+/*! \brief Convert the str to utf32.
+ *
+ * The characters are written to \c out only if it has room for all
+ * of them, so call this with an \c out_len of 0 first to find the
+ * size to allocate.
+ *
+ * \return The number of characters in the str. */
+size_t str_to_utf32(const str* self, uint32_t* out, size_t out_len);
+
+/*! \brief Insert the base64 encoding of \c len bytes at \c data at
+ *  the end of the str.
+ *
+ * The standard alphabet of RFC 4648 is used, with '=' padding.  The
+ * encoded length of 4 characters for every 3 bytes or part thereof is
+ * reserved once up front.  Like other pushes, the capacity grows
+ * geometrically, so it may end up larger than the new length.
+ *
+ * \return -1 on reallocation failure. */
+int str_push_base64(str* self, const void* data, size_t len);
+
+/*! \brief Decode \c len base64 characters at \c string into \c out.
+ *
+ * \c out must have room for \c len / 4 * 3 bytes, and \c out_len is
+ * set to the number of bytes decoded.  The decoded bytes are written
+ * to a buffer rather than a str since they need not be utf8.
+ *
+ * \return 0 on success, or 1 if \c string is not padded base64 in the
+ * standard alphabet, in which case \c out may be partly written. */
+int str_decode_base64(const char* string, size_t len, void* out,
+                      size_t* out_len);
+
+/*! \brief Insert \c len bytes at \c data at the end of the str as
+ *  lower case hex digits.
+ *
+ * \return -1 on reallocation failure. */
+int str_push_hex(str* self, const void* data, size_t len);
+
+/*! \brief Decode \c len hex digits at \c string into \c len / 2
+ *  bytes at \c out.
+ *
+ * Digits may be in either case.
+ *
+ * \return 0 on success, or 1 if \c len is odd or \c string has a
+ * character that is not a hex digit, in which case \c out may be
+ * partly written. */
+int str_decode_hex(const char* string, size_t len, void* out);
+
+/*! \brief Insert the contents of \c string at the end of the str,
+ *  escaped for a JSON string literal.
+ *
+ * Quotes, backslashes and control characters are escaped, and if \c
+ * ascii_only is set, so is every non ASCII character, as \\u escapes
+ * or surrogate pairs of them.  The surrounding quotes are not added.
+ * Runs without anything to escape are found a vector at a time and
+ * copied in bulk.  \c string must not be the str.
+ *
+ * \return -1 on reallocation failure, in which case the str is
+ * unchanged. */
+int str_push_json_escaped(str* self, const str* string, int ascii_only);
+
+/*! \brief Insert the \c len bytes of the body of a JSON string
+ *  literal at \c string, without its quotes, at the end of the str
+ *  with its escapes decoded.
+ *
+ * \c string must not point into the str.
+ *
+ * \return -1 on reallocation failure, or 1 if \c string has an
+ * invalid escape, an unescaped quote or control character, invalid
+ * utf8 or an escaped 0, which a str can't hold.  Either way the str
+ * is unchanged. */
+int str_json_unescape(str* self, const char* string, size_t len);
+
+/*! \brief Insert the decimal representation of \c value at the end
+ *  of the str.
+ *
+ * \return -1 on reallocation failure. */
+int str_push_int(str* self, int64_t value);
+
+/*! \brief Insert the decimal representation of \c value at the end
+ *  of the str.
+ *
+ * \return -1 on reallocation failure. */
+int str_push_uint(str* self, uint64_t value);
+
+/*! \brief Insert the shortest decimal representation of \c value
+ *  that reads back as the same double.
+ *
+ * Numbers from 1e-7 up to 1e21 are written without an exponent, as
+ * in "120", "0.25" and "-0.0001".  Others are written like "1e+21"
+ * and "2.5e-8".  Not a number and infinities are written as "nan",
+ * "inf" and "-inf".
+ *
+ * \return -1 on reallocation failure. */
+int str_push_double(str* self, double value);
+
+/*! \brief Parse a decimal integer from the start of \c len bytes at
+ *  \c string.
+ *
+ * The number is an optional sign followed by decimal digits.  No
+ * whitespace is skipped, no terminator is needed and the locale is
+ * ignored.  The bytes need not be in a str, so this works on views
+ * and raw buffers too.
+ *
+ * \c consumed, if not null, is set to the number of bytes making up
+ * the number.  On overflow all the digits are still consumed and \c
+ * out is set to the closest representable value.
+ *
+ * \return 0 on success, 1 on overflow, or -1 if there is no number,
+ * in which case 0 bytes are consumed. */
+int str_parse_i64(const char* string, size_t len, int64_t* out,
+                  size_t* consumed);
+
+/*! \brief Parse an unsigned decimal integer.  See \c str_parse_i64().
+ *
+ * A leading '-' is not a number. */
+int str_parse_u64(const char* string, size_t len, uint64_t* out,
+                  size_t* consumed);
+
+/*! \brief Parse a decimal floating point number.  See \c
+ *  str_parse_i64().
+ *
+ * The number is an optional sign, digits with an optional '.' and an
+ * optional exponent such as "e-5".  At least one digit is required.
+ * "inf", "infinity" and "nan" are accepted in any case.  The result
+ * is correctly rounded.
+ *
+ * \return 0 on success, 1 if the number rounds to infinity or to
+ * zero from a nonzero value, or -1 if there is no number. */
+int str_parse_f64(const char* string, size_t len, double* out,
+                  size_t* consumed);
+
 /*! \brief Insert \c character at \c pos in the str.
  *
  * This verifies that \c character is a valid utf32 character.
@@ -166,6 +369,9 @@ int str_insert_str(str* self, const char* pos, const str* string);
 /*! \brief Set the byte length of the string to \c len_bytes and add a
  *  null terminator.  THIS DOES NOT CHECK FOR UTF8 VALIDITY!
  *
+ * Changing the length of a shared str copies it, aborting if that
+ * fails.
+ *
  * \return The new length, \c len_bytes. */
 size_t str_set_len_bytes(str* self, size_t len_bytes);
 
@@ -188,9 +394,31 @@ int str_copy_n(str* self, const char* string, size_t len_bytes);
  *
  * This does not verify that \c string is valid utf8.
  *
+ * If \c string is shared, this shares it too and takes O(1).
+ *
  * \return -1 on reallocation failure. */
 int str_copy_str(str* self, const str* string);
 
+/*! \brief Make \c self share the contents of \c source.
+ *
+ * A long \c source is moved into a shared, atomically reference
+ * counted allocation once.  After that, sharing or copying it with \c
+ * str_copy_str() is O(1).  The contents are copied again only when
+ * one of the strs is modified, by the functions that modify it.
+ * Short strings are always copied inline.
+ *
+ * Strs sharing contents may be used and destroyed on different
+ * threads.
+ *
+ * \return -1 on allocation failure. */
+int str_share(str* self, str* source);
+
+/*! \brief Give \c self its own copy of its contents if they are
+ *  shared.
+ *
+ * \return -1 on allocation failure. */
+int str_unshare(str* self);
+
 /* /\*! \brief Erase elements after and including \c begin. */
 /*  * */
 /*  * May cause deallocation of the string (because it is short enough to */
@@ -200,7 +428,9 @@ int str_copy_str(str* self, const str* string);
 /*! \brief Erase elements between \c begin and \c end, excluding \c end.
  *
  * May cause deallocation of the string (because it is short enough to
- * be stored in a short string). */
+ * be stored in a short string).
+ *
+ * Erasing from a shared str copies it, aborting if that fails. */
 void str_erase(str* self, size_t begin, size_t end);
 
 /*! \brief Erase \c num elements between \c begin and \c end.
@@ -209,6 +439,209 @@ void str_erase(str* self, size_t begin, size_t end);
  * be stored in a short string). */
 void str_erase_n_bytes(str* self, size_t begin, size_t num);
 
+/*! \brief Returned by searches that find nothing. */
+#define STR_NPOS ((size_t)-1)
+
+/*! \brief Find the first occurrence of \c needle at or after byte
+ *  \c start.
+ *
+ * Complexity: O(n + m), vectorized.  See \c search.h.
+ *
+ * \return The byte offset of the match or \c STR_NPOS. */
+size_t str_find(const str* self, size_t start, const char* needle,
+                size_t needle_len);
+
+/*! \brief Find the last occurrence of \c needle that ends at or
+ *  before byte \c end.
+ *
+ * Pass \c str_len_bytes(self) to search the whole string.
+ *
+ * \return The byte offset of the match or \c STR_NPOS. */
+size_t str_rfind(const str* self, size_t end, const char* needle,
+                 size_t needle_len);
+
+/*! \brief Find the first byte at or after \c start that is one of the
+ *  \c set_len bytes of \c set.
+ *
+ * \return The byte offset or \c STR_NPOS. */
+size_t str_find_any(const str* self, size_t start, const char* set,
+                    size_t set_len);
+
+/*! \brief Count the non overlapping occurrences of \c needle. */
+size_t str_count(const str* self, const char* needle, size_t needle_len);
+
+/*! \brief Replace every non overlapping occurrence of \c needle with
+ *  \c replacement.
+ *
+ * Occurrences are found left to right like \c str_count().  The
+ * output length is computed first, so the str is rebuilt in one pass,
+ * in place if it doesn't grow.
+ *
+ * \c needle must not be empty.  This verifies that \c needle and \c
+ * replacement are valid utf8.  They may point into the str.
+ *
+ * Complexity: O(n + m * k) where k is the number of occurrences.
+ *
+ * \return -1 on reallocation failure, in which case the str is
+ * unchanged. */
+int str_replace_all(str* self, const char* needle, size_t needle_len,
+                    const char* replacement, size_t replacement_len);
+
+/*! \brief Replace the bytes from \c begin up to \c end with the \c
+ *  text_len bytes at \c text. */
+typedef struct str_edit str_edit;
+struct str_edit {
+    size_t begin;
+    size_t end;
+    const char* text;
+    size_t text_len;
+};
+
+/*! \brief Apply \c num_edits edits to the str at once.
+ *
+ * Offsets are into the str before any edit is applied.  The edits
+ * must be sorted and not overlap, though insertions (where \c begin
+ * equals \c end) may share an offset and are applied in order.  Each
+ * offset must be on a character boundary.  This verifies that the
+ * texts are valid utf8.
+ *
+ * Complexity: O(n + m) where m is the total length of the texts.
+ *
+ * \return -1 on reallocation failure, in which case the str is
+ * unchanged. */
+int str_apply_edits(str* self, const str_edit* edits, size_t num_edits);
+
+/*! \brief Test if two strs have the same contents.
+ *
+ * Strs of different lengths, or with different cached hashes (see \c
+ * str_hash_cached()), are told apart without reading their contents.
+ *
+ * Complexity: O(n) */
+int str_eq(const str* a, const str* b);
+
+/*! \brief Compare the bytes of two strs, like \c strcmp() but using
+ *  their lengths.
+ *
+ * Ordering by bytes is the same as ordering by code point.
+ *
+ * \return Less than, equal to or greater than 0 if \c a is ordered
+ * before, the same as or after \c b. */
+int str_cmp(const str* a, const str* b);
+
+/*! \brief Hash the str like \c str_hash(), caching the result.
+ *
+ * A heap allocated str stores its hash next to its contents, so
+ * hashing it again is O(1) until it is modified.  Every function that
+ * modifies a str forgets the hash, as does taking a mutable pointer
+ * with \c str_begin() or \c str_end().  Don't write through such a
+ * pointer after calling this without taking it again.  Copying a
+ * hashed shared str with \c str_copy_str() keeps the hash.  Inline
+ * strs are hashed each time. */
+size_t str_hash_cached(str* self);
+
+/*! \brief Convert the str to lower case.
+ *
+ * Runs of ASCII are converted a vector at a time.  Other characters
+ * use their simple Unicode mapping, which may change their length in
+ * bytes.
+ *
+ * \return -1 on reallocation failure, in which case part of the str
+ * may be converted. */
+int str_to_lower(str* self);
+
+/*! \brief Convert the str to upper case.  See \c str_to_lower(). */
+int str_to_upper(str* self);
+
+/*! \brief Copy \c source into the str, converted to lower case.
+ *
+ * \return -1 on reallocation failure. */
+int str_copy_lower(str* self, const str* source);
+
+/*! \brief Copy \c source into the str, converted to upper case.
+ *
+ * \return -1 on reallocation failure. */
+int str_copy_upper(str* self, const str* source);
+
+/*! \brief Compare two strs ignoring case.
+ *
+ * Characters are compared after simple case folding, by code point.
+ * ASCII is compared a vector at a time.
+ *
+ * \return Less than, equal to or greater than 0 if \c a is ordered
+ * before, the same as or after \c b. */
+int str_casecmp(const str* a, const str* b);
+
+/*! \brief Hash the case folded contents of the str.
+ *
+ * Strs that \c str_casecmp() says are equal have the same hash.  An
+ * ASCII str hashes to the \c str_hash() of its lower case form. */
+size_t str_hash_ci(const str* self);
+
+#if defined(__GNUC__)
+#define STR_INLINE static __inline__
+#elif defined(_MSC_VER)
+#define STR_INLINE static __inline
+#else
+#define STR_INLINE static
+#endif
+
+/*! \brief The layout of a str whose contents are on the heap.
+ *
+ * This mirrors \c str_alloc in str.c for the inline accessors below
+ * and must be kept in sync with it. */
+struct str_repr_ {
+    char* str;
+    size_t blen;
+    size_t _cap;
+};
+
+/* The inline versions of the accessors.  Calls are only replaced
+ * with these when CUTIL_INLINE is defined. */
+
+STR_INLINE int
+str_is_inline_inline(const str* self) {
+    /* The allocated flag is in the last byte on either endianness. */
+    return (self->_data[sizeof(str) - 1] & 1) == 0;
+}
+
+STR_INLINE const char*
+str_cbegin_inline(const str* self) {
+    return str_is_inline_inline(self) ? self->_data
+                                      : ((const struct str_repr_*)self)->str;
+}
+
+STR_INLINE size_t
+str_len_bytes_inline(const str* self) {
+    if (str_is_inline_inline(self)) {
+        size_t remaining = (unsigned char)self->_data[sizeof(str) - 1] >> 1;
+        return (sizeof(str) - 1 - remaining) * (self->_data[0] != 0);
+    }
+    return ((const struct str_repr_*)self)->blen;
+}
+
+STR_INLINE size_t
+str_cap_inline(const str* self) {
+    size_t stored;
+    int endian = 1;
+    if (str_is_inline_inline(self)) {
+        return sizeof(str) - 1;
+    }
+    stored = ((const struct str_repr_*)self)->_cap;
+    if (*(char*)&endian) {
+        /* On little endian the low byte with the flags is stored
+         * last, so rotate it back into place. */
+        stored = stored << 8 | stored >> (sizeof(size_t) * 8 - 8);
+    }
+    return stored >> 3;
+}
+
+#ifdef CUTIL_INLINE
+#define str_is_inline(self) str_is_inline_inline(self)
+#define str_cbegin(self) str_cbegin_inline(self)
+#define str_len_bytes(self) str_len_bytes_inline(self)
+#define str_cap(self) str_cap_inline(self)
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,80 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2017 Chris Gregory czipperz@gmail.com
+ */
+
+/*! \file str_builder.h
+ *
+ * \brief Append many fragments to a \c str, validating once.
+ *
+ * The \c str push functions validate each fragment they append.  A
+ * \c str_builder appends without checking, straight into the
+ * capacity of its target, and validates everything appended in one
+ * pass over the result when it is finished.  If the result is not
+ * valid utf8, the target is rolled back to what it was before the
+ * builder started, so the target is always valid utf8 once the
+ * builder is done.
+ */
+
+#ifndef CUTIL_STR_BUILDER_H
+#define CUTIL_STR_BUILDER_H
+
+#include "str.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! \brief Appends to a \c str.
+ *
+ * The target must not be used, other than through the builder, until
+ * \c str_builder_finish() is called. */
+typedef struct str_builder str_builder;
+struct str_builder {
+    str* _target;
+    char* _data;
+    size_t _len;
+    size_t _cap;
+    /*! \brief The length of the target when the builder started. */
+    size_t _begin;
+};
+
+/*! \brief Start appending to \c target. */
+str_builder str_builder_new(str* target);
+
+/*! \brief Append \c len bytes at \c string without validating them.
+ *
+ * \return -1 on reallocation failure, leaving the builder unchanged. */
+int str_builder_push_sn(str_builder* self, const char* string, size_t len);
+
+/*! \brief Append the null terminated \c string without validating
+ *  it.
+ *
+ * \return -1 on reallocation failure. */
+int str_builder_push_s(str_builder* self, const char* string);
+
+/*! \brief Append one byte without validating it.
+ *
+ * \return -1 on reallocation failure. */
+int str_builder_push_byte(str_builder* self, char byte);
+
+/*! \brief Get the number of bytes appended so far. */
+size_t str_builder_len(const str_builder* self);
+
+/*! \brief Validate the appended bytes and give the target back.
+ *
+ * If they are not valid utf8, the target is truncated to its length
+ * before the builder started and \c invalid_offset, if not null, is
+ * set to the offset of the first invalid byte counted from where the
+ * builder started.
+ *
+ * \return 0 if the bytes were valid, 1 if they were rolled back. */
+int str_builder_finish(str_builder* self, size_t* invalid_offset);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,98 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2017 Chris Gregory czipperz@gmail.com
+ */
+
+/*! \file strmap.h
+ *
+ * \brief A hash map from byte strings to byte strings of any length.
+ *
+ * Keys and values are copied into one append-only slab.  The table
+ * itself is an open addressing array of slots holding each entry's
+ * hash, offset into the slab, and lengths.  Thus comparing keys
+ * touches memory that was inserted close together and destroying
+ * the map is two frees no matter how many entries it has.
+ *
+ * Erasing an entry leaves its bytes in the slab until \c
+ * strmap_compact is called.
+ *
+ * Pointers into the map are invalidated by any insertion or by \c
+ * strmap_compact.  Keys and values are not aligned.
+ */
+
+#ifndef CUTIL_STRMAP_H
+#define CUTIL_STRMAP_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct strmap strmap;
+/*! \brief Create an empty strmap.
+ *
+ * Returns null on error (in malloc).
+ */
+strmap* strmap_new(void);
+/*! \brief Destroy the strmap.  It is illegal to be used past this point. */
+void strmap_destroy(strmap*);
+/*! \brief Get the number of items in this map.
+ *
+ * This has O(1) performance.
+ */
+size_t strmap_size(const strmap*);
+/*! \brief Check if \c key is contained in this map.
+ *
+ * This has amortized O(1) performance.
+ */
+int strmap_contains(const strmap*, const char* key, size_t key_len);
+/*! \brief Insert a copy of \c key and \c value into this map.
+ *
+ * If the key already was in the map, returns 1.
+ * If an error occured, return -1 (this does not corrupt the map).
+ * Otherwise returns 0.
+ */
+int strmap_insert(strmap*, const char* key, size_t key_len,
+                  const void* value, size_t value_len);
+/*! \brief Erase \c key from this map.
+ *
+ * If the key didn't exist in the map, returns 1.
+ * Otherwise returns 0.
+ */
+int strmap_erase(strmap*, const char* key, size_t key_len);
+/*! \brief Lookup a key, retrieving the associated value.
+ *
+ * If \c value_len is not null, the length of the value is stored in
+ * it.  Returns null if \c key isn't in the map.
+ */
+void* strmap_lookup(strmap*, const char* key, size_t key_len,
+                    size_t* value_len);
+/*! \brief Erase every element from this map.
+ *
+ * The capacity of the table and slab are kept.
+ */
+void strmap_clear(strmap*);
+/*! \brief Release the bytes of erased entries from the slab.
+ *
+ * Error handling for this function can be ignored: it is only an
+ * optimization.
+ *
+ * \return Returns -1 on memory allocation error, 0 on success.
+ */
+int strmap_compact(strmap*);
+
+/*! \brief Iterate through the map. */
+void strmap_iterate(strmap*,
+                    void (*fun)(const char* key, size_t key_len,
+                                void* value, size_t value_len,
+                                void* userdata),
+                    void* userdata);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,134 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2017 Chris Gregory czipperz@gmail.com
+ */
+
+/*! \file strview.h
+ *
+ * \brief A non-owning view of a range of bytes.
+ *
+ * A \c strview is a pointer and a length.  It can point into a \c
+ * str, a C string or a mapped buffer, and nothing here allocates or
+ * copies.  The viewed bytes must outlive the view.
+ *
+ * Views are passed and returned by value.  They are not null
+ * terminated and are not checked for utf8 validity.
+ */
+
+#ifndef CUTIL_STRVIEW_H
+#define CUTIL_STRVIEW_H
+
+#include "str.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct strview strview;
+struct strview {
+    const char* ptr;
+    size_t len;
+};
+
+/*! \brief Returned by searches that find nothing. */
+#define STRVIEW_NPOS ((size_t)-1)
+
+/*! \brief Create a view of \c len bytes at \c ptr. */
+strview strview_new(const char* ptr, size_t len);
+/*! \brief Create a view of the null terminated \c string. */
+strview strview_from_cstr(const char* string);
+/*! \brief Create a view of the contents of \c string.
+ *
+ * Modifying \c string invalidates the view. */
+strview strview_from_str(const str* string);
+
+/*! \brief Get the view of \c len bytes starting at \c pos.
+ *
+ * Both are clamped to the end of \c self. */
+strview strview_substr(strview self, size_t pos, size_t len);
+
+/*! \brief Find the first occurrence of \c needle.
+ *
+ * \return The byte offset of the match or \c STRVIEW_NPOS.  An empty
+ * needle matches at 0. */
+size_t strview_find(strview self, strview needle);
+/*! \brief Find the last occurrence of \c needle.
+ *
+ * \return The byte offset of the match or \c STRVIEW_NPOS.  An empty
+ * needle matches at the end. */
+size_t strview_rfind(strview self, strview needle);
+/*! \brief Find the first occurrence of \c byte. */
+size_t strview_find_byte(strview self, char byte);
+
+int strview_starts_with(strview self, strview prefix);
+int strview_ends_with(strview self, strview suffix);
+
+/*! \brief Remove ASCII whitespace from the start. */
+strview strview_trim_left(strview self);
+/*! \brief Remove ASCII whitespace from the end. */
+strview strview_trim_right(strview self);
+/*! \brief Remove ASCII whitespace from both ends. */
+strview strview_trim(strview self);
+
+/*! \brief Compare bytewise, like \c memcmp, with shorter views
+ *  sorting first on a tie. */
+int strview_cmp(strview a, strview b);
+/*! \brief Test if the bytes viewed are the same. */
+int strview_eq(strview a, strview b);
+/*! \brief Hash the bytes viewed.
+ *
+ * Equal to \c mem_hash of the same bytes, so views can be looked up
+ * in tables keyed by other byte strings. */
+size_t strview_hash(strview self);
+
+/*! \brief Copy the viewed bytes into \c out.
+ *
+ * This verifies that the bytes are a valid utf8 string.
+ *
+ * \return -1 on allocation failure. */
+int strview_to_str(strview self, str* out);
+
+/*! \brief Splits a view around every occurrence of a separator.
+ *
+ * Adjacent separators produce empty pieces, so "a,,b" split on ","
+ * is "a", "", "b". */
+typedef struct strview_split strview_split;
+struct strview_split {
+    strview _rest;
+    strview _separator;
+    int _done;
+};
+
+/*! \brief Create a split iterator.  \c separator must not be empty. */
+strview_split strview_split_new(strview self, strview separator);
+/*! \brief Store the next piece in \c piece.
+ *
+ * \return 1 if there was another piece, 0 once exhausted. */
+int strview_split_next(strview_split* iterator, strview* piece);
+
+/*! \brief Splits a view into tokens separated by runs of delimiter
+ *  bytes.
+ *
+ * Unlike \c strview_split, no empty tokens are produced. */
+typedef struct strview_tokenizer strview_tokenizer;
+struct strview_tokenizer {
+    strview _rest;
+    /*! \brief A bitset of the delimiter bytes. */
+    unsigned char _delimiters[32];
+};
+
+/*! \brief Create a tokenizer splitting on any byte in the null
+ *  terminated \c delimiters. */
+strview_tokenizer strview_tokenizer_new(strview self, const char* delimiters);
+/*! \brief Store the next token in \c token.
+ *
+ * \return 1 if there was another token, 0 once exhausted. */
+int strview_tokenizer_next(strview_tokenizer* iterator, strview* token);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
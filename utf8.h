@@ -0,0 +1,160 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2017 Chris Gregory czipperz@gmail.com
+ */
+
+/*! \file utf8.h
+ *
+ * \brief Fast routines for working with utf8 encoded byte strings.
+ *
+ * On x86 the hot loops are vectorized.  The widest instruction set
+ * the CPU supports is picked the first time a function is called.
+ *
+ * The rules match glib's: overlong encodings, surrogates, code points
+ * above U+10FFFF and null bytes are all invalid.
+ */
+
+#ifndef CUTIL_UTF8_H
+#define CUTIL_UTF8_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! \brief Find the length of the longest valid utf8 prefix of \c
+ *  string.
+ *
+ * Thus \c string is valid if and only if this returns \c len.
+ *
+ * Complexity: O(len) */
+size_t utf8_validate(const char* string, size_t len);
+
+/*! \brief Encode \c character as utf8 into \c out.
+ *
+ * \c out must have room for 4 bytes.
+ *
+ * \return The number of bytes written, or 0 if \c character is a
+ * surrogate or above U+10FFFF. */
+size_t utf8_encode(uint32_t character, char* out);
+
+/*! \brief Count the characters in the valid utf8 \c string.
+ *
+ * Complexity: O(len) */
+size_t utf8_count_chars(const char* string, size_t len);
+
+/*! \brief Get the byte offset of the character at \c char_index.
+ *
+ * Returns \c len if \c string has no more than \c char_index
+ * characters.
+ *
+ * Complexity: O(n) where n is the returned offset */
+size_t utf8_char_to_byte(const char* string, size_t len, size_t char_index);
+
+/*! \brief Get the index of the character starting at \c byte_index.
+ *
+ * \c byte_index must be the end of \c string or the start of a
+ * character.
+ *
+ * Complexity: O(byte_index) */
+size_t utf8_byte_to_char(const char* string, size_t byte_index);
+
+/*! \brief Count the bytes needed to convert \c len utf16 code units
+ *  to utf8.
+ *
+ * This is exact if \c string is valid utf16.
+ *
+ * Complexity: O(len) */
+size_t utf8_len_from_utf16(const uint16_t* string, size_t len);
+
+/*! \brief Count the bytes needed to convert \c len utf32 characters
+ *  to utf8.
+ *
+ * This is exact if \c string is valid utf32.
+ *
+ * Complexity: O(len) */
+size_t utf8_len_from_utf32(const uint32_t* string, size_t len);
+
+/*! \brief Convert utf16 to utf8, stopping at the first invalid code
+ *  unit.
+ *
+ * Unpaired surrogates and 0 are invalid.  \c out must have room for
+ * \c utf8_len_from_utf16(string, len) bytes.  \c *written is set to
+ * the number of bytes written.
+ *
+ * \return The number of code units converted, which is \c len if
+ * \c string is valid. */
+size_t utf8_from_utf16(const uint16_t* string, size_t len, char* out,
+                       size_t* written);
+
+/*! \brief Convert utf32 to utf8, stopping at the first invalid
+ *  character.
+ *
+ * Surrogates, characters above U+10FFFF and 0 are invalid.  \c out
+ * must have room for \c utf8_len_from_utf32(string, len) bytes.  \c
+ * *written is set to the number of bytes written.
+ *
+ * \return The number of characters converted, which is \c len if \c
+ * string is valid. */
+size_t utf8_from_utf32(const uint32_t* string, size_t len, char* out,
+                       size_t* written);
+
+/*! \brief Convert the valid utf8 \c string to utf32.
+ *
+ * \c out must have room for \c utf8_count_chars(string, len)
+ * characters.
+ *
+ * \return The number of characters written. */
+size_t utf8_to_utf32(const char* string, size_t len, uint32_t* out);
+
+/*! \brief A sparse index of character offsets in a utf8 string.
+ *
+ * Every \c stride th character's byte offset is recorded, so
+ * converting between character and byte offsets only scans at most
+ * \c stride characters.  The index doesn't own the string, and must be
+ * rebuilt after the string changes.
+ *
+ * Initialize it with \c UTF8_INDEX_INIT. */
+typedef struct utf8_index utf8_index;
+struct utf8_index {
+    /*! \brief Byte offset of character \c i * \c stride. */
+    size_t* checkpoints;
+    size_t len;
+    size_t stride;
+};
+
+#define UTF8_INDEX_INIT {0, 0, 0}
+
+/*! \brief Index \c string, recording every \c stride th character.
+ *
+ * Any previous contents of \c self are replaced.
+ *
+ * \return -1 on allocation failure. */
+int utf8_index_build(utf8_index* self, const char* string, size_t len,
+                     size_t stride);
+
+/*! \brief Free memory used by \c self.  It is safe to call this
+ *  multiple times. */
+void utf8_index_destroy(utf8_index* self);
+
+/*! \brief \c utf8_char_to_byte using \c self to skip ahead.
+ *
+ * Complexity: O(stride) */
+size_t utf8_index_char_to_byte(const utf8_index* self, const char* string,
+                               size_t len, size_t char_index);
+
+/*! \brief \c utf8_byte_to_char using \c self to skip ahead.
+ *
+ * Complexity: O(log(len / stride) + stride) */
+size_t utf8_index_byte_to_char(const utf8_index* self, const char* string,
+                               size_t byte_index);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -18,6 +18,10 @@ struct vec { item_type* pointer; size_t length; size_t capacity; };
  * The functions uniformly return -1 on memory allocation failure.
  * They all use rpmalloc and variants to allocate memory.
  *
+ * Defining \c CUTIL_INLINE before including this file replaces calls
+ * to \c vec_push() with an inline version that only calls out of line
+ * to grow the vector.
+ *
  * Example:
 \code{.c}
 struct { int* ints; size_t length; size_t capacity } vector = VEC_INIT;
@@ -45,6 +49,7 @@ extern "C" {
 #endif
 
 #include <stddef.h>
+#include <string.h>
 
 /*! \brief Increase the capacity to \c new_cap.
  *
@@ -80,6 +85,38 @@ void vec_remove(void* self, size_t sizeof_elem, size_t index);
 
 #define VEC_INIT {0, 0, 0}
 
+#if defined(__GNUC__)
+#define VEC_INLINE static __inline__
+#elif defined(_MSC_VER)
+#define VEC_INLINE static __inline
+#else
+#define VEC_INLINE static
+#endif
+
+/*! \brief The layout every vector shares. */
+struct vec_repr_ {
+    char* ptr;
+    size_t len;
+    size_t cap;
+};
+
+/*! \brief The inline version of \c vec_push(), used in its place
+ *  when CUTIL_INLINE is defined. */
+VEC_INLINE int
+vec_push_inline(void* self, size_t sizeof_elem, const void* elem) {
+    struct vec_repr_* vec = (struct vec_repr_*)self;
+    if (vec->len == vec->cap) {
+        return vec_push(self, sizeof_elem, elem);
+    }
+    memcpy(vec->ptr + vec->len * sizeof_elem, elem, sizeof_elem);
+    ++vec->len;
+    return 0;
+}
+
+#ifdef CUTIL_INLINE
+#define vec_push(self, sizeof_elem, elem) vec_push_inline(self, sizeof_elem, elem)
+#endif
+
 #ifdef __cplusplus
 }
 #endif